@@ -0,0 +1,729 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <cmath>
+#include <cstring>
+#include <QByteArray>
+#include <QDeadlineTimer>
+#include <QMap>
+#include <QThread>
+#include <QVarLengthArray>
+#include <akaudiopacket.h>
+#include <akfrac.h>
+
+#include "audiodevicebuffer.h"
+#include "audioringbuffer.h"
+#include "audiostats.h"
+
+#define MAX_PLANES 16
+
+// Relates a position in the ring with the device clock and the host clock.
+struct AudioTimeAnchor
+{
+    size_t position;
+    quint64 sampleTime;
+    quint64 hostTime; // In nanoseconds.
+};
+
+class AudioDeviceBufferPrivate
+{
+    public:
+        AudioRingBuffer m_ring;
+        AudioRingBuffer m_anchors;
+        AudioTimeAnchor m_lastAnchor {0, 0, 0};
+        std::atomic<quint64> m_droppedSamples {0};
+        std::atomic<int> m_users {0};
+        std::atomic<bool> m_closed {true};
+        mutable AudioStats m_stats;
+        AkAudioCaps m_caps;
+        qreal m_sampleTimeScale {1.0};
+        AkAudioCaps::SampleFormat m_deviceFormat {AkAudioCaps::SampleFormat_none};
+        AudioKernels::Dither m_dither;
+        QByteArray m_convertBuffer;
+        quint64 m_lostSamples {0};
+        size_t m_period {0};
+        size_t m_maxQueued {0};
+        int m_silence {0};
+        bool m_devicePlanar {false};
+
+        void dropOldSamples();
+        void updateTimeAnchor(size_t position);
+        qint64 hostTime(size_t position, quint64 *samplePosition);
+        quint8 *convertBuffer(size_t size);
+        size_t readFromRing(quint8 *const *planes, size_t samples);
+        size_t writeToRing(const quint8 *const *planes, size_t samples);
+        size_t lowWatermarkSamples(int lowWatermark) const;
+        static QVarLengthArray<const quint8 *, MAX_PLANES> packetPlanes(const AkAudioPacket &packet,
+                                                                        size_t offset);
+        void addAnchor(size_t position, quint64 sampleTime, quint64 hostTime);
+};
+
+// Keeps the buffers alive while a reading or writing thread is using them.
+class AudioDeviceBufferUser
+{
+    public:
+        explicit AudioDeviceBufferUser(AudioDeviceBufferPrivate *d);
+        ~AudioDeviceBufferUser();
+
+        explicit operator bool() const;
+
+    private:
+        AudioDeviceBufferPrivate *d;
+        bool m_valid;
+};
+
+AudioDeviceBuffer::AudioDeviceBuffer()
+{
+    this->d = new AudioDeviceBufferPrivate;
+}
+
+AudioDeviceBuffer::~AudioDeviceBuffer()
+{
+    delete this->d;
+}
+
+void AudioDeviceBuffer::configure(const AkAudioCaps &caps,
+                                  AkAudioCaps::SampleFormat deviceFormat,
+                                  bool devicePlanar,
+                                  size_t period,
+                                  size_t maxQueued,
+                                  qreal deviceRate)
+{
+    devicePlanar = devicePlanar && caps.channels() > 1;
+    this->d->m_caps = caps;
+    this->d->m_sampleTimeScale = deviceRate > 0?
+                                     qreal(caps.rate()) / deviceRate:
+                                     1.0;
+    this->d->m_deviceFormat = deviceFormat;
+    this->d->m_devicePlanar = devicePlanar;
+    this->d->m_silence = deviceFormat == AkAudioCaps::SampleFormat_u8? 0x80: 0;
+    this->d->m_dither = {};
+    this->d->m_period = qMax<size_t>(period, 1);
+    this->d->m_maxQueued = qMax(maxQueued, this->d->m_period);
+    this->d->m_lastAnchor = {0, 0, 0};
+    this->d->m_lostSamples = 0;
+    this->d->m_droppedSamples = 0;
+    this->d->m_stats.setPeriod(quint64(this->d->m_period)
+                               * 1000000000
+                               / quint64(qMax(caps.rate(), 1)));
+    this->d->m_stats.reset();
+
+    auto sampleSize = size_t(AkAudioCaps::bitsPerSample(deviceFormat) / 8);
+    auto channels = size_t(caps.channels());
+    this->d->m_ring.resize(devicePlanar? sampleSize: channels * sampleSize,
+                           2 * this->d->m_maxQueued,
+                           devicePlanar? channels: 1);
+
+    // One time anchor is stored for each captured buffer.
+    this->d->m_anchors.resize(sizeof(AudioTimeAnchor),
+                              16 + 4 * this->d->m_ring.capacity()
+                                 / this->d->m_period);
+    this->d->m_closed = false;
+}
+
+void AudioDeviceBuffer::release()
+{
+    /* Keep new threads out, release the ones waiting, and wait for all of
+     * them to leave before freeing the buffers.
+     */
+    this->d->m_closed = true;
+    this->d->m_ring.abort();
+
+    while (this->d->m_users > 0)
+        QThread::yieldCurrentThread();
+
+    this->d->m_ring.resize(0, 0);
+    this->d->m_anchors.resize(0, 0);
+    this->d->m_convertBuffer.clear();
+    this->d->m_caps = AkAudioCaps();
+    this->d->m_sampleTimeScale = 1.0;
+    this->d->m_deviceFormat = AkAudioCaps::SampleFormat_none;
+    this->d->m_devicePlanar = false;
+    this->d->m_period = 0;
+    this->d->m_maxQueued = 0;
+    this->d->m_droppedSamples = 0;
+}
+
+void AudioDeviceBuffer::abort()
+{
+    this->d->m_ring.abort();
+}
+
+AkAudioCaps AudioDeviceBuffer::caps() const
+{
+    return this->d->m_caps;
+}
+
+AkAudioCaps::SampleFormat AudioDeviceBuffer::deviceFormat() const
+{
+    return this->d->m_deviceFormat;
+}
+
+bool AudioDeviceBuffer::devicePlanar() const
+{
+    return this->d->m_devicePlanar;
+}
+
+size_t AudioDeviceBuffer::period() const
+{
+    return this->d->m_period;
+}
+
+size_t AudioDeviceBuffer::maxQueued() const
+{
+    return this->d->m_maxQueued;
+}
+
+AudioRingBuffer &AudioDeviceBuffer::ring() const
+{
+    return this->d->m_ring;
+}
+
+AudioStats &AudioDeviceBuffer::stats() const
+{
+    return this->d->m_stats;
+}
+
+AudioKernels::SampleFormat AudioDeviceBuffer::kernelFormat(AkAudioCaps::SampleFormat format)
+{
+    static const QMap<AkAudioCaps::SampleFormat, AudioKernels::SampleFormat> kernelFormats {
+        {AkAudioCaps::SampleFormat_u8 , AudioKernels::SampleFormat_u8 },
+        {AkAudioCaps::SampleFormat_s16, AudioKernels::SampleFormat_s16},
+        {AkAudioCaps::SampleFormat_s32, AudioKernels::SampleFormat_s32},
+        {AkAudioCaps::SampleFormat_flt, AudioKernels::SampleFormat_flt},
+    };
+
+    return kernelFormats.value(format, AudioKernels::SampleFormat_none);
+}
+
+size_t AudioDeviceBuffer::capture(const void *const *planes,
+                                  size_t frames,
+                                  quint64 sampleTime,
+                                  quint64 hostTime)
+{
+    auto position = this->d->m_ring.writePosition();
+
+    // When the ring is full, the reader discards the old samples.
+    auto written = this->d->m_ring.write(planes, frames);
+
+    if (written < frames) {
+        this->d->m_droppedSamples.fetch_add(frames - written);
+        this->d->m_stats.overrun(frames - written);
+    }
+
+    if (written > 0)
+        this->d->addAnchor(position, sampleTime, hostTime);
+
+    return written;
+}
+
+bool AudioDeviceBuffer::beginCapture(size_t frames, quint8 **planes) const
+{
+    auto &ring = this->d->m_ring;
+    AudioRingBufferSegment segments[2];
+
+    if (ring.reserve(frames, segments) < frames
+        || segments[0].frames < frames)
+        return false;
+
+    for (size_t plane = 0; plane < ring.planes(); plane++)
+        planes[plane] = ring.plane(plane) + segments[0].offset * ring.frameSize();
+
+    return true;
+}
+
+void AudioDeviceBuffer::endCapture(size_t frames,
+                                   quint64 sampleTime,
+                                   quint64 hostTime)
+{
+    auto position = this->d->m_ring.writePosition();
+    this->d->m_ring.commit(frames);
+    this->d->addAnchor(position, sampleTime, hostTime);
+}
+
+size_t AudioDeviceBuffer::render(void *const *planes, size_t frames)
+{
+    auto &ring = this->d->m_ring;
+    auto read = ring.read(planes, frames);
+
+    if (read < frames)
+        this->d->m_stats.underrun(frames - read);
+
+    // Fill with silence whatever was not available.
+    for (size_t plane = 0; plane < ring.planes(); plane++)
+        memset(static_cast<quint8 *>(planes[plane]) + read * ring.frameSize(),
+               this->d->m_silence,
+               (frames - read) * ring.frameSize());
+
+    return read;
+}
+
+size_t AudioDeviceBuffer::waitForSamples(size_t samples, int timeout)
+{
+    AudioDeviceBufferUser user(this->d);
+
+    if (!user)
+        return 0;
+
+    if (this->d->m_ring.frameSize() < 1)
+        return 0;
+
+    QDeadlineTimer deadline(timeout < 0?
+                                QDeadlineTimer(QDeadlineTimer::Forever):
+                                QDeadlineTimer(timeout));
+
+    forever {
+        this->d->dropOldSamples();
+
+        if (this->d->m_ring.readAvailable() >= samples)
+            return samples;
+
+        auto remainingTime = deadline.remainingTime();
+
+        if (remainingTime == 0
+            || !this->d->m_ring.waitForData(samples, int(remainingTime)))
+            break;
+    }
+
+    this->d->dropOldSamples();
+
+    return qMin(samples, this->d->m_ring.readAvailable());
+}
+
+QByteArray AudioDeviceBuffer::read(size_t samples, int timeout)
+{
+    AudioDeviceBufferUser user(this->d);
+
+    if (!user)
+        return {};
+
+    samples = this->waitForSamples(samples, timeout);
+
+    if (samples < 1)
+        return {};
+
+    auto &caps = this->d->m_caps;
+    auto sampleSize = size_t(caps.bps() / 8);
+    auto channels = size_t(caps.channels());
+    QByteArray audioData(qsizetype(samples * channels * sampleSize),
+                         Qt::Uninitialized);
+    auto data = reinterpret_cast<quint8 *>(audioData.data());
+    QVarLengthArray<quint8 *, MAX_PLANES> planes;
+
+    if (caps.planar())
+        for (size_t channel = 0; channel < channels; channel++)
+            planes << data + channel * samples * sampleSize;
+    else
+        planes << data;
+
+    this->d->readFromRing(planes.data(), samples);
+
+    return audioData;
+}
+
+AkAudioPacket AudioDeviceBuffer::readPacket(size_t samples,
+                                            int timeout,
+                                            quint64 *lostSamples,
+                                            quint64 *samplePosition)
+{
+    AudioDeviceBufferUser user(this->d);
+
+    if (!user)
+        return {};
+
+    // Wait for a whole chunk, or for whatever arrived until the timeout, so
+    // the samples are copied just once into the packet.
+    samples = this->waitForSamples(samples, timeout);
+
+    if (samples < 1)
+        return {};
+
+    auto &caps = this->d->m_caps;
+    auto pts = this->d->hostTime(this->d->m_ring.readPosition(),
+                                 samplePosition);
+
+    if (lostSamples)
+        *lostSamples = this->d->m_lostSamples;
+
+    this->d->m_lostSamples = 0;
+    AkAudioPacket packet(caps, samples);
+    QVarLengthArray<quint8 *, MAX_PLANES> planes;
+
+    if (caps.planar())
+        for (int channel = 0; channel < caps.channels(); channel++)
+            planes << packet.plane(channel);
+    else
+        planes << reinterpret_cast<quint8 *>(packet.data());
+
+    this->d->readFromRing(planes.data(), samples);
+    packet.setPts(pts);
+    packet.setTimeBase(AkFrac(1, 1000000000));
+
+    return packet;
+}
+
+bool AudioDeviceBuffer::write(const AkAudioPacket &packet)
+{
+    AudioDeviceBufferUser user(this->d);
+
+    if (!user)
+        return false;
+
+    auto &ring = this->d->m_ring;
+
+    if (ring.frameSize() < 1)
+        return false;
+
+    // Don't queue more samples than required by the target latency.
+    auto minFree = ring.capacity() - this->d->m_maxQueued + 1;
+    auto samples = packet.samples();
+    size_t writtenSamples = 0;
+
+    while (writtenSamples < samples) {
+        if (!ring.waitForSpace(minFree))
+            return false;
+
+        auto planes = this->d->packetPlanes(packet, writtenSamples);
+        writtenSamples +=
+                this->d->writeToRing(planes.data(),
+                                     qMin(samples - writtenSamples,
+                                          this->queueFree()));
+    }
+
+    return true;
+}
+
+size_t AudioDeviceBuffer::tryWrite(const AkAudioPacket &packet, size_t offset)
+{
+    AudioDeviceBufferUser user(this->d);
+
+    if (!user)
+        return 0;
+
+    if (this->d->m_ring.frameSize() < 1 || offset >= packet.samples())
+        return 0;
+
+    auto planes = this->d->packetPlanes(packet, offset);
+
+    return this->d->writeToRing(planes.data(),
+                                qMin(packet.samples() - offset,
+                                     this->queueFree()));
+}
+
+size_t AudioDeviceBuffer::queueFree() const
+{
+    AudioDeviceBufferUser user(this->d);
+
+    if (!user)
+        return 0;
+
+    auto queued = this->d->m_ring.readAvailable();
+
+    return this->d->m_maxQueued - qMin(queued, this->d->m_maxQueued);
+}
+
+void AudioDeviceBuffer::notifierLoop(const std::atomic<bool> &running,
+                                     const std::atomic<int> &lowWatermark,
+                                     const std::function<void (qint64)> &notify)
+{
+    AudioDeviceBufferUser user(this->d);
+
+    if (!user)
+        return;
+
+    auto &ring = this->d->m_ring;
+    auto period = qMax(1, int(1000
+                              * this->d->m_period
+                              / size_t(qMax(this->d->m_caps.rate(), 1))));
+
+    while (running && !this->d->m_closed) {
+        // Sleep until the render callback drains the queue below the low
+        // watermark.
+        auto lowWatermarkSamples = this->d->lowWatermarkSamples(lowWatermark);
+
+        if (!ring.waitForSpace(ring.capacity() - lowWatermarkSamples + 1))
+            continue;
+
+        if (!running)
+            break;
+
+        notify(qint64(this->queueFree()));
+
+        // Don't notify again until the queue is refilled, or until it's still
+        // starving after a period.
+        ring.waitForData(lowWatermarkSamples, period);
+    }
+}
+
+AudioDeviceBufferUser::AudioDeviceBufferUser(AudioDeviceBufferPrivate *d):
+    d(d)
+{
+    // Paired with release(), either it sees this user or this user sees the
+    // buffer closed.
+    this->d->m_users++;
+    this->m_valid = !this->d->m_closed;
+}
+
+AudioDeviceBufferUser::~AudioDeviceBufferUser()
+{
+    this->d->m_users--;
+}
+
+AudioDeviceBufferUser::operator bool() const
+{
+    return this->m_valid;
+}
+
+void AudioDeviceBufferPrivate::dropOldSamples()
+{
+    // The callback can't discard samples that belong to the reader, so it just
+    // counts the samples it couldn't write. Discard here all old samples but
+    // the last period.
+    auto droppedSamples = this->m_droppedSamples.exchange(0);
+
+    if (droppedSamples < 1)
+        return;
+
+    auto available = this->m_ring.readAvailable();
+    auto keep = qMin(available, this->m_period);
+    this->m_lostSamples += droppedSamples + this->m_ring.discard(available - keep);
+    this->updateTimeAnchor(this->m_ring.readPosition());
+}
+
+void AudioDeviceBufferPrivate::updateTimeAnchor(size_t position)
+{
+    // Keep the newest anchor at or before the position, and drop the older.
+    AudioRingBufferSegment segments[2];
+
+    while (this->m_anchors.peek(1, segments) > 0) {
+        auto anchor =
+                reinterpret_cast<const AudioTimeAnchor *>(this->m_anchors.plane(0))
+                + segments[0].offset;
+
+        if (anchor->position > position)
+            break;
+
+        this->m_lastAnchor = *anchor;
+        this->m_anchors.discard(1);
+    }
+}
+
+qint64 AudioDeviceBufferPrivate::hostTime(size_t position,
+                                          quint64 *samplePosition)
+{
+    this->updateTimeAnchor(position);
+    auto anchor = this->m_lastAnchor;
+
+    // Before the first anchor, extrapolate back from the next one.
+    if (anchor.hostTime == 0) {
+        AudioRingBufferSegment segments[2];
+
+        if (this->m_anchors.peek(1, segments) > 0)
+            anchor =
+                *(reinterpret_cast<const AudioTimeAnchor *>(this->m_anchors.plane(0))
+                  + segments[0].offset);
+    }
+
+    // The ring counts frames at the requested rate, while the sample time
+    // of the anchor is counted at the rate of the device.
+    auto diff = qint64(position) - qint64(anchor.position);
+
+    if (samplePosition)
+        *samplePosition =
+                quint64(std::llround(qreal(anchor.sampleTime)
+                                     * this->m_sampleTimeScale)
+                        + diff);
+
+    return qint64(anchor.hostTime)
+           + diff * 1000000000 / this->m_caps.rate();
+}
+
+quint8 *AudioDeviceBufferPrivate::convertBuffer(size_t size)
+{
+    if (size_t(this->m_convertBuffer.size()) < size)
+        this->m_convertBuffer.resize(qsizetype(size));
+
+    return reinterpret_cast<quint8 *>(this->m_convertBuffer.data());
+}
+
+size_t AudioDeviceBufferPrivate::readFromRing(quint8 *const *planes,
+                                              size_t samples)
+{
+    AudioRingBufferSegment segments[2];
+    samples = this->m_ring.peek(samples, segments);
+
+    auto channels = size_t(this->m_caps.channels());
+    auto sampleSize = size_t(this->m_caps.bps() / 8);
+    bool planar = this->m_caps.planar();
+    auto frameSize = planar? sampleSize: channels * sampleSize;
+    auto ringFrameSize = this->m_ring.frameSize();
+    QVarLengthArray<const quint8 *, MAX_PLANES> src(int(this->m_ring.planes()));
+    QVarLengthArray<quint8 *, MAX_PLANES> dst(planar? int(channels): 1);
+    size_t offset = 0;
+
+    // Convert to the requested format in the device layout first.
+    bool convert = this->m_deviceFormat != this->m_caps.format();
+    auto planeSamples = this->m_devicePlanar? 1: channels;
+    auto buffer = convert?
+                      this->convertBuffer(samples * channels * sampleSize):
+                      nullptr;
+
+    for (auto &segment: segments) {
+        if (segment.frames < 1)
+            continue;
+
+        for (int plane = 0; plane < src.size(); plane++)
+            src[plane] = this->m_ring.plane(size_t(plane))
+                         + segment.offset * ringFrameSize;
+
+        if (convert)
+            for (int plane = 0; plane < src.size(); plane++) {
+                auto converted = buffer
+                                 + size_t(plane)
+                                   * segment.frames
+                                   * planeSamples
+                                   * sampleSize;
+                AudioKernels::convert(src[plane],
+                                      AudioDeviceBuffer::kernelFormat(this->m_deviceFormat),
+                                      converted,
+                                      AudioDeviceBuffer::kernelFormat(this->m_caps.format()),
+                                      segment.frames * planeSamples,
+                                      &this->m_dither);
+                src[plane] = converted;
+            }
+
+        for (int plane = 0; plane < dst.size(); plane++)
+            dst[plane] = planes[plane] + offset * frameSize;
+
+        AudioKernels::copy(src.data(),
+                           this->m_devicePlanar,
+                           dst.data(),
+                           planar,
+                           channels,
+                           segment.frames,
+                           sampleSize);
+        offset += segment.frames;
+    }
+
+    this->m_ring.discard(samples);
+    this->updateTimeAnchor(this->m_ring.readPosition());
+
+    return samples;
+}
+
+size_t AudioDeviceBufferPrivate::writeToRing(const quint8 *const *planes,
+                                             size_t samples)
+{
+    AudioRingBufferSegment segments[2];
+    samples = this->m_ring.reserve(samples, segments);
+
+    auto channels = size_t(this->m_caps.channels());
+    auto sampleSize = size_t(this->m_caps.bps() / 8);
+    bool planar = this->m_caps.planar();
+    auto frameSize = planar? sampleSize: channels * sampleSize;
+    auto ringFrameSize = this->m_ring.frameSize();
+    QVarLengthArray<const quint8 *, MAX_PLANES> src(planar? int(channels): 1);
+    QVarLengthArray<quint8 *, MAX_PLANES> dst(int(this->m_ring.planes()));
+    size_t offset = 0;
+
+    // Convert the layout first, and then the format into the ring.
+    bool convert = this->m_deviceFormat != this->m_caps.format();
+    auto planeSamples = this->m_devicePlanar? 1: channels;
+    auto buffer = convert?
+                      this->convertBuffer(samples * channels * sampleSize):
+                      nullptr;
+    QVarLengthArray<quint8 *, MAX_PLANES> converted(dst.size());
+
+    for (auto &segment: segments) {
+        if (segment.frames < 1)
+            continue;
+
+        for (int plane = 0; plane < src.size(); plane++)
+            src[plane] = planes[plane] + offset * frameSize;
+
+        for (int plane = 0; plane < dst.size(); plane++) {
+            dst[plane] = this->m_ring.plane(size_t(plane))
+                         + segment.offset * ringFrameSize;
+            converted[plane] = convert?
+                                   buffer
+                                   + size_t(plane)
+                                     * segment.frames
+                                     * planeSamples
+                                     * sampleSize:
+                                   dst[plane];
+        }
+
+        AudioKernels::copy(src.data(),
+                           planar,
+                           converted.data(),
+                           this->m_devicePlanar,
+                           channels,
+                           segment.frames,
+                           sampleSize);
+
+        if (convert)
+            for (int plane = 0; plane < dst.size(); plane++)
+                AudioKernels::convert(converted[plane],
+                                      AudioDeviceBuffer::kernelFormat(this->m_caps.format()),
+                                      dst[plane],
+                                      AudioDeviceBuffer::kernelFormat(this->m_deviceFormat),
+                                      segment.frames * planeSamples,
+                                      &this->m_dither);
+
+        offset += segment.frames;
+    }
+
+    this->m_ring.commit(samples);
+
+    return samples;
+}
+
+size_t AudioDeviceBufferPrivate::lowWatermarkSamples(int lowWatermark) const
+{
+    auto samples = lowWatermark > 0?
+                       size_t(lowWatermark) * size_t(this->m_caps.rate()) / 1000:
+                       this->m_maxQueued / 2;
+
+    return qBound<size_t>(1, samples, this->m_maxQueued);
+}
+
+QVarLengthArray<const quint8 *, MAX_PLANES> AudioDeviceBufferPrivate::packetPlanes(const AkAudioPacket &packet,
+                                                                                   size_t offset)
+{
+    auto caps = packet.caps();
+    auto sampleSize = size_t(caps.bps() / 8);
+    QVarLengthArray<const quint8 *, MAX_PLANES> planes;
+
+    if (caps.planar())
+        for (int channel = 0; channel < caps.channels(); channel++)
+            planes << packet.constPlane(channel) + offset * sampleSize;
+    else
+        planes << reinterpret_cast<const quint8 *>(packet.constData())
+                  + offset * size_t(caps.channels()) * sampleSize;
+
+    return planes;
+}
+
+void AudioDeviceBufferPrivate::addAnchor(size_t position,
+                                         quint64 sampleTime,
+                                         quint64 hostTime)
+{
+    AudioTimeAnchor anchor {position, sampleTime, hostTime};
+    this->m_anchors.write(&anchor, 1);
+}
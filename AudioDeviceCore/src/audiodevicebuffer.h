@@ -0,0 +1,125 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef AUDIODEVICEBUFFER_H
+#define AUDIODEVICEBUFFER_H
+
+#include <atomic>
+#include <functional>
+#include <QByteArray>
+#include <akaudiocaps.h>
+
+#include "audiokernels.h"
+
+class AudioDeviceBufferPrivate;
+class AudioRingBuffer;
+class AudioStats;
+class AkAudioPacket;
+
+/* Buffering core shared by the audio device implementations.
+ *
+ * It connects the real-time callback of a device with the reading or writing
+ * thread: the ring of samples in the native format of the device, the clock
+ * anchors of the captured buffers, the overflow trimming, the conversion to
+ * the requested format and the low watermark notifications. It doesn't
+ * depend on any audio API.
+ */
+class AudioDeviceBuffer
+{
+    public:
+        AudioDeviceBuffer();
+        AudioDeviceBuffer(const AudioDeviceBuffer &other) = delete;
+        ~AudioDeviceBuffer();
+
+        AudioDeviceBuffer &operator =(const AudioDeviceBuffer &other) = delete;
+
+        /* Allocates the buffers, must be called before the callback starts.
+         * The period is the number of frames processed on each callback, and
+         * maxQueued the number of frames allowed to wait for playback.
+         * deviceRate is the rate of the sample times given to capture(), if
+         * it's not the one of caps, 0 means they match.
+         */
+        void configure(const AkAudioCaps &caps,
+                       AkAudioCaps::SampleFormat deviceFormat,
+                       bool devicePlanar,
+                       size_t period,
+                       size_t maxQueued,
+                       qreal deviceRate=0);
+
+        /* Must be called after the callback stops. It releases the waiting
+         * threads and returns once all reading and writing calls left, any
+         * later call fails until the buffer is configured again.
+         */
+        void release();
+
+        // Release all threads waiting in the buffer.
+        void abort();
+
+        AkAudioCaps caps() const;
+        AkAudioCaps::SampleFormat deviceFormat() const;
+        bool devicePlanar() const;
+        size_t period() const;
+        size_t maxQueued() const;
+        AudioRingBuffer &ring() const;
+        AudioStats &stats() const;
+        static AudioKernels::SampleFormat kernelFormat(AkAudioCaps::SampleFormat format);
+
+        /* Real-time capture side. The sample time and the host time, in
+         * nanoseconds, are the ones of the first frame of the buffer.
+         */
+        size_t capture(const void *const *planes,
+                       size_t frames,
+                       quint64 sampleTime,
+                       quint64 hostTime);
+
+        /* Returns the planes where the device can write the next buffer
+         * directly, or false if there is no contiguous room for it.
+         */
+        bool beginCapture(size_t frames, quint8 **planes) const;
+        void endCapture(size_t frames, quint64 sampleTime, quint64 hostTime);
+
+        // Real-time playback side, missing samples are filled with silence.
+        size_t render(void *const *planes, size_t frames);
+
+        // Reading side.
+        size_t waitForSamples(size_t samples, int timeout);
+        QByteArray read(size_t samples, int timeout=-1);
+        AkAudioPacket readPacket(size_t samples,
+                                 int timeout=-1,
+                                 quint64 *lostSamples=nullptr,
+                                 quint64 *samplePosition=nullptr);
+
+        // Writing side.
+        bool write(const AkAudioPacket &packet);
+        size_t tryWrite(const AkAudioPacket &packet, size_t offset=0);
+        size_t queueFree() const;
+
+        /* Calls notify with the free space every time playback drains the
+         * queue below the low watermark, in milliseconds, until running is
+         * false. A low watermark of 0 means half of the queue.
+         */
+        void notifierLoop(const std::atomic<bool> &running,
+                          const std::atomic<int> &lowWatermark,
+                          const std::function<void (qint64 samples)> &notify);
+
+    private:
+        AudioDeviceBufferPrivate *d;
+};
+
+#endif // AUDIODEVICEBUFFER_H
@@ -0,0 +1,153 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <cmath>
+
+#include "audiodriftestimator.h"
+
+// Weight of the old points on each update, about 1000 points of memory.
+#define DECAY_FACTOR 0.999
+
+// Don't trust the fit until the points span this much host time, in seconds.
+#define MIN_SPAN 2.0
+
+// Move the origin of the fit after this many seconds.
+#define RECENTER_TIME 60.0
+
+// Rates too far from the nominal one are certainly wrong measurements.
+#define MAX_DEVIATION 0.01
+
+class AudioDriftEstimatorPrivate
+{
+    public:
+        qreal m_nominalRate {0.0};
+        qint64 m_hostTime0 {0};
+        quint64 m_position0 {0};
+        bool m_started {false};
+        qreal m_span {0.0};
+        qreal m_sw {0.0};
+        qreal m_sx {0.0};
+        qreal m_sy {0.0};
+        qreal m_sxx {0.0};
+        qreal m_sxy {0.0};
+
+        void recenter(qreal x, qreal y);
+};
+
+AudioDriftEstimator::AudioDriftEstimator()
+{
+    this->d = new AudioDriftEstimatorPrivate;
+}
+
+AudioDriftEstimator::AudioDriftEstimator(const AudioDriftEstimator &other)
+{
+    this->d = new AudioDriftEstimatorPrivate;
+    *this->d = *other.d;
+}
+
+AudioDriftEstimator::~AudioDriftEstimator()
+{
+    delete this->d;
+}
+
+AudioDriftEstimator &AudioDriftEstimator::operator =(const AudioDriftEstimator &other)
+{
+    if (this != &other)
+        *this->d = *other.d;
+
+    return *this;
+}
+
+qreal AudioDriftEstimator::nominalRate() const
+{
+    return this->d->m_nominalRate;
+}
+
+void AudioDriftEstimator::setNominalRate(qreal rate)
+{
+    this->d->m_nominalRate = rate;
+    this->reset();
+}
+
+void AudioDriftEstimator::addPoint(qint64 hostTime, quint64 position)
+{
+    if (!this->d->m_started) {
+        this->d->m_hostTime0 = hostTime;
+        this->d->m_position0 = position;
+        this->d->m_started = true;
+    }
+
+    // Work relative to a recent point to keep the precision.
+    auto x = qreal(hostTime - this->d->m_hostTime0) / 1e9;
+    auto y = qreal(qint64(position - this->d->m_position0));
+
+    if (x > RECENTER_TIME) {
+        this->d->recenter(x, y);
+        this->d->m_hostTime0 = hostTime;
+        this->d->m_position0 = position;
+        x = 0.0;
+        y = 0.0;
+    }
+
+    this->d->m_sw = DECAY_FACTOR * this->d->m_sw + 1.0;
+    this->d->m_sx = DECAY_FACTOR * this->d->m_sx + x;
+    this->d->m_sy = DECAY_FACTOR * this->d->m_sy + y;
+    this->d->m_sxx = DECAY_FACTOR * this->d->m_sxx + x * x;
+    this->d->m_sxy = DECAY_FACTOR * this->d->m_sxy + x * y;
+    this->d->m_span = qMax(this->d->m_span, x);
+}
+
+qreal AudioDriftEstimator::rate() const
+{
+    if (this->d->m_span < MIN_SPAN)
+        return this->d->m_nominalRate;
+
+    auto det = this->d->m_sw * this->d->m_sxx
+             - this->d->m_sx * this->d->m_sx;
+
+    if (qFuzzyIsNull(det))
+        return this->d->m_nominalRate;
+
+    auto rate = (this->d->m_sw * this->d->m_sxy
+                 - this->d->m_sx * this->d->m_sy) / det;
+
+    if (this->d->m_nominalRate > 0
+        && std::abs(rate / this->d->m_nominalRate - 1.0) > MAX_DEVIATION)
+        return this->d->m_nominalRate;
+
+    return rate;
+}
+
+void AudioDriftEstimator::reset()
+{
+    auto nominalRate = this->d->m_nominalRate;
+    *this->d = {};
+    this->d->m_nominalRate = nominalRate;
+}
+
+void AudioDriftEstimatorPrivate::recenter(qreal x, qreal y)
+{
+    this->m_sxx += x * x * this->m_sw - 2.0 * x * this->m_sx;
+    this->m_sxy += x * y * this->m_sw - x * this->m_sy - y * this->m_sx;
+    this->m_sx -= x * this->m_sw;
+    this->m_sy -= y * this->m_sw;
+
+    // The span is measured from the origin, so it's always enough from now.
+    this->m_span = MIN_SPAN;
+}
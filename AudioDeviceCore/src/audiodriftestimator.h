@@ -0,0 +1,56 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef AUDIODRIFTESTIMATOR_H
+#define AUDIODRIFTESTIMATOR_H
+
+#include <QtGlobal>
+
+class AudioDriftEstimatorPrivate;
+
+/* Estimates the real sample rate of a device measured against the host clock.
+ *
+ * The estimation is an exponentially weighted least squares fit of the sample
+ * position of the device against the host time, so a single late timestamp
+ * has little effect on it.
+ */
+class AudioDriftEstimator
+{
+    public:
+        AudioDriftEstimator();
+        AudioDriftEstimator(const AudioDriftEstimator &other);
+        ~AudioDriftEstimator();
+
+        AudioDriftEstimator &operator =(const AudioDriftEstimator &other);
+
+        qreal nominalRate() const;
+        void setNominalRate(qreal rate);
+
+        // The host time is in nanoseconds, the position in samples.
+        void addPoint(qint64 hostTime, quint64 position);
+
+        // Estimated rate in samples per second of host time.
+        qreal rate() const;
+        void reset();
+
+    private:
+        AudioDriftEstimatorPrivate *d;
+};
+
+#endif // AUDIODRIFTESTIMATOR_H
@@ -0,0 +1,715 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <cmath>
+#include <cstring>
+
+/* AUDIOKERNELS_SCALAR builds only the portable code, the tests and the
+ * benchmarks use it to check the vector paths against it.
+ */
+#if defined(AUDIOKERNELS_SCALAR)
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_NEON
+#endif
+
+#include "audiokernels.h"
+
+template<typename T>
+inline void interleaveGeneric(const quint8 *const *src,
+                              quint8 *dst,
+                              size_t channels,
+                              size_t offset,
+                              size_t samples)
+{
+    auto out = reinterpret_cast<T *>(dst);
+
+    for (size_t c = 0; c < channels; c++) {
+        auto in = reinterpret_cast<const T *>(src[c]);
+
+        for (size_t i = offset; i < samples; i++)
+            out[i * channels + c] = in[i];
+    }
+}
+
+template<typename T>
+inline void deinterleaveGeneric(const quint8 *src,
+                                quint8 *const *dst,
+                                size_t channels,
+                                size_t offset,
+                                size_t samples)
+{
+    auto in = reinterpret_cast<const T *>(src);
+
+    for (size_t c = 0; c < channels; c++) {
+        auto out = reinterpret_cast<T *>(dst[c]);
+
+        for (size_t i = offset; i < samples; i++)
+            out[i] = in[i * channels + c];
+    }
+}
+
+// Stereo is by far the most common case, so it's the one vectorized.
+
+inline size_t interleaveStereo16(const quint8 *const *src,
+                                 quint8 *dst,
+                                 size_t samples)
+{
+    auto left = reinterpret_cast<const qint16 *>(src[0]);
+    auto right = reinterpret_cast<const qint16 *>(src[1]);
+    auto out = reinterpret_cast<qint16 *>(dst);
+    size_t i = 0;
+
+#if defined(USE_SSE2)
+    for (; i + 8 <= samples; i += 8) {
+        auto l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(left + i));
+        auto r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(right + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i),
+                         _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i + 8),
+                         _mm_unpackhi_epi16(l, r));
+    }
+#elif defined(USE_NEON)
+    for (; i + 8 <= samples; i += 8) {
+        int16x8x2_t lr = {{vld1q_s16(left + i), vld1q_s16(right + i)}};
+        vst2q_s16(out + 2 * i, lr);
+    }
+#else
+    Q_UNUSED(left)
+    Q_UNUSED(right)
+    Q_UNUSED(out)
+    Q_UNUSED(samples)
+#endif
+
+    return i;
+}
+
+inline size_t interleaveStereo32(const quint8 *const *src,
+                                 quint8 *dst,
+                                 size_t samples)
+{
+    auto left = reinterpret_cast<const qint32 *>(src[0]);
+    auto right = reinterpret_cast<const qint32 *>(src[1]);
+    auto out = reinterpret_cast<qint32 *>(dst);
+    size_t i = 0;
+
+#if defined(USE_SSE2)
+    for (; i + 4 <= samples; i += 4) {
+        auto l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(left + i));
+        auto r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(right + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i),
+                         _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i + 4),
+                         _mm_unpackhi_epi32(l, r));
+    }
+#elif defined(USE_NEON)
+    for (; i + 4 <= samples; i += 4) {
+        int32x4x2_t lr = {{vld1q_s32(left + i), vld1q_s32(right + i)}};
+        vst2q_s32(out + 2 * i, lr);
+    }
+#else
+    Q_UNUSED(left)
+    Q_UNUSED(right)
+    Q_UNUSED(out)
+    Q_UNUSED(samples)
+#endif
+
+    return i;
+}
+
+inline size_t deinterleaveStereo16(const quint8 *src,
+                                   quint8 *const *dst,
+                                   size_t samples)
+{
+    auto in = reinterpret_cast<const qint16 *>(src);
+    auto left = reinterpret_cast<qint16 *>(dst[0]);
+    auto right = reinterpret_cast<qint16 *>(dst[1]);
+    size_t i = 0;
+
+#if defined(USE_SSE2)
+    for (; i + 8 <= samples; i += 8) {
+        auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i));
+        auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i + 8));
+
+        // Sign extend each half to 32 bits, packing back is then lossless.
+        auto la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        auto lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        auto ra = _mm_srai_epi32(a, 16);
+        auto rb = _mm_srai_epi32(b, 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(left + i),
+                         _mm_packs_epi32(la, lb));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(right + i),
+                         _mm_packs_epi32(ra, rb));
+    }
+#elif defined(USE_NEON)
+    for (; i + 8 <= samples; i += 8) {
+        auto lr = vld2q_s16(in + 2 * i);
+        vst1q_s16(left + i, lr.val[0]);
+        vst1q_s16(right + i, lr.val[1]);
+    }
+#else
+    Q_UNUSED(in)
+    Q_UNUSED(left)
+    Q_UNUSED(right)
+    Q_UNUSED(samples)
+#endif
+
+    return i;
+}
+
+inline size_t deinterleaveStereo32(const quint8 *src,
+                                   quint8 *const *dst,
+                                   size_t samples)
+{
+    auto in = reinterpret_cast<const qint32 *>(src);
+    auto left = reinterpret_cast<qint32 *>(dst[0]);
+    auto right = reinterpret_cast<qint32 *>(dst[1]);
+    size_t i = 0;
+
+#if defined(USE_SSE2)
+    for (; i + 4 <= samples; i += 4) {
+        // The shuffles just move bits around, so this is valid for integers
+        // too.
+        auto a = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i)));
+        auto b = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i + 4)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(left + i),
+                         _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(right + i),
+                         _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+#elif defined(USE_NEON)
+    for (; i + 4 <= samples; i += 4) {
+        auto lr = vld2q_s32(in + 2 * i);
+        vst1q_s32(left + i, lr.val[0]);
+        vst1q_s32(right + i, lr.val[1]);
+    }
+#else
+    Q_UNUSED(in)
+    Q_UNUSED(left)
+    Q_UNUSED(right)
+    Q_UNUSED(samples)
+#endif
+
+    return i;
+}
+
+/* Sample format conversion.
+ *
+ * Float samples are in the [-1, 1) range, the scalar code rounds to nearest
+ * even as the vector instructions do, so both paths give the same output.
+ */
+
+#define DITHER_LANES 4
+
+inline quint32 ditherNext(quint32 &state)
+{
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return state;
+}
+
+inline float ditherUniform(quint32 value)
+{
+    union {
+        quint32 i;
+        float f;
+    } bits;
+
+    // Build a float in [1, 2) from the highest 23 bits.
+    bits.i = (value >> 9) | 0x3f800000;
+
+    return bits.f - 1.0f;
+}
+
+// Triangular noise in the (-1, 1) LSB range.
+inline float ditherTriangular(quint32 &state)
+{
+    auto a = ditherUniform(ditherNext(state));
+    auto b = ditherUniform(ditherNext(state));
+
+    return a - b;
+}
+
+inline float readSample(const quint8 *src,
+                        AudioKernels::SampleFormat format,
+                        size_t i)
+{
+    switch (format) {
+    case AudioKernels::SampleFormat_u8:
+        return float(int(src[i]) - 128) / 128.0f;
+    case AudioKernels::SampleFormat_s16:
+        return float(reinterpret_cast<const qint16 *>(src)[i]) / 32768.0f;
+    case AudioKernels::SampleFormat_s32:
+        return float(reinterpret_cast<const qint32 *>(src)[i]) / 2147483648.0f;
+    case AudioKernels::SampleFormat_flt:
+        return reinterpret_cast<const float *>(src)[i];
+    default:
+        break;
+    }
+
+    return 0.0f;
+}
+
+inline void writeSample(quint8 *dst,
+                        AudioKernels::SampleFormat format,
+                        size_t i,
+                        float sample,
+                        quint32 *dither)
+{
+    switch (format) {
+    case AudioKernels::SampleFormat_u8: {
+        auto value = sample * 128.0f;
+
+        if (dither)
+            value += ditherTriangular(dither[i % DITHER_LANES]);
+
+        value = qBound(-128.0f, value, 127.0f);
+        dst[i] = quint8(int(std::nearbyint(value)) + 128);
+
+        break;
+    }
+    case AudioKernels::SampleFormat_s16: {
+        auto value = sample * 32768.0f;
+
+        if (dither)
+            value += ditherTriangular(dither[i % DITHER_LANES]);
+
+        value = qBound(-32768.0f, value, 32767.0f);
+        reinterpret_cast<qint16 *>(dst)[i] = qint16(std::nearbyint(value));
+
+        break;
+    }
+    case AudioKernels::SampleFormat_s32: {
+        // 2147483520 is the largest float below 2^31.
+        auto value = qBound(-2147483648.0f,
+                            sample * 2147483648.0f,
+                            2147483520.0f);
+        reinterpret_cast<qint32 *>(dst)[i] = qint32(std::nearbyint(value));
+
+        break;
+    }
+    case AudioKernels::SampleFormat_flt:
+        reinterpret_cast<float *>(dst)[i] = sample;
+
+        break;
+    default:
+        break;
+    }
+}
+
+#if defined(USE_SSE2)
+inline __m128i ditherNext(__m128i &state)
+{
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+    state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+
+    return state;
+}
+
+inline __m128 ditherTriangular(__m128i &state)
+{
+    auto one = _mm_set1_epi32(0x3f800000);
+    auto a = _mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(ditherNext(state), 9),
+                                           one));
+    auto b = _mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(ditherNext(state), 9),
+                                           one));
+
+    return _mm_sub_ps(a, b);
+}
+#elif defined(USE_NEON)
+inline uint32x4_t ditherNext(uint32x4_t &state)
+{
+    state = veorq_u32(state, vshlq_n_u32(state, 13));
+    state = veorq_u32(state, vshrq_n_u32(state, 17));
+    state = veorq_u32(state, vshlq_n_u32(state, 5));
+
+    return state;
+}
+
+inline float32x4_t ditherTriangular(uint32x4_t &state)
+{
+    auto one = vdupq_n_u32(0x3f800000);
+    auto a = vreinterpretq_f32_u32(vorrq_u32(vshrq_n_u32(ditherNext(state), 9),
+                                             one));
+    auto b = vreinterpretq_f32_u32(vorrq_u32(vshrq_n_u32(ditherNext(state), 9),
+                                             one));
+
+    return vsubq_f32(a, b);
+}
+#endif
+
+// Round to nearest even is only available on 64 bits ARM.
+#if defined(USE_SSE2) || (defined(USE_NEON) && defined(__aarch64__))
+#define USE_SIMD_CONVERT
+#endif
+
+inline void convertFltToS16(const float *src,
+                            qint16 *dst,
+                            size_t samples,
+                            quint32 *dither)
+{
+    size_t i = 0;
+
+#if defined(USE_SSE2)
+    auto scale = _mm_set1_ps(32768.0f);
+    auto minValue = _mm_set1_ps(-32768.0f);
+    auto maxValue = _mm_set1_ps(32767.0f);
+    auto state = dither?
+                     _mm_loadu_si128(reinterpret_cast<const __m128i *>(dither)):
+                     _mm_setzero_si128();
+
+    for (; i + 8 <= samples; i += 8) {
+        auto a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        auto b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+
+        if (dither) {
+            a = _mm_add_ps(a, ditherTriangular(state));
+            b = _mm_add_ps(b, ditherTriangular(state));
+        }
+
+        a = _mm_min_ps(_mm_max_ps(a, minValue), maxValue);
+        b = _mm_min_ps(_mm_max_ps(b, minValue), maxValue);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_packs_epi32(_mm_cvtps_epi32(a),
+                                         _mm_cvtps_epi32(b)));
+    }
+
+    if (dither)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dither), state);
+#elif defined(USE_SIMD_CONVERT)
+    auto minValue = vdupq_n_f32(-32768.0f);
+    auto maxValue = vdupq_n_f32(32767.0f);
+    auto state = dither? vld1q_u32(dither): vdupq_n_u32(0);
+
+    for (; i + 8 <= samples; i += 8) {
+        auto a = vmulq_n_f32(vld1q_f32(src + i), 32768.0f);
+        auto b = vmulq_n_f32(vld1q_f32(src + i + 4), 32768.0f);
+
+        if (dither) {
+            a = vaddq_f32(a, ditherTriangular(state));
+            b = vaddq_f32(b, ditherTriangular(state));
+        }
+
+        a = vminq_f32(vmaxq_f32(a, minValue), maxValue);
+        b = vminq_f32(vmaxq_f32(b, minValue), maxValue);
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a)),
+                                        vqmovn_s32(vcvtnq_s32_f32(b))));
+    }
+
+    if (dither)
+        vst1q_u32(dither, state);
+#endif
+
+    for (; i < samples; i++) {
+        auto value = src[i] * 32768.0f;
+
+        if (dither)
+            value += ditherTriangular(dither[i % DITHER_LANES]);
+
+        value = qBound(-32768.0f, value, 32767.0f);
+        dst[i] = qint16(std::nearbyint(value));
+    }
+}
+
+inline void convertS16ToFlt(const qint16 *src, float *dst, size_t samples)
+{
+    size_t i = 0;
+
+#if defined(USE_SSE2)
+    auto scale = _mm_set1_ps(1.0f / 32768.0f);
+
+    for (; i + 8 <= samples; i += 8) {
+        auto in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+
+        // Sign extend by shifting the samples to the high half.
+        auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16);
+        auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#elif defined(USE_NEON)
+    for (; i + 8 <= samples; i += 8) {
+        auto in = vld1q_s16(src + i);
+        auto lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(in)));
+        auto hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(in)));
+        vst1q_f32(dst + i, vmulq_n_f32(lo, 1.0f / 32768.0f));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(hi, 1.0f / 32768.0f));
+    }
+#endif
+
+    for (; i < samples; i++)
+        dst[i] = float(src[i]) / 32768.0f;
+}
+
+inline void convertFltToS32(const float *src, qint32 *dst, size_t samples)
+{
+    size_t i = 0;
+
+#if defined(USE_SSE2)
+    auto scale = _mm_set1_ps(2147483648.0f);
+    auto minValue = _mm_set1_ps(-2147483648.0f);
+    auto maxValue = _mm_set1_ps(2147483520.0f);
+
+    for (; i + 4 <= samples; i += 4) {
+        auto value = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        value = _mm_min_ps(_mm_max_ps(value, minValue), maxValue);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_cvtps_epi32(value));
+    }
+#elif defined(USE_SIMD_CONVERT)
+    auto minValue = vdupq_n_f32(-2147483648.0f);
+    auto maxValue = vdupq_n_f32(2147483520.0f);
+
+    for (; i + 4 <= samples; i += 4) {
+        auto value = vmulq_n_f32(vld1q_f32(src + i), 2147483648.0f);
+        value = vminq_f32(vmaxq_f32(value, minValue), maxValue);
+        vst1q_s32(dst + i, vcvtnq_s32_f32(value));
+    }
+#endif
+
+    for (; i < samples; i++) {
+        auto value = qBound(-2147483648.0f,
+                            src[i] * 2147483648.0f,
+                            2147483520.0f);
+        dst[i] = qint32(std::nearbyint(value));
+    }
+}
+
+inline void convertS32ToFlt(const qint32 *src, float *dst, size_t samples)
+{
+    size_t i = 0;
+
+#if defined(USE_SSE2)
+    auto scale = _mm_set1_ps(1.0f / 2147483648.0f);
+
+    for (; i + 4 <= samples; i += 4) {
+        auto in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(in), scale));
+    }
+#elif defined(USE_NEON)
+    for (; i + 4 <= samples; i += 4)
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)),
+                                       1.0f / 2147483648.0f));
+#endif
+
+    for (; i < samples; i++)
+        dst[i] = float(src[i]) / 2147483648.0f;
+}
+
+void AudioKernels::interleave(const quint8 *const *src,
+                              quint8 *dst,
+                              size_t channels,
+                              size_t samples,
+                              size_t sampleSize)
+{
+    if (channels < 1 || samples < 1)
+        return;
+
+    if (channels == 1) {
+        memcpy(dst, src[0], samples * sampleSize);
+
+        return;
+    }
+
+    size_t offset = 0;
+
+    switch (sampleSize) {
+    case 1:
+        interleaveGeneric<quint8>(src, dst, channels, 0, samples);
+
+        break;
+    case 2:
+        if (channels == 2)
+            offset = interleaveStereo16(src, dst, samples);
+
+        interleaveGeneric<quint16>(src, dst, channels, offset, samples);
+
+        break;
+    case 4:
+        if (channels == 2)
+            offset = interleaveStereo32(src, dst, samples);
+
+        interleaveGeneric<quint32>(src, dst, channels, offset, samples);
+
+        break;
+    case 8:
+        interleaveGeneric<quint64>(src, dst, channels, 0, samples);
+
+        break;
+    default:
+        for (size_t c = 0; c < channels; c++)
+            for (size_t i = 0; i < samples; i++)
+                memcpy(dst + (i * channels + c) * sampleSize,
+                       src[c] + i * sampleSize,
+                       sampleSize);
+
+        break;
+    }
+}
+
+void AudioKernels::deinterleave(const quint8 *src,
+                                quint8 *const *dst,
+                                size_t channels,
+                                size_t samples,
+                                size_t sampleSize)
+{
+    if (channels < 1 || samples < 1)
+        return;
+
+    if (channels == 1) {
+        memcpy(dst[0], src, samples * sampleSize);
+
+        return;
+    }
+
+    size_t offset = 0;
+
+    switch (sampleSize) {
+    case 1:
+        deinterleaveGeneric<quint8>(src, dst, channels, 0, samples);
+
+        break;
+    case 2:
+        if (channels == 2)
+            offset = deinterleaveStereo16(src, dst, samples);
+
+        deinterleaveGeneric<quint16>(src, dst, channels, offset, samples);
+
+        break;
+    case 4:
+        if (channels == 2)
+            offset = deinterleaveStereo32(src, dst, samples);
+
+        deinterleaveGeneric<quint32>(src, dst, channels, offset, samples);
+
+        break;
+    case 8:
+        deinterleaveGeneric<quint64>(src, dst, channels, 0, samples);
+
+        break;
+    default:
+        for (size_t c = 0; c < channels; c++)
+            for (size_t i = 0; i < samples; i++)
+                memcpy(dst[c] + i * sampleSize,
+                       src + (i * channels + c) * sampleSize,
+                       sampleSize);
+
+        break;
+    }
+}
+
+void AudioKernels::copy(const quint8 *const *src,
+                        bool srcPlanar,
+                        quint8 *const *dst,
+                        bool dstPlanar,
+                        size_t channels,
+                        size_t samples,
+                        size_t sampleSize)
+{
+    if (channels < 2)
+        srcPlanar = dstPlanar = false;
+
+    if (srcPlanar == dstPlanar) {
+        auto planes = srcPlanar? channels: 1;
+        auto planeSize = samples * sampleSize * (srcPlanar? 1: channels);
+
+        for (size_t plane = 0; plane < planes; plane++)
+            memcpy(dst[plane], src[plane], planeSize);
+    } else if (srcPlanar) {
+        interleave(src, dst[0], channels, samples, sampleSize);
+    } else {
+        deinterleave(src[0], dst, channels, samples, sampleSize);
+    }
+}
+
+size_t AudioKernels::sampleSize(SampleFormat format)
+{
+    switch (format) {
+    case SampleFormat_u8:
+        return 1;
+    case SampleFormat_s16:
+        return 2;
+    case SampleFormat_s32:
+    case SampleFormat_flt:
+        return 4;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+bool AudioKernels::convert(const quint8 *src,
+                           SampleFormat srcFormat,
+                           quint8 *dst,
+                           SampleFormat dstFormat,
+                           size_t samples,
+                           Dither *dither)
+{
+    if (sampleSize(srcFormat) < 1 || sampleSize(dstFormat) < 1)
+        return false;
+
+    if (srcFormat == dstFormat) {
+        memcpy(dst, src, samples * sampleSize(srcFormat));
+
+        return true;
+    }
+
+    // Only add noise when the resolution is reduced.
+    auto ditherState =
+            dither && dstFormat < srcFormat?
+                dither->state:
+                nullptr;
+
+    // The most common conversions have their own kernels.
+    if (srcFormat == SampleFormat_flt && dstFormat == SampleFormat_s16) {
+        convertFltToS16(reinterpret_cast<const float *>(src),
+                        reinterpret_cast<qint16 *>(dst),
+                        samples,
+                        ditherState);
+    } else if (srcFormat == SampleFormat_s16 && dstFormat == SampleFormat_flt) {
+        convertS16ToFlt(reinterpret_cast<const qint16 *>(src),
+                        reinterpret_cast<float *>(dst),
+                        samples);
+    } else if (srcFormat == SampleFormat_flt && dstFormat == SampleFormat_s32) {
+        convertFltToS32(reinterpret_cast<const float *>(src),
+                        reinterpret_cast<qint32 *>(dst),
+                        samples);
+    } else if (srcFormat == SampleFormat_s32 && dstFormat == SampleFormat_flt) {
+        convertS32ToFlt(reinterpret_cast<const qint32 *>(src),
+                        reinterpret_cast<float *>(dst),
+                        samples);
+    } else {
+        for (size_t i = 0; i < samples; i++)
+            writeSample(dst,
+                        dstFormat,
+                        i,
+                        readSample(src, srcFormat, i),
+                        ditherState);
+    }
+
+    return true;
+}
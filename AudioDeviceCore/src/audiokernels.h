@@ -0,0 +1,88 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef AUDIOKERNELS_H
+#define AUDIOKERNELS_H
+
+#include <cstddef>
+#include <QtGlobal>
+
+/* Sample processing kernels shared by the audio device implementations.
+ *
+ * They don't depend on any audio API, so they can be built and profiled on any
+ * platform. SSE2 and NEON versions are used for the most common cases when
+ * available, everything else falls back to plain C++.
+ */
+class AudioKernels
+{
+    public:
+        enum SampleFormat
+        {
+            SampleFormat_none,
+            SampleFormat_u8,
+            SampleFormat_s16,
+            SampleFormat_s32,
+            SampleFormat_flt
+        };
+
+        // State of the dither noise generator, keep one for each stream.
+        struct Dither
+        {
+            quint32 state[4] {0x9e3779b9, 0x7f4a7c15, 0x6a09e667, 0xbb67ae85};
+        };
+
+        // Pack one plane per channel into interleaved frames.
+        static void interleave(const quint8 *const *src,
+                               quint8 *dst,
+                               size_t channels,
+                               size_t samples,
+                               size_t sampleSize);
+
+        // Split interleaved frames into one plane per channel.
+        static void deinterleave(const quint8 *src,
+                                 quint8 *const *dst,
+                                 size_t channels,
+                                 size_t samples,
+                                 size_t sampleSize);
+
+        // Copy samples between buffers converting the layout if required.
+        static void copy(const quint8 *const *src,
+                         bool srcPlanar,
+                         quint8 *const *dst,
+                         bool dstPlanar,
+                         size_t channels,
+                         size_t samples,
+                         size_t sampleSize);
+
+        static size_t sampleSize(SampleFormat format);
+
+        /* Convert samples from one format to another. The layout doesn't
+         * matter since every sample is converted independently. Triangular
+         * dither is added when the resolution is reduced and a dither state
+         * is given.
+         */
+        static bool convert(const quint8 *src,
+                            SampleFormat srcFormat,
+                            quint8 *dst,
+                            SampleFormat dstFormat,
+                            size_t samples,
+                            Dither *dither=nullptr);
+};
+
+#endif // AUDIOKERNELS_H
@@ -0,0 +1,379 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <cstring>
+
+#include "audiomonitor.h"
+#include "audioringbuffer.h"
+
+#define MAX_MONITOR_CHANNELS 64
+
+// No entry in the channel map.
+#define CHANNEL_DEFAULT (-2)
+
+class AudioMonitorPrivate
+{
+    public:
+        AudioRingBuffer m_ring;
+        QVector<float> m_inputBuffer;
+        QVector<float> m_mixBuffer;
+        QVector<float> m_planeBuffer;
+        AudioKernels::Dither m_dither;
+        std::atomic<float> m_gain {1.0f};
+        std::atomic<int> m_channelMap[MAX_MONITOR_CHANNELS];
+        std::atomic<quint64> m_underruns {0};
+        std::atomic<quint64> m_droppedFrames {0};
+        int m_inputChannels {0};
+        int m_outputChannels {0};
+        size_t m_outputPeriod {0};
+        size_t m_maxLatency {0};
+        size_t m_maxFrames {0};
+        bool m_primed {false};
+
+        AudioMonitorPrivate();
+        inline int inputChannel(int outputChannel) const;
+        void mix(const float *src, float *dst, size_t frames) const;
+        size_t render(quint8 *const *planes,
+                      bool planar,
+                      AudioKernels::SampleFormat format,
+                      size_t frames);
+};
+
+AudioMonitor::AudioMonitor()
+{
+    this->d = new AudioMonitorPrivate;
+}
+
+AudioMonitor::~AudioMonitor()
+{
+    delete this->d;
+}
+
+void AudioMonitor::configure(int inputChannels,
+                             int outputChannels,
+                             size_t inputPeriod,
+                             size_t outputPeriod,
+                             size_t maxFrames)
+{
+    this->d->m_inputChannels = qBound(0, inputChannels, MAX_MONITOR_CHANNELS);
+    this->d->m_outputChannels = qBound(0, outputChannels, MAX_MONITOR_CHANNELS);
+    this->d->m_outputPeriod = qMax<size_t>(outputPeriod, 1);
+    this->d->m_maxLatency = qMax<size_t>(inputPeriod, 1) + this->d->m_outputPeriod;
+    this->d->m_maxFrames = qMax(maxFrames, this->d->m_maxLatency);
+    this->d->m_primed = false;
+
+    // All the buffers are allocated here, the callbacks never allocate.
+    auto inputSamples = int(this->d->m_maxFrames) * this->d->m_inputChannels;
+    auto outputSamples = int(this->d->m_maxFrames) * this->d->m_outputChannels;
+    this->d->m_inputBuffer.resize(inputSamples);
+    this->d->m_mixBuffer.resize(outputSamples);
+    this->d->m_planeBuffer.resize(outputSamples);
+    this->d->m_ring.resize(sizeof(float) * size_t(this->d->m_inputChannels),
+                           2 * this->d->m_maxFrames + this->d->m_maxLatency);
+    this->d->m_underruns = 0;
+    this->d->m_droppedFrames = 0;
+}
+
+int AudioMonitor::inputChannels() const
+{
+    return this->d->m_inputChannels;
+}
+
+int AudioMonitor::outputChannels() const
+{
+    return this->d->m_outputChannels;
+}
+
+size_t AudioMonitor::maxLatency() const
+{
+    return this->d->m_maxLatency;
+}
+
+qreal AudioMonitor::gain() const
+{
+    return qreal(this->d->m_gain.load());
+}
+
+void AudioMonitor::setGain(qreal gain)
+{
+    this->d->m_gain = float(gain);
+}
+
+QVector<int> AudioMonitor::channelMap() const
+{
+    QVector<int> channelMap;
+
+    for (auto &channel: this->d->m_channelMap) {
+        auto inputChannel = channel.load();
+
+        if (inputChannel == CHANNEL_DEFAULT)
+            break;
+
+        channelMap << inputChannel;
+    }
+
+    return channelMap;
+}
+
+void AudioMonitor::setChannelMap(const QVector<int> &channelMap)
+{
+    for (int i = 0; i < MAX_MONITOR_CHANNELS; i++)
+        this->d->m_channelMap[i] =
+                i < channelMap.size()? qMax(channelMap[i], -1): CHANNEL_DEFAULT;
+}
+
+size_t AudioMonitor::write(const quint8 *const *planes,
+                           bool planar,
+                           AudioKernels::SampleFormat format,
+                           size_t frames)
+{
+    auto channels = size_t(this->d->m_inputChannels);
+
+    if (channels < 1)
+        return 0;
+
+    if (channels < 2)
+        planar = false;
+
+    frames = qMin(frames, this->d->m_maxFrames);
+
+    // Convert to float in the same layout.
+    auto nPlanes = planar? channels: 1;
+    auto planeSamples = planar? frames: frames * channels;
+    const quint8 *src[MAX_MONITOR_CHANNELS];
+
+    for (size_t plane = 0; plane < nPlanes; plane++) {
+        auto buffer = this->d->m_inputBuffer.data() + plane * planeSamples;
+        AudioKernels::convert(planes[plane],
+                              format,
+                              reinterpret_cast<quint8 *>(buffer),
+                              AudioKernels::SampleFormat_flt,
+                              planeSamples);
+        src[plane] = reinterpret_cast<const quint8 *>(buffer);
+    }
+
+    // And then interleave into the ring.
+    AudioRingBufferSegment segments[2];
+    auto written = this->d->m_ring.reserve(frames, segments);
+    auto frameSize = this->d->m_ring.frameSize();
+    size_t offset = 0;
+
+    for (auto &segment: segments) {
+        if (segment.frames < 1)
+            continue;
+
+        const quint8 *srcPlanes[MAX_MONITOR_CHANNELS];
+
+        for (size_t plane = 0; plane < nPlanes; plane++)
+            srcPlanes[plane] = src[plane]
+                               + offset
+                                 * sizeof(float)
+                                 * (planar? 1: channels);
+
+        auto dst = this->d->m_ring.plane(0) + segment.offset * frameSize;
+        AudioKernels::copy(srcPlanes,
+                           planar,
+                           &dst,
+                           false,
+                           channels,
+                           segment.frames,
+                           sizeof(float));
+        offset += segment.frames;
+    }
+
+    this->d->m_ring.commit(written);
+
+    if (written < frames)
+        this->d->m_droppedFrames.fetch_add(frames - written);
+
+    return written;
+}
+
+size_t AudioMonitor::render(quint8 *const *planes,
+                            bool planar,
+                            AudioKernels::SampleFormat format,
+                            size_t frames)
+{
+    auto channels = size_t(this->d->m_outputChannels);
+
+    if (channels < 1)
+        return 0;
+
+    if (channels < 2)
+        planar = false;
+
+    // The buffers hold up to maxFrames, render bigger requests in chunks.
+    auto nPlanes = planar? channels: 1;
+    auto frameSize = AudioKernels::sampleSize(format) * (planar? 1: channels);
+    quint8 *chunkPlanes[MAX_MONITOR_CHANNELS];
+    size_t read = 0;
+
+    for (size_t offset = 0; offset < frames;) {
+        auto chunk = qMin(frames - offset, this->d->m_maxFrames);
+
+        for (size_t plane = 0; plane < nPlanes; plane++)
+            chunkPlanes[plane] = planes[plane] + offset * frameSize;
+
+        read += this->d->render(chunkPlanes, planar, format, chunk);
+        offset += chunk;
+    }
+
+    return read;
+}
+
+quint64 AudioMonitor::underruns() const
+{
+    return this->d->m_underruns;
+}
+
+quint64 AudioMonitor::droppedFrames() const
+{
+    return this->d->m_droppedFrames;
+}
+
+void AudioMonitor::resetStats()
+{
+    this->d->m_underruns = 0;
+    this->d->m_droppedFrames = 0;
+}
+
+AudioMonitorPrivate::AudioMonitorPrivate()
+{
+    for (auto &channel: this->m_channelMap)
+        channel = CHANNEL_DEFAULT;
+}
+
+int AudioMonitorPrivate::inputChannel(int outputChannel) const
+{
+    if (this->m_inputChannels < 1)
+        return -1;
+
+    auto channel = this->m_channelMap[outputChannel].load(std::memory_order_relaxed);
+
+    if (channel == CHANNEL_DEFAULT)
+        return outputChannel % this->m_inputChannels;
+
+    return channel < this->m_inputChannels? channel: -1;
+}
+
+void AudioMonitorPrivate::mix(const float *src, float *dst, size_t frames) const
+{
+    auto gain = this->m_gain.load(std::memory_order_relaxed);
+    auto inputChannels = size_t(this->m_inputChannels);
+    auto outputChannels = size_t(this->m_outputChannels);
+    int map[MAX_MONITOR_CHANNELS];
+
+    for (size_t channel = 0; channel < outputChannels; channel++)
+        map[channel] = this->inputChannel(int(channel));
+
+    for (size_t frame = 0; frame < frames; frame++) {
+        for (size_t channel = 0; channel < outputChannels; channel++)
+            dst[channel] = map[channel] < 0? 0.0f: gain * src[map[channel]];
+
+        src += inputChannels;
+        dst += outputChannels;
+    }
+}
+
+size_t AudioMonitorPrivate::render(quint8 *const *planes,
+                                   bool planar,
+                                   AudioKernels::SampleFormat format,
+                                   size_t frames)
+{
+    auto channels = size_t(this->m_outputChannels);
+    auto &ring = this->m_ring;
+    auto available = ring.readAvailable();
+
+    // Keep the latency bounded, drop the oldest samples.
+    if (available > this->m_maxLatency) {
+        auto dropped = ring.discard(available - this->m_maxLatency);
+        this->m_droppedFrames.fetch_add(dropped);
+        available -= dropped;
+    }
+
+    /* Wait for a whole buffer before starting, and start again after an
+     * underrun, instead of playing many small fragments.
+     */
+    if (!this->m_primed && available >= qMin(frames, this->m_maxLatency))
+        this->m_primed = true;
+
+    auto mix = this->m_mixBuffer.data();
+    size_t read = 0;
+
+    if (this->m_primed) {
+        AudioRingBufferSegment segments[2];
+        read = ring.peek(frames, segments);
+
+        for (auto &segment: segments) {
+            if (segment.frames < 1)
+                continue;
+
+            auto src = reinterpret_cast<const float *>(ring.plane(0)
+                                                       + segment.offset
+                                                         * ring.frameSize());
+            this->mix(src, mix, segment.frames);
+            mix += segment.frames * channels;
+        }
+
+        ring.discard(read);
+
+        if (read < frames) {
+            this->m_underruns++;
+            this->m_primed = false;
+        }
+    }
+
+    memset(mix, 0, (frames - read) * channels * sizeof(float));
+
+    // Convert to the output layout and format.
+    auto mixBuffer = reinterpret_cast<const quint8 *>(this->m_mixBuffer.constData());
+
+    if (planar) {
+        quint8 *channelPlanes[MAX_MONITOR_CHANNELS];
+
+        for (size_t channel = 0; channel < channels; channel++)
+            channelPlanes[channel] =
+                    reinterpret_cast<quint8 *>(this->m_planeBuffer.data()
+                                               + channel * frames);
+
+        AudioKernels::deinterleave(mixBuffer,
+                                   channelPlanes,
+                                   channels,
+                                   frames,
+                                   sizeof(float));
+
+        for (size_t channel = 0; channel < channels; channel++)
+            AudioKernels::convert(channelPlanes[channel],
+                                  AudioKernels::SampleFormat_flt,
+                                  planes[channel],
+                                  format,
+                                  frames,
+                                  &this->m_dither);
+    } else {
+        AudioKernels::convert(mixBuffer,
+                              AudioKernels::SampleFormat_flt,
+                              planes[0],
+                              format,
+                              frames * channels,
+                              &this->m_dither);
+    }
+
+    return read;
+}
@@ -0,0 +1,94 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef AUDIOMONITOR_H
+#define AUDIOMONITOR_H
+
+#include <cstddef>
+#include <QVector>
+
+#include "audiokernels.h"
+
+class AudioMonitorPrivate;
+
+/* Routes the samples of a capture callback straight to a render callback.
+ *
+ * The samples are exchanged as float interleaved frames through a lock-free
+ * ring. The render side applies the gain and the channel map, and drops the
+ * oldest samples when the queue grows over the input and output periods,
+ * so the latency of the path stays bounded to two device periods.
+ *
+ * configure() must be called before the callbacks use the monitor, write()
+ * and render() are real-time safe, the gain and the channel map can be
+ * changed from any thread at any time.
+ */
+class AudioMonitor
+{
+    public:
+        AudioMonitor();
+        AudioMonitor(const AudioMonitor &other) = delete;
+        ~AudioMonitor();
+
+        AudioMonitor &operator =(const AudioMonitor &other) = delete;
+
+        // Periods and maximum callback size are in frames.
+        void configure(int inputChannels,
+                       int outputChannels,
+                       size_t inputPeriod,
+                       size_t outputPeriod,
+                       size_t maxFrames);
+        int inputChannels() const;
+        int outputChannels() const;
+
+        // Maximum number of frames queued between the two callbacks.
+        size_t maxLatency() const;
+
+        qreal gain() const;
+        void setGain(qreal gain);
+
+        /* The output channel i plays the input channel map[i], -1 mutes it.
+         * Channels without an entry play the input channel i modulo the
+         * number of input channels.
+         */
+        QVector<int> channelMap() const;
+        void setChannelMap(const QVector<int> &channelMap);
+
+        // Capture callback side.
+        size_t write(const quint8 *const *planes,
+                     bool planar,
+                     AudioKernels::SampleFormat format,
+                     size_t frames);
+
+        // Render callback side, always fills the whole buffer.
+        size_t render(quint8 *const *planes,
+                      bool planar,
+                      AudioKernels::SampleFormat format,
+                      size_t frames);
+
+        quint64 underruns() const;
+        quint64 droppedFrames() const;
+
+        // Can be called from any thread while the callbacks run.
+        void resetStats();
+
+    private:
+        AudioMonitorPrivate *d;
+};
+
+#endif // AUDIOMONITOR_H
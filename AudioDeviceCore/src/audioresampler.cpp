@@ -0,0 +1,131 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <cmath>
+#include <cstring>
+#include <QtGlobal>
+
+#include "audioresampler.h"
+
+#define HALF_TAPS 8
+#define TAPS      (2 * HALF_TAPS)
+#define PHASES    256
+
+// Cutoff frequency relative to the Nyquist frequency.
+#define CUTOFF 0.9
+
+class AudioResamplerTable
+{
+    public:
+        float m_taps[PHASES + 1][TAPS];
+
+        AudioResamplerTable();
+};
+
+Q_GLOBAL_STATIC(AudioResamplerTable, resamplerTable)
+
+size_t AudioResampler::history()
+{
+    return HALF_TAPS - 1;
+}
+
+size_t AudioResampler::lookahead()
+{
+    return HALF_TAPS;
+}
+
+size_t AudioResampler::process(const float *in,
+                               size_t inFrames,
+                               size_t channels,
+                               double *position,
+                               float *out,
+                               size_t outFrames,
+                               double ratio)
+{
+    auto &table = resamplerTable->m_taps;
+    auto pos = *position;
+    size_t frames = 0;
+    float taps[TAPS];
+
+    for (; frames < outFrames; frames++) {
+        auto index = size_t(pos);
+
+        if (index < HALF_TAPS - 1 || index + HALF_TAPS >= inFrames)
+            break;
+
+        // Interpolate the taps for this fractional position.
+        auto phase = (pos - double(index)) * PHASES;
+        auto phaseIndex = int(phase);
+        auto k = float(phase - phaseIndex);
+        auto taps0 = table[phaseIndex];
+        auto taps1 = table[phaseIndex + 1];
+
+        for (int i = 0; i < TAPS; i++)
+            taps[i] = taps0[i] + k * (taps1[i] - taps0[i]);
+
+        auto src = in + (index + 1 - HALF_TAPS) * channels;
+        auto dst = out + frames * channels;
+
+        for (size_t c = 0; c < channels; c++) {
+            float sample = 0.0f;
+
+            for (int i = 0; i < TAPS; i++)
+                sample += taps[i] * src[size_t(i) * channels + c];
+
+            dst[c] = sample;
+        }
+
+        pos += ratio;
+    }
+
+    *position = pos;
+
+    return frames;
+}
+
+AudioResamplerTable::AudioResamplerTable()
+{
+    for (int phase = 0; phase <= PHASES; phase++) {
+        auto frac = double(phase) / PHASES;
+        double sum = 0.0;
+
+        for (int i = 0; i < TAPS; i++) {
+            // Distance from the tap to the interpolated point.
+            auto x = double(i + 1 - HALF_TAPS) - frac;
+            auto sinc = qFuzzyIsNull(x)?
+                            1.0:
+                            std::sin(M_PI * CUTOFF * x) / (M_PI * CUTOFF * x);
+
+            // Blackman window.
+            auto w = 0.5 + 0.5 * (x / HALF_TAPS);
+            auto window = w <= 0.0 || w >= 1.0?
+                              0.0:
+                              0.42
+                              - 0.5 * std::cos(2.0 * M_PI * w)
+                              + 0.08 * std::cos(4.0 * M_PI * w);
+            auto tap = sinc * window;
+            this->m_taps[phase][i] = float(tap);
+            sum += tap;
+        }
+
+        // Unity gain at DC for every phase.
+        for (int i = 0; i < TAPS; i++)
+            this->m_taps[phase][i] = float(this->m_taps[phase][i] / sum);
+    }
+}
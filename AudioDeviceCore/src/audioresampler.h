@@ -0,0 +1,53 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef AUDIORESAMPLER_H
+#define AUDIORESAMPLER_H
+
+#include <cstddef>
+
+/* Variable ratio resampler for interleaved float samples.
+ *
+ * It uses a windowed sinc filter with a precomputed polyphase table, the taps
+ * for each output sample are linearly interpolated between the two nearest
+ * phases, so the ratio can change freely between calls. It's meant for small
+ * corrections like clock drift compensation, the cutoff frequency is fixed.
+ */
+class AudioResampler
+{
+    public:
+        // Frames of context needed before and after the read position.
+        static size_t history();
+        static size_t lookahead();
+
+        /* Writes up to outFrames resampled frames, starting at the fractional
+         * input frame given by position, and advancing ratio input frames per
+         * output frame. Returns the number of frames written, the position is
+         * updated to the next output frame.
+         */
+        static size_t process(const float *in,
+                              size_t inFrames,
+                              size_t channels,
+                              double *position,
+                              float *out,
+                              size_t outFrames,
+                              double ratio);
+};
+
+#endif // AUDIORESAMPLER_H
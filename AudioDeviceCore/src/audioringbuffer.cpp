@@ -0,0 +1,508 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <cstring>
+#include <QByteArray>
+#include <QDeadlineTimer>
+
+#ifdef Q_OS_LINUX
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(Q_OS_MACOS)
+#include <cstdint>
+#include <dispatch/dispatch.h>
+
+#if __has_include(<os/os_sync_wait_on_address.h>)
+#include <os/clock.h>
+#include <os/os_sync_wait_on_address.h>
+#define HAVE_OS_SYNC_WAIT_ON_ADDRESS
+#endif
+#else
+#include <QMutex>
+#include <QWaitCondition>
+#endif
+
+#include "audioringbuffer.h"
+
+/* Waits are synchronized through an event counter instead of a mutex.
+ *
+ * A waiter registers itself, reads the counter, checks the buffer, and then
+ * sleeps only while the counter keeps its value. After moving a position, the
+ * other side bumps the counter and wakes the sleepers, but only if someone is
+ * registered. Sleeping and waking are single system calls on the address of
+ * the counter, a futex on Linux and os_sync_wait_on_address() on macOS 14.4
+ * and later. Older macOS versions sleep on a dispatch semaphore instead, that
+ * the real-time side only signals. The real-time side never takes a lock, and
+ * no wake up can be lost.
+ */
+
+class AudioRingBufferPrivate
+{
+    public:
+        QByteArray m_buffer;
+        quint8 *m_data {nullptr};
+        size_t m_frameSize {0};
+        size_t m_planes {0};
+        size_t m_capacity {0};
+        size_t m_mask {0};
+        alignas(64) std::atomic<size_t> m_readPos {0};
+        alignas(64) std::atomic<size_t> m_writePos {0};
+        alignas(64) std::atomic<quint32> m_epoch {0};
+        std::atomic<int> m_waiters {0};
+        std::atomic<bool> m_aborted {false};
+
+#ifdef Q_OS_MACOS
+        dispatch_semaphore_t m_semaphore {dispatch_semaphore_create(0)};
+        bool m_waitOnAddress {false};
+#elif !defined(Q_OS_LINUX)
+        // There is no lock-free wake up here, used just for testing.
+        QMutex m_mutex;
+        QWaitCondition m_changed;
+#endif
+
+        AudioRingBufferPrivate();
+        ~AudioRingBufferPrivate();
+
+        inline size_t used() const;
+        inline size_t segments(size_t position,
+                               size_t frames,
+                               AudioRingBufferSegment segments[2]) const;
+        inline void wake();
+        inline void wakeAll();
+        inline void notify(int waiters);
+        void sleep(quint32 epoch, qint64 timeout);
+        bool wait(size_t frames, int timeout, bool forData);
+};
+
+AudioRingBufferPrivate::AudioRingBufferPrivate()
+{
+#if defined(Q_OS_MACOS) && defined(HAVE_OS_SYNC_WAIT_ON_ADDRESS)
+    if (__builtin_available(macOS 14.4, *))
+        this->m_waitOnAddress = true;
+#endif
+}
+
+AudioRingBufferPrivate::~AudioRingBufferPrivate()
+{
+#ifdef Q_OS_MACOS
+    dispatch_release(this->m_semaphore);
+#endif
+}
+
+AudioRingBuffer::AudioRingBuffer()
+{
+    this->d = new AudioRingBufferPrivate;
+}
+
+AudioRingBuffer::~AudioRingBuffer()
+{
+    this->abort();
+    delete this->d;
+}
+
+size_t AudioRingBuffer::frameSize() const
+{
+    return this->d->m_frameSize;
+}
+
+size_t AudioRingBuffer::planes() const
+{
+    return this->d->m_planes;
+}
+
+size_t AudioRingBuffer::capacity() const
+{
+    return this->d->m_capacity;
+}
+
+quint8 *AudioRingBuffer::plane(size_t plane) const
+{
+    return this->d->m_data + plane * this->d->m_capacity * this->d->m_frameSize;
+}
+
+void AudioRingBuffer::resize(size_t frameSize, size_t minFrames, size_t planes)
+{
+    size_t capacity = 0;
+
+    if (frameSize > 0 && minFrames > 0 && planes > 0) {
+        capacity = 1;
+
+        while (capacity < minFrames)
+            capacity <<= 1;
+    } else {
+        planes = 0;
+    }
+
+    this->d->m_frameSize = frameSize;
+    this->d->m_planes = planes;
+    this->d->m_capacity = capacity;
+    this->d->m_mask = capacity > 0? capacity - 1: 0;
+    this->d->m_buffer = QByteArray(qsizetype(planes * capacity * frameSize),
+                                   Qt::Uninitialized);
+    this->d->m_data = reinterpret_cast<quint8 *>(this->d->m_buffer.data());
+    this->clear();
+}
+
+void AudioRingBuffer::clear()
+{
+    this->d->m_readPos = 0;
+    this->d->m_writePos = 0;
+    this->d->m_aborted = false;
+}
+
+size_t AudioRingBuffer::readPosition() const
+{
+    return this->d->m_readPos.load(std::memory_order_acquire);
+}
+
+size_t AudioRingBuffer::writePosition() const
+{
+    return this->d->m_writePos.load(std::memory_order_acquire);
+}
+
+size_t AudioRingBuffer::readAvailable() const
+{
+    return this->d->used();
+}
+
+size_t AudioRingBuffer::read(void *data, size_t frames)
+{
+    return this->read(&data, frames);
+}
+
+size_t AudioRingBuffer::read(void *const *planes, size_t frames)
+{
+    AudioRingBufferSegment segments[2];
+    frames = this->peek(frames, segments);
+
+    if (frames < 1)
+        return 0;
+
+    auto fs = this->d->m_frameSize;
+
+    for (size_t plane = 0; plane < this->d->m_planes; plane++) {
+        auto src = this->plane(plane);
+        auto dst = static_cast<quint8 *>(planes[plane]);
+
+        for (auto &segment: segments) {
+            memcpy(dst, src + segment.offset * fs, segment.frames * fs);
+            dst += segment.frames * fs;
+        }
+    }
+
+    this->discard(frames);
+
+    return frames;
+}
+
+size_t AudioRingBuffer::peek(size_t frames,
+                             AudioRingBufferSegment segments[2]) const
+{
+    auto readPos = this->d->m_readPos.load(std::memory_order_relaxed);
+    auto writePos = this->d->m_writePos.load(std::memory_order_acquire);
+
+    return this->d->segments(readPos,
+                             qMin(frames, writePos - readPos),
+                             segments);
+}
+
+size_t AudioRingBuffer::discard(size_t frames)
+{
+    auto readPos = this->d->m_readPos.load(std::memory_order_relaxed);
+    auto writePos = this->d->m_writePos.load(std::memory_order_acquire);
+    frames = qMin(frames, writePos - readPos);
+
+    if (frames < 1)
+        return 0;
+
+    this->d->m_readPos.store(readPos + frames, std::memory_order_release);
+    this->d->wake();
+
+    return frames;
+}
+
+bool AudioRingBuffer::waitForData(size_t frames, int timeout)
+{
+    return this->d->wait(frames, timeout, true);
+}
+
+size_t AudioRingBuffer::writeAvailable() const
+{
+    return this->d->m_capacity - this->d->used();
+}
+
+size_t AudioRingBuffer::write(const void *data, size_t frames)
+{
+    return this->write(&data, frames);
+}
+
+size_t AudioRingBuffer::write(const void *const *planes, size_t frames)
+{
+    AudioRingBufferSegment segments[2];
+    frames = this->reserve(frames, segments);
+
+    if (frames < 1)
+        return 0;
+
+    auto fs = this->d->m_frameSize;
+
+    for (size_t plane = 0; plane < this->d->m_planes; plane++) {
+        auto src = static_cast<const quint8 *>(planes[plane]);
+        auto dst = this->plane(plane);
+
+        for (auto &segment: segments) {
+            memcpy(dst + segment.offset * fs, src, segment.frames * fs);
+            src += segment.frames * fs;
+        }
+    }
+
+    this->commit(frames);
+
+    return frames;
+}
+
+size_t AudioRingBuffer::reserve(size_t frames,
+                                AudioRingBufferSegment segments[2]) const
+{
+    auto writePos = this->d->m_writePos.load(std::memory_order_relaxed);
+    auto readPos = this->d->m_readPos.load(std::memory_order_acquire);
+
+    return this->d->segments(writePos,
+                             qMin(frames,
+                                  this->d->m_capacity - (writePos - readPos)),
+                             segments);
+}
+
+void AudioRingBuffer::commit(size_t frames)
+{
+    if (frames < 1)
+        return;
+
+    auto writePos = this->d->m_writePos.load(std::memory_order_relaxed);
+    this->d->m_writePos.store(writePos + frames, std::memory_order_release);
+    this->d->wake();
+}
+
+bool AudioRingBuffer::waitForSpace(size_t frames, int timeout)
+{
+    return this->d->wait(frames, timeout, false);
+}
+
+void AudioRingBuffer::abort()
+{
+    this->d->m_aborted = true;
+    this->d->wakeAll();
+}
+
+size_t AudioRingBufferPrivate::used() const
+{
+    auto writePos = this->m_writePos.load(std::memory_order_acquire);
+    auto readPos = this->m_readPos.load(std::memory_order_acquire);
+
+    return writePos - readPos;
+}
+
+size_t AudioRingBufferPrivate::segments(size_t position,
+                                        size_t frames,
+                                        AudioRingBufferSegment segments[2]) const
+{
+    auto offset = position & this->m_mask;
+    auto firstPart = qMin(frames, this->m_capacity - offset);
+    segments[0] = {offset, firstPart};
+    segments[1] = {0, frames - firstPart};
+
+    return frames;
+}
+
+void AudioRingBufferPrivate::wake()
+{
+    // Pairs with the fence in wait(), the position must be visible before
+    // checking if the other side is sleeping.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto waiters = this->m_waiters.load(std::memory_order_relaxed);
+
+    if (waiters > 0) {
+        this->m_epoch.fetch_add(1, std::memory_order_release);
+        this->notify(waiters);
+    }
+}
+
+void AudioRingBufferPrivate::wakeAll()
+{
+    this->m_epoch.fetch_add(1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    this->notify(this->m_waiters.load(std::memory_order_relaxed));
+}
+
+void AudioRingBufferPrivate::notify(int waiters)
+{
+    // Usually there is only the non real-time side waiting, wake just one.
+#ifdef Q_OS_LINUX
+    syscall(SYS_futex,
+            &this->m_epoch,
+            FUTEX_WAKE_PRIVATE,
+            waiters > 1? INT_MAX: 1,
+            nullptr,
+            nullptr,
+            0);
+#elif defined(Q_OS_MACOS)
+#ifdef HAVE_OS_SYNC_WAIT_ON_ADDRESS
+    if (this->m_waitOnAddress) {
+        if (__builtin_available(macOS 14.4, *)) {
+            if (waiters > 1)
+                os_sync_wake_by_address_all(&this->m_epoch,
+                                            sizeof(quint32),
+                                            OS_SYNC_WAKE_BY_ADDRESS_NONE);
+            else
+                os_sync_wake_by_address_any(&this->m_epoch,
+                                            sizeof(quint32),
+                                            OS_SYNC_WAKE_BY_ADDRESS_NONE);
+        }
+
+        return;
+    }
+#endif
+
+    for (int i = 0; i < waiters; i++)
+        dispatch_semaphore_signal(this->m_semaphore);
+#else
+    Q_UNUSED(waiters)
+    this->m_mutex.lock();
+    this->m_changed.wakeAll();
+    this->m_mutex.unlock();
+#endif
+}
+
+void AudioRingBufferPrivate::sleep(quint32 epoch, qint64 timeout)
+{
+    // Returns when the counter changes, on time out, or spuriously.
+#ifdef Q_OS_LINUX
+    timespec ts;
+    ts.tv_sec = time_t(timeout / 1000);
+    ts.tv_nsec = long(timeout % 1000) * 1000000;
+    syscall(SYS_futex,
+            &this->m_epoch,
+            FUTEX_WAIT_PRIVATE,
+            epoch,
+            timeout < 0? nullptr: &ts,
+            nullptr,
+            0);
+#elif defined(Q_OS_MACOS)
+#ifdef HAVE_OS_SYNC_WAIT_ON_ADDRESS
+    if (this->m_waitOnAddress) {
+        if (__builtin_available(macOS 14.4, *)) {
+            if (timeout < 0)
+                os_sync_wait_on_address(&this->m_epoch,
+                                        epoch,
+                                        sizeof(quint32),
+                                        OS_SYNC_WAIT_ON_ADDRESS_NONE);
+            else
+                os_sync_wait_on_address_with_timeout(&this->m_epoch,
+                                                     epoch,
+                                                     sizeof(quint32),
+                                                     OS_SYNC_WAIT_ON_ADDRESS_NONE,
+                                                     OS_CLOCK_MACH_ABSOLUTE_TIME,
+                                                     quint64(qMax<qint64>(1, timeout))
+                                                     * 1000000);
+        }
+
+        return;
+    }
+#endif
+
+    /* The semaphore keeps the signals sent since the waiter registered, so
+     * none is lost. A signal left over by a waiter that didn't sleep only
+     * causes a spurious wake up, the caller checks the buffer again anyway.
+     */
+    if (this->m_epoch.load(std::memory_order_acquire) != epoch)
+        return;
+
+    dispatch_semaphore_wait(this->m_semaphore,
+                            timeout < 0?
+                                DISPATCH_TIME_FOREVER:
+                                dispatch_time(DISPATCH_TIME_NOW,
+                                              timeout * NSEC_PER_MSEC));
+#else
+    QMutexLocker mutexLocker(&this->m_mutex);
+
+    if (this->m_epoch.load() == epoch)
+        this->m_changed.wait(&this->m_mutex,
+                             timeout < 0?
+                                 QDeadlineTimer(QDeadlineTimer::Forever):
+                                 QDeadlineTimer(timeout));
+#endif
+}
+
+bool AudioRingBufferPrivate::wait(size_t frames, int timeout, bool forData)
+{
+    frames = qMin(frames, this->m_capacity);
+
+    auto ready = [this, frames, forData] () {
+        auto used = this->used();
+
+        return forData?
+                   used >= frames:
+                   this->m_capacity - used >= frames;
+    };
+
+    if (ready())
+        return true;
+
+    QDeadlineTimer deadline(timeout < 0?
+                                QDeadlineTimer(QDeadlineTimer::Forever):
+                                QDeadlineTimer(timeout));
+
+    forever {
+        if (this->m_aborted)
+            return false;
+
+        // Register before reading the counter and checking the buffer, so
+        // the other side either sees us or we see its changes.
+        this->m_waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto epoch = this->m_epoch.load(std::memory_order_acquire);
+
+        if (ready() || this->m_aborted) {
+            this->m_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+            return !this->m_aborted;
+        }
+
+        auto remainingTime = deadline.remainingTime();
+
+        if (remainingTime == 0) {
+            this->m_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+            return false;
+        }
+
+        this->sleep(epoch, remainingTime);
+        this->m_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+        if (ready())
+            return true;
+
+        if (deadline.hasExpired())
+            return false;
+    }
+}
@@ -0,0 +1,88 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef AUDIORINGBUFFER_H
+#define AUDIORINGBUFFER_H
+
+#include <cstddef>
+#include <QtGlobal>
+
+class AudioRingBufferPrivate;
+
+struct AudioRingBufferSegment
+{
+    size_t offset; // In frames from the start of the plane.
+    size_t frames;
+};
+
+/* Single producer, single consumer lock-free ring buffer of audio frames.
+ *
+ * read(), write() and the availability functions never lock nor allocate, so
+ * they are safe to call from a real-time audio callback. If the other side is
+ * sleeping in a wait function, it's woken with a single system call, without
+ * taking any lock. The capacity is always a power of two. Only the wait
+ * functions can block, they must be called from the non real-time side.
+ *
+ * Planar audio is stored in one plane per channel, all planes share the same
+ * read and write positions.
+ */
+class AudioRingBuffer
+{
+    public:
+        AudioRingBuffer();
+        AudioRingBuffer(const AudioRingBuffer &other) = delete;
+        ~AudioRingBuffer();
+
+        AudioRingBuffer &operator =(const AudioRingBuffer &other) = delete;
+
+        size_t frameSize() const;
+        size_t planes() const;
+        size_t capacity() const;
+        quint8 *plane(size_t plane) const;
+        void resize(size_t frameSize, size_t minFrames, size_t planes=1);
+        void clear();
+
+        // Frames read and written since the last clear().
+        size_t readPosition() const;
+        size_t writePosition() const;
+
+        // Consumer side.
+        size_t readAvailable() const;
+        size_t read(void *data, size_t frames);
+        size_t read(void *const *planes, size_t frames);
+        size_t peek(size_t frames, AudioRingBufferSegment segments[2]) const;
+        size_t discard(size_t frames);
+        bool waitForData(size_t frames, int timeout=-1);
+
+        // Producer side.
+        size_t writeAvailable() const;
+        size_t write(const void *data, size_t frames);
+        size_t write(const void *const *planes, size_t frames);
+        size_t reserve(size_t frames, AudioRingBufferSegment segments[2]) const;
+        void commit(size_t frames);
+        bool waitForSpace(size_t frames, int timeout=-1);
+
+        // Wake up and cancel all waits until clear() is called.
+        void abort();
+
+    private:
+        AudioRingBufferPrivate *d;
+};
+
+#endif // AUDIORINGBUFFER_H
@@ -0,0 +1,218 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <QVariantList>
+
+#include "audiostats.h"
+
+// Time histograms use power of two buckets in microseconds, up to ~1 s.
+#define TIME_BUCKETS 21
+
+// Fill level histogram in 10% steps.
+#define FILL_BUCKETS 11
+
+using AudioCounter = std::atomic<quint64>;
+
+class AudioStatsPrivate
+{
+    public:
+        std::atomic<quint64> m_period {0};
+        std::atomic<bool> m_resetRequested {false};
+
+        // Only written by the real-time thread.
+        AudioCounter m_callbacks {0};
+        AudioCounter m_overruns {0};
+        AudioCounter m_overrunSamples {0};
+        AudioCounter m_underruns {0};
+        AudioCounter m_underrunSamples {0};
+        AudioCounter m_maxJitter {0};
+        AudioCounter m_maxExecutionTime {0};
+        AudioCounter m_lastFill {0};
+        AudioCounter m_jitter[TIME_BUCKETS];
+        AudioCounter m_executionTime[TIME_BUCKETS];
+        AudioCounter m_fill[FILL_BUCKETS];
+        quint64 m_lastStart {0};
+        quint64 m_start {0};
+
+        AudioStatsPrivate();
+        inline static void add(AudioCounter &counter, quint64 value=1);
+        inline static void max(AudioCounter &counter, quint64 value);
+        inline static int timeBucket(quint64 time);
+        void clear();
+        static QVariantList histogram(const AudioCounter *counters,
+                                      int size);
+};
+
+AudioStats::AudioStats()
+{
+    this->d = new AudioStatsPrivate;
+}
+
+AudioStats::~AudioStats()
+{
+    delete this->d;
+}
+
+void AudioStats::setPeriod(quint64 period)
+{
+    this->d->m_period = period;
+}
+
+void AudioStats::callbackStarted(quint64 time)
+{
+    if (this->d->m_resetRequested.exchange(false))
+        this->d->clear();
+
+    this->d->add(this->d->m_callbacks);
+
+    if (this->d->m_lastStart > 0 && time > this->d->m_lastStart) {
+        auto interval = time - this->d->m_lastStart;
+        auto period = this->d->m_period.load(std::memory_order_relaxed);
+        auto jitter = interval > period? interval - period: period - interval;
+        this->d->add(this->d->m_jitter[this->d->timeBucket(jitter)]);
+        this->d->max(this->d->m_maxJitter, jitter);
+    }
+
+    this->d->m_lastStart = time;
+    this->d->m_start = time;
+}
+
+void AudioStats::callbackFinished(quint64 time, size_t fill, size_t capacity)
+{
+    if (time >= this->d->m_start) {
+        auto executionTime = time - this->d->m_start;
+        this->d->add(this->d->m_executionTime[this->d->timeBucket(executionTime)]);
+        this->d->max(this->d->m_maxExecutionTime, executionTime);
+    }
+
+    if (capacity > 0) {
+        auto level = qMin<quint64>(100 * fill / capacity, 100);
+        this->d->m_lastFill.store(level, std::memory_order_relaxed);
+        this->d->add(this->d->m_fill[level / 10]);
+    }
+}
+
+void AudioStats::overrun(size_t samples)
+{
+    this->d->add(this->d->m_overruns);
+    this->d->add(this->d->m_overrunSamples, samples);
+}
+
+void AudioStats::underrun(size_t samples)
+{
+    this->d->add(this->d->m_underruns);
+    this->d->add(this->d->m_underrunSamples, samples);
+}
+
+QVariantMap AudioStats::toMap() const
+{
+    auto load = [] (const AudioCounter &counter) {
+        return counter.load(std::memory_order_relaxed);
+    };
+
+    return QVariantMap {
+        {"callbacks", load(this->d->m_callbacks)},
+        {"overruns", load(this->d->m_overruns)},
+        {"overrunSamples", load(this->d->m_overrunSamples)},
+        {"underruns", load(this->d->m_underruns)},
+        {"underrunSamples", load(this->d->m_underrunSamples)},
+        {"maxJitter", load(this->d->m_maxJitter)},
+        {"maxExecutionTime", load(this->d->m_maxExecutionTime)},
+        {"fill", load(this->d->m_lastFill)},
+        {"jitter", this->d->histogram(this->d->m_jitter, TIME_BUCKETS)},
+        {"executionTime", this->d->histogram(this->d->m_executionTime, TIME_BUCKETS)},
+        {"fillLevel", this->d->histogram(this->d->m_fill, FILL_BUCKETS)},
+    };
+}
+
+void AudioStats::reset()
+{
+    // The counters are cleared by the writer, so it stays the only one
+    // touching them.
+    this->d->m_resetRequested = true;
+}
+
+AudioStatsPrivate::AudioStatsPrivate()
+{
+    this->clear();
+}
+
+void AudioStatsPrivate::add(AudioCounter &counter, quint64 value)
+{
+    // There is a single writer, so a plain store is enough and avoids a
+    // locked read-modify-write.
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+}
+
+void AudioStatsPrivate::max(AudioCounter &counter, quint64 value)
+{
+    if (value > counter.load(std::memory_order_relaxed))
+        counter.store(value, std::memory_order_relaxed);
+}
+
+int AudioStatsPrivate::timeBucket(quint64 time)
+{
+    auto us = time / 1000;
+    int bucket = 0;
+
+    while (us > 0 && bucket < TIME_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+void AudioStatsPrivate::clear()
+{
+    for (auto counter: {&this->m_callbacks,
+                        &this->m_overruns,
+                        &this->m_overrunSamples,
+                        &this->m_underruns,
+                        &this->m_underrunSamples,
+                        &this->m_maxJitter,
+                        &this->m_maxExecutionTime,
+                        &this->m_lastFill})
+        counter->store(0, std::memory_order_relaxed);
+
+    for (auto &counter: this->m_jitter)
+        counter.store(0, std::memory_order_relaxed);
+
+    for (auto &counter: this->m_executionTime)
+        counter.store(0, std::memory_order_relaxed);
+
+    for (auto &counter: this->m_fill)
+        counter.store(0, std::memory_order_relaxed);
+
+    this->m_lastStart = 0;
+    this->m_start = 0;
+}
+
+QVariantList AudioStatsPrivate::histogram(const AudioCounter *counters,
+                                          int size)
+{
+    QVariantList histogram;
+
+    for (int i = 0; i < size; i++)
+        histogram << counters[i].load(std::memory_order_relaxed);
+
+    return histogram;
+}
@@ -0,0 +1,60 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef AUDIOSTATS_H
+#define AUDIOSTATS_H
+
+#include <cstddef>
+#include <QVariantMap>
+
+class AudioStatsPrivate;
+
+/* Real-time safe statistics of an audio stream.
+ *
+ * All the record functions are wait-free and must be called from a single
+ * thread, the audio callback. toMap() and reset() can be called from any
+ * other thread.
+ */
+class AudioStats
+{
+    public:
+        AudioStats();
+        AudioStats(const AudioStats &other) = delete;
+        ~AudioStats();
+
+        AudioStats &operator =(const AudioStats &other) = delete;
+
+        // Expected time between callbacks, in nanoseconds.
+        void setPeriod(quint64 period);
+
+        // Real-time side.
+        void callbackStarted(quint64 time);
+        void callbackFinished(quint64 time, size_t fill, size_t capacity);
+        void overrun(size_t samples);
+        void underrun(size_t samples);
+
+        // Reader side.
+        QVariantMap toMap() const;
+        void reset();
+
+    private:
+        AudioStatsPrivate *d;
+};
+
+#endif // AUDIOSTATS_H
@@ -0,0 +1,392 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <cmath>
+#include <cstring>
+
+#include "audiostreamaligner.h"
+#include "audiodriftestimator.h"
+#include "audioresampler.h"
+
+// Timestamps farther than this from the expected ones are discontinuities.
+#define RESYNC_THRESHOLD 20000000
+
+// Gains of the alignment control loop, the error is in seconds.
+#define ALIGN_KP 2.0
+#define ALIGN_KI 1.0
+
+// Maximum correction applied to the resampling ratio.
+#define MAX_CORRECTION 0.005
+
+struct AudioAlignedStream
+{
+    int channels {0};
+    int offset {0};
+    QVector<float> fifo;
+    AudioDriftEstimator drift;
+
+    // Host time and fifo index of the first frame of the last push.
+    qint64 lastTime {0};
+    qint64 lastIndex {0};
+
+    double position {0.0};
+    double ratio {1.0};
+    double baseRatio {0.0};
+    double integral {0.0};
+    bool started {false};
+    bool aligned {false};
+
+    inline size_t frames() const
+    {
+        return size_t(this->fifo.size()) / size_t(this->channels);
+    }
+
+    inline qint64 time(double index) const
+    {
+        return this->lastTime
+               + qint64((index - double(this->lastIndex))
+                        * 1e9 / this->drift.rate());
+    }
+
+    inline double index(qint64 time) const
+    {
+        return double(this->lastIndex)
+               + double(time - this->lastTime) * this->drift.rate() / 1e9;
+    }
+};
+
+class AudioStreamAlignerPrivate
+{
+    public:
+        QVector<AudioAlignedStream> m_streams;
+        QVector<float> m_buffer;
+        int m_channels {0};
+        int m_rate {0};
+        size_t m_maxDelay {0};
+
+        size_t producible(const AudioAlignedStream &stream) const;
+        bool align(AudioAlignedStream &stream, qint64 time);
+        void drop(AudioAlignedStream &stream, size_t frames);
+        void updateRatio(AudioAlignedStream &stream,
+                         qreal referenceRate,
+                         qint64 time,
+                         size_t frames);
+};
+
+AudioStreamAligner::AudioStreamAligner()
+{
+    this->d = new AudioStreamAlignerPrivate;
+}
+
+AudioStreamAligner::~AudioStreamAligner()
+{
+    delete this->d;
+}
+
+void AudioStreamAligner::configure(const QVector<int> &channels,
+                                   int rate,
+                                   size_t maxDelay)
+{
+    this->d->m_streams.clear();
+    this->d->m_channels = 0;
+    this->d->m_rate = rate;
+    this->d->m_maxDelay = maxDelay;
+
+    for (auto &nChannels: channels) {
+        AudioAlignedStream stream;
+        stream.channels = qMax(nChannels, 1);
+        stream.offset = this->d->m_channels;
+        stream.drift.setNominalRate(rate);
+        this->d->m_streams << stream;
+        this->d->m_channels += stream.channels;
+    }
+}
+
+int AudioStreamAligner::streams() const
+{
+    return this->d->m_streams.size();
+}
+
+int AudioStreamAligner::channels() const
+{
+    return this->d->m_channels;
+}
+
+void AudioStreamAligner::push(int stream,
+                              const float *samples,
+                              size_t frames,
+                              qint64 hostTime,
+                              quint64 position)
+{
+    if (stream < 0 || stream >= this->d->m_streams.size() || frames < 1)
+        return;
+
+    auto &alignedStream = this->d->m_streams[stream];
+    auto index = qint64(alignedStream.frames());
+
+    if (alignedStream.started) {
+        auto expected = alignedStream.time(double(index));
+
+        if (qAbs(hostTime - expected) > RESYNC_THRESHOLD) {
+            alignedStream.drift.reset();
+
+            if (stream == 0) {
+                // The timeline of the reference jumped, realign everything.
+                for (int i = 1; i < this->d->m_streams.size(); i++)
+                    this->d->m_streams[i].aligned = false;
+            } else {
+                alignedStream.aligned = false;
+            }
+        }
+    }
+
+    alignedStream.drift.addPoint(hostTime, position);
+    alignedStream.lastTime = hostTime;
+    alignedStream.lastIndex = index;
+    alignedStream.started = true;
+
+    auto size = alignedStream.fifo.size();
+    auto nSamples = int(frames) * alignedStream.channels;
+    alignedStream.fifo.resize(size + nSamples);
+    memcpy(alignedStream.fifo.data() + size,
+           samples,
+           size_t(nSamples) * sizeof(float));
+}
+
+size_t AudioStreamAligner::available() const
+{
+    if (this->d->m_streams.isEmpty())
+        return 0;
+
+    auto available = this->d->m_streams[0].frames();
+
+    if (available > this->d->m_maxDelay)
+        return available;
+
+    for (int i = 1; i < this->d->m_streams.size(); i++)
+        available = qMin(available,
+                         this->d->producible(this->d->m_streams[i]));
+
+    return available;
+}
+
+size_t AudioStreamAligner::pull(float *out, size_t frames, qint64 *hostTime)
+{
+    if (this->d->m_streams.isEmpty())
+        return 0;
+
+    auto &reference = this->d->m_streams[0];
+    frames = qMin(frames, reference.frames());
+
+    if (frames < 1)
+        return 0;
+
+    auto time = reference.time(0.0);
+    auto referenceRate = reference.drift.rate();
+    auto outChannels = size_t(this->d->m_channels);
+
+    if (hostTime)
+        *hostTime = time;
+
+    for (auto &stream: this->d->m_streams) {
+        auto channels = size_t(stream.channels);
+        const float *src = nullptr;
+        size_t nFrames = 0;
+
+        if (&stream == &reference) {
+            src = reference.fifo.constData();
+            nFrames = frames;
+        } else if (stream.aligned || this->d->align(stream, time)) {
+            this->d->updateRatio(stream, referenceRate, time, frames);
+
+            if (stream.aligned) {
+                auto nSamples = int(frames * channels);
+
+                if (this->d->m_buffer.size() < nSamples)
+                    this->d->m_buffer.resize(nSamples);
+
+                nFrames = AudioResampler::process(stream.fifo.constData(),
+                                                  stream.frames(),
+                                                  channels,
+                                                  &stream.position,
+                                                  this->d->m_buffer.data(),
+                                                  frames,
+                                                  stream.ratio);
+                src = this->d->m_buffer.constData();
+            }
+        }
+
+        auto dst = out + stream.offset;
+
+        for (size_t frame = 0; frame < nFrames; frame++) {
+            memcpy(dst, src, channels * sizeof(float));
+            src += channels;
+            dst += outChannels;
+        }
+
+        if (nFrames < frames) {
+            // The stream is late, fill with silence and realign it later.
+            for (size_t frame = nFrames; frame < frames; frame++) {
+                memset(dst, 0, channels * sizeof(float));
+                dst += outChannels;
+            }
+
+            stream.aligned = false;
+        }
+
+        if (&stream == &reference) {
+            this->d->drop(stream, frames);
+        } else if (stream.aligned) {
+            auto history = AudioResampler::history();
+            auto index = size_t(stream.position);
+
+            if (index > history) {
+                this->d->drop(stream, index - history);
+                stream.position -= double(index - history);
+            }
+        }
+    }
+
+    return frames;
+}
+
+qreal AudioStreamAligner::rate(int stream) const
+{
+    if (stream < 0 || stream >= this->d->m_streams.size())
+        return 0.0;
+
+    return this->d->m_streams[stream].drift.rate();
+}
+
+void AudioStreamAligner::reset()
+{
+    for (auto &stream: this->d->m_streams) {
+        stream.fifo.clear();
+        stream.drift.reset();
+        stream.lastTime = 0;
+        stream.lastIndex = 0;
+        stream.position = 0.0;
+        stream.ratio = 1.0;
+        stream.baseRatio = 0.0;
+        stream.integral = 0.0;
+        stream.started = false;
+        stream.aligned = false;
+    }
+}
+
+size_t AudioStreamAlignerPrivate::producible(const AudioAlignedStream &stream) const
+{
+    if (!stream.started)
+        return 0;
+
+    auto history = double(AudioResampler::history());
+    auto lookahead = double(AudioResampler::lookahead());
+    auto position = stream.position;
+
+    if (!stream.aligned) {
+        auto &reference = this->m_streams[0];
+        position = qMax(stream.index(reference.time(0.0)), history);
+    }
+
+    auto last = double(stream.frames()) - lookahead - 1.0;
+
+    if (last < position)
+        return 0;
+
+    return size_t((last - position) / stream.ratio) + 1;
+}
+
+bool AudioStreamAlignerPrivate::align(AudioAlignedStream &stream, qint64 time)
+{
+    if (!stream.started)
+        return false;
+
+    auto history = AudioResampler::history();
+    auto position = stream.index(time);
+
+    if (position < double(history)) {
+        // The stream started after the reference, prepend silence.
+        auto pad = size_t(std::ceil(double(history) - position));
+        stream.fifo.insert(0, int(pad) * stream.channels, 0.0f);
+        stream.lastIndex += qint64(pad);
+        position += double(pad);
+    } else {
+        auto excess = size_t(position - double(history));
+
+        if (excess >= stream.frames()) {
+            // All the queued samples are older than the reference.
+            this->drop(stream, stream.frames());
+
+            return false;
+        }
+
+        this->drop(stream, excess);
+        position -= double(excess);
+    }
+
+    stream.position = position;
+    stream.baseRatio = 0.0;
+    stream.integral = 0.0;
+    stream.aligned = true;
+
+    return true;
+}
+
+void AudioStreamAlignerPrivate::drop(AudioAlignedStream &stream, size_t frames)
+{
+    stream.fifo.remove(0, int(frames) * stream.channels);
+    stream.lastIndex -= qint64(frames);
+}
+
+void AudioStreamAlignerPrivate::updateRatio(AudioAlignedStream &stream,
+                                            qreal referenceRate,
+                                            qint64 time,
+                                            size_t frames)
+{
+    auto error = qreal(stream.time(stream.position) - time) / 1e9;
+
+    if (qAbs(error) > RESYNC_THRESHOLD / 1e9) {
+        // Too far for the control loop, jump to the right position.
+        stream.aligned = false;
+
+        if (!this->align(stream, time))
+            return;
+
+        error = 0.0;
+    }
+
+    auto baseRatio = stream.drift.rate() / referenceRate;
+
+    /* When the rate estimations change, move the accumulated correction so
+     * the resampling ratio doesn't jump.
+     */
+    if (stream.baseRatio > 0.0 && !qFuzzyCompare(baseRatio, stream.baseRatio))
+        stream.integral =
+                (1.0 - stream.baseRatio / baseRatio
+                       * (1.0 - ALIGN_KI * stream.integral)) / ALIGN_KI;
+
+    stream.baseRatio = baseRatio;
+    stream.integral = qBound(-MAX_CORRECTION / ALIGN_KI,
+                             stream.integral
+                             + error * qreal(frames) / this->m_rate,
+                             MAX_CORRECTION / ALIGN_KI);
+    auto correction = ALIGN_KP * error + ALIGN_KI * stream.integral;
+    correction = qBound(-MAX_CORRECTION, correction, MAX_CORRECTION);
+    stream.ratio = baseRatio * (1.0 - correction);
+}
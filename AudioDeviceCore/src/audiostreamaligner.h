@@ -0,0 +1,85 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef AUDIOSTREAMALIGNER_H
+#define AUDIOSTREAMALIGNER_H
+
+#include <cstddef>
+#include <QVector>
+
+class AudioStreamAlignerPrivate;
+
+/* Merges several capture streams into a single interleaved stream.
+ *
+ * Each stream is a float interleaved stream captured by a different device,
+ * timestamped with the host clock. The first stream is the reference, its
+ * samples are passed through untouched, the other streams are resampled to
+ * follow the clock of the reference, and their channels are appended after
+ * the reference channels.
+ *
+ * The clock of each device is estimated from its timestamps, and a slow
+ * control loop on the alignment error corrects the remaining offset.
+ */
+class AudioStreamAligner
+{
+    public:
+        AudioStreamAligner();
+        AudioStreamAligner(const AudioStreamAligner &other) = delete;
+        ~AudioStreamAligner();
+
+        AudioStreamAligner &operator =(const AudioStreamAligner &other) = delete;
+
+        /* Sets the number of channels of each stream and the nominal sample
+         * rate. maxDelay is the maximum number of frames the reference will
+         * wait for the slowest stream before the missing samples are filled
+         * with silence.
+         */
+        void configure(const QVector<int> &channels,
+                       int rate,
+                       size_t maxDelay);
+        int streams() const;
+        int channels() const;
+
+        /* Queues frames of a stream, hostTime is the time of the first frame
+         * in nanoseconds, and position its position in the device timeline.
+         */
+        void push(int stream,
+                  const float *samples,
+                  size_t frames,
+                  qint64 hostTime,
+                  quint64 position);
+
+        // Number of aligned frames that can be pulled right now.
+        size_t available() const;
+
+        /* Writes up to frames aligned frames to out, and returns the number
+         * of frames written. hostTime receives the time of the first frame.
+         */
+        size_t pull(float *out, size_t frames, qint64 *hostTime=nullptr);
+
+        // Estimated sample rate of each stream.
+        qreal rate(int stream) const;
+
+        void reset();
+
+    private:
+        AudioStreamAlignerPrivate *d;
+};
+
+#endif // AUDIOSTREAMALIGNER_H
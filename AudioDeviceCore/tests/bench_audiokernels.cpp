@@ -0,0 +1,237 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <chrono>
+#include <vector>
+#include <QtTest>
+
+#include "audiokernels.h"
+
+/* Built twice, bench_audiokernels with the vector code of the target and
+ * bench_audiokernels_scalar with AUDIOKERNELS_SCALAR, compare both outputs.
+ */
+
+// 10 ms of 48 kHz audio, the usual callback size.
+#define SAMPLES 480
+#define ROUNDS  20000
+
+using Clock = std::chrono::steady_clock;
+
+class BenchAudioKernels: public QObject
+{
+    Q_OBJECT
+
+    private:
+        static void report(const char *name,
+                           Clock::time_point start,
+                           size_t samples);
+        static void convert(const char *name,
+                            AudioKernels::SampleFormat srcFormat,
+                            AudioKernels::SampleFormat dstFormat,
+                            bool dither);
+
+    private slots:
+        void interleaveS16();
+        void deinterleaveS16();
+        void interleaveFlt();
+        void deinterleaveFlt();
+        void fltToS16();
+        void fltToS16Dither();
+        void s16ToFlt();
+        void fltToS32();
+        void s32ToFlt();
+        void fltToU8();
+};
+
+void BenchAudioKernels::report(const char *name,
+                               Clock::time_point start,
+                               size_t samples)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()
+                                                                   - start).count();
+    qInfo() << name
+#ifdef AUDIOKERNELS_SCALAR
+            << "(scalar)"
+#else
+            << "(simd)"
+#endif
+            << "ns per callback:" << ns / ROUNDS
+            << "Msamples per second:"
+            << qint64(1e3 * double(ROUNDS * samples) / double(qMax<qint64>(ns, 1)));
+}
+
+void BenchAudioKernels::interleaveS16()
+{
+    std::vector<qint16> left(SAMPLES, 1);
+    std::vector<qint16> right(SAMPLES, 2);
+    std::vector<qint16> out(2 * SAMPLES);
+    const quint8 *src[] {reinterpret_cast<const quint8 *>(left.data()),
+                         reinterpret_cast<const quint8 *>(right.data())};
+    auto start = Clock::now();
+
+    for (int i = 0; i < ROUNDS; i++)
+        AudioKernels::interleave(src,
+                                 reinterpret_cast<quint8 *>(out.data()),
+                                 2,
+                                 SAMPLES,
+                                 sizeof(qint16));
+
+    report("interleave s16 stereo", start, 2 * SAMPLES);
+    QCOMPARE(out[1], qint16(2));
+}
+
+void BenchAudioKernels::deinterleaveS16()
+{
+    std::vector<qint16> in(2 * SAMPLES, 3);
+    std::vector<qint16> left(SAMPLES);
+    std::vector<qint16> right(SAMPLES);
+    quint8 *dst[] {reinterpret_cast<quint8 *>(left.data()),
+                   reinterpret_cast<quint8 *>(right.data())};
+    auto start = Clock::now();
+
+    for (int i = 0; i < ROUNDS; i++)
+        AudioKernels::deinterleave(reinterpret_cast<const quint8 *>(in.data()),
+                                   dst,
+                                   2,
+                                   SAMPLES,
+                                   sizeof(qint16));
+
+    report("deinterleave s16 stereo", start, 2 * SAMPLES);
+    QCOMPARE(right[0], qint16(3));
+}
+
+void BenchAudioKernels::interleaveFlt()
+{
+    std::vector<float> left(SAMPLES, 0.25f);
+    std::vector<float> right(SAMPLES, 0.5f);
+    std::vector<float> out(2 * SAMPLES);
+    const quint8 *src[] {reinterpret_cast<const quint8 *>(left.data()),
+                         reinterpret_cast<const quint8 *>(right.data())};
+    auto start = Clock::now();
+
+    for (int i = 0; i < ROUNDS; i++)
+        AudioKernels::interleave(src,
+                                 reinterpret_cast<quint8 *>(out.data()),
+                                 2,
+                                 SAMPLES,
+                                 sizeof(float));
+
+    report("interleave flt stereo", start, 2 * SAMPLES);
+    QCOMPARE(out[1], 0.5f);
+}
+
+void BenchAudioKernels::deinterleaveFlt()
+{
+    std::vector<float> in(2 * SAMPLES, 0.75f);
+    std::vector<float> left(SAMPLES);
+    std::vector<float> right(SAMPLES);
+    quint8 *dst[] {reinterpret_cast<quint8 *>(left.data()),
+                   reinterpret_cast<quint8 *>(right.data())};
+    auto start = Clock::now();
+
+    for (int i = 0; i < ROUNDS; i++)
+        AudioKernels::deinterleave(reinterpret_cast<const quint8 *>(in.data()),
+                                   dst,
+                                   2,
+                                   SAMPLES,
+                                   sizeof(float));
+
+    report("deinterleave flt stereo", start, 2 * SAMPLES);
+    QCOMPARE(right[0], 0.75f);
+}
+
+void BenchAudioKernels::convert(const char *name,
+                                AudioKernels::SampleFormat srcFormat,
+                                AudioKernels::SampleFormat dstFormat,
+                                bool dither)
+{
+    auto samples = 2 * SAMPLES;
+    std::vector<quint8> src(samples * AudioKernels::sampleSize(srcFormat));
+    std::vector<quint8> dst(samples * AudioKernels::sampleSize(dstFormat));
+
+    // Silence is a valid input for every format.
+    if (srcFormat == AudioKernels::SampleFormat_u8)
+        std::fill(src.begin(), src.end(), 0x80);
+
+    AudioKernels::Dither state;
+    auto start = Clock::now();
+
+    for (int i = 0; i < ROUNDS; i++)
+        AudioKernels::convert(src.data(),
+                              srcFormat,
+                              dst.data(),
+                              dstFormat,
+                              samples,
+                              dither? &state: nullptr);
+
+    report(name, start, samples);
+}
+
+void BenchAudioKernels::fltToS16()
+{
+    convert("flt -> s16",
+            AudioKernels::SampleFormat_flt,
+            AudioKernels::SampleFormat_s16,
+            false);
+}
+
+void BenchAudioKernels::fltToS16Dither()
+{
+    convert("flt -> s16 dithered",
+            AudioKernels::SampleFormat_flt,
+            AudioKernels::SampleFormat_s16,
+            true);
+}
+
+void BenchAudioKernels::s16ToFlt()
+{
+    convert("s16 -> flt",
+            AudioKernels::SampleFormat_s16,
+            AudioKernels::SampleFormat_flt,
+            false);
+}
+
+void BenchAudioKernels::fltToS32()
+{
+    convert("flt -> s32",
+            AudioKernels::SampleFormat_flt,
+            AudioKernels::SampleFormat_s32,
+            false);
+}
+
+void BenchAudioKernels::s32ToFlt()
+{
+    convert("s32 -> flt",
+            AudioKernels::SampleFormat_s32,
+            AudioKernels::SampleFormat_flt,
+            false);
+}
+
+void BenchAudioKernels::fltToU8()
+{
+    // Generic path, no vector code for it.
+    convert("flt -> u8 dithered",
+            AudioKernels::SampleFormat_flt,
+            AudioKernels::SampleFormat_u8,
+            true);
+}
+
+QTEST_GUILESS_MAIN(BenchAudioKernels)
+
+#include "bench_audiokernels.moc"
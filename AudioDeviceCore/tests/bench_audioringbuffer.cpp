@@ -0,0 +1,191 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <QtTest>
+
+#include "audioringbuffer.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+struct BenchFrame
+{
+    quint64 sequence;
+    qint64 time; // Commit time of the chunk, in nanoseconds.
+};
+
+static qint64 nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now().time_since_epoch()).count();
+}
+
+static qint64 percentile(std::vector<qint64> values, double p)
+{
+    if (values.empty())
+        return 0;
+
+    auto i = size_t(p * double(values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + qint64(i), values.end());
+
+    return values[i];
+}
+
+class BenchAudioRingBuffer: public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void throughput();
+        void stressFullSpeed();
+        void stressRealTimeCadence();
+};
+
+void BenchAudioRingBuffer::throughput()
+{
+    AudioRingBuffer ring;
+    ring.resize(2 * sizeof(float), 4096);
+    std::vector<float> in(2 * 256, 0.5f);
+    std::vector<float> out(2 * 256);
+
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++) {
+            ring.write(in.data(), 256);
+            ring.read(out.data(), 256);
+        }
+    }
+}
+
+void BenchAudioRingBuffer::stressFullSpeed()
+{
+    // Random sized chunks on both sides, as fast as possible.
+    AudioRingBuffer ring;
+    ring.resize(sizeof(BenchFrame), 1024);
+    const quint64 totalFrames = 4000000;
+    std::atomic<bool> ok {true};
+
+    std::thread producer([&ring, totalFrames] () {
+        std::mt19937 random(1);
+        std::vector<BenchFrame> chunk(512);
+        quint64 sequence = 0;
+
+        while (sequence < totalFrames) {
+            auto frames = size_t(1 + random() % 512);
+            frames = size_t(qMin<quint64>(frames, totalFrames - sequence));
+
+            if (!ring.waitForSpace(frames, -1))
+                break;
+
+            for (size_t i = 0; i < frames; i++)
+                chunk[i] = {sequence + i, 0};
+
+            sequence += ring.write(chunk.data(), frames);
+        }
+    });
+
+    std::mt19937 random(2);
+    std::vector<BenchFrame> chunk(512);
+    quint64 expected = 0;
+    auto start = BenchClock::now();
+
+    while (expected < totalFrames) {
+        auto frames = size_t(1 + random() % 512);
+        frames = size_t(qMin<quint64>(frames, totalFrames - expected));
+        QVERIFY(ring.waitForData(frames, 1000));
+        auto read = ring.read(chunk.data(), frames);
+
+        for (size_t i = 0; i < read; i++)
+            if (chunk[i].sequence != expected++)
+                ok = false;
+    }
+
+    auto elapsed = std::chrono::duration<double>(BenchClock::now() - start).count();
+    producer.join();
+    QVERIFY(ok);
+    qInfo() << "Frames per second:" << qint64(double(totalFrames) / elapsed);
+}
+
+void BenchAudioRingBuffer::stressRealTimeCadence()
+{
+    /* Emulates a device callback delivering 1 ms periods at 48 kHz to a reader
+     * that waits with no time out. Measures how long the callback spends in
+     * write(), which must never block, and how long it takes the reader to
+     * wake up.
+     */
+    const size_t period = 48;
+    const int callbacks = 2000;
+    AudioRingBuffer ring;
+    ring.resize(sizeof(BenchFrame), 16 * period);
+    std::vector<qint64> writeTimes;
+    std::vector<qint64> wakeLatencies;
+    writeTimes.reserve(callbacks);
+    wakeLatencies.reserve(callbacks);
+
+    std::thread callback([&ring, &writeTimes, period, callbacks] () {
+        std::vector<BenchFrame> chunk(period);
+        quint64 sequence = 0;
+        auto next = BenchClock::now();
+
+        for (int i = 0; i < callbacks; i++) {
+            next += std::chrono::milliseconds(1);
+            std::this_thread::sleep_until(next);
+            auto time = nowNs();
+
+            for (auto &frame: chunk)
+                frame = {sequence++, time};
+
+            ring.write(chunk.data(), period);
+            writeTimes.push_back(nowNs() - time);
+        }
+    });
+
+    std::vector<BenchFrame> chunk(period);
+    quint64 expected = 0;
+
+    for (int i = 0; i < callbacks; i++) {
+        QVERIFY(ring.waitForData(period, 1000));
+        auto now = nowNs();
+        AudioRingBufferSegment segments[2];
+        ring.peek(1, segments);
+        auto first = reinterpret_cast<const BenchFrame *>(ring.plane(0))
+                     + segments[0].offset;
+        wakeLatencies.push_back(now - first->time);
+        QCOMPARE(ring.read(chunk.data(), period), period);
+
+        for (auto &frame: chunk)
+            QCOMPARE(frame.sequence, expected++);
+    }
+
+    callback.join();
+
+    qInfo() << "write() ns: p50" << percentile(writeTimes, 0.5)
+            << "p99" << percentile(writeTimes, 0.99)
+            << "max" << *std::max_element(writeTimes.begin(), writeTimes.end());
+    qInfo() << "Wake up latency ns: p50" << percentile(wakeLatencies, 0.5)
+            << "p99" << percentile(wakeLatencies, 0.99)
+            << "max" << *std::max_element(wakeLatencies.begin(), wakeLatencies.end());
+}
+
+QTEST_GUILESS_MAIN(BenchAudioRingBuffer)
+
+#include "bench_audioringbuffer.moc"
@@ -0,0 +1,486 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <QtTest>
+#include <akaudiopacket.h>
+
+#include "audiodevicebuffer.h"
+
+#define RATE     48000
+#define PERIOD   48
+#define QUEUED   4800
+
+using Clock = std::chrono::steady_clock;
+
+class TestAudioDeviceBuffer: public QObject
+{
+    Q_OBJECT
+
+    private:
+        static AkAudioCaps playbackCaps();
+        static AkAudioPacket packet(size_t samples, qint16 value);
+        static bool waitFor(const std::function<bool ()> &condition,
+                            int timeout);
+
+    private slots:
+        void captureRead();
+        void captureTimestamps();
+        void captureTimestampsDeviceRate();
+        void renderFillsSilence();
+        void tryWriteLimitedToQueue();
+        void notifierWakesBelowLowWatermark();
+        void notifierIdleWhileQueued();
+        void notifierFeedsSimulatedCallback();
+        void notifierStopsOnAbort();
+        void releaseWaitsForReaders();
+        void releaseWaitsForWriters();
+        void callsFailAfterRelease();
+};
+
+AkAudioCaps TestAudioDeviceBuffer::playbackCaps()
+{
+    return AkAudioCaps(AkAudioCaps::SampleFormat_s16,
+                       AkAudioCaps::Layout_stereo,
+                       false,
+                       RATE);
+}
+
+AkAudioPacket TestAudioDeviceBuffer::packet(size_t samples, qint16 value)
+{
+    AkAudioPacket packet(playbackCaps(), samples);
+    auto data = reinterpret_cast<qint16 *>(packet.data());
+
+    for (size_t i = 0; i < 2 * samples; i++)
+        data[i] = value;
+
+    return packet;
+}
+
+bool TestAudioDeviceBuffer::waitFor(const std::function<bool ()> &condition,
+                                    int timeout)
+{
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout);
+
+    while (!condition()) {
+        if (Clock::now() >= deadline)
+            return false;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return true;
+}
+
+void TestAudioDeviceBuffer::captureRead()
+{
+    // The device captures float samples, the reader wants 16 bits.
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_flt,
+                     false,
+                     PERIOD,
+                     QUEUED);
+
+    std::vector<float> frames(2 * PERIOD, 0.5f);
+    const void *planes[] {frames.data()};
+    QCOMPARE(buffer.capture(planes, PERIOD, 0, 1000), size_t(PERIOD));
+
+    auto data = buffer.read(PERIOD, 0);
+    QCOMPARE(size_t(data.size()), 2 * PERIOD * sizeof(qint16));
+
+    auto samples = reinterpret_cast<const qint16 *>(data.data());
+
+    for (size_t i = 0; i < 2 * PERIOD; i++)
+        QVERIFY(qAbs(samples[i] - 16384) <= 1);
+
+    // Nothing else was captured.
+    QCOMPARE(buffer.read(PERIOD, 0).size(), 0);
+}
+
+void TestAudioDeviceBuffer::captureTimestamps()
+{
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     PERIOD,
+                     QUEUED);
+
+    std::vector<qint16> frames(2 * PERIOD);
+    const void *planes[] {frames.data()};
+    quint64 hostTime = 5000000000;
+
+    for (int i = 0; i < 4; i++)
+        buffer.capture(planes,
+                       PERIOD,
+                       1000 + quint64(i) * PERIOD,
+                       hostTime + quint64(i) * 1000000);
+
+    // Half a period inside the second buffer.
+    quint64 position = 0;
+    buffer.readPacket(PERIOD + PERIOD / 2, 0, nullptr, &position);
+    QCOMPARE(position, quint64(1000));
+    auto packet = buffer.readPacket(PERIOD, 0, nullptr, &position);
+    QCOMPARE(position, quint64(1000 + PERIOD + PERIOD / 2));
+    QCOMPARE(packet.pts(), qint64(hostTime + 1500000));
+}
+
+void TestAudioDeviceBuffer::captureTimestampsDeviceRate()
+{
+    /* A 44.1 kHz device read at 48 kHz: the device sample times advance
+     * 441 for each 480 frames in the ring, the positions must be given in
+     * frames of the ring.
+     */
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     480,
+                     QUEUED,
+                     44100);
+
+    std::vector<qint16> frames(2 * 480);
+    const void *planes[] {frames.data()};
+    quint64 hostTime = 5000000000;
+
+    for (int i = 0; i < 8; i++)
+        buffer.capture(planes,
+                       480,
+                       441000 + quint64(i) * 441,
+                       hostTime + quint64(i) * 10000000);
+
+    quint64 position = 0;
+    buffer.readPacket(480, 0, nullptr, &position);
+    QCOMPARE(position, quint64(480000));
+
+    for (int i = 1; i < 8; i++) {
+        quint64 lastPosition = position;
+        auto packet = buffer.readPacket(240, 0, nullptr, &position);
+        QCOMPARE(position, quint64(480000 + 480 + 240 * (i - 1)));
+        QCOMPARE(position - lastPosition, quint64(i > 1? 240: 480));
+        QCOMPARE(packet.pts(), qint64(hostTime + 10000000 + 5000000 * (i - 1)));
+    }
+}
+
+void TestAudioDeviceBuffer::renderFillsSilence()
+{
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     PERIOD,
+                     QUEUED);
+    QCOMPARE(buffer.tryWrite(packet(PERIOD / 2, 1000)), size_t(PERIOD / 2));
+
+    std::vector<qint16> frames(2 * PERIOD, -1);
+    void *planes[] {frames.data()};
+    QCOMPARE(buffer.render(planes, PERIOD), size_t(PERIOD / 2));
+
+    for (size_t i = 0; i < PERIOD; i++)
+        QCOMPARE(frames[i], qint16(1000));
+
+    for (size_t i = PERIOD; i < 2 * PERIOD; i++)
+        QCOMPARE(frames[i], qint16(0));
+}
+
+void TestAudioDeviceBuffer::tryWriteLimitedToQueue()
+{
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     PERIOD,
+                     QUEUED);
+    QCOMPARE(buffer.queueFree(), size_t(QUEUED));
+
+    // Never queue more than maxQueued, even if the ring has more room.
+    auto pkt = packet(2 * QUEUED, 1);
+    QCOMPARE(buffer.tryWrite(pkt), size_t(QUEUED));
+    QCOMPARE(buffer.queueFree(), size_t(0));
+    QCOMPARE(buffer.tryWrite(pkt, QUEUED), size_t(0));
+}
+
+void TestAudioDeviceBuffer::notifierWakesBelowLowWatermark()
+{
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     PERIOD,
+                     QUEUED);
+    QCOMPARE(buffer.tryWrite(packet(QUEUED, 1)), size_t(QUEUED));
+
+    // 50 ms = 2400 samples.
+    std::atomic<bool> running {true};
+    std::atomic<int> lowWatermark {50};
+    std::atomic<int> notifications {0};
+    std::atomic<qint64> lastFree {0};
+    std::thread notifier([&] () {
+        buffer.notifierLoop(running, lowWatermark, [&] (qint64 samples) {
+            lastFree = samples;
+            notifications++;
+        });
+    });
+
+    std::vector<qint16> frames(2 * QUEUED);
+    void *planes[] {frames.data()};
+
+    // Still above the low watermark.
+    QCOMPARE(buffer.render(planes, 1920), size_t(1920));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    QCOMPARE(notifications.load(), 0);
+
+    // Crossing it wakes the notifier.
+    QCOMPARE(buffer.render(planes, 960), size_t(960));
+    QVERIFY(waitFor([&] () { return notifications > 0; }, 5000));
+    QCOMPARE(lastFree.load(), qint64(QUEUED - 1920));
+
+    running = false;
+    buffer.abort();
+    notifier.join();
+}
+
+void TestAudioDeviceBuffer::notifierIdleWhileQueued()
+{
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     PERIOD,
+                     QUEUED);
+
+    std::atomic<bool> running {true};
+    std::atomic<int> lowWatermark {50};
+    std::atomic<int> notifications {0};
+    std::thread notifier([&] () {
+        buffer.notifierLoop(running, lowWatermark, [&] (qint64) {
+            notifications++;
+        });
+    });
+
+    // The queue starts empty, so it's notified right away.
+    QVERIFY(waitFor([&] () { return notifications > 0; }, 5000));
+
+    // Once refilled, the notifier sleeps until the queue is drained again.
+    QCOMPARE(buffer.tryWrite(packet(QUEUED, 1)), size_t(QUEUED));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    int count = notifications;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    QCOMPARE(notifications.load(), count);
+
+    std::vector<qint16> frames(2 * QUEUED);
+    void *planes[] {frames.data()};
+    buffer.render(planes, QUEUED);
+    QVERIFY(waitFor([&] () { return notifications > count; }, 5000));
+
+    running = false;
+    buffer.abort();
+    notifier.join();
+}
+
+void TestAudioDeviceBuffer::notifierFeedsSimulatedCallback()
+{
+    /* Emulate a device pulling a period every millisecond, and a writer that
+     * only writes when it's notified. Once primed, the device must never run
+     * out of samples.
+     */
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     PERIOD,
+                     QUEUED);
+
+    std::atomic<bool> running {true};
+    std::atomic<int> lowWatermark {40};
+    std::atomic<int> requests {0};
+    std::atomic<bool> primed {false};
+    std::thread notifier([&] () {
+        buffer.notifierLoop(running, lowWatermark, [&] (qint64) {
+            requests++;
+        });
+    });
+
+    std::thread writer([&] () {
+        auto pkt = packet(QUEUED, 1);
+        int served = 0;
+
+        while (running) {
+            if (requests == served) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+                continue;
+            }
+
+            served = requests;
+            buffer.tryWrite(pkt, QUEUED - buffer.queueFree());
+
+            if (buffer.queueFree() < 1)
+                primed = true;
+        }
+    });
+
+    QVERIFY(waitFor([&] () { return primed.load(); }, 5000));
+
+    std::vector<qint16> frames(2 * PERIOD);
+    void *planes[] {frames.data()};
+    size_t underruns = 0;
+    auto next = Clock::now();
+
+    for (int i = 0; i < 500; i++) {
+        next += std::chrono::milliseconds(1);
+        std::this_thread::sleep_until(next);
+        underruns += PERIOD - buffer.render(planes, PERIOD);
+    }
+
+    running = false;
+    buffer.abort();
+    notifier.join();
+    writer.join();
+
+    QVERIFY(requests > 1);
+    QCOMPARE(underruns, size_t(0));
+}
+
+void TestAudioDeviceBuffer::notifierStopsOnAbort()
+{
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     PERIOD,
+                     QUEUED);
+    QCOMPARE(buffer.tryWrite(packet(QUEUED, 1)), size_t(QUEUED));
+
+    std::atomic<bool> running {true};
+    std::atomic<int> lowWatermark {0};
+    std::atomic<bool> finished {false};
+    std::thread notifier([&] () {
+        buffer.notifierLoop(running, lowWatermark, [] (qint64) {});
+        finished = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    QVERIFY(!finished);
+    running = false;
+    buffer.abort();
+    QVERIFY(waitFor([&] () { return finished.load(); }, 5000));
+    notifier.join();
+}
+
+void TestAudioDeviceBuffer::releaseWaitsForReaders()
+{
+    // Tear down the buffer while a reader is busy, as uninit() does.
+    AudioDeviceBuffer buffer;
+    std::vector<float> frames(2 * PERIOD, 0.25f);
+    const void *planes[] {frames.data()};
+
+    for (int i = 0; i < 200; i++) {
+        buffer.configure(playbackCaps(),
+                         AkAudioCaps::SampleFormat_flt,
+                         false,
+                         PERIOD,
+                         QUEUED);
+        std::atomic<bool> capturing {true};
+        std::thread device([&] () {
+            quint64 time = 1;
+
+            while (capturing) {
+                buffer.capture(planes, PERIOD, time, time);
+                time += PERIOD;
+                std::this_thread::yield();
+            }
+        });
+        std::atomic<int> packets {0};
+        std::thread reader([&] () {
+            while (buffer.readPacket(PERIOD / 2, -1))
+                packets++;
+        });
+
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        capturing = false;
+        device.join();
+        buffer.abort();
+        buffer.release();
+
+        // The reader may not touch the buffer anymore.
+        QCOMPARE(buffer.readPacket(PERIOD, -1).samples(), size_t(0));
+        reader.join();
+    }
+}
+
+void TestAudioDeviceBuffer::releaseWaitsForWriters()
+{
+    AudioDeviceBuffer buffer;
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     PERIOD,
+                     QUEUED);
+
+    // The second packet doesn't fit, so the writer blocks.
+    std::atomic<int> result {-1};
+    std::thread writer([&] () {
+        buffer.write(packet(QUEUED, 1));
+        result = buffer.write(packet(QUEUED, 1));
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    QCOMPARE(result.load(), -1);
+    buffer.release();
+    QVERIFY(waitFor([&] () { return result >= 0; }, 5000));
+    QCOMPARE(result.load(), 0);
+    writer.join();
+}
+
+void TestAudioDeviceBuffer::callsFailAfterRelease()
+{
+    AudioDeviceBuffer buffer;
+
+    // Not configured yet.
+    QCOMPARE(buffer.read(PERIOD, -1).size(), 0);
+    QVERIFY(!buffer.write(packet(PERIOD, 1)));
+
+    buffer.configure(playbackCaps(),
+                     AkAudioCaps::SampleFormat_s16,
+                     false,
+                     PERIOD,
+                     QUEUED);
+    QCOMPARE(buffer.tryWrite(packet(PERIOD, 1)), size_t(PERIOD));
+    buffer.release();
+
+    QCOMPARE(buffer.read(PERIOD, -1).size(), 0);
+    QCOMPARE(buffer.readPacket(PERIOD, -1).samples(), size_t(0));
+    QCOMPARE(buffer.waitForSamples(PERIOD, -1), size_t(0));
+    QCOMPARE(buffer.tryWrite(packet(PERIOD, 1)), size_t(0));
+    QVERIFY(!buffer.write(packet(PERIOD, 1)));
+    QCOMPARE(buffer.queueFree(), size_t(0));
+
+    std::atomic<bool> running {true};
+    std::atomic<int> lowWatermark {0};
+    buffer.notifierLoop(running, lowWatermark, [] (qint64) {});
+}
+
+QTEST_GUILESS_MAIN(TestAudioDeviceBuffer)
+
+#include "tst_audiodevicebuffer.moc"
@@ -0,0 +1,137 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <random>
+#include <QtTest>
+
+#include "audiodriftestimator.h"
+
+#define RATE   48000
+#define PERIOD 480
+
+class TestAudioDriftEstimator: public QObject
+{
+    Q_OBJECT
+
+    private:
+        /* Feeds a device running at rate samples per second of host time for
+         * the given seconds, with up to jitter nanoseconds of noise in each
+         * timestamp.
+         */
+        static void feed(AudioDriftEstimator &estimator,
+                         qreal rate,
+                         qreal seconds,
+                         qint64 jitter,
+                         quint64 firstPosition=0);
+
+    private slots:
+        void nominalUntilEnoughSpan();
+        void estimatesDrift();
+        void estimatesDriftWithJitter();
+        void keepsEstimateAfterRecentering();
+        void rejectsImpossibleRates();
+        void resetKeepsNominalRate();
+};
+
+void TestAudioDriftEstimator::feed(AudioDriftEstimator &estimator,
+                                   qreal rate,
+                                   qreal seconds,
+                                   qint64 jitter,
+                                   quint64 firstPosition)
+{
+    std::mt19937 generator(1234);
+    std::uniform_int_distribution<qint64> noise(-jitter, jitter);
+    qint64 hostTime0 = 1000000000000;
+    auto periods = quint64(seconds * rate / PERIOD);
+
+    for (quint64 i = 0; i < periods; i++) {
+        auto position = i * PERIOD;
+        auto hostTime = hostTime0
+                        + qint64(1e9 * qreal(position) / rate)
+                        + (jitter > 0? noise(generator): 0);
+        estimator.addPoint(hostTime, firstPosition + position);
+    }
+}
+
+void TestAudioDriftEstimator::nominalUntilEnoughSpan()
+{
+    AudioDriftEstimator estimator;
+    estimator.setNominalRate(RATE);
+    feed(estimator, RATE * 1.0002, 1.5, 0);
+    QCOMPARE(estimator.rate(), qreal(RATE));
+}
+
+void TestAudioDriftEstimator::estimatesDrift()
+{
+    // +200 ppm and -150 ppm, typical of cheap USB devices.
+    for (auto ppm: {200.0, -150.0}) {
+        AudioDriftEstimator estimator;
+        estimator.setNominalRate(RATE);
+        auto rate = RATE * (1.0 + ppm / 1e6);
+        feed(estimator, rate, 10.0, 0, 123456789);
+        QVERIFY(qAbs(estimator.rate() - rate) < 0.01);
+    }
+}
+
+void TestAudioDriftEstimator::estimatesDriftWithJitter()
+{
+    // Callbacks woken up to 1 ms late or early.
+    AudioDriftEstimator estimator;
+    estimator.setNominalRate(RATE);
+    auto rate = RATE * 1.0001;
+    feed(estimator, rate, 30.0, 1000000);
+
+    // Below 10 ppm.
+    QVERIFY(qAbs(estimator.rate() - rate) < 0.48);
+}
+
+void TestAudioDriftEstimator::keepsEstimateAfterRecentering()
+{
+    // Several times the recentering period.
+    AudioDriftEstimator estimator;
+    estimator.setNominalRate(RATE);
+    auto rate = RATE * 0.99995;
+    feed(estimator, rate, 200.0, 200000);
+    QVERIFY(qAbs(estimator.rate() - rate) < 0.48);
+}
+
+void TestAudioDriftEstimator::rejectsImpossibleRates()
+{
+    // A 2% error is a wrong measurement, not drift.
+    AudioDriftEstimator estimator;
+    estimator.setNominalRate(RATE);
+    feed(estimator, RATE * 1.02, 10.0, 0);
+    QCOMPARE(estimator.rate(), qreal(RATE));
+}
+
+void TestAudioDriftEstimator::resetKeepsNominalRate()
+{
+    AudioDriftEstimator estimator;
+    estimator.setNominalRate(RATE);
+    feed(estimator, RATE * 1.0002, 10.0, 0);
+    QVERIFY(estimator.rate() > RATE);
+
+    estimator.reset();
+    QCOMPARE(estimator.nominalRate(), qreal(RATE));
+    QCOMPARE(estimator.rate(), qreal(RATE));
+}
+
+QTEST_GUILESS_MAIN(TestAudioDriftEstimator)
+
+#include "tst_audiodriftestimator.moc"
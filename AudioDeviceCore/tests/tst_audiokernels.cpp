@@ -0,0 +1,387 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <QtTest>
+
+#include "audiokernels.h"
+
+/* Built twice, with and without AUDIOKERNELS_SCALAR, so both the vector and
+ * the portable code are checked against the same reference.
+ */
+
+// Covers the vector blocks plus every tail length.
+#define MAX_SAMPLES 37
+
+class TestAudioKernels: public QObject
+{
+    Q_OBJECT
+
+    private:
+        static std::vector<quint8> pattern(size_t size, quint8 seed);
+        static std::vector<float> ramp(size_t samples);
+        static float triangular(quint32 &state);
+
+    private slots:
+        void interleave();
+        void deinterleave();
+        void copy();
+        void fltToS16();
+        void fltToS16Dither();
+        void s16ToFlt();
+        void fltToS32();
+        void s32ToFlt();
+        void u8RoundTrip();
+        void ditherOnlyWhenNarrowing();
+        void invalidFormats();
+};
+
+std::vector<quint8> TestAudioKernels::pattern(size_t size, quint8 seed)
+{
+    std::vector<quint8> data(size);
+
+    for (size_t i = 0; i < size; i++)
+        data[i] = quint8(seed + 7 * i + (i >> 8));
+
+    return data;
+}
+
+std::vector<float> TestAudioKernels::ramp(size_t samples)
+{
+    // Goes past both ends of the range to check the clipping.
+    std::vector<float> data(samples);
+
+    for (size_t i = 0; i < samples; i++)
+        data[i] = -1.25f + 2.5f * float(i) / float(qMax<size_t>(samples, 2) - 1);
+
+    return data;
+}
+
+float TestAudioKernels::triangular(quint32 &state)
+{
+    // Same generator as the kernels: xorshift32 mapped to [0, 1).
+    float values[2];
+
+    for (auto &value: values) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        quint32 bits = (state >> 9) | 0x3f800000;
+        memcpy(&value, &bits, sizeof(float));
+        value -= 1.0f;
+    }
+
+    return values[0] - values[1];
+}
+
+void TestAudioKernels::interleave()
+{
+    for (size_t sampleSize: {1, 2, 3, 4, 8})
+        for (size_t channels: {1, 2, 3, 6})
+            for (size_t samples = 0; samples <= MAX_SAMPLES; samples++) {
+                std::vector<std::vector<quint8>> planes;
+                std::vector<const quint8 *> src;
+
+                for (size_t c = 0; c < channels; c++) {
+                    planes.push_back(pattern(samples * sampleSize, quint8(c)));
+                    src.push_back(planes.back().data());
+                }
+
+                std::vector<quint8> dst(channels * samples * sampleSize + 1, 0xaa);
+                AudioKernels::interleave(src.data(),
+                                         dst.data(),
+                                         channels,
+                                         samples,
+                                         sampleSize);
+
+                for (size_t i = 0; i < samples; i++)
+                    for (size_t c = 0; c < channels; c++)
+                        QVERIFY(!memcmp(dst.data() + (i * channels + c) * sampleSize,
+                                        planes[c].data() + i * sampleSize,
+                                        sampleSize));
+
+                // Nothing is written past the end.
+                QCOMPARE(dst.back(), quint8(0xaa));
+            }
+}
+
+void TestAudioKernels::deinterleave()
+{
+    for (size_t sampleSize: {1, 2, 3, 4, 8})
+        for (size_t channels: {1, 2, 3, 6})
+            for (size_t samples = 0; samples <= MAX_SAMPLES; samples++) {
+                auto src = pattern(channels * samples * sampleSize, 3);
+                std::vector<std::vector<quint8>> planes;
+                std::vector<quint8 *> dst;
+
+                for (size_t c = 0; c < channels; c++) {
+                    planes.emplace_back(samples * sampleSize + 1, 0xaa);
+                    dst.push_back(planes.back().data());
+                }
+
+                AudioKernels::deinterleave(src.data(),
+                                           dst.data(),
+                                           channels,
+                                           samples,
+                                           sampleSize);
+
+                for (size_t c = 0; c < channels; c++) {
+                    for (size_t i = 0; i < samples; i++)
+                        QVERIFY(!memcmp(planes[c].data() + i * sampleSize,
+                                        src.data() + (i * channels + c) * sampleSize,
+                                        sampleSize));
+
+                    QCOMPARE(planes[c].back(), quint8(0xaa));
+                }
+            }
+}
+
+void TestAudioKernels::copy()
+{
+    // Planar -> interleaved -> planar must give back the same samples.
+    size_t channels = 2;
+    size_t samples = 1000;
+    size_t sampleSize = 4;
+    auto left = pattern(samples * sampleSize, 1);
+    auto right = pattern(samples * sampleSize, 2);
+    const quint8 *planar[] {left.data(), right.data()};
+    std::vector<quint8> packed(channels * samples * sampleSize);
+    quint8 *interleaved[] {packed.data()};
+    AudioKernels::copy(planar,
+                       true,
+                       interleaved,
+                       false,
+                       channels,
+                       samples,
+                       sampleSize);
+
+    std::vector<quint8> outLeft(left.size());
+    std::vector<quint8> outRight(right.size());
+    quint8 *outPlanar[] {outLeft.data(), outRight.data()};
+    const quint8 *packedIn[] {packed.data()};
+    AudioKernels::copy(packedIn,
+                       false,
+                       outPlanar,
+                       true,
+                       channels,
+                       samples,
+                       sampleSize);
+    QVERIFY(outLeft == left);
+    QVERIFY(outRight == right);
+
+    // Mono is never planar.
+    std::vector<quint8> mono(samples * sampleSize);
+    quint8 *monoOut[] {mono.data()};
+    AudioKernels::copy(planar, true, monoOut, false, 1, samples, sampleSize);
+    QVERIFY(mono == left);
+}
+
+void TestAudioKernels::fltToS16()
+{
+    for (size_t samples = 0; samples <= MAX_SAMPLES; samples++) {
+        auto src = ramp(samples);
+        std::vector<qint16> dst(samples + 1, 0x5555);
+        QVERIFY(AudioKernels::convert(reinterpret_cast<const quint8 *>(src.data()),
+                                      AudioKernels::SampleFormat_flt,
+                                      reinterpret_cast<quint8 *>(dst.data()),
+                                      AudioKernels::SampleFormat_s16,
+                                      samples));
+
+        for (size_t i = 0; i < samples; i++) {
+            auto expected = std::nearbyint(qBound(-32768.0f,
+                                                  src[i] * 32768.0f,
+                                                  32767.0f));
+            QCOMPARE(dst[i], qint16(expected));
+        }
+
+        QCOMPARE(dst.back(), qint16(0x5555));
+    }
+
+    // Ties are rounded to even in every path.
+    float ties[] {0.5f / 32768, 1.5f / 32768, 2.5f / 32768, -0.5f / 32768,
+                  -1.5f / 32768, 3.5f / 32768, 4.5f / 32768, -2.5f / 32768,
+                  0.5f / 32768};
+    qint16 rounded[9];
+    AudioKernels::convert(reinterpret_cast<const quint8 *>(ties),
+                          AudioKernels::SampleFormat_flt,
+                          reinterpret_cast<quint8 *>(rounded),
+                          AudioKernels::SampleFormat_s16,
+                          9);
+    qint16 expected[] {0, 2, 2, 0, -2, 4, 4, -2, 0};
+
+    for (int i = 0; i < 9; i++)
+        QCOMPARE(rounded[i], expected[i]);
+}
+
+void TestAudioKernels::fltToS16Dither()
+{
+    // The vector and the scalar code must produce the same noise.
+    auto src = ramp(1000);
+    std::vector<qint16> dst(src.size());
+    AudioKernels::Dither dither;
+    AudioKernels::Dither reference;
+
+    for (int round = 0; round < 3; round++) {
+        // Odd sizes leave tails after the vector blocks.
+        size_t samples = 997 - size_t(round);
+        AudioKernels::convert(reinterpret_cast<const quint8 *>(src.data()),
+                              AudioKernels::SampleFormat_flt,
+                              reinterpret_cast<quint8 *>(dst.data()),
+                              AudioKernels::SampleFormat_s16,
+                              samples,
+                              &dither);
+
+        for (size_t i = 0; i < samples; i++) {
+            auto value = src[i] * 32768.0f + triangular(reference.state[i % 4]);
+            auto expected = std::nearbyint(qBound(-32768.0f, value, 32767.0f));
+            QCOMPARE(dst[i], qint16(expected));
+        }
+    }
+}
+
+void TestAudioKernels::s16ToFlt()
+{
+    for (size_t samples = 0; samples <= MAX_SAMPLES; samples++) {
+        std::vector<qint16> src(samples);
+
+        for (size_t i = 0; i < samples; i++)
+            src[i] = qint16(-32768 + int(i) * 1771);
+
+        std::vector<float> dst(samples + 1, 2.0f);
+        AudioKernels::convert(reinterpret_cast<const quint8 *>(src.data()),
+                              AudioKernels::SampleFormat_s16,
+                              reinterpret_cast<quint8 *>(dst.data()),
+                              AudioKernels::SampleFormat_flt,
+                              samples);
+
+        for (size_t i = 0; i < samples; i++)
+            QCOMPARE(dst[i], float(src[i]) / 32768.0f);
+
+        QCOMPARE(dst.back(), 2.0f);
+    }
+}
+
+void TestAudioKernels::fltToS32()
+{
+    for (size_t samples = 0; samples <= MAX_SAMPLES; samples++) {
+        auto src = ramp(samples);
+        std::vector<qint32> dst(samples + 1, 0x55555555);
+        AudioKernels::convert(reinterpret_cast<const quint8 *>(src.data()),
+                              AudioKernels::SampleFormat_flt,
+                              reinterpret_cast<quint8 *>(dst.data()),
+                              AudioKernels::SampleFormat_s32,
+                              samples);
+
+        for (size_t i = 0; i < samples; i++) {
+            auto expected = std::nearbyint(qBound(-2147483648.0f,
+                                                  src[i] * 2147483648.0f,
+                                                  2147483520.0f));
+            QCOMPARE(dst[i], qint32(expected));
+        }
+
+        QCOMPARE(dst.back(), qint32(0x55555555));
+    }
+}
+
+void TestAudioKernels::s32ToFlt()
+{
+    for (size_t samples = 0; samples <= MAX_SAMPLES; samples++) {
+        std::vector<qint32> src(samples);
+
+        for (size_t i = 0; i < samples; i++)
+            src[i] = qint32(-2147483647 + qint64(i) * 116069887);
+
+        std::vector<float> dst(samples + 1, 2.0f);
+        AudioKernels::convert(reinterpret_cast<const quint8 *>(src.data()),
+                              AudioKernels::SampleFormat_s32,
+                              reinterpret_cast<quint8 *>(dst.data()),
+                              AudioKernels::SampleFormat_flt,
+                              samples);
+
+        for (size_t i = 0; i < samples; i++)
+            QCOMPARE(dst[i], float(src[i]) / 2147483648.0f);
+
+        QCOMPARE(dst.back(), 2.0f);
+    }
+}
+
+void TestAudioKernels::u8RoundTrip()
+{
+    std::vector<quint8> src(256);
+
+    for (size_t i = 0; i < src.size(); i++)
+        src[i] = quint8(i);
+
+    std::vector<float> flt(src.size());
+    std::vector<quint8> dst(src.size());
+    AudioKernels::convert(src.data(),
+                          AudioKernels::SampleFormat_u8,
+                          reinterpret_cast<quint8 *>(flt.data()),
+                          AudioKernels::SampleFormat_flt,
+                          src.size());
+    QCOMPARE(flt[128], 0.0f);
+    QCOMPARE(flt[0], -1.0f);
+    AudioKernels::convert(reinterpret_cast<const quint8 *>(flt.data()),
+                          AudioKernels::SampleFormat_flt,
+                          dst.data(),
+                          AudioKernels::SampleFormat_u8,
+                          src.size());
+    QVERIFY(dst == src);
+}
+
+void TestAudioKernels::ditherOnlyWhenNarrowing()
+{
+    std::vector<qint16> src {1, -1, 1000, -1000, 32767, -32768, 7, 0};
+    std::vector<qint32> dst(src.size());
+    AudioKernels::Dither dither;
+    AudioKernels::convert(reinterpret_cast<const quint8 *>(src.data()),
+                          AudioKernels::SampleFormat_s16,
+                          reinterpret_cast<quint8 *>(dst.data()),
+                          AudioKernels::SampleFormat_s32,
+                          src.size(),
+                          &dither);
+
+    for (size_t i = 0; i < src.size(); i++)
+        QCOMPARE(dst[i], qint32(src[i]) * 65536);
+
+    // The state wasn't touched either.
+    QCOMPARE(dither.state[0], AudioKernels::Dither().state[0]);
+}
+
+void TestAudioKernels::invalidFormats()
+{
+    quint8 src[4] {};
+    quint8 dst[4] {};
+    QVERIFY(!AudioKernels::convert(src,
+                                   AudioKernels::SampleFormat_none,
+                                   dst,
+                                   AudioKernels::SampleFormat_s16,
+                                   1));
+    QVERIFY(!AudioKernels::convert(src,
+                                   AudioKernels::SampleFormat_s16,
+                                   dst,
+                                   AudioKernels::SampleFormat_none,
+                                   1));
+}
+
+QTEST_GUILESS_MAIN(TestAudioKernels)
+
+#include "tst_audiokernels.moc"
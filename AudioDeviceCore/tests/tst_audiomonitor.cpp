@@ -0,0 +1,246 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <QtTest>
+
+#include "audiomonitor.h"
+
+using Clock = std::chrono::steady_clock;
+
+class TestAudioMonitor: public QObject
+{
+    Q_OBJECT
+
+    private:
+        static void writeRamp(AudioMonitor &monitor,
+                              size_t frames,
+                              float *next);
+
+    private slots:
+        void passThrough();
+        void renderFillsWholeRequest();
+        void boundedLatency();
+        void resetStats();
+        void channelMapAndGain();
+        void planarS16Output();
+        void simulatedCallbacks();
+};
+
+void TestAudioMonitor::writeRamp(AudioMonitor &monitor,
+                                 size_t frames,
+                                 float *next)
+{
+    // Mono input, each frame one step above the previous one.
+    std::vector<float> in(frames);
+
+    for (auto &sample: in) {
+        sample = *next;
+        *next += 1.0f;
+    }
+
+    const quint8 *planes[] {reinterpret_cast<const quint8 *>(in.data())};
+    monitor.write(planes, false, AudioKernels::SampleFormat_flt, frames);
+}
+
+void TestAudioMonitor::passThrough()
+{
+    AudioMonitor monitor;
+    monitor.configure(1, 1, 64, 64, 128);
+    float next = 1.0f;
+    writeRamp(monitor, 64, &next);
+
+    std::vector<float> out(64);
+    quint8 *planes[] {reinterpret_cast<quint8 *>(out.data())};
+    QCOMPARE(monitor.render(planes, false, AudioKernels::SampleFormat_flt, 64),
+             size_t(64));
+
+    for (size_t i = 0; i < out.size(); i++)
+        QCOMPARE(out[i], float(i + 1));
+
+    QCOMPARE(monitor.underruns(), quint64(0));
+}
+
+void TestAudioMonitor::renderFillsWholeRequest()
+{
+    // Ask for more than the buffers of the monitor can hold at once.
+    AudioMonitor monitor;
+    monitor.configure(1, 2, 64, 64, 128);
+    float next = 1.0f;
+    writeRamp(monitor, 128, &next);
+
+    std::vector<float> out(2 * 300, -1.0f);
+    quint8 *planes[] {reinterpret_cast<quint8 *>(out.data())};
+    QCOMPARE(monitor.render(planes, false, AudioKernels::SampleFormat_flt, 300),
+             size_t(128));
+
+    for (size_t i = 0; i < 128; i++) {
+        QCOMPARE(out[2 * i], float(i + 1));
+        QCOMPARE(out[2 * i + 1], float(i + 1));
+    }
+
+    // The rest is silence, never stale data.
+    for (size_t i = 2 * 128; i < out.size(); i++)
+        QCOMPARE(out[i], 0.0f);
+}
+
+void TestAudioMonitor::boundedLatency()
+{
+    AudioMonitor monitor;
+    monitor.configure(1, 1, 64, 64, 256);
+    QCOMPARE(monitor.maxLatency(), size_t(128));
+
+    // The output stalled, only the newest two periods are played.
+    float next = 1.0f;
+    writeRamp(monitor, 256, &next);
+
+    std::vector<float> out(64);
+    quint8 *planes[] {reinterpret_cast<quint8 *>(out.data())};
+    monitor.render(planes, false, AudioKernels::SampleFormat_flt, 64);
+    QCOMPARE(out[0], 129.0f);
+    QCOMPARE(monitor.droppedFrames(), quint64(128));
+}
+
+void TestAudioMonitor::resetStats()
+{
+    AudioMonitor monitor;
+    monitor.configure(1, 1, 64, 64, 256);
+    float next = 1.0f;
+    writeRamp(monitor, 256, &next);
+
+    // Drops the oldest samples, then runs out of them.
+    std::vector<float> out(256);
+    quint8 *planes[] {reinterpret_cast<quint8 *>(out.data())};
+    monitor.render(planes, false, AudioKernels::SampleFormat_flt, 256);
+    QVERIFY(monitor.droppedFrames() > 0);
+    QVERIFY(monitor.underruns() > 0);
+
+    monitor.resetStats();
+    QCOMPARE(monitor.droppedFrames(), quint64(0));
+    QCOMPARE(monitor.underruns(), quint64(0));
+}
+
+void TestAudioMonitor::channelMapAndGain()
+{
+    AudioMonitor monitor;
+    monitor.configure(2, 3, 16, 16, 32);
+    monitor.setGain(0.5);
+    monitor.setChannelMap({1, -1});
+
+    std::vector<float> in {0.2f, 0.4f, 0.2f, 0.4f};
+    const quint8 *inPlanes[] {reinterpret_cast<const quint8 *>(in.data())};
+    monitor.write(inPlanes, false, AudioKernels::SampleFormat_flt, 2);
+
+    std::vector<float> out(6);
+    quint8 *outPlanes[] {reinterpret_cast<quint8 *>(out.data())};
+    QCOMPARE(monitor.render(outPlanes, false, AudioKernels::SampleFormat_flt, 2),
+             size_t(2));
+
+    // Channel 0 plays input 1, channel 1 is muted, channel 2 plays input 0.
+    for (int i = 0; i < 2; i++) {
+        QCOMPARE(out[3 * i], 0.2f);
+        QCOMPARE(out[3 * i + 1], 0.0f);
+        QCOMPARE(out[3 * i + 2], 0.1f);
+    }
+}
+
+void TestAudioMonitor::planarS16Output()
+{
+    AudioMonitor monitor;
+    monitor.configure(1, 2, 32, 32, 64);
+    std::vector<float> in(64, 0.5f);
+    const quint8 *inPlanes[] {reinterpret_cast<const quint8 *>(in.data())};
+    monitor.write(inPlanes, false, AudioKernels::SampleFormat_flt, 64);
+
+    // More frames than fit in a chunk, so the plane offsets are checked too.
+    std::vector<qint16> left(100, -1);
+    std::vector<qint16> right(100, -1);
+    quint8 *outPlanes[] {reinterpret_cast<quint8 *>(left.data()),
+                         reinterpret_cast<quint8 *>(right.data())};
+    QCOMPARE(monitor.render(outPlanes, true, AudioKernels::SampleFormat_s16, 100),
+             size_t(64));
+
+    for (size_t i = 0; i < 100; i++) {
+        auto expected = i < 64? qint16(16384): qint16(0);
+        QVERIFY(qAbs(left[i] - expected) <= 1);
+        QVERIFY(qAbs(right[i] - expected) <= 1);
+    }
+}
+
+void TestAudioMonitor::simulatedCallbacks()
+{
+    /* A 48 kHz input delivering 480 frames every 10 ms and an output pulling
+     * 256 frames every 5.33 ms, both from their own threads. The output must
+     * play the input in order, and stay within the latency bound.
+     */
+    AudioMonitor monitor;
+    monitor.configure(1, 1, 480, 256, 512);
+    std::atomic<bool> running {true};
+    auto start = Clock::now();
+
+    std::thread input([&] () {
+        float next = 1.0f;
+        auto wakeUp = start;
+
+        while (running) {
+            wakeUp += std::chrono::microseconds(10000);
+            std::this_thread::sleep_until(wakeUp);
+            writeRamp(monitor, 480, &next);
+        }
+    });
+
+    std::vector<float> out(256);
+    quint8 *planes[] {reinterpret_cast<quint8 *>(out.data())};
+    auto wakeUp = start;
+    float last = 0.0f;
+    size_t callbacks = 0;
+    size_t played = 0;
+    bool ordered = true;
+
+    for (; callbacks < 375; callbacks++) {
+        wakeUp += std::chrono::microseconds(5333);
+        std::this_thread::sleep_until(wakeUp);
+        auto read = monitor.render(planes,
+                                   false,
+                                   AudioKernels::SampleFormat_flt,
+                                   256);
+        played += read;
+
+        for (size_t i = 0; i < read; i++) {
+            ordered = ordered && out[i] > last;
+            last = out[i];
+        }
+    }
+
+    running = false;
+    input.join();
+
+    QVERIFY(ordered);
+
+    // About 2 s of audio, allow for some scheduling hiccups.
+    QVERIFY(played > 90 * callbacks * 256 / 100);
+    QVERIFY(monitor.underruns() < callbacks / 20);
+}
+
+QTEST_GUILESS_MAIN(TestAudioMonitor)
+
+#include "tst_audiomonitor.moc"
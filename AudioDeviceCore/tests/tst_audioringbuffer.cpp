@@ -0,0 +1,291 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <QtTest>
+
+#include "audioringbuffer.h"
+
+class TestAudioRingBuffer: public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void resize();
+        void readWrite();
+        void wrapAround();
+        void planar();
+        void reserveCommit();
+        void waitTimeout();
+        void waitWakesOnCommit();
+        void waitWakesOnDiscard();
+        void noLostWakeUps();
+        void multipleWaiters();
+        void abortReleasesWaiters();
+};
+
+void TestAudioRingBuffer::resize()
+{
+    AudioRingBuffer ring;
+    ring.resize(4, 1000, 2);
+    QCOMPARE(ring.frameSize(), size_t(4));
+    QCOMPARE(ring.planes(), size_t(2));
+    QCOMPARE(ring.capacity(), size_t(1024));
+    QCOMPARE(ring.readAvailable(), size_t(0));
+    QCOMPARE(ring.writeAvailable(), size_t(1024));
+
+    ring.resize(0, 0);
+    QCOMPARE(ring.capacity(), size_t(0));
+    QCOMPARE(ring.planes(), size_t(0));
+}
+
+void TestAudioRingBuffer::readWrite()
+{
+    AudioRingBuffer ring;
+    ring.resize(sizeof(qint32), 8);
+    qint32 in[] {1, 2, 3, 4, 5};
+    QCOMPARE(ring.write(in, 5), size_t(5));
+    QCOMPARE(ring.readAvailable(), size_t(5));
+    QCOMPARE(ring.writeAvailable(), size_t(3));
+
+    // Writes never overwrite unread frames.
+    QCOMPARE(ring.write(in, 5), size_t(3));
+
+    qint32 out[8] {};
+    QCOMPARE(ring.read(out, 8), size_t(8));
+
+    qint32 expected[] {1, 2, 3, 4, 5, 1, 2, 3};
+
+    for (int i = 0; i < 8; i++)
+        QCOMPARE(out[i], expected[i]);
+
+    QCOMPARE(ring.read(out, 1), size_t(0));
+    QCOMPARE(ring.readPosition(), size_t(8));
+    QCOMPARE(ring.writePosition(), size_t(8));
+}
+
+void TestAudioRingBuffer::wrapAround()
+{
+    AudioRingBuffer ring;
+    ring.resize(sizeof(qint32), 16);
+    qint32 next = 0;
+    qint32 expected = 0;
+
+    // Odd chunk sizes so the copies cross the end of the buffer.
+    for (int i = 0; i < 1000; i++) {
+        qint32 in[7];
+
+        for (auto &value: in)
+            value = next++;
+
+        QCOMPARE(ring.write(in, 7), size_t(7));
+
+        qint32 out[7];
+        QCOMPARE(ring.read(out, 7), size_t(7));
+
+        for (auto &value: out)
+            QCOMPARE(value, expected++);
+    }
+}
+
+void TestAudioRingBuffer::planar()
+{
+    AudioRingBuffer ring;
+    ring.resize(sizeof(qint16), 4, 2);
+    qint16 left[] {1, 2, 3};
+    qint16 right[] {-1, -2, -3};
+    const void *in[] {left, right};
+    QCOMPARE(ring.write(in, 3), size_t(3));
+
+    qint16 outLeft[3] {};
+    qint16 outRight[3] {};
+    void *out[] {outLeft, outRight};
+    QCOMPARE(ring.read(out, 3), size_t(3));
+
+    for (int i = 0; i < 3; i++) {
+        QCOMPARE(outLeft[i], left[i]);
+        QCOMPARE(outRight[i], right[i]);
+    }
+}
+
+void TestAudioRingBuffer::reserveCommit()
+{
+    AudioRingBuffer ring;
+    ring.resize(1, 8);
+    quint8 in[6] {};
+    ring.write(in, 6);
+    ring.discard(6);
+
+    // 2 frames at the end of the buffer and 4 at the start.
+    AudioRingBufferSegment segments[2];
+    QCOMPARE(ring.reserve(6, segments), size_t(6));
+    QCOMPARE(segments[0].offset, size_t(6));
+    QCOMPARE(segments[0].frames, size_t(2));
+    QCOMPARE(segments[1].offset, size_t(0));
+    QCOMPARE(segments[1].frames, size_t(4));
+
+    // Nothing is visible until committed.
+    QCOMPARE(ring.readAvailable(), size_t(0));
+    ring.commit(6);
+    QCOMPARE(ring.readAvailable(), size_t(6));
+    QCOMPARE(ring.peek(8, segments), size_t(6));
+    QCOMPARE(segments[0].offset, size_t(6));
+    QCOMPARE(ring.discard(8), size_t(6));
+}
+
+void TestAudioRingBuffer::waitTimeout()
+{
+    AudioRingBuffer ring;
+    ring.resize(1, 8);
+    auto start = std::chrono::steady_clock::now();
+    QVERIFY(!ring.waitForData(1, 50));
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    QVERIFY(elapsed >= std::chrono::milliseconds(45));
+
+    // Already satisfied waits return at once, even with no time out.
+    QVERIFY(ring.waitForSpace(8, 0));
+}
+
+void TestAudioRingBuffer::waitWakesOnCommit()
+{
+    AudioRingBuffer ring;
+    ring.resize(1, 8);
+    std::atomic<bool> woken {false};
+
+    std::thread waiter([&ring, &woken] () {
+        woken = ring.waitForData(4, -1);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    quint8 in[4] {};
+    ring.write(in, 3);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    QVERIFY(!woken);
+    ring.write(in, 1);
+    waiter.join();
+    QVERIFY(woken);
+}
+
+void TestAudioRingBuffer::waitWakesOnDiscard()
+{
+    AudioRingBuffer ring;
+    ring.resize(1, 8);
+    quint8 in[8] {};
+    ring.write(in, 8);
+    std::atomic<bool> woken {false};
+
+    std::thread waiter([&ring, &woken] () {
+        woken = ring.waitForSpace(2, -1);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ring.discard(2);
+    waiter.join();
+    QVERIFY(woken);
+}
+
+void TestAudioRingBuffer::noLostWakeUps()
+{
+    /* Ping-pong one frame at a time between two threads with waits that never
+     * time out. A single lost wake up hangs the test.
+     */
+    AudioRingBuffer ping;
+    AudioRingBuffer pong;
+    ping.resize(sizeof(int), 1);
+    pong.resize(sizeof(int), 1);
+    const int rounds = 20000;
+    bool ok = true;
+
+    std::thread echo([&ping, &pong, &ok] () {
+        for (int i = 0; i < rounds; i++) {
+            int value = 0;
+
+            if (!ping.waitForData(1, -1) || ping.read(&value, 1) != 1) {
+                ok = false;
+
+                break;
+            }
+
+            pong.write(&value, 1);
+        }
+    });
+
+    for (int i = 0; i < rounds; i++) {
+        ping.write(&i, 1);
+        int value = -1;
+        QVERIFY(pong.waitForData(1, -1));
+        QCOMPARE(pong.read(&value, 1), size_t(1));
+        QCOMPARE(value, i);
+    }
+
+    echo.join();
+    QVERIFY(ok);
+}
+
+void TestAudioRingBuffer::multipleWaiters()
+{
+    // The playback writer and the low watermark notifier wait together.
+    AudioRingBuffer ring;
+    ring.resize(1, 8);
+    quint8 in[8] {};
+    ring.write(in, 8);
+    std::atomic<int> woken {0};
+    std::vector<std::thread> waiters;
+
+    for (int i = 0; i < 3; i++)
+        waiters.emplace_back([&ring, &woken] () {
+            if (ring.waitForSpace(4, -1))
+                woken++;
+        });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ring.discard(4);
+
+    for (auto &waiter: waiters)
+        waiter.join();
+
+    QCOMPARE(woken.load(), 3);
+}
+
+void TestAudioRingBuffer::abortReleasesWaiters()
+{
+    AudioRingBuffer ring;
+    ring.resize(1, 8);
+    std::atomic<int> result {-1};
+
+    std::thread waiter([&ring, &result] () {
+        result = ring.waitForData(1, -1)? 1: 0;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ring.abort();
+    waiter.join();
+    QCOMPARE(result.load(), 0);
+
+    // Waits fail at once until the ring is cleared.
+    QVERIFY(!ring.waitForData(1, -1));
+    ring.clear();
+    QVERIFY(!ring.waitForData(1, 10));
+}
+
+QTEST_GUILESS_MAIN(TestAudioRingBuffer)
+
+#include "tst_audioringbuffer.moc"
@@ -0,0 +1,203 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <cmath>
+#include <vector>
+#include <QtTest>
+
+#include "audiostreamaligner.h"
+
+#define RATE      48000
+#define PERIOD    480
+#define FREQUENCY 220.0
+
+/* A device of the simulation. All devices capture the same tone, so once
+ * aligned, the channels of every stream must be the same.
+ */
+struct SimulatedDevice
+{
+    qreal rate;         // Real rate in samples per second of host time.
+    qint64 startTime;   // Host time of the first sample, in nanoseconds.
+    qint64 latency;     // Delay of the callback after the period ends.
+    quint64 position {0};
+
+    qint64 time(quint64 sample) const
+    {
+        return this->startTime + qint64(1e9 * qreal(sample) / this->rate);
+    }
+
+    // Pushes all the periods already delivered at the host time now.
+    void deliver(AudioStreamAligner &aligner, int stream, qint64 now)
+    {
+        std::vector<float> samples(PERIOD);
+
+        while (this->time(this->position + PERIOD) + this->latency <= now) {
+            for (size_t i = 0; i < PERIOD; i++) {
+                auto t = qreal(this->time(this->position + i)) / 1e9;
+                samples[i] = float(std::sin(2.0 * M_PI * FREQUENCY * t));
+            }
+
+            aligner.push(stream,
+                         samples.data(),
+                         PERIOD,
+                         this->time(this->position),
+                         this->position);
+            this->position += PERIOD;
+        }
+    }
+};
+
+class TestAudioStreamAligner: public QObject
+{
+    Q_OBJECT
+
+    private:
+        /* Runs the simulation for the given seconds from now, and returns the
+         * RMS difference between the reference and the other stream in the
+         * last measure seconds.
+         */
+        static qreal simulate(AudioStreamAligner &aligner,
+                              qint64 &now,
+                              SimulatedDevice &reference,
+                              SimulatedDevice &device,
+                              qreal seconds,
+                              qreal measure,
+                              size_t *silence=nullptr);
+
+    private slots:
+        void passesReferenceThrough();
+        void followsDriftingDevice();
+        void alignsLateStart();
+        void realignsAfterJump();
+};
+
+qreal TestAudioStreamAligner::simulate(AudioStreamAligner &aligner,
+                                       qint64 &now,
+                                       SimulatedDevice &reference,
+                                       SimulatedDevice &device,
+                                       qreal seconds,
+                                       qreal measure,
+                                       size_t *silence)
+{
+    auto end = now + qint64(seconds * 1e9);
+    auto measureStart = end - qint64(measure * 1e9);
+    std::vector<float> out(2 * RATE);
+    qreal error = 0.0;
+    size_t measured = 0;
+
+    if (silence)
+        *silence = 0;
+
+    // The reading thread wakes up every 10 ms.
+    for (; now < end; now += 10000000) {
+        reference.deliver(aligner, 0, now);
+        device.deliver(aligner, 1, now);
+        auto available = aligner.available();
+
+        if (available < 1)
+            continue;
+
+        qint64 pts = 0;
+        auto frames = aligner.pull(out.data(), available, &pts);
+
+        if (pts < measureStart)
+            continue;
+
+        for (size_t i = 0; i < frames; i++) {
+            auto diff = qreal(out[2 * i] - out[2 * i + 1]);
+            error += diff * diff;
+
+            if (silence && out[2 * i + 1] == 0.0f)
+                (*silence)++;
+        }
+
+        measured += frames;
+    }
+
+    return measured > 0? std::sqrt(error / qreal(measured)): 1.0;
+}
+
+void TestAudioStreamAligner::passesReferenceThrough()
+{
+    AudioStreamAligner aligner;
+    aligner.configure({1}, RATE, RATE / 10);
+    std::vector<float> in(PERIOD);
+
+    for (size_t i = 0; i < PERIOD; i++)
+        in[i] = float(i);
+
+    aligner.push(0, in.data(), PERIOD, 1000000000, 0);
+    QCOMPARE(aligner.available(), size_t(PERIOD));
+
+    std::vector<float> out(PERIOD);
+    qint64 pts = 0;
+    QCOMPARE(aligner.pull(out.data(), PERIOD, &pts), size_t(PERIOD));
+    QCOMPARE(pts, qint64(1000000000));
+    QVERIFY(out == in);
+}
+
+void TestAudioStreamAligner::followsDriftingDevice()
+{
+    // The second device runs 300 ppm fast, 14 samples per second.
+    for (auto ppm: {300.0, -300.0}) {
+        AudioStreamAligner aligner;
+        aligner.configure({1, 1}, RATE, RATE / 10);
+        SimulatedDevice reference {RATE, 1000000000000, 2000000};
+        SimulatedDevice device {RATE * (1.0 + ppm / 1e6), 1000000000000, 3000000};
+        auto now = reference.startTime;
+        size_t silence = 0;
+        auto error = simulate(aligner, now, reference, device, 30.0, 10.0, &silence);
+
+        // Well under -40 dB of a full scale tone.
+        QVERIFY(error < 0.01);
+        QCOMPARE(silence, size_t(0));
+        QVERIFY(qAbs(aligner.rate(1) / aligner.rate(0) - device.rate / RATE) < 5e-6);
+    }
+}
+
+void TestAudioStreamAligner::alignsLateStart()
+{
+    // The second device starts 37 ms after the reference.
+    AudioStreamAligner aligner;
+    aligner.configure({1, 1}, RATE, RATE / 10);
+    SimulatedDevice reference {RATE, 1000000000000, 2000000};
+    SimulatedDevice device {RATE * 1.0001, 1000037000000, 2000000};
+    auto now = reference.startTime;
+    QVERIFY(simulate(aligner, now, reference, device, 20.0, 5.0) < 0.01);
+}
+
+void TestAudioStreamAligner::realignsAfterJump()
+{
+    AudioStreamAligner aligner;
+    aligner.configure({1, 1}, RATE, RATE / 10);
+    SimulatedDevice reference {RATE, 1000000000000, 2000000};
+    SimulatedDevice device {RATE * 1.0002, 1000000000000, 2000000};
+    auto now = reference.startTime;
+    QVERIFY(simulate(aligner, now, reference, device, 10.0, 5.0) < 0.01);
+
+    /* The device loses 100 ms of samples, so its timestamps jump ahead of the
+     * expected ones.
+     */
+    device.position += RATE / 10;
+    QVERIFY(simulate(aligner, now, reference, device, 10.0, 5.0) < 0.01);
+}
+
+QTEST_GUILESS_MAIN(TestAudioStreamAligner)
+
+#include "tst_audiostreamaligner.moc"
@@ -17,20 +17,56 @@
  * Web-Site: http://webcamoid.github.io/
  */
 
+#include <atomic>
+#include <QDebug>
+#include <QDeadlineTimer>
+#include <QFuture>
 #include <QMap>
 #include <QMutex>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtConcurrent>
 #include <QVector>
-#include <QWaitCondition>
+#include <ak.h>
 #include <akaudiocaps.h>
 #include <akaudiopacket.h>
+#include <akfrac.h>
 #include <CoreAudio/CoreAudio.h>
 #include <AudioUnit/AudioUnit.h>
 
 #include "audiodevcoreaudio.h"
+#include "audiodevicebuffer.h"
+#include "audiokernels.h"
+#include "audiomonitor.h"
+#include "audioringbuffer.h"
+#include "audiostats.h"
+#include "audiostreamaligner.h"
 
 #define OUTPUT_DEVICE 0
 #define INPUT_DEVICE  1
 
+// Devices that fail to be probed are tried again this many times, in ms.
+#define PROBE_RETRY_INTERVAL 1000
+#define MAX_PROBE_RETRIES    10
+
+// Result of probing the streams of a device in one direction.
+enum StreamsStatus
+{
+    StreamsStatusUsable,
+    StreamsStatusNone,      // The device has no streams in this direction.
+    StreamsStatusFailed     // The device didn't answer, maybe still starting.
+};
+
+// Capabilities of a device, probed the first time they are requested.
+struct AudioDeviceCapabilities
+{
+    AkAudioCaps defaultCaps;
+    QList<AkAudioCaps::SampleFormat> formats;
+    QList<AkAudioCaps::ChannelLayout> layouts;
+    QList<int> sampleRates;
+    bool probed {false};
+};
+
 class AudioDevCoreAudioPrivate
 {
     public:
@@ -41,27 +77,60 @@ class AudioDevCoreAudioPrivate
         QStringList m_sources;
         QStringList m_sinks;
         QMap<QString, QString> m_descriptionMap;
-        QMap<QString, AkAudioCaps> m_defaultCaps;
-        QMap<QString, QList<AkAudioCaps::SampleFormat>> m_supportedFormats;
-        QMap<QString, QList<AkAudioCaps::ChannelLayout>> m_supportedLayouts;
-        QMap<QString, QList<int>> m_supportedSampleRates;
+        QMap<QString, AudioDeviceCapabilities> m_capabilities;
+        QVector<AudioDeviceID> m_devices;
+        QVector<AudioDeviceID> m_pendingDevices;
+        int m_probeRetries {0};
+        mutable QMutex m_devicesMutex;
         AudioUnit m_audioUnit {nullptr};
         UInt32 m_bufferSize {0};
+        UInt32 m_maxBufferSize {0};
         AudioBufferList *m_bufferList {nullptr};
-        QByteArray m_buffer;
-        QMutex m_mutex;
-        QWaitCondition m_canWrite;
-        QWaitCondition m_samplesAvailable;
-        AkAudioCaps m_curCaps;
+        QByteArray m_renderBuffer;
+        AudioDeviceBuffer m_buffer;
+        QVector<void *> m_callbackPlanes;
+        QThreadPool m_threadPool;
+        QFuture<void> m_notifierStatus;
+        std::atomic<bool> m_runNotifier {false};
+        std::atomic<int> m_lowWatermark {0};
+        QVector<AudioDevCoreAudio *> m_syncDevices;
+        AudioStreamAligner m_aligner;
+        AkAudioCaps m_syncCaps;
+        quint64 m_syncSamples {0};
+        QVector<AudioDevCoreAudio *> m_monitorDevices;
+        AudioMonitor m_monitor;
+        std::atomic<AudioMonitor *> m_monitorInput {nullptr};
+        std::atomic<AudioMonitor *> m_monitorOutput {nullptr};
+        bool m_monitorDevice {false};
+        QList<int> m_monitorChannelMap;
+        qreal m_monitorGain {1.0};
+        quint64 m_samplePosition {0};
+        qint64 m_id {-1};
+        qreal m_achievedLatency {0.0};
         int m_samples {0};
-        int m_maxBufferSize {0};
         bool m_isInput {false};
 
         explicit AudioDevCoreAudioPrivate(AudioDevCoreAudio *self);
         static QString statusToStr(OSStatus status);
         static QString CFStringToString(const CFStringRef &cfstr);
         static QString defaultDevice(bool input, bool *ok=nullptr);
-        void clearBuffer();
+        static QVector<AudioDeviceID> devices();
+        static StreamsStatus streamsStatus(AudioDeviceID deviceId,
+                                           AudioObjectPropertyScope scope);
+        static QString deviceName(AudioDeviceID deviceId,
+                                  AudioObjectPropertyScope scope);
+        AudioDeviceCapabilities capabilities(const QString &device);
+        static AudioValueRange bufferFrameSizeRange(AudioDeviceID deviceId,
+                                                    bool input);
+        static UInt32 deviceProperty(AudioDeviceID deviceId,
+                                     AudioObjectPropertySelector selector,
+                                     bool input);
+        void setAchievedLatency(qreal achievedLatency);
+        bool deviceDescription(bool input,
+                               AudioStreamBasicDescription *description) const;
+        bool isDevicePlanar(bool input) const;
+        AkAudioPacket readSynchronized(int timeout);
+        void pushSynchronized(int stream, const AkAudioPacket &packet);
         QList<AkAudioCaps::SampleFormat> supportedCAFormats(AudioDeviceID deviceId,
                                                             AudioObjectPropertyScope scope);
         QList<AkAudioCaps::ChannelLayout> supportedCALayouts(AudioDeviceID deviceId,
@@ -87,6 +156,11 @@ class AudioDevCoreAudioPrivate
                                       UInt32 busNumber,
                                       UInt32 nFrames,
                                       AudioBufferList *data);
+        OSStatus capture(AudioUnitRenderActionFlags *actionFlags,
+                         const AudioTimeStamp *timeStamp,
+                         UInt32 busNumber,
+                         UInt32 nFrames);
+        OSStatus playback(UInt32 nFrames, AudioBufferList *data);
 };
 
 AudioDevCoreAudio::AudioDevCoreAudio(QObject *parent):
@@ -187,37 +261,43 @@ QString AudioDevCoreAudio::defaultOutput()
 
 QStringList AudioDevCoreAudio::inputs()
 {
+    QMutexLocker mutexLocker(&this->d->m_devicesMutex);
+
     return this->d->m_sources;
 }
 
 QStringList AudioDevCoreAudio::outputs()
 {
+    QMutexLocker mutexLocker(&this->d->m_devicesMutex);
+
     return this->d->m_sinks;
 }
 
 QString AudioDevCoreAudio::description(const QString &device)
 {
+    QMutexLocker mutexLocker(&this->d->m_devicesMutex);
+
     return this->d->m_descriptionMap.value(device);
 }
 
 AkAudioCaps AudioDevCoreAudio::preferredFormat(const QString &device)
 {
-    return this->d->m_defaultCaps.value(device);
+    return this->d->capabilities(device).defaultCaps;
 }
 
 QList<AkAudioCaps::SampleFormat> AudioDevCoreAudio::supportedFormats(const QString &device)
 {
-    return this->d->m_supportedFormats.value(device);
+    return this->d->capabilities(device).formats;
 }
 
 QList<AkAudioCaps::ChannelLayout> AudioDevCoreAudio::supportedChannelLayouts(const QString &device)
 {
-    return this->d->m_supportedLayouts.value(device);
+    return this->d->capabilities(device).layouts;
 }
 
 QList<int> AudioDevCoreAudio::supportedSampleRates(const QString &device)
 {
-    return this->d->m_supportedSampleRates.value(device);
+    return this->d->capabilities(device).sampleRates;
 }
 
 bool AudioDevCoreAudio::init(const QString &device, const AkAudioCaps &caps)
@@ -344,18 +424,40 @@ bool AudioDevCoreAudio::init(const QString &device, const AkAudioCaps &caps)
         return false;
     }
 
+    /* Open the device in its native sample format, the samples are converted
+     * by our own kernels when reading or writing, out of the real-time
+     * thread. The unit only converts the sample rate and the channels.
+     */
+    auto deviceFormat = caps.format();
+    qreal deviceRate = 0;
+    AudioStreamBasicDescription nativeDescription;
+
+    if (this->d->deviceDescription(input, &nativeDescription)) {
+        // The sample times of the callback are counted at this rate.
+        deviceRate = nativeDescription.mSampleRate;
+        auto nativeFormat =
+                this->d->descriptionToSampleFormat(nativeDescription);
+
+        if (AudioDeviceBuffer::kernelFormat(nativeFormat) != AudioKernels::SampleFormat_none
+            && AudioDeviceBuffer::kernelFormat(caps.format()) != AudioKernels::SampleFormat_none)
+            deviceFormat = nativeFormat;
+    }
+
     AudioFormatFlags sampleType =
-            AkAudioCaps::sampleType(caps.format()) == AkAudioCaps::SampleType_float?
+            AkAudioCaps::sampleType(deviceFormat) == AkAudioCaps::SampleType_float?
             kAudioFormatFlagIsFloat:
-            AkAudioCaps::sampleType(caps.format()) == AkAudioCaps::SampleType_int?
+            AkAudioCaps::sampleType(deviceFormat) == AkAudioCaps::SampleType_int?
             kAudioFormatFlagIsSignedInteger:
             0;
     AudioFormatFlags sampleEndianness =
-            AkAudioCaps::endianness(caps.format()) == Q_BIG_ENDIAN?
+            AkAudioCaps::endianness(deviceFormat) == Q_BIG_ENDIAN?
                 kAudioFormatFlagIsBigEndian: 0;
+
+    // Use the same layout as the device, if it doesn't match the requested
+    // one the samples will be converted when reading or writing the buffer.
+    bool devicePlanar = this->d->isDevicePlanar(input) && caps.channels() > 1;
     AudioFormatFlags sampleIsPlanar =
-            caps.planar()?
-                kAudioFormatFlagIsNonInterleaved: 0;
+            devicePlanar? kAudioFormatFlagIsNonInterleaved: 0;
 
     AudioStreamBasicDescription streamDescription;
     streamDescription.mSampleRate = caps.rate();
@@ -366,8 +468,10 @@ bool AudioDevCoreAudio::init(const QString &device, const AkAudioCaps &caps)
                                    | sampleIsPlanar;
     streamDescription.mFramesPerPacket = 1;
     streamDescription.mChannelsPerFrame = UInt32(caps.channels());
-    streamDescription.mBitsPerChannel = UInt32(AkAudioCaps::bitsPerSample(caps.format()));
-    streamDescription.mBytesPerFrame = streamDescription.mChannelsPerFrame
+    streamDescription.mBitsPerChannel = UInt32(AkAudioCaps::bitsPerSample(deviceFormat));
+    streamDescription.mBytesPerFrame = (devicePlanar?
+                                            1:
+                                            streamDescription.mChannelsPerFrame)
                                      * streamDescription.mBitsPerChannel
                                      / 8;
     streamDescription.mBytesPerPacket = streamDescription.mFramesPerPacket
@@ -392,7 +496,30 @@ bool AudioDevCoreAudio::init(const QString &device, const AkAudioCaps &caps)
         return false;
     }
 
-    UInt32 bufferSize = 0; // In N° of frames
+    // Half of the target latency goes to the device period, and the other
+    // half to the chunks exchanged through the ring.
+    auto targetSamples = qMax(this->latency() * caps.rate() / 1000, 1);
+    auto bufferSizeRange = this->d->bufferFrameSizeRange(deviceID, input);
+    UInt32 bufferSize = UInt32(qMax(targetSamples / 2, 1));
+
+    if (bufferSizeRange.mMaximum > 0)
+        bufferSize = qBound(UInt32(bufferSizeRange.mMinimum),
+                            bufferSize,
+                            UInt32(bufferSizeRange.mMaximum));
+
+    status = AudioUnitSetProperty(this->d->m_audioUnit,
+                                  kAudioDevicePropertyBufferFrameSize,
+                                  kAudioUnitScope_Global,
+                                  0,
+                                  &bufferSize,
+                                  sizeof(UInt32));
+
+    if (status != noErr)
+        qWarning() << "Can't set the buffer size:"
+                   << this->d->statusToStr(status);
+
+    // Read back the buffer size actually used by the device.
+    bufferSize = 0; // In N° of frames
     UInt32 vSize = sizeof(UInt32);
 
     status = AudioUnitGetProperty(this->d->m_audioUnit,
@@ -410,6 +537,66 @@ bool AudioDevCoreAudio::init(const QString &device, const AkAudioCaps &caps)
         return false;
     }
 
+    this->d->m_isInput = input;
+    this->d->m_id = Ak::id();
+    this->d->m_samplePosition = 0;
+    this->d->m_samples = int(bufferSize);
+
+    // The buffers must be allocated before the callback starts running.
+    this->d->m_buffer.configure(caps,
+                                deviceFormat,
+                                devicePlanar,
+                                bufferSize,
+                                size_t(qMax(targetSamples, int(bufferSize))),
+                                deviceRate);
+
+    UInt32 nBuffers = (streamDescription.mFormatFlags
+                       & kAudioFormatFlagIsNonInterleaved)?
+                        streamDescription.mChannelsPerFrame: 1;
+
+    // The callback renders into buffers owned by us, the unit must not
+    // allocate its own.
+    auto maxBufferSize = qMax(bufferSize, UInt32(bufferSizeRange.mMaximum));
+    AudioUnitSetProperty(this->d->m_audioUnit,
+                         kAudioUnitProperty_MaximumFramesPerSlice,
+                         kAudioUnitScope_Global,
+                         0,
+                         &maxBufferSize,
+                         sizeof(UInt32));
+
+    if (input) {
+        UInt32 shouldAllocate = 0;
+        AudioUnitSetProperty(this->d->m_audioUnit,
+                             kAudioUnitProperty_ShouldAllocateBuffer,
+                             kAudioUnitScope_Output,
+                             INPUT_DEVICE,
+                             &shouldAllocate,
+                             sizeof(UInt32));
+    }
+
+    this->d->m_bufferSize = bufferSize;
+    this->d->m_maxBufferSize = maxBufferSize;
+    this->d->m_renderBuffer =
+            QByteArray(qsizetype(nBuffers
+                                 * maxBufferSize
+                                 * this->d->m_buffer.ring().frameSize()),
+                       Qt::Uninitialized);
+    this->d->m_bufferList =
+            reinterpret_cast<AudioBufferList *>(malloc(sizeof(AudioBufferList)
+                                                       + sizeof(AudioBuffer)
+                                                       * nBuffers));
+    this->d->m_bufferList->mNumberBuffers = nBuffers;
+    this->d->m_callbackPlanes.fill(nullptr, int(nBuffers));
+
+    for (UInt32 i = 0; i < nBuffers; i++) {
+        this->d->m_bufferList->mBuffers[i].mNumberChannels =
+                (streamDescription.mFormatFlags
+                 & kAudioFormatFlagIsNonInterleaved)?
+                    1: streamDescription.mChannelsPerFrame;
+        this->d->m_bufferList->mBuffers[i].mDataByteSize = 0;
+        this->d->m_bufferList->mBuffers[i].mData = nullptr;
+    }
+
     status = AudioUnitInitialize(this->d->m_audioUnit);
 
     if (status != noErr) {
@@ -430,82 +617,359 @@ bool AudioDevCoreAudio::init(const QString &device, const AkAudioCaps &caps)
         return false;
     }
 
-    this->d->m_curCaps = caps;
-    this->d->m_isInput = input;
-    this->d->m_maxBufferSize = 2
-                             * caps.bps()
-                             * caps.channels()
-                             * int(bufferSize) / 8;
+    /* The worst case latency is the hardware latency and safety offset,
+     * plus one device period, plus the samples waiting in the ring: a read
+     * chunk for capture, and the queued samples for playback.
+     */
+    auto latencySamples =
+            this->d->deviceProperty(deviceID, kAudioDevicePropertyLatency, input)
+            + this->d->deviceProperty(deviceID, kAudioDevicePropertySafetyOffset, input)
+            + bufferSize
+            + (input?
+                   size_t(this->d->m_samples):
+                   this->d->m_buffer.maxQueued());
+    this->d->setAchievedLatency(1000.0 * qreal(latencySamples) / caps.rate());
+
+    // The monitor feeds the output directly, nobody writes to its buffer.
+    if (!input && !this->d->m_monitorDevice) {
+        this->d->m_runNotifier = true;
+        this->d->m_notifierStatus =
+                QtConcurrent::run(&this->d->m_threadPool,
+                                  [this] () {
+                                      this->d->m_buffer.notifierLoop(this->d->m_runNotifier,
+                                                                     this->d->m_lowWatermark,
+                                                                     [this] (qint64 samples) {
+                                          emit this->needMoreData(samples);
+                                      });
+                                  });
+    }
 
-    UInt32 nBuffers = (streamDescription.mFormatFlags
-                       & kAudioFormatFlagIsNonInterleaved)?
-                        streamDescription.mChannelsPerFrame: 1;
+    return true;
+}
 
-    this->d->m_bufferSize = bufferSize;
-    this->d->m_bufferList =
-            reinterpret_cast<AudioBufferList *>(malloc(sizeof(AudioBufferList)
-                                                       + sizeof(AudioBuffer)
-                                                       * nBuffers));
-    this->d->m_bufferList->mNumberBuffers = nBuffers;
+bool AudioDevCoreAudio::initSynchronized(const QStringList &devices,
+                                         const AkAudioCaps &caps)
+{
+    this->uninit();
 
-    for (UInt32 i = 0; i < nBuffers; i++) {
-        this->d->m_bufferList->mBuffers[i].mNumberChannels =
-                (streamDescription.mFormatFlags
-                 & kAudioFormatFlagIsNonInterleaved)?
-                    1: streamDescription.mChannelsPerFrame;
-        this->d->m_bufferList->mBuffers[i].mDataByteSize = 0;
-        this->d->m_bufferList->mBuffers[i].mData = nullptr;
+    if (devices.isEmpty()) {
+        this->d->m_error = "No devices to synchronize";
+        emit this->errorChanged(this->d->m_error);
+
+        return false;
+    }
+
+    auto inputs = this->inputs();
+    QVector<int> channels;
+
+    for (auto &device: devices)
+        if (!inputs.contains(device)) {
+            this->d->m_error = QString("Invalid input device: %1").arg(device);
+            emit this->errorChanged(this->d->m_error);
+
+            return false;
+        }
+
+    /* Each device is captured by its own instance, with its own callback and
+     * ring, as float interleaved samples at the requested sample rate. The
+     * first device is the clock reference.
+     */
+    for (auto &device: devices) {
+        auto preferredCaps = this->preferredFormat(device);
+        AkAudioCaps deviceCaps(AkAudioCaps::SampleFormat_flt,
+                               AkAudioCaps::defaultChannelLayout(qMax(preferredCaps.channels(), 1)),
+                               false,
+                               caps.rate());
+        auto audioDevice = new AudioDevCoreAudio;
+        audioDevice->setLatency(this->latency());
+        this->d->m_syncDevices << audioDevice;
+
+        if (!audioDevice->init(device, deviceCaps)) {
+            this->d->m_error = audioDevice->error();
+            this->uninit();
+            emit this->errorChanged(this->d->m_error);
+
+            return false;
+        }
+
+        channels << deviceCaps.channels();
+    }
+
+    int nChannels = 0;
+
+    for (auto &deviceChannels: channels)
+        nChannels += deviceChannels;
+
+    auto layout = AkAudioCaps::defaultChannelLayout(nChannels);
+
+    if (layout == AkAudioCaps::Layout_none) {
+        this->d->m_error = QString("Unsupported number of channels: %1").arg(nChannels);
+        this->uninit();
+        emit this->errorChanged(this->d->m_error);
+
+        return false;
     }
 
-    this->d->m_samples = qMax(this->latency() * caps.rate() / 1000, 1);
+    // Wait at most twice the target latency for the slowest device.
+    auto maxDelay = size_t(2 * qMax(this->latency(), 1) * caps.rate() / 1000);
+    this->d->m_aligner.configure(channels, caps.rate(), maxDelay);
+    this->d->m_syncCaps = AkAudioCaps(AkAudioCaps::SampleFormat_flt,
+                                      layout,
+                                      false,
+                                      caps.rate());
+    this->d->m_id = Ak::id();
+    this->d->m_samplePosition = 0;
+    this->d->m_syncSamples = 0;
+    QObject::connect(this->d->m_syncDevices.first(),
+                     &AudioDevCoreAudio::discontinuity,
+                     this,
+                     &AudioDevCoreAudio::discontinuity);
+    this->d->setAchievedLatency(this->d->m_syncDevices.first()->achievedLatency());
 
     return true;
 }
 
-QByteArray AudioDevCoreAudio::read()
+AkAudioCaps AudioDevCoreAudio::synchronizedCaps() const
+{
+    return this->d->m_syncCaps;
+}
+
+bool AudioDevCoreAudio::initMonitor(const QString &input,
+                                    const QString &output,
+                                    const AkAudioCaps &caps)
 {
-    int bufferSize = this->d->m_curCaps.bps()
-                   * this->d->m_curCaps.channels()
-                   * this->d->m_samples / 8;
-    QByteArray audioData;
+    this->uninit();
+
+    if (!this->inputs().contains(input)) {
+        this->d->m_error = QString("Invalid input device: %1").arg(input);
+        emit this->errorChanged(this->d->m_error);
 
-    this->d->m_mutex.lock();
+        return false;
+    }
 
-    while (audioData.size() < bufferSize) {
-        if (this->d->m_buffer.isEmpty())
-            this->d->m_samplesAvailable.wait(&this->d->m_mutex);
+    if (!this->outputs().contains(output)) {
+        this->d->m_error = QString("Invalid output device: %1").arg(output);
+        emit this->errorChanged(this->d->m_error);
 
-        int copyBytes = qMin(this->d->m_buffer.size(),
-                             bufferSize - audioData.size());
-        audioData += this->d->m_buffer.mid(0, copyBytes);
-        this->d->m_buffer.remove(0, copyBytes);
+        return false;
     }
 
-    this->d->m_mutex.unlock();
+    /* The capture callback of the input device feeds the render callback of
+     * the output device directly, the samples never leave the real-time
+     * threads. Both devices run at the requested rate, the input with its
+     * own channels and the output with the requested ones.
+     */
+    auto inputCaps = this->preferredFormat(input);
+    QVector<QPair<QString, AkAudioCaps>> devices {
+        {input, AkAudioCaps(AkAudioCaps::SampleFormat_flt,
+                            AkAudioCaps::defaultChannelLayout(qMax(inputCaps.channels(), 1)),
+                            false,
+                            caps.rate())},
+        {output, AkAudioCaps(AkAudioCaps::SampleFormat_flt,
+                             AkAudioCaps::defaultChannelLayout(qMax(caps.channels(), 1)),
+                             false,
+                             caps.rate())},
+    };
 
-    return audioData;
+    for (auto &device: devices) {
+        auto audioDevice = new AudioDevCoreAudio;
+        audioDevice->setLatency(this->latency());
+        audioDevice->d->m_monitorDevice = true;
+        this->d->m_monitorDevices << audioDevice;
+
+        if (!audioDevice->init(device.first, device.second)) {
+            this->d->m_error = audioDevice->error();
+            this->uninit();
+            emit this->errorChanged(this->d->m_error);
+
+            return false;
+        }
+    }
+
+    auto inputDevice = this->d->m_monitorDevices[0];
+    auto outputDevice = this->d->m_monitorDevices[1];
+    this->d->m_monitor.configure(inputDevice->d->m_buffer.caps().channels(),
+                                 outputDevice->d->m_buffer.caps().channels(),
+                                 inputDevice->d->m_bufferSize,
+                                 outputDevice->d->m_bufferSize,
+                                 qMax(inputDevice->d->m_maxBufferSize,
+                                      outputDevice->d->m_maxBufferSize));
+    this->d->m_monitor.setGain(this->d->m_monitorGain);
+    this->d->m_monitor.setChannelMap(this->d->m_monitorChannelMap.toVector());
+
+    // The monitor is ready, hand it to the callbacks.
+    inputDevice->d->m_monitorInput = &this->d->m_monitor;
+    outputDevice->d->m_monitorOutput = &this->d->m_monitor;
+    this->d->setAchievedLatency(1000.0
+                                * qreal(this->d->m_monitor.maxLatency())
+                                / caps.rate());
+
+    return true;
+}
+
+QByteArray AudioDevCoreAudio::read()
+{
+    if (!this->d->m_syncDevices.isEmpty()) {
+        auto packet = this->d->readSynchronized(-1);
+
+        if (!packet)
+            return {};
+
+        return QByteArray(packet.constData(), qsizetype(packet.size()));
+    }
+
+    return this->d->m_buffer.read(size_t(this->d->m_samples));
+}
+
+AkAudioPacket AudioDevCoreAudio::readPacket(int timeout)
+{
+    if (!this->d->m_syncDevices.isEmpty())
+        return this->d->readSynchronized(timeout);
+
+    quint64 lostSamples = 0;
+    auto packet = this->d->m_buffer.readPacket(size_t(this->d->m_samples),
+                                               timeout,
+                                               &lostSamples,
+                                               &this->d->m_samplePosition);
+
+    if (!packet)
+        return {};
+
+    if (lostSamples > 0)
+        emit this->discontinuity(packet.pts(), lostSamples);
+
+    packet.setIndex(0);
+    packet.setId(this->d->m_id);
+
+    return packet;
+}
+
+quint64 AudioDevCoreAudio::samplePosition() const
+{
+    return this->d->m_samplePosition;
+}
+
+QVariantMap AudioDevCoreAudio::stats() const
+{
+    if (this->d->m_monitorDevices.isEmpty())
+        return this->d->m_buffer.stats().toMap();
+
+    return {
+        {"input"        , this->d->m_monitorDevices[0]->stats()           },
+        {"output"       , this->d->m_monitorDevices[1]->stats()           },
+        {"underruns"    , this->d->m_monitor.underruns()                  },
+        {"droppedFrames", this->d->m_monitor.droppedFrames()              },
+    };
+}
+
+void AudioDevCoreAudio::resetStats()
+{
+    this->d->m_buffer.stats().reset();
+
+    // In monitor mode the stats come from both devices and the monitor.
+    for (auto &audioDevice: this->d->m_monitorDevices)
+        audioDevice->resetStats();
+
+    this->d->m_monitor.resetStats();
 }
 
 bool AudioDevCoreAudio::write(const AkAudioPacket &packet)
 {
-    this->d->m_mutex.lock();
+    return this->d->m_buffer.write(packet);
+}
 
-    if (this->d->m_buffer.size() >= this->d->m_maxBufferSize)
-        this->d->m_canWrite.wait(&this->d->m_mutex);
+qint64 AudioDevCoreAudio::tryWrite(const AkAudioPacket &packet, qint64 offset)
+{
+    if (offset < 0)
+        return 0;
 
-    this->d->m_buffer += {packet.constData(), int(packet.size())};
-    this->d->m_mutex.unlock();
+    return qint64(this->d->m_buffer.tryWrite(packet, size_t(offset)));
+}
 
-    return true;
+int AudioDevCoreAudio::lowWatermark() const
+{
+    return this->d->m_lowWatermark;
+}
+
+void AudioDevCoreAudio::setLowWatermark(int lowWatermark)
+{
+    if (this->d->m_lowWatermark == lowWatermark)
+        return;
+
+    this->d->m_lowWatermark = lowWatermark;
+    emit this->lowWatermarkChanged(lowWatermark);
+}
+
+qreal AudioDevCoreAudio::monitorGain() const
+{
+    return this->d->m_monitorGain;
+}
+
+QList<int> AudioDevCoreAudio::monitorChannelMap() const
+{
+    return this->d->m_monitorChannelMap;
+}
+
+void AudioDevCoreAudio::setMonitorGain(qreal monitorGain)
+{
+    if (qFuzzyCompare(this->d->m_monitorGain, monitorGain))
+        return;
+
+    this->d->m_monitorGain = monitorGain;
+    this->d->m_monitor.setGain(monitorGain);
+    emit this->monitorGainChanged(monitorGain);
+}
+
+void AudioDevCoreAudio::setMonitorChannelMap(const QList<int> &monitorChannelMap)
+{
+    if (this->d->m_monitorChannelMap == monitorChannelMap)
+        return;
+
+    this->d->m_monitorChannelMap = monitorChannelMap;
+    this->d->m_monitor.setChannelMap(monitorChannelMap.toVector());
+    emit this->monitorChannelMapChanged(monitorChannelMap);
+}
+
+void AudioDevCoreAudio::resetLowWatermark()
+{
+    this->setLowWatermark(0);
+}
+
+void AudioDevCoreAudio::resetMonitorGain()
+{
+    this->setMonitorGain(1.0);
+}
+
+void AudioDevCoreAudio::resetMonitorChannelMap()
+{
+    this->setMonitorChannelMap({});
 }
 
 bool AudioDevCoreAudio::uninit()
 {
-    if (this->d->m_bufferList) {
-        free(this->d->m_bufferList);
-        this->d->m_bufferList = nullptr;
-    }
+    // Stop all the synchronized devices before releasing them.
+    for (auto &audioDevice: this->d->m_syncDevices)
+        audioDevice->uninit();
 
+    qDeleteAll(this->d->m_syncDevices);
+    this->d->m_syncDevices.clear();
+
+    for (auto &audioDevice: this->d->m_monitorDevices)
+        audioDevice->uninit();
+
+    qDeleteAll(this->d->m_monitorDevices);
+    this->d->m_monitorDevices.clear();
+    this->d->m_monitorInput = nullptr;
+    this->d->m_monitorOutput = nullptr;
+    this->d->m_aligner.configure({}, 0, 0);
+    this->d->m_syncCaps = AkAudioCaps();
+
+    // Release any thread blocked in read() or write().
+    this->d->m_runNotifier = false;
+    this->d->m_buffer.abort();
+    this->d->m_notifierStatus.waitForFinished();
+
+    // Stop the device before releasing the buffers used by the callback.
     if (this->d->m_audioUnit) {
         AudioOutputUnitStop(this->d->m_audioUnit);
         AudioUnitUninitialize(this->d->m_audioUnit);
@@ -513,14 +977,27 @@ bool AudioDevCoreAudio::uninit()
         this->d->m_audioUnit = nullptr;
     }
 
+    if (this->d->m_bufferList) {
+        free(this->d->m_bufferList);
+        this->d->m_bufferList = nullptr;
+    }
+
     this->d->m_bufferSize = 0;
-    this->d->m_curCaps = AkAudioCaps();
+    this->d->m_maxBufferSize = 0;
+    this->d->m_renderBuffer.clear();
     this->d->m_isInput = false;
-    this->d->m_buffer.clear();
+    this->d->m_callbackPlanes.clear();
+    this->d->m_buffer.release();
+    this->d->setAchievedLatency(0.0);
 
     return true;
 }
 
+qreal AudioDevCoreAudio::achievedLatency() const
+{
+    return this->d->m_achievedLatency;
+}
+
 AudioDevCoreAudioPrivate::AudioDevCoreAudioPrivate(AudioDevCoreAudio *self):
     self(self)
 {
@@ -582,12 +1059,304 @@ QString AudioDevCoreAudioPrivate::defaultDevice(bool input, bool *ok)
     return QString("%1:%2").arg(input).arg(deviceId);
 }
 
-void AudioDevCoreAudioPrivate::clearBuffer()
+QVector<AudioDeviceID> AudioDevCoreAudioPrivate::devices()
 {
-    for (UInt32 i = 0; i < self->d->m_bufferList->mNumberBuffers; i++) {
-        self->d->m_bufferList->mBuffers[i].mDataByteSize = 0;
-        self->d->m_bufferList->mBuffers[i].mData = nullptr;
+    static const AudioObjectPropertyAddress propDevices = {
+        kAudioHardwarePropertyDevices,
+        kAudioObjectPropertyScopeGlobal,
+        kAudioObjectPropertyElementMaster
+    };
+
+    UInt32 propSize = 0;
+
+    if (AudioObjectGetPropertyDataSize(kAudioObjectSystemObject,
+                                       &propDevices,
+                                       0,
+                                       nullptr,
+                                       &propSize) != noErr) {
+        return {};
     }
+
+    int nDevices = propSize / sizeof(AudioDeviceID);
+
+    if (nDevices < 1)
+        return {};
+
+    QVector<AudioDeviceID> devices(nDevices);
+
+    if (AudioObjectGetPropertyData(kAudioObjectSystemObject,
+                                   &propDevices,
+                                   0,
+                                   nullptr,
+                                   &propSize,
+                                   devices.data()) != noErr) {
+        return {};
+    }
+
+    devices.resize(int(propSize / sizeof(AudioDeviceID)));
+
+    return devices;
+}
+
+StreamsStatus AudioDevCoreAudioPrivate::streamsStatus(AudioDeviceID deviceId,
+                                                     AudioObjectPropertyScope scope)
+{
+    AudioObjectPropertyAddress propStreams = {
+        kAudioDevicePropertyStreams,
+        scope,
+        kAudioObjectPropertyElementMaster
+    };
+
+    UInt32 propSize = 0;
+
+    if (AudioObjectGetPropertyDataSize(deviceId,
+                                       &propStreams,
+                                       0,
+                                       nullptr,
+                                       &propSize) != noErr)
+        return StreamsStatusFailed;
+
+    if (propSize < sizeof(AudioStreamID))
+        return StreamsStatusNone;
+
+    AudioObjectPropertyAddress propStreamFormat = {
+        kAudioDevicePropertyStreamFormat,
+        scope,
+        kAudioObjectPropertyElementMaster
+    };
+
+    propSize = sizeof(AudioStreamBasicDescription);
+    AudioStreamBasicDescription streamDescription;
+
+    // The device has streams, but they can't be used yet.
+    if (AudioObjectGetPropertyData(deviceId,
+                                   &propStreamFormat,
+                                   0,
+                                   nullptr,
+                                   &propSize,
+                                   &streamDescription) != noErr)
+        return StreamsStatusFailed;
+
+    return StreamsStatusUsable;
+}
+
+QString AudioDevCoreAudioPrivate::deviceName(AudioDeviceID deviceId,
+                                             AudioObjectPropertyScope scope)
+{
+    AudioObjectPropertyAddress propName = {
+        kAudioObjectPropertyName,
+        scope == kAudioObjectPropertyScopeInput?
+            kAudioDevicePropertyScopeInput:
+            kAudioDevicePropertyScopeOutput,
+        kAudioObjectPropertyElementMaster
+    };
+
+    UInt32 propSize = sizeof(CFStringRef);
+    CFStringRef name;
+
+    auto status = AudioObjectGetPropertyData(deviceId,
+                                             &propName,
+                                             0,
+                                             nullptr,
+                                             &propSize,
+                                             &name);
+
+    if (status != noErr)
+        return {};
+
+    auto description = CFStringToString(name);
+    CFRelease(name);
+
+    return description;
+}
+
+AudioDeviceCapabilities AudioDevCoreAudioPrivate::capabilities(const QString &device)
+{
+    QMutexLocker mutexLocker(&this->m_devicesMutex);
+    auto it = this->m_capabilities.find(device);
+
+    if (it == this->m_capabilities.end())
+        return {};
+
+    if (it->probed)
+        return *it;
+
+    auto deviceParts = device.split(':');
+    auto deviceId = AudioDeviceID(deviceParts.value(1).toUInt());
+    auto scope = deviceParts.value(0).toInt() == INPUT_DEVICE?
+                     kAudioObjectPropertyScopeInput:
+                     kAudioObjectPropertyScopeOutput;
+    it->formats = this->supportedCAFormats(deviceId, scope);
+    it->layouts = this->supportedCALayouts(deviceId, scope);
+    it->sampleRates = this->supportedCASampleRates(deviceId, scope);
+
+    if (!it->formats.isEmpty()
+        && !it->layouts.isEmpty()
+        && !it->sampleRates.isEmpty()) {
+        it->defaultCaps =
+                AkAudioCaps(it->formats.first(),
+                            AkAudioCaps::defaultChannelLayout(it->layouts.first()),
+                            false,
+                            it->sampleRates.first());
+    }
+
+    // If the device is still starting, try again on the next request.
+    it->probed = bool(it->defaultCaps);
+
+    return *it;
+}
+
+AudioValueRange AudioDevCoreAudioPrivate::bufferFrameSizeRange(AudioDeviceID deviceId,
+                                                              bool input)
+{
+    AudioObjectPropertyAddress propBufferFrameSizeRange = {
+        kAudioDevicePropertyBufferFrameSizeRange,
+        input?
+            kAudioDevicePropertyScopeInput:
+            kAudioDevicePropertyScopeOutput,
+        kAudioObjectPropertyElementMaster
+    };
+
+    AudioValueRange range {0, 0};
+    UInt32 propSize = sizeof(AudioValueRange);
+    auto status = AudioObjectGetPropertyData(deviceId,
+                                             &propBufferFrameSizeRange,
+                                             0,
+                                             nullptr,
+                                             &propSize,
+                                             &range);
+
+    if (status != noErr)
+        return {0, 0};
+
+    return range;
+}
+
+UInt32 AudioDevCoreAudioPrivate::deviceProperty(AudioDeviceID deviceId,
+                                                AudioObjectPropertySelector selector,
+                                                bool input)
+{
+    AudioObjectPropertyAddress propAddress = {
+        selector,
+        input?
+            kAudioDevicePropertyScopeInput:
+            kAudioDevicePropertyScopeOutput,
+        kAudioObjectPropertyElementMaster
+    };
+
+    UInt32 value = 0;
+    UInt32 propSize = sizeof(UInt32);
+    auto status = AudioObjectGetPropertyData(deviceId,
+                                             &propAddress,
+                                             0,
+                                             nullptr,
+                                             &propSize,
+                                             &value);
+
+    return status == noErr? value: 0;
+}
+
+void AudioDevCoreAudioPrivate::setAchievedLatency(qreal achievedLatency)
+{
+    if (qFuzzyCompare(this->m_achievedLatency, achievedLatency))
+        return;
+
+    this->m_achievedLatency = achievedLatency;
+    emit self->achievedLatencyChanged(achievedLatency);
+}
+
+bool AudioDevCoreAudioPrivate::deviceDescription(bool input,
+                                                 AudioStreamBasicDescription *description) const
+{
+    // Read the format in the hardware side of the unit.
+    UInt32 propSize = sizeof(AudioStreamBasicDescription);
+    auto status = AudioUnitGetProperty(this->m_audioUnit,
+                                       kAudioUnitProperty_StreamFormat,
+                                       input?
+                                           kAudioUnitScope_Input:
+                                           kAudioUnitScope_Output,
+                                       input?
+                                           INPUT_DEVICE:
+                                           OUTPUT_DEVICE,
+                                       description,
+                                       &propSize);
+
+    return status == noErr;
+}
+
+bool AudioDevCoreAudioPrivate::isDevicePlanar(bool input) const
+{
+    AudioStreamBasicDescription streamDescription;
+
+    return this->deviceDescription(input, &streamDescription)
+           && (streamDescription.mFormatFlags
+               & kAudioFormatFlagIsNonInterleaved);
+}
+
+AkAudioPacket AudioDevCoreAudioPrivate::readSynchronized(int timeout)
+{
+    auto reference = this->m_syncDevices.first();
+    QDeadlineTimer deadline(timeout < 0?
+                                QDeadlineTimer(QDeadlineTimer::Forever):
+                                QDeadlineTimer(timeout));
+    size_t samples = 0;
+
+    forever {
+        /* The reference paces the reading, the other devices are drained
+         * without blocking, their late samples will be aligned in the next
+         * round.
+         */
+        auto remainingTime = deadline.remainingTime();
+        auto packet =
+                reference->readPacket(remainingTime < 0?
+                                          -1: int(remainingTime));
+
+        if (packet)
+            this->pushSynchronized(0, packet);
+
+        for (int i = 1; i < this->m_syncDevices.size(); i++)
+            forever {
+                auto devicePacket = this->m_syncDevices[i]->readPacket(0);
+
+                if (!devicePacket)
+                    break;
+
+                this->pushSynchronized(i, devicePacket);
+            }
+
+        samples = this->m_aligner.available();
+
+        if (samples > 0 || !packet || deadline.hasExpired())
+            break;
+    }
+
+    if (samples < 1)
+        return {};
+
+    AkAudioPacket packet(this->m_syncCaps, samples);
+    qint64 pts = 0;
+    samples = this->m_aligner.pull(reinterpret_cast<float *>(packet.data()),
+                                   samples,
+                                   &pts);
+    packet.setPts(pts);
+    packet.setTimeBase(AkFrac(1, 1000000000));
+    packet.setIndex(0);
+    packet.setId(this->m_id);
+    this->m_samplePosition = this->m_syncSamples;
+    this->m_syncSamples += samples;
+
+    return packet;
+}
+
+void AudioDevCoreAudioPrivate::pushSynchronized(int stream,
+                                                const AkAudioPacket &packet)
+{
+    auto audioDevice = this->m_syncDevices[stream];
+    this->m_aligner.push(stream,
+                         reinterpret_cast<const float *>(packet.constData()),
+                         packet.samples(),
+                         packet.pts(),
+                         audioDevice->samplePosition());
 }
 
 QList<AkAudioCaps::SampleFormat> AudioDevCoreAudioPrivate::supportedCAFormats(AudioDeviceID deviceId,
@@ -625,7 +1394,7 @@ QList<AkAudioCaps::SampleFormat> AudioDevCoreAudioPrivate::supportedCAFormats(Au
     if (status != noErr)
         return QList<AkAudioCaps::SampleFormat>();
 
-    // These are all common formats supported by the audio converter.
+    // These are all common formats supported by our conversion kernels.
     static const QVector<AkAudioCaps::SampleFormat> recommendedFormats = {
         AkAudioCaps::SampleFormat_flt,
         AkAudioCaps::SampleFormat_s32,
@@ -675,7 +1444,7 @@ QList<AkAudioCaps::SampleFormat> AudioDevCoreAudioPrivate::supportedCAFormats(Au
             for (auto &description: streamDescriptions) {
                 auto format = this->descriptionToSampleFormat(description.mFormat);
 
-                // Formats not supported by the converter are excluded.
+                // Formats not supported by the kernels are excluded.
                 if (recommendedFormats.contains(format)
                     && !supportedFormats.contains(format)) {
                     supportedFormats << format;
@@ -847,8 +1616,12 @@ OSStatus AudioDevCoreAudioPrivate::defaultInputDeviceChangedCallback(AudioObject
     if (self) {
         auto defaultInput = self->d->defaultDevice(true, nullptr);
 
-        if (defaultInput.isEmpty() && !self->d->m_sources.isEmpty())
-            defaultInput = self->d->m_sources.first();
+        if (defaultInput.isEmpty()) {
+            QMutexLocker mutexLocker(&self->d->m_devicesMutex);
+
+            if (!self->d->m_sources.isEmpty())
+                defaultInput = self->d->m_sources.first();
+        }
 
         if (self->d->m_defaultSource != defaultInput) {
             self->d->m_defaultSource = defaultInput;
@@ -873,8 +1646,12 @@ OSStatus AudioDevCoreAudioPrivate::defaultOutputDeviceChangedCallback(AudioObjec
     if (self) {
         auto defaultOutput = self->d->defaultDevice(false, nullptr);
 
-        if (defaultOutput.isEmpty() && !self->d->m_sinks.isEmpty())
-            defaultOutput = self->d->m_sinks.first();
+        if (defaultOutput.isEmpty()) {
+            QMutexLocker mutexLocker(&self->d->m_devicesMutex);
+
+            if (!self->d->m_sinks.isEmpty())
+                defaultOutput = self->d->m_sinks.first();
+        }
 
         if (self->d->m_defaultSink != defaultOutput) {
             self->d->m_defaultSink = defaultOutput;
@@ -897,225 +1674,243 @@ OSStatus AudioDevCoreAudioPrivate::audioCallback(void *audioDev,
     if (!self)
         return noErr;
 
-    if (self->d->m_isInput) {
-        self->d->clearBuffer();
-
-        auto status =
-                AudioUnitRender(self->d->m_audioUnit,
-                                actionFlags,
-                                timeStamp,
-                                busNumber,
-                                nFrames,
-                                self->d->m_bufferList);
-
-        if (status != noErr)
-            return status;
-
-        self->d->m_mutex.lock();
-
-        // FIXME: This assumees that all samples are interleaved, so appending it to
-        // the buffer is ok. It must be fixed for planar sample formats.
-        for (UInt32 i = 0; i < self->d->m_bufferList->mNumberBuffers; i++)
-            self->d->m_buffer +=
-                QByteArray::fromRawData(static_cast<const char *>(self->d->m_bufferList->mBuffers[i].mData),
-                                        int(self->d->m_bufferList->mBuffers[i].mDataByteSize));
-
-        // We use a ring buffer and all old samples are discarded.
-        if (self->d->m_buffer.size() > self->d->m_maxBufferSize) {
-            int k = self->d->m_curCaps.bps()
-                    * self->d->m_curCaps.channels();
-            int bufferSize = k * int(self->d->m_maxBufferSize / k);
-
-            self->d->m_buffer =
-                self->d->m_buffer.mid(self->d->m_buffer.size() - bufferSize,
-                                      bufferSize);
-        }
+    auto &buffer = self->d->m_buffer;
+    auto &stats = buffer.stats();
+    stats.callbackStarted(AudioConvertHostTimeToNanos(AudioGetCurrentHostTime()));
+    auto status =
+            self->d->m_isInput?
+                self->d->capture(actionFlags, timeStamp, busNumber, nFrames):
+                self->d->playback(nFrames, data);
+    stats.callbackFinished(AudioConvertHostTimeToNanos(AudioGetCurrentHostTime()),
+                           buffer.ring().readAvailable(),
+                           buffer.ring().capacity());
+
+    return status;
+}
+
+OSStatus AudioDevCoreAudioPrivate::capture(AudioUnitRenderActionFlags *actionFlags,
+                                           const AudioTimeStamp *timeStamp,
+                                           UInt32 busNumber,
+                                           UInt32 nFrames)
+{
+    if (nFrames > this->m_maxBufferSize)
+        return kAudioUnitErr_TooManyFramesToProcess;
+
+    // Render straight into the ring if there is enough contiguous space,
+    // otherwise render into our own buffers and copy what fits.
+    auto &buffer = this->m_buffer;
+    auto bufferList = this->m_bufferList;
+    auto frameSize = buffer.ring().frameSize();
+    auto monitor = this->m_monitorInput.load();
+    auto planes = this->m_callbackPlanes.data();
+    bool direct =
+            !monitor
+            && buffer.beginCapture(nFrames,
+                                   reinterpret_cast<quint8 **>(planes));
+    auto renderBuffer =
+            reinterpret_cast<quint8 *>(this->m_renderBuffer.data());
+
+    for (UInt32 i = 0; i < bufferList->mNumberBuffers; i++) {
+        auto &audioBuffer = bufferList->mBuffers[i];
+        audioBuffer.mData =
+                direct?
+                    planes[i]:
+                    renderBuffer + i * this->m_maxBufferSize * frameSize;
+        audioBuffer.mDataByteSize = UInt32(nFrames * frameSize);
+    }
+
+    auto status =
+            AudioUnitRender(this->m_audioUnit,
+                            actionFlags,
+                            timeStamp,
+                            busNumber,
+                            nFrames,
+                            bufferList);
+
+    if (status != noErr)
+        return status;
+
+    for (UInt32 i = 0; i < bufferList->mNumberBuffers; i++)
+        planes[i] = bufferList->mBuffers[i].mData;
+
+    // In monitor mode the samples go straight to the output device.
+    if (monitor) {
+        monitor->write(reinterpret_cast<const quint8 *const *>(planes),
+                       buffer.devicePlanar(),
+                       AudioDeviceBuffer::kernelFormat(buffer.deviceFormat()),
+                       nFrames);
+
+        return noErr;
+    }
 
-        self->d->m_samplesAvailable.wakeAll();
-        self->d->m_mutex.unlock();
-    } else {
-        // FIXME: Same as above.
-        if (data->mNumberBuffers == 1) {
-            int i = 0; // Write just the first buffer.
+    /* Host time is the same clock used by AVFoundation for the capture
+     * sessions, so captured audio and video can be synced directly by
+     * pts.
+     */
+    auto sampleTime =
+            (timeStamp->mFlags & kAudioTimeStampSampleTimeValid)?
+                quint64(timeStamp->mSampleTime): 0;
+    auto hostTime =
+            (timeStamp->mFlags & kAudioTimeStampHostTimeValid)?
+                AudioConvertHostTimeToNanos(timeStamp->mHostTime):
+                AudioConvertHostTimeToNanos(AudioGetCurrentHostTime());
+
+    if (direct)
+        buffer.endCapture(nFrames, sampleTime, hostTime);
+    else
+        buffer.capture(planes, nFrames, sampleTime, hostTime);
 
+    return noErr;
+}
+
+OSStatus AudioDevCoreAudioPrivate::playback(UInt32 nFrames,
+                                            AudioBufferList *data)
+{
+    auto &buffer = this->m_buffer;
+    auto monitor = this->m_monitorOutput.load();
+
+    if (data->mNumberBuffers != buffer.ring().planes()) {
+        buffer.stats().underrun(nFrames);
+
+        for (UInt32 i = 0; i < data->mNumberBuffers; i++)
             memset(data->mBuffers[i].mData,
-                   0,
+                   buffer.deviceFormat() == AkAudioCaps::SampleFormat_u8?
+                       0x80: 0,
                    data->mBuffers[i].mDataByteSize);
 
-            self->d->m_mutex.lock();
-            int copyBytes = qMin(int(data->mBuffers[i].mDataByteSize),
-                                  self->d->m_buffer.size());
+        return noErr;
+    }
 
-            if (copyBytes > 0) {
-                memcpy(data->mBuffers[i].mData,
-                       self->d->m_buffer.constData(),
-                       size_t(copyBytes));
-                self->d->m_buffer.remove(0, copyBytes);
-            }
+    auto planes = this->m_callbackPlanes.data();
 
-            if (self->d->m_buffer.size() <= self->d->m_maxBufferSize)
-                self->d->m_canWrite.wakeAll();
+    for (UInt32 i = 0; i < data->mNumberBuffers; i++)
+        planes[i] = data->mBuffers[i].mData;
 
-            self->d->m_mutex.unlock();
-        }
-    }
+    if (monitor)
+        monitor->render(reinterpret_cast<quint8 *const *>(planes),
+                        buffer.devicePlanar(),
+                        AudioDeviceBuffer::kernelFormat(buffer.deviceFormat()),
+                        nFrames);
+    else
+        buffer.render(planes,
+                      size_t(data->mBuffers[0].mDataByteSize)
+                      / buffer.ring().frameSize());
 
     return noErr;
 }
 
 void AudioDevCoreAudio::updateDevices()
 {
-    decltype(this->d->m_defaultSink) defaultOutput;
-    decltype(this->d->m_defaultSource) defaultInput;
-    decltype(this->d->m_sources) inputs;
-    decltype(this->d->m_sinks) outputs;
-    decltype(this->d->m_descriptionMap) descriptionMap;
-    decltype(this->d->m_defaultCaps) defaultCaps;
-    decltype(this->d->m_supportedFormats) supportedFormats;
-    decltype(this->d->m_supportedLayouts) supportedLayouts;
-    decltype(this->d->m_supportedSampleRates) supportedSampleRates;
-
     // List default devices
-    defaultInput = this->d->defaultDevice(true, nullptr);
-    defaultOutput = this->d->defaultDevice(false, nullptr);
+    auto defaultInput = this->d->defaultDevice(true, nullptr);
+    auto defaultOutput = this->d->defaultDevice(false, nullptr);
+
+    /* Only the devices that were added or removed since the last update are
+     * processed, and just with the properties needed for listing them. The
+     * capabilities are probed later, when requested for the first time.
+     */
+    auto devices = this->d->devices();
+
+    this->d->m_devicesMutex.lock();
+    auto inputs = this->d->m_sources;
+    auto outputs = this->d->m_sinks;
+
+    for (auto &deviceId: this->d->m_devices)
+        if (!devices.contains(deviceId)) {
+            this->d->m_pendingDevices.removeAll(deviceId);
+
+            for (auto &devId: {QString("%1:%2").arg(INPUT_DEVICE).arg(deviceId),
+                               QString("%1:%2").arg(OUTPUT_DEVICE).arg(deviceId)}) {
+                inputs.removeAll(devId);
+                outputs.removeAll(devId);
+                this->d->m_descriptionMap.remove(devId);
+                this->d->m_capabilities.remove(devId);
+            }
+        }
 
-    // List all devices
-    static const AudioObjectPropertyAddress propDevices = {
-        kAudioHardwarePropertyDevices,
-        kAudioObjectPropertyScopeGlobal,
-        kAudioObjectPropertyElementMaster
-    };
+    /* The devices that were still starting when listed are probed again, until
+     * every direction with streams is usable and named. A device without
+     * streams is remembered in m_devices, and not probed again.
+     */
+    auto pendingDevices = this->d->m_pendingDevices;
+    this->d->m_pendingDevices.clear();
 
-    UInt32 propSize = 0;
+    for (auto &deviceId: devices) {
+        if (this->d->m_devices.contains(deviceId)
+            && !pendingDevices.contains(deviceId))
+            continue;
 
-    if (AudioObjectGetPropertyDataSize(kAudioObjectSystemObject,
-                                       &propDevices,
-                                       0,
-                                       nullptr,
-                                       &propSize) == noErr) {
-        int nDevices = propSize / sizeof(AudioDeviceID);
+        bool failed = false;
 
-        if (nDevices > 0) {
-            QVector<AudioDeviceID> devices(nDevices);
+        for (auto &deviceType: QVector<AudioObjectPropertyScope> {
+                                   kAudioObjectPropertyScopeInput,
+                                   kAudioObjectPropertyScopeOutput
+                               }) {
+            // Check if we can use this device.
+            auto status = this->d->streamsStatus(deviceId, deviceType);
 
-            if (AudioObjectGetPropertyData(kAudioObjectSystemObject,
-                                                &propDevices,
-                                                0,
-                                                nullptr,
-                                                &propSize,
-                                                devices.data()) == noErr) {
-                for (auto &deviceType: QVector<AudioObjectPropertyScope> {
-                                           kAudioObjectPropertyScopeInput,
-                                           kAudioObjectPropertyScopeOutput
-                                       }) {
-                    AudioObjectPropertyAddress propStreamFormat = {
-                        kAudioDevicePropertyStreamFormat,
-                        deviceType,
-                        kAudioObjectPropertyElementMaster
-                    };
-
-                    for (auto &deviceId: devices) {
-                        // Check if we can use this device.
-                        propSize = sizeof(AudioStreamBasicDescription);
-                        AudioStreamBasicDescription streamDescription;
-
-                        auto status =
-                                AudioObjectGetPropertyData(deviceId,
-                                                           &propStreamFormat,
-                                                           0,
-                                                           nullptr,
-                                                           &propSize,
-                                                           &streamDescription);
-
-                        if (status != noErr)
-                            continue;
-
-                        // Get device description.
-                        AudioObjectPropertyAddress propName = {
-                            kAudioObjectPropertyName,
-                            deviceType == kAudioObjectPropertyScopeInput?
-                                kAudioDevicePropertyScopeInput:
-                                kAudioDevicePropertyScopeOutput,
-                            kAudioObjectPropertyElementMaster
-                        };
-
-                        UInt32 propSize = sizeof(CFStringRef);
-                        CFStringRef name;
-
-                        status = AudioObjectGetPropertyData(deviceId,
-                                                            &propName,
-                                                            0,
-                                                            nullptr,
-                                                            &propSize,
-                                                            &name);
-
-                        if (status != noErr)
-                            continue;
-
-                        auto description = this->d->CFStringToString(name);
-                        CFRelease(name);
-                        auto formats = this->d->supportedCAFormats(deviceId,
-                                                                   deviceType);
-                        auto layouts = this->d->supportedCALayouts(deviceId,
-                                                                  deviceType);
-                        auto sampleRates = this->d->supportedCASampleRates(deviceId,
-                                                                           deviceType);
-
-                        if (formats.isEmpty()
-                            || layouts.isEmpty()
-                            || sampleRates.isEmpty())
-                            continue;
-
-                        QString devId;
-
-                        // Append device to the list.
-                        if (deviceType == kAudioObjectPropertyScopeInput) {
-                            devId = QString("%1:%2").arg(INPUT_DEVICE).arg(deviceId);
-                            inputs << devId;
-                        } else {
-                            devId = QString("%1:%2").arg(OUTPUT_DEVICE).arg(deviceId);
-                            outputs << devId;
-                        }
-
-                        descriptionMap[devId] = description;
-                        supportedFormats[devId] = formats;
-                        supportedLayouts[devId] = layouts;
-                        supportedSampleRates[devId] = sampleRates;
-                        defaultCaps[devId] =
-                                AkAudioCaps(formats.first(),
-                                            AkAudioCaps::defaultChannelLayout(layouts.first()),
-                                            false,
-                                            sampleRates.first());
-                    }
-                }
+            if (status != StreamsStatusUsable) {
+                failed |= status == StreamsStatusFailed;
+
+                continue;
             }
-        }
-    }
 
-    if (this->d->m_defaultCaps != defaultCaps)
-        this->d->m_defaultCaps = defaultCaps;
+            auto description = this->d->deviceName(deviceId, deviceType);
+
+            if (description.isEmpty()) {
+                failed = true;
 
-    if (this->d->m_supportedFormats != supportedFormats)
-        this->d->m_supportedFormats = supportedFormats;
+                continue;
+            }
 
-    if (this->d->m_supportedLayouts != supportedLayouts)
-        this->d->m_supportedLayouts = supportedLayouts;
+            QString devId;
 
-    if (this->d->m_supportedSampleRates != supportedSampleRates)
-        this->d->m_supportedSampleRates = supportedSampleRates;
+            // Append device to the list.
+            if (deviceType == kAudioObjectPropertyScopeInput) {
+                devId = QString("%1:%2").arg(INPUT_DEVICE).arg(deviceId);
 
-    if (this->d->m_descriptionMap != descriptionMap)
-        this->d->m_descriptionMap = descriptionMap;
+                if (!inputs.contains(devId))
+                    inputs << devId;
+            } else {
+                devId = QString("%1:%2").arg(OUTPUT_DEVICE).arg(deviceId);
 
-    if (this->d->m_sources != inputs) {
-        this->d->m_sources = inputs;
-        emit this->inputsChanged(inputs);
+                if (!outputs.contains(devId))
+                    outputs << devId;
+            }
+
+            this->d->m_descriptionMap[devId] = description;
+
+            if (!this->d->m_capabilities.contains(devId))
+                this->d->m_capabilities[devId] = {};
+        }
+
+        if (failed)
+            this->d->m_pendingDevices << deviceId;
     }
 
-    if (this->d->m_sinks != outputs) {
-        this->d->m_sinks = outputs;
+    this->d->m_devices = devices;
+    bool inputsChanged = this->d->m_sources != inputs;
+    bool outputsChanged = this->d->m_sinks != outputs;
+    this->d->m_sources = inputs;
+    this->d->m_sinks = outputs;
+    bool retry = !this->d->m_pendingDevices.isEmpty()
+                 && this->d->m_probeRetries < MAX_PROBE_RETRIES;
+    this->d->m_probeRetries = retry? this->d->m_probeRetries + 1: 0;
+    this->d->m_devicesMutex.unlock();
+
+    // This is called from the CoreAudio notification thread.
+    if (retry)
+        QMetaObject::invokeMethod(this, [this] () {
+            QTimer::singleShot(PROBE_RETRY_INTERVAL,
+                               this,
+                               &AudioDevCoreAudio::updateDevices);
+        }, Qt::QueuedConnection);
+
+    if (inputsChanged)
+        emit this->inputsChanged(inputs);
+
+    if (outputsChanged)
         emit this->outputsChanged(outputs);
-    }
 
     if (defaultInput.isEmpty() && !inputs.isEmpty())
         defaultInput = inputs.first();
@@ -27,6 +27,26 @@ class AudioDevCoreAudioPrivate;
 class AudioDevCoreAudio: public AudioDev
 {
     Q_OBJECT
+    Q_PROPERTY(qreal achievedLatency
+               READ achievedLatency
+               NOTIFY achievedLatencyChanged)
+    Q_PROPERTY(QVariantMap stats
+               READ stats)
+    Q_PROPERTY(int lowWatermark
+               READ lowWatermark
+               WRITE setLowWatermark
+               RESET resetLowWatermark
+               NOTIFY lowWatermarkChanged)
+    Q_PROPERTY(qreal monitorGain
+               READ monitorGain
+               WRITE setMonitorGain
+               RESET resetMonitorGain
+               NOTIFY monitorGainChanged)
+    Q_PROPERTY(QList<int> monitorChannelMap
+               READ monitorChannelMap
+               WRITE setMonitorChannelMap
+               RESET resetMonitorChannelMap
+               NOTIFY monitorChannelMapChanged)
 
     public:
         AudioDevCoreAudio(QObject *parent=nullptr);
@@ -43,13 +63,45 @@ class AudioDevCoreAudio: public AudioDev
         Q_INVOKABLE QList<AkAudioCaps::ChannelLayout> supportedChannelLayouts(const QString &device) override;
         Q_INVOKABLE QList<int> supportedSampleRates(const QString &device) override;
         Q_INVOKABLE bool init(const QString &device, const AkAudioCaps &caps) override;
+        Q_INVOKABLE bool initSynchronized(const QStringList &devices,
+                                          const AkAudioCaps &caps);
+        Q_INVOKABLE AkAudioCaps synchronizedCaps() const;
+        Q_INVOKABLE bool initMonitor(const QString &input,
+                                     const QString &output,
+                                     const AkAudioCaps &caps);
         Q_INVOKABLE QByteArray read() override;
+        Q_INVOKABLE AkAudioPacket readPacket(int timeout=-1);
         Q_INVOKABLE bool write(const AkAudioPacket &packet) override;
+        Q_INVOKABLE qint64 tryWrite(const AkAudioPacket &packet,
+                                    qint64 offset=0);
         Q_INVOKABLE bool uninit() override;
+        Q_INVOKABLE qreal achievedLatency() const;
+        Q_INVOKABLE quint64 samplePosition() const;
+        Q_INVOKABLE QVariantMap stats() const;
+        Q_INVOKABLE int lowWatermark() const;
+        Q_INVOKABLE qreal monitorGain() const;
+        Q_INVOKABLE QList<int> monitorChannelMap() const;
 
     private:
         AudioDevCoreAudioPrivate *d;
 
+    signals:
+        void achievedLatencyChanged(qreal achievedLatency);
+        void discontinuity(qint64 pts, quint64 lostSamples);
+        void lowWatermarkChanged(int lowWatermark);
+        void needMoreData(qint64 samples);
+        void monitorGainChanged(qreal monitorGain);
+        void monitorChannelMapChanged(const QList<int> &monitorChannelMap);
+
+    public slots:
+        void setLowWatermark(int lowWatermark);
+        void setMonitorGain(qreal monitorGain);
+        void setMonitorChannelMap(const QList<int> &monitorChannelMap);
+        void resetLowWatermark();
+        void resetMonitorGain();
+        void resetMonitorChannelMap();
+        void resetStats();
+
     private slots:
         void updateDevices();
 
@@ -0,0 +1,514 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <QFuture>
+#include <QRandomGenerator>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <ak.h>
+#include <akaudiocaps.h>
+#include <akaudiopacket.h>
+
+#include "audiodevsimulated.h"
+#include "audiodevicebuffer.h"
+#include "audioringbuffer.h"
+#include "audiostats.h"
+
+#define INPUT_DEVICE  "SimulatedInput"
+#define OUTPUT_DEVICE "SimulatedOutput"
+
+// Frequency and amplitude of the captured tone.
+#define TONE_FREQUENCY 440.0
+#define TONE_AMPLITUDE 0.5
+
+using SimulatedClock = std::chrono::steady_clock;
+
+class AudioDevSimulatedPrivate
+{
+    public:
+        AudioDevSimulated *self;
+        QString m_error;
+        AudioDeviceBuffer m_buffer;
+        QByteArray m_periodBuffer;
+        QThreadPool m_threadPool;
+        QFuture<void> m_deviceStatus;
+        QFuture<void> m_notifierStatus;
+        std::atomic<bool> m_runDevice {false};
+        std::atomic<bool> m_runNotifier {false};
+        std::atomic<int> m_lowWatermark {0};
+        std::atomic<int> m_jitter {0};
+        quint64 m_samplePosition {0};
+        qint64 m_id {-1};
+        qreal m_achievedLatency {0.0};
+        qreal m_drift {0.0};
+        int m_period {0};
+        int m_samples {0};
+        bool m_isInput {false};
+
+        explicit AudioDevSimulatedPrivate(AudioDevSimulated *self);
+        static quint64 hostTime(SimulatedClock::time_point time);
+        void setAchievedLatency(qreal achievedLatency);
+        void deviceLoop(qreal drift);
+        void capture(quint64 sampleTime, quint64 hostTime);
+        void playback();
+};
+
+AudioDevSimulated::AudioDevSimulated(QObject *parent):
+    AudioDev(parent)
+{
+    this->d = new AudioDevSimulatedPrivate(this);
+}
+
+AudioDevSimulated::~AudioDevSimulated()
+{
+    this->uninit();
+    delete this->d;
+}
+
+QString AudioDevSimulated::error() const
+{
+    return this->d->m_error;
+}
+
+QString AudioDevSimulated::defaultInput()
+{
+    return INPUT_DEVICE;
+}
+
+QString AudioDevSimulated::defaultOutput()
+{
+    return OUTPUT_DEVICE;
+}
+
+QStringList AudioDevSimulated::inputs()
+{
+    return {INPUT_DEVICE};
+}
+
+QStringList AudioDevSimulated::outputs()
+{
+    return {OUTPUT_DEVICE};
+}
+
+QString AudioDevSimulated::description(const QString &device)
+{
+    if (device == INPUT_DEVICE)
+        return "Simulated Input";
+
+    if (device == OUTPUT_DEVICE)
+        return "Simulated Output";
+
+    return {};
+}
+
+AkAudioCaps AudioDevSimulated::preferredFormat(const QString &device)
+{
+    if (device != INPUT_DEVICE && device != OUTPUT_DEVICE)
+        return {};
+
+    return AkAudioCaps(AkAudioCaps::SampleFormat_s16,
+                       AkAudioCaps::Layout_stereo,
+                       false,
+                       48000);
+}
+
+QList<AkAudioCaps::SampleFormat> AudioDevSimulated::supportedFormats(const QString &device)
+{
+    if (device != INPUT_DEVICE && device != OUTPUT_DEVICE)
+        return {};
+
+    return {
+        AkAudioCaps::SampleFormat_u8,
+        AkAudioCaps::SampleFormat_s16,
+        AkAudioCaps::SampleFormat_s32,
+        AkAudioCaps::SampleFormat_flt,
+    };
+}
+
+QList<AkAudioCaps::ChannelLayout> AudioDevSimulated::supportedChannelLayouts(const QString &device)
+{
+    if (device != INPUT_DEVICE && device != OUTPUT_DEVICE)
+        return {};
+
+    return {
+        AkAudioCaps::Layout_mono,
+        AkAudioCaps::Layout_stereo,
+    };
+}
+
+QList<int> AudioDevSimulated::supportedSampleRates(const QString &device)
+{
+    if (device != INPUT_DEVICE && device != OUTPUT_DEVICE)
+        return {};
+
+    return {8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000};
+}
+
+bool AudioDevSimulated::init(const QString &device, const AkAudioCaps &caps)
+{
+    this->uninit();
+
+    if (device != INPUT_DEVICE && device != OUTPUT_DEVICE) {
+        this->d->m_error = QString("Invalid device: %1").arg(device);
+        emit this->errorChanged(this->d->m_error);
+
+        return false;
+    }
+
+    if (AudioDeviceBuffer::kernelFormat(caps.format()) == AudioKernels::SampleFormat_none
+        || caps.channels() < 1
+        || caps.rate() < 1) {
+        this->d->m_error = "Unsupported audio format";
+        emit this->errorChanged(this->d->m_error);
+
+        return false;
+    }
+
+    bool input = device == INPUT_DEVICE;
+
+    // Same split of the latency than the CoreAudio implementation, half for
+    // the device period and the other half for the ring.
+    auto targetSamples = qMax(this->latency() * caps.rate() / 1000, 1);
+    auto period = this->d->m_period > 0?
+                      this->d->m_period:
+                      qMax(targetSamples / 2, 1);
+
+    this->d->m_isInput = input;
+    this->d->m_id = Ak::id();
+    this->d->m_samplePosition = 0;
+    this->d->m_samples = period;
+
+    // The device works with float interleaved samples, like most of the
+    // hardware, so the conversion kernels are exercised too.
+    this->d->m_buffer.configure(caps,
+                                AkAudioCaps::SampleFormat_flt,
+                                false,
+                                size_t(period),
+                                size_t(qMax(targetSamples, period)));
+    this->d->m_periodBuffer =
+            QByteArray(qsizetype(size_t(period)
+                                 * this->d->m_buffer.ring().frameSize()),
+                       Qt::Uninitialized);
+
+    this->d->m_runDevice = true;
+    this->d->m_deviceStatus =
+            QtConcurrent::run(&this->d->m_threadPool,
+                              [this, drift = this->d->m_drift] () {
+                                  this->d->deviceLoop(drift);
+                              });
+
+    // The worst case latency is one device period plus the maximum jitter,
+    // plus the samples waiting in the ring.
+    auto latencySamples = size_t(period)
+                          + (input?
+                                 size_t(period):
+                                 this->d->m_buffer.maxQueued());
+    this->d->setAchievedLatency(1000.0 * qreal(latencySamples) / caps.rate()
+                                + this->d->m_jitter / 1000.0);
+
+    if (!input) {
+        this->d->m_runNotifier = true;
+        this->d->m_notifierStatus =
+                QtConcurrent::run(&this->d->m_threadPool,
+                                  [this] () {
+                                      this->d->m_buffer.notifierLoop(this->d->m_runNotifier,
+                                                                     this->d->m_lowWatermark,
+                                                                     [this] (qint64 samples) {
+                                          emit this->needMoreData(samples);
+                                      });
+                                  });
+    }
+
+    return true;
+}
+
+QByteArray AudioDevSimulated::read()
+{
+    return this->d->m_buffer.read(size_t(this->d->m_samples));
+}
+
+AkAudioPacket AudioDevSimulated::readPacket(int timeout)
+{
+    quint64 lostSamples = 0;
+    auto packet = this->d->m_buffer.readPacket(size_t(this->d->m_samples),
+                                               timeout,
+                                               &lostSamples,
+                                               &this->d->m_samplePosition);
+
+    if (!packet)
+        return {};
+
+    if (lostSamples > 0)
+        emit this->discontinuity(packet.pts(), lostSamples);
+
+    packet.setIndex(0);
+    packet.setId(this->d->m_id);
+
+    return packet;
+}
+
+bool AudioDevSimulated::write(const AkAudioPacket &packet)
+{
+    return this->d->m_buffer.write(packet);
+}
+
+qint64 AudioDevSimulated::tryWrite(const AkAudioPacket &packet, qint64 offset)
+{
+    if (offset < 0)
+        return 0;
+
+    return qint64(this->d->m_buffer.tryWrite(packet, size_t(offset)));
+}
+
+bool AudioDevSimulated::uninit()
+{
+    // Release any thread blocked in read() or write().
+    this->d->m_runNotifier = false;
+    this->d->m_runDevice = false;
+    this->d->m_buffer.abort();
+    this->d->m_notifierStatus.waitForFinished();
+
+    // Stop the device before releasing the buffers used by the callback.
+    this->d->m_deviceStatus.waitForFinished();
+    this->d->m_periodBuffer.clear();
+    this->d->m_isInput = false;
+    this->d->m_buffer.release();
+    this->d->setAchievedLatency(0.0);
+
+    return true;
+}
+
+qreal AudioDevSimulated::achievedLatency() const
+{
+    return this->d->m_achievedLatency;
+}
+
+quint64 AudioDevSimulated::samplePosition() const
+{
+    return this->d->m_samplePosition;
+}
+
+QVariantMap AudioDevSimulated::stats() const
+{
+    return this->d->m_buffer.stats().toMap();
+}
+
+int AudioDevSimulated::lowWatermark() const
+{
+    return this->d->m_lowWatermark;
+}
+
+int AudioDevSimulated::period() const
+{
+    return this->d->m_period;
+}
+
+int AudioDevSimulated::jitter() const
+{
+    return this->d->m_jitter;
+}
+
+qreal AudioDevSimulated::drift() const
+{
+    return this->d->m_drift;
+}
+
+void AudioDevSimulated::setLowWatermark(int lowWatermark)
+{
+    if (this->d->m_lowWatermark == lowWatermark)
+        return;
+
+    this->d->m_lowWatermark = lowWatermark;
+    emit this->lowWatermarkChanged(lowWatermark);
+}
+
+void AudioDevSimulated::setPeriod(int period)
+{
+    period = qMax(period, 0);
+
+    if (this->d->m_period == period)
+        return;
+
+    this->d->m_period = period;
+    emit this->periodChanged(period);
+}
+
+void AudioDevSimulated::setJitter(int jitter)
+{
+    jitter = qMax(jitter, 0);
+
+    if (this->d->m_jitter == jitter)
+        return;
+
+    this->d->m_jitter = jitter;
+    emit this->jitterChanged(jitter);
+}
+
+void AudioDevSimulated::setDrift(qreal drift)
+{
+    if (qFuzzyCompare(this->d->m_drift, drift))
+        return;
+
+    this->d->m_drift = drift;
+    emit this->driftChanged(drift);
+}
+
+void AudioDevSimulated::resetLowWatermark()
+{
+    this->setLowWatermark(0);
+}
+
+void AudioDevSimulated::resetPeriod()
+{
+    this->setPeriod(0);
+}
+
+void AudioDevSimulated::resetJitter()
+{
+    this->setJitter(0);
+}
+
+void AudioDevSimulated::resetDrift()
+{
+    this->setDrift(0.0);
+}
+
+void AudioDevSimulated::resetStats()
+{
+    this->d->m_buffer.stats().reset();
+}
+
+AudioDevSimulatedPrivate::AudioDevSimulatedPrivate(AudioDevSimulated *self):
+    self(self)
+{
+    // The device loop and the notifier run at the same time, even on single
+    // core machines.
+    this->m_threadPool.setMaxThreadCount(2);
+}
+
+quint64 AudioDevSimulatedPrivate::hostTime(SimulatedClock::time_point time)
+{
+    return quint64(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+}
+
+void AudioDevSimulatedPrivate::setAchievedLatency(qreal achievedLatency)
+{
+    if (qFuzzyCompare(this->m_achievedLatency, achievedLatency))
+        return;
+
+    this->m_achievedLatency = achievedLatency;
+    emit self->achievedLatencyChanged(achievedLatency);
+}
+
+void AudioDevSimulatedPrivate::deviceLoop(qreal drift)
+{
+    /* The device clock runs at the sample rate deviated by the drift, and it
+     * never waits for us: a period is ready at a fixed time, and the periods
+     * missed because the thread woke up too late are lost, as with the real
+     * hardware.
+     */
+    auto &buffer = this->m_buffer;
+    auto &stats = buffer.stats();
+    auto period = quint64(buffer.period());
+    auto rate = qreal(buffer.caps().rate()) * (1.0 + drift / 1e6);
+    auto frameDuration = 1e9 / rate;
+    auto start = SimulatedClock::now();
+    quint64 sampleTime = 0;
+
+    auto frameTime = [start, frameDuration] (quint64 frame) {
+        return start
+               + std::chrono::nanoseconds(qint64(std::llround(qreal(frame)
+                                                              * frameDuration)));
+    };
+
+    while (this->m_runDevice) {
+        int jitter = this->m_jitter;
+        auto wakeUp = frameTime(sampleTime + period);
+
+        if (jitter > 0)
+            wakeUp += std::chrono::microseconds(QRandomGenerator::global()->bounded(jitter + 1));
+
+        std::this_thread::sleep_until(wakeUp);
+
+        if (!this->m_runDevice)
+            break;
+
+        /* The device holds two periods, the current one is lost if we wake up
+         * after the next one is complete. Large jitters cause xruns too.
+         */
+        auto now = SimulatedClock::now();
+        quint64 missed = 0;
+
+        while (frameTime(sampleTime + 2 * period + missed) <= now)
+            missed += period;
+
+        if (missed > 0) {
+            if (this->m_isInput)
+                stats.overrun(missed);
+            else
+                stats.underrun(missed);
+
+            sampleTime += missed;
+        }
+
+        stats.callbackStarted(this->hostTime(now));
+
+        if (this->m_isInput)
+            this->capture(sampleTime, this->hostTime(frameTime(sampleTime)));
+        else
+            this->playback();
+
+        stats.callbackFinished(this->hostTime(SimulatedClock::now()),
+                               buffer.ring().readAvailable(),
+                               buffer.ring().capacity());
+        sampleTime += period;
+    }
+}
+
+void AudioDevSimulatedPrivate::capture(quint64 sampleTime, quint64 hostTime)
+{
+    auto &buffer = this->m_buffer;
+    auto period = buffer.period();
+    auto channels = size_t(buffer.caps().channels());
+    auto samples = reinterpret_cast<float *>(this->m_periodBuffer.data());
+    auto phaseStep = 2.0 * M_PI * TONE_FREQUENCY / buffer.caps().rate();
+
+    for (size_t i = 0; i < period; i++) {
+        auto phase = std::fmod(qreal(sampleTime + i) * phaseStep, 2.0 * M_PI);
+        auto sample = float(TONE_AMPLITUDE * std::sin(phase));
+
+        for (size_t channel = 0; channel < channels; channel++)
+            *samples++ = sample;
+    }
+
+    const void *planes[] = {this->m_periodBuffer.constData()};
+    buffer.capture(planes, period, sampleTime, hostTime);
+}
+
+void AudioDevSimulatedPrivate::playback()
+{
+    void *planes[] = {this->m_periodBuffer.data()};
+    this->m_buffer.render(planes, this->m_buffer.period());
+}
+
+#include "moc_audiodevsimulated.cpp"
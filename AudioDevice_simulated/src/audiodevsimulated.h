@@ -0,0 +1,126 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef AUDIODEVSIMULATED_H
+#define AUDIODEVSIMULATED_H
+
+#include "audiodev.h"
+
+class AudioDevSimulatedPrivate;
+
+/* Audio device without audio hardware.
+ *
+ * A pseudo real-time thread wakes up once per device period and runs the same
+ * buffering core as the CoreAudio implementation, the input device captures a
+ * sine tone and the output device discards the samples. The wake-up time
+ * can be delayed by a random jitter, and the device clock can drift from the
+ * nominal sample rate, so the latency and the xruns of the pipeline can be
+ * measured on any machine.
+ */
+class AudioDevSimulated: public AudioDev
+{
+    Q_OBJECT
+    Q_PROPERTY(qreal achievedLatency
+               READ achievedLatency
+               NOTIFY achievedLatencyChanged)
+    Q_PROPERTY(QVariantMap stats
+               READ stats)
+    Q_PROPERTY(int lowWatermark
+               READ lowWatermark
+               WRITE setLowWatermark
+               RESET resetLowWatermark
+               NOTIFY lowWatermarkChanged)
+    Q_PROPERTY(int period
+               READ period
+               WRITE setPeriod
+               RESET resetPeriod
+               NOTIFY periodChanged)
+    Q_PROPERTY(int jitter
+               READ jitter
+               WRITE setJitter
+               RESET resetJitter
+               NOTIFY jitterChanged)
+    Q_PROPERTY(qreal drift
+               READ drift
+               WRITE setDrift
+               RESET resetDrift
+               NOTIFY driftChanged)
+
+    public:
+        AudioDevSimulated(QObject *parent=nullptr);
+        ~AudioDevSimulated();
+
+        Q_INVOKABLE QString error() const override;
+        Q_INVOKABLE QString defaultInput() override;
+        Q_INVOKABLE QString defaultOutput() override;
+        Q_INVOKABLE QStringList inputs() override;
+        Q_INVOKABLE QStringList outputs() override;
+        Q_INVOKABLE QString description(const QString &device) override;
+        Q_INVOKABLE AkAudioCaps preferredFormat(const QString &device) override;
+        Q_INVOKABLE QList<AkAudioCaps::SampleFormat> supportedFormats(const QString &device) override;
+        Q_INVOKABLE QList<AkAudioCaps::ChannelLayout> supportedChannelLayouts(const QString &device) override;
+        Q_INVOKABLE QList<int> supportedSampleRates(const QString &device) override;
+        Q_INVOKABLE bool init(const QString &device, const AkAudioCaps &caps) override;
+        Q_INVOKABLE QByteArray read() override;
+        Q_INVOKABLE AkAudioPacket readPacket(int timeout=-1);
+        Q_INVOKABLE bool write(const AkAudioPacket &packet) override;
+        Q_INVOKABLE qint64 tryWrite(const AkAudioPacket &packet,
+                                    qint64 offset=0);
+        Q_INVOKABLE bool uninit() override;
+        Q_INVOKABLE qreal achievedLatency() const;
+        Q_INVOKABLE quint64 samplePosition() const;
+        Q_INVOKABLE QVariantMap stats() const;
+        Q_INVOKABLE int lowWatermark() const;
+
+        // Device period in frames, 0 uses half of the latency.
+        Q_INVOKABLE int period() const;
+
+        // Maximum random delay of each wake-up, in microseconds.
+        Q_INVOKABLE int jitter() const;
+
+        // Deviation of the device clock from the sample rate, in ppm.
+        Q_INVOKABLE qreal drift() const;
+
+    private:
+        AudioDevSimulatedPrivate *d;
+
+    signals:
+        void achievedLatencyChanged(qreal achievedLatency);
+        void discontinuity(qint64 pts, quint64 lostSamples);
+        void lowWatermarkChanged(int lowWatermark);
+        void needMoreData(qint64 samples);
+        void periodChanged(int period);
+        void jitterChanged(int jitter);
+        void driftChanged(qreal drift);
+
+    public slots:
+        void setLowWatermark(int lowWatermark);
+        void setPeriod(int period);
+        void setJitter(int jitter);
+        void setDrift(qreal drift);
+        void resetLowWatermark();
+        void resetPeriod();
+        void resetJitter();
+        void resetDrift();
+        void resetStats();
+
+        friend class AudioDevSimulatedPrivate;
+};
+
+#endif // AUDIODEVSIMULATED_H
@@ -0,0 +1,191 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <QtTest>
+#include <akaudiocaps.h>
+#include <akaudiopacket.h>
+
+#include "audiodevsimulated.h"
+
+/* Stress tests of the buffering core: the simulated device runs in real time
+ * with a jittery and drifting clock, while the client reads or writes from
+ * its own thread as the media pipeline does.
+ */
+
+#define RATE     48000
+#define PERIOD   480
+#define LATENCY  50
+#define JITTER   3000
+#define DRIFT    300.0
+#define DURATION 3000
+
+using Clock = std::chrono::steady_clock;
+
+class TestAudioDevSimulated: public QObject
+{
+    Q_OBJECT
+
+    private:
+        static AkAudioCaps caps();
+        static void setupDevice(AudioDevSimulated &device);
+        static quint64 counter(const AudioDevSimulated &device,
+                               const QString &name);
+
+    private slots:
+        void captureUnderJitter();
+        void playbackUnderJitter();
+        void restartWhileBusy();
+};
+
+AkAudioCaps TestAudioDevSimulated::caps()
+{
+    return AkAudioCaps(AkAudioCaps::SampleFormat_s16,
+                       AkAudioCaps::Layout_stereo,
+                       false,
+                       RATE);
+}
+
+void TestAudioDevSimulated::setupDevice(AudioDevSimulated &device)
+{
+    device.setLatency(LATENCY);
+    device.setPeriod(PERIOD);
+    device.setJitter(JITTER);
+    device.setDrift(DRIFT);
+}
+
+quint64 TestAudioDevSimulated::counter(const AudioDevSimulated &device,
+                                       const QString &name)
+{
+    return device.stats().value(name).toULongLong();
+}
+
+void TestAudioDevSimulated::captureUnderJitter()
+{
+    AudioDevSimulated device;
+    setupDevice(device);
+    quint64 discontinuities = 0;
+    QObject::connect(&device,
+                     &AudioDevSimulated::discontinuity,
+                     [&discontinuities] (qint64, quint64) {
+                         discontinuities++;
+                     });
+    QVERIFY(device.init(device.defaultInput(), caps()));
+
+    auto deadline = Clock::now() + std::chrono::milliseconds(DURATION);
+    quint64 samples = 0;
+    qint64 lastPts = -1;
+    bool ordered = true;
+    qint16 peak = 0;
+
+    while (Clock::now() < deadline) {
+        auto packet = device.readPacket(1000);
+        QVERIFY(packet);
+
+        ordered = ordered && packet.pts() > lastPts;
+        lastPts = packet.pts();
+        samples += packet.samples();
+        auto data = reinterpret_cast<const qint16 *>(packet.data());
+
+        for (size_t i = 0; i < 2 * packet.samples(); i++)
+            peak = qMax<qint16>(peak, qAbs(data[i]));
+    }
+
+    auto callbacks = counter(device, "callbacks");
+    device.uninit();
+
+    QVERIFY(ordered);
+
+    // The device captures a half scale tone.
+    QVERIFY(qAbs(peak - 16384) < 256);
+
+    // The reader kept up with the device, allow for some scheduling hiccups.
+    QVERIFY(samples > 90 * quint64(RATE) * DURATION / 100000);
+    QVERIFY(counter(device, "overruns") <= callbacks / 20);
+    QVERIFY(discontinuities <= callbacks / 20);
+}
+
+void TestAudioDevSimulated::playbackUnderJitter()
+{
+    AudioDevSimulated device;
+    setupDevice(device);
+    QVERIFY(device.init(device.defaultOutput(), caps()));
+
+    AkAudioPacket packet(caps(), PERIOD / 2);
+    auto data = reinterpret_cast<qint16 *>(packet.data());
+
+    for (size_t i = 0; i < 2 * packet.samples(); i++)
+        data[i] = 8192;
+
+    // Let the device run dry once while the writer starts.
+    QVERIFY(device.write(packet));
+    device.resetStats();
+    auto deadline = Clock::now() + std::chrono::milliseconds(DURATION);
+    quint64 samples = 0;
+
+    // write() blocks while the queue is full, so it paces the writer.
+    while (Clock::now() < deadline) {
+        QVERIFY(device.write(packet));
+        samples += packet.samples();
+    }
+
+    auto callbacks = counter(device, "callbacks");
+    auto underruns = counter(device, "underruns");
+    device.uninit();
+
+    QVERIFY(samples > 90 * quint64(RATE) * DURATION / 100000);
+    QVERIFY(underruns <= callbacks / 20);
+}
+
+void TestAudioDevSimulated::restartWhileBusy()
+{
+    /* Restart the devices while a client thread is blocked reading or
+     * writing, as happens when the user switches devices. Neither side can
+     * hang or touch the released buffers.
+     */
+    AudioDevSimulated device;
+    setupDevice(device);
+    AkAudioPacket packet(caps(), PERIOD, true);
+
+    for (int i = 0; i < 40; i++) {
+        bool input = i % 2 == 0;
+        QVERIFY(device.init(input? device.defaultInput(): device.defaultOutput(),
+                            caps()));
+        std::atomic<bool> running {true};
+        std::thread client([&] () {
+            while (running) {
+                if (input)
+                    device.readPacket(100);
+                else
+                    device.write(packet);
+            }
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5 + i % 7));
+        device.uninit();
+        running = false;
+        client.join();
+    }
+}
+
+QTEST_GUILESS_MAIN(TestAudioDevSimulated)
+
+#include "tst_audiodevsimulated.moc"
@@ -20,15 +20,32 @@
 #ifndef CAPTUREAVFOUNDATION_H
 #define CAPTUREAVFOUNDATION_H
 
+#include <akvideocaps.h>
+
 #include "capture.h"
 
 class CaptureAvFoundationPrivate;
-class QWaitCondition;
-class QMutex;
 
 class CaptureAvFoundation: public Capture
 {
     Q_OBJECT
+    Q_PROPERTY(QVariantMap stats
+               READ stats)
+    Q_PROPERTY(QList<AkVideoCaps::PixelFormat> preferredFormats
+               READ preferredFormats
+               WRITE setPreferredFormats
+               RESET resetPreferredFormats
+               NOTIFY preferredFormatsChanged)
+    Q_PROPERTY(bool pushMode
+               READ pushMode
+               WRITE setPushMode
+               RESET resetPushMode
+               NOTIFY pushModeChanged)
+    Q_PROPERTY(QString queueQos
+               READ queueQos
+               WRITE setQueueQos
+               RESET resetQueueQos
+               NOTIFY queueQosChanged)
 
     public:
         CaptureAvFoundation(QObject *parent=nullptr);
@@ -48,15 +65,53 @@ class CaptureAvFoundation: public Capture
         Q_INVOKABLE QVariantList cameraControls() const override;
         Q_INVOKABLE bool setCameraControls(const QVariantMap &cameraControls) override;
         Q_INVOKABLE bool resetCameraControls() override;
+
+        /* Returns the oldest queued frame, with the image controls applied.
+         * The queue holds up to nBuffers frames, less if they don't fit in
+         * the memory budget, the oldest one is dropped when the queue is
+         * full. stats() reports the effective depth.
+         */
         Q_INVOKABLE AkPacket readFrame() override;
 
-        QMutex &mutex();
-        QWaitCondition &frameReady();
-        void *curFrame();
+        /* Pixel formats accepted by the consumers of the frames, in order of
+         * preference. The frames are delivered in the format of the camera
+         * if it's accepted, an empty list accepts any format.
+         */
+        Q_INVOKABLE QList<AkVideoCaps::PixelFormat> preferredFormats() const;
+
+        /* Deliver the frames through frameCaptured(), converted in the
+         * capture queue as soon as the camera produces them, instead of
+         * queueing them for readFrame(). Takes effect on the next init().
+         * While pushing, readFrame() waits with the same timeout as in pull
+         * mode, or until uninit(), and returns an empty packet. Only the
+         * receivers of frameCaptured() get the frames.
+         */
+        Q_INVOKABLE bool pushMode() const;
+
+        /* Quality of service class of the capture queue: "unspecified",
+         * "background", "utility", "default", "userInitiated" or
+         * "userInteractive". Takes effect on the next init().
+         */
+        Q_INVOKABLE QString queueQos() const;
+
+        // Latencies are measured from the frame presentation time, in µs.
+        Q_INVOKABLE QVariantMap stats() const;
+
+        // Called from the capture queue.
+        void pushFrame(void *sampleBuffer);
+        void frameDropped();
 
     private:
         CaptureAvFoundationPrivate *d;
 
+    signals:
+        void preferredFormatsChanged(const QList<AkVideoCaps::PixelFormat> &preferredFormats);
+        void pushModeChanged(bool pushMode);
+        void queueQosChanged(const QString &queueQos);
+
+        // Emitted from the capture queue in push mode.
+        void frameCaptured(const AkPacket &packet);
+
     public slots:
         bool init() override;
         void uninit() override;
@@ -64,10 +119,17 @@ class CaptureAvFoundation: public Capture
         void setStreams(const QList<int> &streams) override;
         void setIoMethod(const QString &ioMethod) override;
         void setNBuffers(int nBuffers) override;
+        void setPreferredFormats(const QList<AkVideoCaps::PixelFormat> &preferredFormats);
+        void setPushMode(bool pushMode);
+        void setQueueQos(const QString &queueQos);
         void resetDevice() override;
         void resetStreams() override;
         void resetIoMethod() override;
         void resetNBuffers() override;
+        void resetPreferredFormats();
+        void resetPushMode();
+        void resetQueueQos();
+        void resetStats();
         void reset() override;
 
         void cameraConnected();
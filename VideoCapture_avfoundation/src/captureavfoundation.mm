@@ -17,21 +17,25 @@
  * Web-Site: http://webcamoid.github.io/
  */
 
+#include <atomic>
 #include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QFuture>
 #include <QMap>
 #include <QMutex>
 #include <QReadWriteLock>
+#include <QSemaphore>
+#include <QThreadPool>
 #include <QVariant>
 #include <QWaitCondition>
+#include <QtConcurrent>
 #include <QtDebug>
 #include <ak.h>
 #include <akcaps.h>
 #include <akcompressedvideocaps.h>
 #include <akcompressedvideopacket.h>
-#include <akelement.h>
 #include <akfrac.h>
 #include <akpacket.h>
-#include <akpluginmanager.h>
 #include <akvideocaps.h>
 #include <akvideopacket.h>
 #include <sys/time.h>
@@ -40,6 +44,15 @@
 
 #include "captureavfoundation.h"
 #include "deviceobserver.h"
+#include "externalvideoframe.h"
+#include "imagecontrols.h"
+
+/* Memory available to the frames waiting for readFrame(). The queue holds
+ * nBuffers frames as long as they fit, 32 frames of 1080p NV12 take about
+ * 100 MB, but 4K frames only fit 20 times. The effective depth is reported in
+ * stats().
+ */
+#define MAX_QUEUED_BYTES (256 * 1024 * 1024)
 
 enum ControlType
 {
@@ -104,6 +117,10 @@ inline RawFmtToAkFmtMap initRawFmtToAkFmt()
         {kCVPixelFormatType_422YpCbCr10BiPlanarFullRange     , AkVideoCaps::Format_p210         },
         {kCVPixelFormatType_444YpCbCr10BiPlanarFullRange     , AkVideoCaps::Format_p410         },
         {kCVPixelFormatType_420YpCbCr8VideoRange_8A_TriPlanar, AkVideoCaps::Format_nv12a        },
+        {kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange     , AkVideoCaps::Format_nv12         },
+        {kCVPixelFormatType_420YpCbCr8BiPlanarFullRange      , AkVideoCaps::Format_nv12         },
+        {kCVPixelFormatType_420YpCbCr8Planar                 , AkVideoCaps::Format_yuv420p      },
+        {kCVPixelFormatType_420YpCbCr8PlanarFullRange        , AkVideoCaps::Format_yuv420p      },
     };
 
     return rawFmtToAkFmt;
@@ -113,6 +130,34 @@ Q_GLOBAL_STATIC_WITH_ARGS(RawFmtToAkFmtMap,
                           rawFmtToAkFmt,
                           (initRawFmtToAkFmt()))
 
+using FourCCList = QVector<FourCharCode>;
+
+// Formats produced natively by most cameras, the cheapest ones to deliver.
+Q_GLOBAL_STATIC_WITH_ARGS(FourCCList,
+                          nativeCameraFormats,
+                          ({kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange,
+                            kCVPixelFormatType_420YpCbCr8BiPlanarFullRange,
+                            kCVPixelFormatType_422YpCbCr8,
+                            kCVPixelFormatType_422YpCbCr8_yuvs}))
+
+using QosClassMap = QMap<QString, qos_class_t>;
+
+inline QosClassMap initQosClass()
+{
+    QosClassMap qosClass {
+        {"unspecified"    , QOS_CLASS_UNSPECIFIED     },
+        {"background"     , QOS_CLASS_BACKGROUND      },
+        {"utility"        , QOS_CLASS_UTILITY         },
+        {"default"        , QOS_CLASS_DEFAULT         },
+        {"userInitiated"  , QOS_CLASS_USER_INITIATED  },
+        {"userInteractive", QOS_CLASS_USER_INTERACTIVE},
+    };
+
+    return qosClass;
+}
+
+Q_GLOBAL_STATIC_WITH_ARGS(QosClassMap, qosClass, (initQosClass()))
+
 using CompressedFormatToStrMap = QMap<FourCharCode, QString>;
 
 inline CompressedFormatToStrMap initCompressedFormatToStr()
@@ -160,6 +205,12 @@ Q_GLOBAL_STATIC_WITH_ARGS(CompressedFormatToStrMap,
                           compressedFormatToStr,
                           (initCompressedFormatToStr()))
 
+struct CaptureAvFoundationFrame
+{
+    AkPacket packet;
+    CMTime presentationTime;
+};
+
 class CaptureAvFoundationPrivate
 {
     public:
@@ -169,11 +220,19 @@ class CaptureAvFoundationPrivate
         AVCaptureDeviceInput *m_deviceInput {nil};
         AVCaptureVideoDataOutput *m_dataOutput {nil};
         AVCaptureSession *m_session {nil};
-        CMSampleBufferRef m_curFrame {nil};
+        QVector<CaptureAvFoundationFrame> m_frames;
+        int m_framesHead {0};
+        int m_framesCount {0};
+        int m_queueDepth {0};
+        quint64 m_capturedFrames {0};
+        quint64 m_droppedFrames {0};
+        quint64 m_deviceDroppedFrames {0};
+        qint64 m_latency {0};
+        qint64 m_maxLatency {0};
+        qint64 m_latencySum {0};
+        quint64 m_latencyFrames {0};
         CMIODeviceID m_deviceID {kCMIODeviceUnknown};
-        AkElementPtr m_hslFilter {akPluginManager->create<AkElement>("VideoFilter/AdjustHSL")};
-        AkElementPtr m_contrastFilter {akPluginManager->create<AkElement>("VideoFilter/Contrast")};
-        AkElementPtr m_gammaFilter {akPluginManager->create<AkElement>("VideoFilter/Gamma")};
+        ImageControls m_imageControls;
         QString m_device;
         QList<int> m_streams;
         QMap<QString, CMIODeviceID> m_cmioIDs;
@@ -181,6 +240,10 @@ class CaptureAvFoundationPrivate
         QMap<QString, QString> m_descriptions;
         QMap<QString, CaptureVideoCaps> m_devicesCaps;
         int m_nBuffers {32};
+        QList<AkVideoCaps::PixelFormat> m_preferredFormats;
+        bool m_pushMode {false};
+        std::atomic<bool> m_pushing {false};
+        QString m_queueQos {"unspecified"};
         QMutex m_mutex;
         QReadWriteLock m_controlsMutex;
         QWaitCondition m_frameReady;
@@ -190,8 +253,12 @@ class CaptureAvFoundationPrivate
         qint64 m_id {-1};
         QVariantList m_globalImageControls;
         QVariantList m_globalCameraControls;
-        QVariantMap m_localImageControls;
-        QVariantMap m_localCameraControls;
+        QVariantMap m_localControls;
+        QThreadPool m_threadPool;
+        QFuture<void> m_controlsStatus;
+        std::atomic<bool> m_runControls {false};
+        std::atomic<QVariantMap *> m_pendingControls {nullptr};
+        QSemaphore m_controlsPosted;
 
         CaptureAvFoundationPrivate(CaptureAvFoundation *self);
         static bool canUseCamera();
@@ -202,9 +269,20 @@ class CaptureAvFoundationPrivate
                                                             const AkCaps &caps);
         static inline AVFrameRateRange *frameRateRangeFromFps(AVCaptureDeviceFormat *format,
                                                               const AkFrac &fps);
+        CaptureAvFoundationFrame takeFrame(int timeout);
+        void clearFrames();
+        FourCharCode outputPixelFormat(AVCaptureVideoDataOutput *output,
+                                       FourCharCode nativeFormat) const;
+        static ExternalVideoFrame frameFromPixelBuffer(CVImageBufferRef imageBuffer,
+                                                       const AkVideoCaps &caps);
+        AkPacket packetFromSampleBuffer(CMSampleBufferRef sampleBuffer,
+                                        bool applyControls);
+        void updateLatency(const CMTime &presentationTime);
         QVariantMap controlStatus(const QVariantList &controls) const;
         QVariantMap mapDiff(const QVariantMap &map1,
                             const QVariantMap &map2) const;
+        void postControls();
+        void controlsLoop();
         QVector<CMIOControlID> deviceControls(CMIODeviceID deviceID) const;
         ControlType controlType(CMIOControlID controlID, Boolean *isSettable) const;
         void setControlType(CMIOControlID controlID, ControlType type) const;
@@ -325,7 +403,7 @@ QVariantList CaptureAvFoundation::imageControls() const
                      255,
                      1,
                      0,
-                     this->d->m_hslFilter->property("luminance").toInt(),
+                     this->d->m_imageControls.luminance(),
                      QStringList()}),
         QVariant(QVariantList {
                      "Contrast",
@@ -334,7 +412,7 @@ QVariantList CaptureAvFoundation::imageControls() const
                      255,
                      1,
                      0,
-                     this->d->m_contrastFilter->property("contrast").toInt(),
+                     this->d->m_imageControls.contrast(),
                      QStringList()}),
         QVariant(QVariantList {
                      "Saturation",
@@ -343,7 +421,7 @@ QVariantList CaptureAvFoundation::imageControls() const
                      255,
                      1,
                      0,
-                     this->d->m_hslFilter->property("saturation").toInt(),
+                     this->d->m_imageControls.saturation(),
                      QStringList()}),
         QVariant(QVariantList {
                      "Hue",
@@ -352,7 +430,7 @@ QVariantList CaptureAvFoundation::imageControls() const
                      359,
                      1,
                      0,
-                     this->d->m_hslFilter->property("hue").toInt(),
+                     this->d->m_imageControls.hue(),
                      QStringList()}),
         QVariant(QVariantList {
                      "Gamma",
@@ -361,7 +439,7 @@ QVariantList CaptureAvFoundation::imageControls() const
                      255,
                      1,
                      0,
-                     this->d->m_gammaFilter->property("gamma").toInt(),
+                     this->d->m_imageControls.gamma(),
                      QStringList()}),
     };
 }
@@ -393,6 +471,7 @@ bool CaptureAvFoundation::setImageControls(const QVariantMap &imageControls)
 
         this->d->m_globalImageControls = globalImageControls;
         this->d->m_controlsMutex.unlock();
+        this->d->postControls();
 
         emit this->imageControlsChanged(imageControls);
 
@@ -403,15 +482,15 @@ bool CaptureAvFoundation::setImageControls(const QVariantMap &imageControls)
 
     for (auto it = imageControls.cbegin(); it != imageControls.cend(); it++) {
         if (it.key() == "Brightness")
-            this->d->m_hslFilter->setProperty("luminance", it.value());
+            this->d->m_imageControls.setLuminance(it.value().toInt());
         else if (it.key() == "Contrast")
-            this->d->m_contrastFilter->setProperty("contrast", it.value());
+            this->d->m_imageControls.setContrast(it.value().toInt());
         else if (it.key() == "Saturation")
-            this->d->m_hslFilter->setProperty("saturation", it.value());
+            this->d->m_imageControls.setSaturation(it.value().toInt());
         else if (it.key() == "Hue")
-            this->d->m_hslFilter->setProperty("hue", it.value());
+            this->d->m_imageControls.setHue(it.value().toInt());
         else if (it.key() == "Gamma")
-            this->d->m_gammaFilter->setProperty("gamma", it.value());
+            this->d->m_imageControls.setGamma(it.value().toInt());
         else
             ok = false;
     }
@@ -432,11 +511,7 @@ bool CaptureAvFoundation::resetImageControls()
         return this->setImageControls(controls);
     }
 
-    this->d->m_hslFilter->setProperty("luminance", 0);
-    this->d->m_contrastFilter->setProperty("contrast", 0);
-    this->d->m_hslFilter->setProperty("saturation", 0);
-    this->d->m_hslFilter->setProperty("hue", 0);
-    this->d->m_gammaFilter->setProperty("gamma", 0);
+    this->d->m_imageControls.reset();
 
     return true;
 }
@@ -478,6 +553,7 @@ bool CaptureAvFoundation::setCameraControls(const QVariantMap &cameraControls)
 
     this->d->m_globalCameraControls = globalCameraControls;
     this->d->m_controlsMutex.unlock();
+    this->d->postControls();
 
     emit this->cameraControlsChanged(cameraControls);
 
@@ -501,152 +577,147 @@ bool CaptureAvFoundation::resetCameraControls()
 
 AkPacket CaptureAvFoundation::readFrame()
 {
+    /* Nothing is queued in push mode, but still wait as in pull mode, so a
+     * consumer polling this doesn't spin. uninit() releases the wait.
+     */
     this->d->m_mutex.lock();
 
-    if (this->d->m_enableHwControls) {
-        this->d->m_controlsMutex.lockForRead();
-        auto imageControls = this->d->controlStatus(this->d->m_globalImageControls);
-        this->d->m_controlsMutex.unlock();
+    // The frames were already converted by the delegate.
+    auto frame = this->d->takeFrame(1000);
+    this->d->m_mutex.unlock();
 
-        if (this->d->m_localImageControls != imageControls) {
-            auto controls = this->d->mapDiff(this->d->m_localImageControls,
-                                             imageControls);
-            this->d->setControls(this->d->m_deviceID, controls);
-            this->d->m_localImageControls = imageControls;
-        }
-    }
+    if (!frame.packet)
+        return {};
 
-    if (!this->d->m_curFrame)
-        if (!this->d->m_frameReady.wait(&this->d->m_mutex, 1000)) {
-            this->d->m_mutex.unlock();
+    this->d->updateLatency(frame.presentationTime);
 
-            return {};
-        }
+    // The software controls run here, out of the capture queue.
+    if (this->d->m_enableHwControls
+        || frame.packet.type() != AkPacket::PacketVideo)
+        return frame.packet;
 
-    auto formatDesc = CMSampleBufferGetFormatDescription(this->d->m_curFrame);
-    int width = 0;
-    int height = 0;
+    return this->d->m_imageControls.process(AkVideoPacket(frame.packet));
+}
 
-    if (formatDesc) {
-        auto size = CMVideoFormatDescriptionGetDimensions(formatDesc);
-        width = size.width;
-        height = size.height;
-    }
+QList<AkVideoCaps::PixelFormat> CaptureAvFoundation::preferredFormats() const
+{
+    return this->d->m_preferredFormats;
+}
+
+bool CaptureAvFoundation::pushMode() const
+{
+    return this->d->m_pushMode;
+}
+
+QString CaptureAvFoundation::queueQos() const
+{
+    return this->d->m_queueQos;
+}
+
+QVariantMap CaptureAvFoundation::stats() const
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+    auto averageLatency =
+            this->d->m_latencyFrames > 0?
+                this->d->m_latencySum / qint64(this->d->m_latencyFrames):
+                0;
+
+    return {
+        {"capturedFrames"     , this->d->m_capturedFrames     },
+        {"queuedFrames"       , this->d->m_framesCount        },
+        {"queueDepth"         , this->d->m_queueDepth         },
+        {"maxQueuedBytes"     , MAX_QUEUED_BYTES              },
+        {"droppedFrames"      , this->d->m_droppedFrames      },
+        {"deviceDroppedFrames", this->d->m_deviceDroppedFrames},
+        {"latency"            , this->d->m_latency            },
+        {"averageLatency"     , averageLatency                },
+        {"maxLatency"         , this->d->m_maxLatency         },
+    };
+}
 
-    if (width < 1 || height < 1) {
-        CFRelease(this->d->m_curFrame);
-        this->d->m_curFrame = nil;
+void CaptureAvFoundation::pushFrame(void *sampleBuffer)
+{
+    if (this->d->m_pushing) {
+        // Convert and deliver the frame right here in the capture queue.
+        auto buffer = CMSampleBufferRef(sampleBuffer);
+        this->d->m_mutex.lock();
+        this->d->m_capturedFrames++;
         this->d->m_mutex.unlock();
+        auto packet = this->d->packetFromSampleBuffer(buffer, true);
 
-        return {};
+        if (packet) {
+            this->d->updateLatency(CMSampleBufferGetPresentationTimeStamp(buffer));
+            emit this->frameCaptured(packet);
+        }
+
+        return;
     }
 
-    // Read pts.
-    CMItemCount count = 0;
-    CMSampleTimingInfo timingInfo;
-    qint64 pts;
-    AkFrac timeBase;
+    this->d->m_mutex.lock();
+    bool capturing = !this->d->m_frames.isEmpty();
+    this->d->m_mutex.unlock();
 
-    if (CMSampleBufferGetOutputSampleTimingInfoArray(this->d->m_curFrame,
-                                                     1,
-                                                     &timingInfo,
-                                                     &count) == noErr) {
-        pts = timingInfo.presentationTimeStamp.value;
-        timeBase = AkFrac(1, timingInfo.presentationTimeStamp.timescale);
-    } else {
-        timeval timestamp;
-        gettimeofday(&timestamp, nullptr);
-        pts = qint64((timestamp.tv_sec
-                      + 1e-6 * timestamp.tv_usec)
-                     * this->d->m_timeBase.invert().value());
-        timeBase = this->d->m_timeBase;
-    }
+    if (!capturing)
+        return;
 
-    // Create package.
-    auto fourCC = CMFormatDescriptionGetMediaSubType(formatDesc);
-    AkPacket packet;
+    /* Copy the frame right away, so the sample buffer goes back to the
+     * capture pool when the delegate returns instead of waiting in the
+     * queue. The image controls are left to readFrame(), the capture queue
+     * only pays for the copy.
+     */
+    auto buffer = CMSampleBufferRef(sampleBuffer);
+    CaptureAvFoundationFrame frame {
+        this->d->packetFromSampleBuffer(buffer, false),
+        CMSampleBufferGetPresentationTimeStamp(buffer)
+    };
 
-    // Read frame data.
-    auto imageBuffer = CMSampleBufferGetImageBuffer(this->d->m_curFrame);
+    if (!frame.packet)
+        return;
 
-    if (imageBuffer) {
-        AkVideoPacket videoPacket({rawFmtToAkFmt->value(fourCC),
-                                   width,
-                                   height,
-                                   this->d->m_timeBase.invert()});
-        CVPixelBufferLockBaseAddress(imageBuffer, 0);
-        auto iData = reinterpret_cast<const quint8 *>(CVPixelBufferGetBaseAddress(imageBuffer));
-        auto iLineSize = CVPixelBufferGetBytesPerRow(imageBuffer);
-        auto lineSize = qMin<size_t>(videoPacket.lineSize(0),
-                                     iLineSize);
-
-        for (int y = 0; y < videoPacket.caps().height(); ++y) {
-            auto srcLine = iData + y * iLineSize;
-            auto dstLine = videoPacket.line(0, y);
-            memcpy(dstLine, srcLine, lineSize);
-        }
+    auto frameSize = frame.packet.type() == AkPacket::PacketVideo?
+                         AkVideoPacket(frame.packet).size():
+                         size_t(AkCompressedVideoPacket(frame.packet).size());
 
-        CVPixelBufferUnlockBaseAddress(imageBuffer, 0);
-        packet = videoPacket;
-    } else {
-        auto dataBuffer = CMSampleBufferGetDataBuffer(this->d->m_curFrame);
+    this->d->m_mutex.lock();
+    auto &frames = this->d->m_frames;
 
-        if (dataBuffer) {
-            size_t dataSize = 0;
-            char *data = nullptr;
-            CMBlockBufferGetDataPointer(dataBuffer,
-                                        0,
-                                        nullptr,
-                                        &dataSize,
-                                        &data);
-            AkCompressedVideoPacket videoPacket({compressedFormatToStr->value(fourCC),
-                                                 width,
-                                                 height,
-                                                 this->d->m_timeBase.invert()},
-                                                dataSize);
-            memcpy(videoPacket.data(), data, dataSize);
-            packet = videoPacket;
-        }
-    }
+    if (frames.isEmpty()) {
+        this->d->m_mutex.unlock();
 
-    packet.setPts(pts);
-    packet.setTimeBase(timeBase);
-    packet.setIndex(0);
-    packet.setId(this->d->m_id);
+        return;
+    }
 
-    if (!this->d->m_enableHwControls) {
-        packet = this->d->m_hslFilter->iStream(packet);
-        packet = this->d->m_gammaFilter->iStream(packet);
-        packet = this->d->m_contrastFilter->iStream(packet);
+    // Up to nBuffers frames, as many as fit in the memory budget.
+    this->d->m_queueDepth =
+            int(qBound<size_t>(1,
+                               MAX_QUEUED_BYTES / qMax<size_t>(frameSize, 1),
+                               size_t(frames.size())));
+
+    // When the queue is full, drop the oldest frames.
+    while (this->d->m_framesCount >= this->d->m_queueDepth) {
+        frames[this->d->m_framesHead] = {};
+        this->d->m_framesHead = (this->d->m_framesHead + 1) % frames.size();
+        this->d->m_framesCount--;
+        this->d->m_droppedFrames++;
     }
 
-    CFRelease(this->d->m_curFrame);
-    this->d->m_curFrame = nil;
+    auto tail = (this->d->m_framesHead + this->d->m_framesCount) % frames.size();
+    frames[tail] = frame;
+    this->d->m_framesCount++;
+    this->d->m_capturedFrames++;
+    this->d->m_frameReady.wakeAll();
     this->d->m_mutex.unlock();
-
-    return packet;
-}
-
-QMutex &CaptureAvFoundation::mutex()
-{
-    return this->d->m_mutex;
-}
-
-QWaitCondition &CaptureAvFoundation::frameReady()
-{
-    return this->d->m_frameReady;
 }
 
-void *CaptureAvFoundation::curFrame()
+void CaptureAvFoundation::frameDropped()
 {
-    return &this->d->m_curFrame;
+    this->d->m_mutex.lock();
+    this->d->m_deviceDroppedFrames++;
+    this->d->m_mutex.unlock();
 }
 
 bool CaptureAvFoundation::init()
 {
-    this->d->m_localImageControls.clear();
-    this->d->m_localCameraControls.clear();
-
     auto webcam = this->d->m_device;
 
     if (webcam.isEmpty()) {
@@ -727,12 +798,33 @@ bool CaptureAvFoundation::init()
     // Add data output unit.
     this->d->m_dataOutput = [AVCaptureVideoDataOutput new];
 
+    /* Deliver the frames in the format of the camera when possible, so
+     * AVFoundation doesn't convert every frame, and the consumers don't have
+     * to convert them back.
+     */
+    auto nativeFormat = CaptureAvFoundationPrivate::formatFromCaps(camera, caps);
+    auto pixelFormat =
+            this->d->outputPixelFormat(this->d->m_dataOutput,
+                                       nativeFormat && caps.type() == AkCaps::CapsVideo?
+                                           CMFormatDescriptionGetMediaSubType(nativeFormat.formatDescription):
+                                           0);
     this->d->m_dataOutput.videoSettings = @{
-        (NSString *) kCVPixelBufferPixelFormatTypeKey: @(kCVPixelFormatType_32ARGB)
+        (NSString *) kCVPixelBufferPixelFormatTypeKey: @(pixelFormat)
     };
+
+    /* The frames wait in our own queue, AVFoundation only has to hold the
+     * ones arriving while the delegate is still busy with the previous one.
+     * Those are late already, drop them instead of adding latency, they are
+     * counted in deviceDroppedFrames.
+     */
     this->d->m_dataOutput.alwaysDiscardsLateVideoFrames = YES;
 
-    dispatch_queue_t queue = dispatch_queue_create("frameQueue", nullptr);
+    auto queueAttributes =
+            dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL,
+                                                    qosClass->value(this->d->m_queueQos,
+                                                                    QOS_CLASS_UNSPECIFIED),
+                                                    0);
+    dispatch_queue_t queue = dispatch_queue_create("frameQueue", queueAttributes);
     [this->d->m_dataOutput
      setSampleBufferDelegate: this->d->m_deviceObserver
      queue: queue];
@@ -777,6 +869,21 @@ bool CaptureAvFoundation::init()
     camera.activeVideoMinFrameDuration = fpsRange.minFrameDuration;
     camera.activeVideoMaxFrameDuration = fpsRange.maxFrameDuration;
 
+    // The queue must be ready before the first frame arrives.
+    this->d->m_mutex.lock();
+    this->d->clearFrames();
+    this->d->m_frames.fill({}, qMax(1, this->d->m_nBuffers));
+    this->d->m_queueDepth = this->d->m_frames.size();
+    this->d->m_capturedFrames = 0;
+    this->d->m_droppedFrames = 0;
+    this->d->m_deviceDroppedFrames = 0;
+    this->d->m_latency = 0;
+    this->d->m_maxLatency = 0;
+    this->d->m_latencySum = 0;
+    this->d->m_latencyFrames = 0;
+    this->d->m_mutex.unlock();
+    this->d->m_pushing = this->d->m_pushMode;
+
     // Start capturing from the camera.
     [this->d->m_session startRunning];
     [camera unlockForConfiguration];
@@ -787,11 +894,30 @@ bool CaptureAvFoundation::init()
     this->d->m_timeBase = fps.invert();
     this->d->m_id = Ak::id();
 
+    // The hardware controls are applied out of the frame path.
+    if (this->d->m_enableHwControls) {
+        this->d->m_localControls.clear();
+        this->d->m_runControls = true;
+        this->d->m_controlsStatus =
+                QtConcurrent::run(&this->d->m_threadPool,
+                                  &CaptureAvFoundationPrivate::controlsLoop,
+                                  this->d);
+        this->d->postControls();
+    }
+
     return true;
 }
 
 void CaptureAvFoundation::uninit()
 {
+    if (this->d->m_runControls) {
+        this->d->m_runControls = false;
+        this->d->m_controlsPosted.release();
+        this->d->m_controlsStatus.waitForFinished();
+    }
+
+    delete this->d->m_pendingControls.exchange(nullptr);
+
     if (this->d->m_session) {
         [this->d->m_session stopRunning];
         [this->d->m_session beginConfiguration];
@@ -817,13 +943,12 @@ void CaptureAvFoundation::uninit()
         this->d->m_dataOutput = nil;
     }
 
+    this->d->m_pushing = false;
     this->d->m_mutex.lock();
-
-    if (this->d->m_curFrame) {
-        CFRelease(this->d->m_curFrame);
-        this->d->m_curFrame = nil;
-    }
-
+    this->d->clearFrames();
+    this->d->m_frames.clear();
+    this->d->m_queueDepth = 0;
+    this->d->m_frameReady.wakeAll();
     this->d->m_mutex.unlock();
 }
 
@@ -901,6 +1026,33 @@ void CaptureAvFoundation::setNBuffers(int nBuffers)
     emit this->nBuffersChanged(nBuffers);
 }
 
+void CaptureAvFoundation::setPreferredFormats(const QList<AkVideoCaps::PixelFormat> &preferredFormats)
+{
+    if (this->d->m_preferredFormats == preferredFormats)
+        return;
+
+    this->d->m_preferredFormats = preferredFormats;
+    emit this->preferredFormatsChanged(preferredFormats);
+}
+
+void CaptureAvFoundation::setPushMode(bool pushMode)
+{
+    if (this->d->m_pushMode == pushMode)
+        return;
+
+    this->d->m_pushMode = pushMode;
+    emit this->pushModeChanged(pushMode);
+}
+
+void CaptureAvFoundation::setQueueQos(const QString &queueQos)
+{
+    if (this->d->m_queueQos == queueQos)
+        return;
+
+    this->d->m_queueQos = queueQos;
+    emit this->queueQosChanged(queueQos);
+}
+
 void CaptureAvFoundation::resetDevice()
 {
     this->setDevice(this->d->m_devices.value(0, ""));
@@ -927,6 +1079,34 @@ void CaptureAvFoundation::resetNBuffers()
     this->setNBuffers(32);
 }
 
+void CaptureAvFoundation::resetPreferredFormats()
+{
+    this->setPreferredFormats({});
+}
+
+void CaptureAvFoundation::resetPushMode()
+{
+    this->setPushMode(false);
+}
+
+void CaptureAvFoundation::resetQueueQos()
+{
+    this->setQueueQos("unspecified");
+}
+
+void CaptureAvFoundation::resetStats()
+{
+    this->d->m_mutex.lock();
+    this->d->m_capturedFrames = 0;
+    this->d->m_droppedFrames = 0;
+    this->d->m_deviceDroppedFrames = 0;
+    this->d->m_latency = 0;
+    this->d->m_maxLatency = 0;
+    this->d->m_latencySum = 0;
+    this->d->m_latencyFrames = 0;
+    this->d->m_mutex.unlock();
+}
+
 void CaptureAvFoundation::reset()
 {
     this->resetStreams();
@@ -1189,6 +1369,218 @@ AVFrameRateRange *CaptureAvFoundationPrivate::frameRateRangeFromFps(AVCaptureDev
     return nil;
 }
 
+CaptureAvFoundationFrame CaptureAvFoundationPrivate::takeFrame(int timeout)
+{
+    // Must be called with m_mutex locked, only waits if the queue is empty.
+    QDeadlineTimer deadline(timeout);
+
+    while (this->m_framesCount < 1) {
+        if (!this->m_frameReady.wait(&this->m_mutex, deadline))
+            return {};
+
+        // Woken up by uninit(), the capture is stopped.
+        if (this->m_frames.isEmpty())
+            return {};
+    }
+
+    auto frame = this->m_frames[this->m_framesHead];
+    this->m_frames[this->m_framesHead] = {};
+    this->m_framesHead = (this->m_framesHead + 1) % this->m_frames.size();
+    this->m_framesCount--;
+
+    return frame;
+}
+
+void CaptureAvFoundationPrivate::clearFrames()
+{
+    while (this->m_framesCount > 0) {
+        this->m_frames[this->m_framesHead] = {};
+        this->m_framesHead = (this->m_framesHead + 1) % this->m_frames.size();
+        this->m_framesCount--;
+    }
+
+    this->m_framesHead = 0;
+}
+
+FourCharCode CaptureAvFoundationPrivate::outputPixelFormat(AVCaptureVideoDataOutput *output,
+                                                          FourCharCode nativeFormat) const
+{
+    QVector<FourCharCode> available;
+
+    for (NSNumber *format in output.availableVideoCVPixelFormatTypes)
+        if (rawFmtToAkFmt->contains(format.unsignedIntValue))
+            available << format.unsignedIntValue;
+
+    // No conversion at all if the format of the camera is accepted.
+    if (available.contains(nativeFormat)
+        && (this->m_preferredFormats.isEmpty()
+            || this->m_preferredFormats.contains(rawFmtToAkFmt->value(nativeFormat))))
+        return nativeFormat;
+
+    // Otherwise the first accepted format, trying the camera formats first.
+    auto candidates = *nativeCameraFormats + available;
+
+    if (this->m_preferredFormats.isEmpty()) {
+        for (auto &format: candidates)
+            if (available.contains(format))
+                return format;
+    } else {
+        for (auto &preferredFormat: this->m_preferredFormats)
+            for (auto &format: candidates)
+                if (available.contains(format)
+                    && rawFmtToAkFmt->value(format) == preferredFormat)
+                    return format;
+    }
+
+    return kCVPixelFormatType_32ARGB;
+}
+
+ExternalVideoFrame CaptureAvFoundationPrivate::frameFromPixelBuffer(CVImageBufferRef imageBuffer,
+                                                                   const AkVideoCaps &caps)
+{
+    if (CVPixelBufferLockBaseAddress(imageBuffer,
+                                     kCVPixelBufferLock_ReadOnly) != kCVReturnSuccess)
+        return {};
+
+    // The planes stay valid until the last copy of the frame is released.
+    CVPixelBufferRetain(imageBuffer);
+    QVector<ExternalVideoPlane> planes;
+
+    if (CVPixelBufferIsPlanar(imageBuffer)) {
+        auto planeCount = CVPixelBufferGetPlaneCount(imageBuffer);
+
+        for (size_t plane = 0; plane < planeCount; plane++)
+            planes << ExternalVideoPlane {
+                reinterpret_cast<const quint8 *>(CVPixelBufferGetBaseAddressOfPlane(imageBuffer, plane)),
+                CVPixelBufferGetBytesPerRowOfPlane(imageBuffer, plane),
+                CVPixelBufferGetHeightOfPlane(imageBuffer, plane)
+            };
+    } else {
+        planes << ExternalVideoPlane {
+            reinterpret_cast<const quint8 *>(CVPixelBufferGetBaseAddress(imageBuffer)),
+            CVPixelBufferGetBytesPerRow(imageBuffer),
+            CVPixelBufferGetHeight(imageBuffer)
+        };
+    }
+
+    return ExternalVideoFrame(caps, planes, [imageBuffer] () {
+        CVPixelBufferUnlockBaseAddress(imageBuffer,
+                                       kCVPixelBufferLock_ReadOnly);
+        CVPixelBufferRelease(imageBuffer);
+    });
+}
+
+AkPacket CaptureAvFoundationPrivate::packetFromSampleBuffer(CMSampleBufferRef sampleBuffer,
+                                                           bool applyControls)
+{
+    auto formatDesc = CMSampleBufferGetFormatDescription(sampleBuffer);
+    int width = 0;
+    int height = 0;
+
+    if (formatDesc) {
+        auto size = CMVideoFormatDescriptionGetDimensions(formatDesc);
+        width = size.width;
+        height = size.height;
+    }
+
+    if (width < 1 || height < 1)
+        return {};
+
+    // Read pts.
+    CMItemCount count = 0;
+    CMSampleTimingInfo timingInfo;
+    qint64 pts;
+    AkFrac timeBase;
+
+    if (CMSampleBufferGetOutputSampleTimingInfoArray(sampleBuffer,
+                                                     1,
+                                                     &timingInfo,
+                                                     &count) == noErr) {
+        pts = timingInfo.presentationTimeStamp.value;
+        timeBase = AkFrac(1, timingInfo.presentationTimeStamp.timescale);
+    } else {
+        timeval timestamp;
+        gettimeofday(&timestamp, nullptr);
+        pts = qint64((timestamp.tv_sec
+                      + 1e-6 * timestamp.tv_usec)
+                     * this->m_timeBase.invert().value());
+        timeBase = this->m_timeBase;
+    }
+
+    // Create package.
+    auto fourCC = CMFormatDescriptionGetMediaSubType(formatDesc);
+    AkPacket packet;
+
+    // Read frame data.
+    auto imageBuffer = CMSampleBufferGetImageBuffer(sampleBuffer);
+
+    if (imageBuffer) {
+        // The frame keeps its own reference to the pixel buffer, the copy
+        // is made straight from the memory of the camera.
+        auto frame = this->frameFromPixelBuffer(imageBuffer,
+                                                   {rawFmtToAkFmt->value(fourCC),
+                                                    width,
+                                                    height,
+                                                    this->m_timeBase.invert()});
+
+        // Software controls run on the uncompressed frames only, in the same
+        // pass that copies the frame.
+        if (this->m_enableHwControls || !applyControls)
+            packet = frame.toPacket();
+        else
+            packet = this->m_imageControls.process(frame);
+    } else {
+        auto dataBuffer = CMSampleBufferGetDataBuffer(sampleBuffer);
+
+        if (dataBuffer) {
+            size_t dataSize = 0;
+            char *data = nullptr;
+            CMBlockBufferGetDataPointer(dataBuffer,
+                                        0,
+                                        nullptr,
+                                        &dataSize,
+                                        &data);
+            AkCompressedVideoPacket videoPacket({compressedFormatToStr->value(fourCC),
+                                                 width,
+                                                 height,
+                                                 this->m_timeBase.invert()},
+                                                dataSize);
+            memcpy(videoPacket.data(), data, dataSize);
+            packet = videoPacket;
+        }
+    }
+
+    if (!packet)
+        return {};
+
+    packet.setPts(pts);
+    packet.setTimeBase(timeBase);
+    packet.setIndex(0);
+    packet.setId(this->m_id);
+
+    return packet;
+}
+
+void CaptureAvFoundationPrivate::updateLatency(const CMTime &presentationTime)
+{
+    // The session clock is the host time clock, so the presentation time of
+    // the frame can be compared against the current host time.
+    auto pts = presentationTime;
+
+    if (!CMTIME_IS_NUMERIC(pts))
+        return;
+
+    auto now = CMClockGetTime(CMClockGetHostTimeClock());
+    auto latency = qint64(1e6 * CMTimeGetSeconds(CMTimeSubtract(now, pts)));
+
+    this->m_mutex.lock();
+    this->m_latency = latency;
+    this->m_maxLatency = qMax(this->m_maxLatency, latency);
+    this->m_latencySum += latency;
+    this->m_latencyFrames++;
+    this->m_mutex.unlock();
+}
+
 QVariantMap CaptureAvFoundationPrivate::controlStatus(const QVariantList &controls) const
 {
     QVariantMap controlStatus;
@@ -1216,6 +1608,42 @@ QVariantMap CaptureAvFoundationPrivate::mapDiff(const QVariantMap &map1,
     return map;
 }
 
+void CaptureAvFoundationPrivate::postControls()
+{
+    if (!this->m_runControls)
+        return;
+
+    this->m_controlsMutex.lockForRead();
+    auto controls =
+            new QVariantMap(this->controlStatus(this->m_globalImageControls));
+    controls->insert(this->controlStatus(this->m_globalCameraControls));
+    this->m_controlsMutex.unlock();
+
+    // Only the newest status matters, replace any status not applied yet.
+    delete this->m_pendingControls.exchange(controls);
+    this->m_controlsPosted.release();
+}
+
+void CaptureAvFoundationPrivate::controlsLoop()
+{
+    while (this->m_runControls) {
+        this->m_controlsPosted.acquire();
+        this->m_controlsPosted.tryAcquire(this->m_controlsPosted.available());
+        auto controls = this->m_pendingControls.exchange(nullptr);
+
+        if (!controls)
+            continue;
+
+        if (this->m_localControls != *controls) {
+            auto diff = this->mapDiff(this->m_localControls, *controls);
+            this->setControls(this->m_deviceID, diff);
+            this->m_localControls = *controls;
+        }
+
+        delete controls;
+    }
+}
+
 QVector<CMIOControlID> CaptureAvFoundationPrivate::deviceControls(CMIODeviceID deviceID) const
 {
     CMIOObjectPropertyAddress ownedObjectsProperty {
@@ -32,6 +32,9 @@
 - (void) captureOutput: (AVCaptureOutput *) captureOutput
          didOutputSampleBuffer: (CMSampleBufferRef) videoFrame
          fromConnection: (AVCaptureConnection *) connection;
+- (void) captureOutput: (AVCaptureOutput *) captureOutput
+         didDropSampleBuffer: (CMSampleBufferRef) videoFrame
+         fromConnection: (AVCaptureConnection *) connection;
 - (void) cameraConnected: (NSNotification *) notification;
 - (void) cameraDisconnected: (NSNotification *) notification;
 - (void) disconnect;
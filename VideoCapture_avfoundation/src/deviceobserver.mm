@@ -17,9 +17,6 @@
  * Web-Site: http://webcamoid.github.io/
  */
 
-#include <QMutex>
-#include <QWaitCondition>
-
 #include "deviceobserver.h"
 
 @implementation DeviceObserverAVFoundation
@@ -43,23 +40,20 @@
     Q_UNUSED(captureOutput)
     Q_UNUSED(connection)
 
-    m_capture->mutex().lock();
-
-    CMSampleBufferRef *frame =
-            reinterpret_cast<CMSampleBufferRef *>(m_capture->curFrame());
-
-    if (!frame) {
-        m_capture->mutex().unlock();
-
-        return;
-    }
+    if (m_capture)
+        m_capture->pushFrame(videoFrame);
+}
 
-    if (*frame)
-        CFRelease(*frame);
+- (void) captureOutput: (AVCaptureOutput *) captureOutput
+         didDropSampleBuffer: (CMSampleBufferRef) videoFrame
+         fromConnection: (AVCaptureConnection *) connection
+{
+    Q_UNUSED(captureOutput)
+    Q_UNUSED(videoFrame)
+    Q_UNUSED(connection)
 
-    *frame = (CMSampleBufferRef) CFRetain(videoFrame);
-    m_capture->frameReady().wakeAll();
-    m_capture->mutex().unlock();
+    if (m_capture)
+        m_capture->frameDropped();
 }
 
 - (void) cameraConnected: (NSNotification *) notification
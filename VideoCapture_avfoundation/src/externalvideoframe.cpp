@@ -0,0 +1,161 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <cstring>
+#include <memory>
+#include <akvideopacket.h>
+
+#include "externalvideoframe.h"
+
+// Owns the reference to the external buffer, shared by all the copies.
+class ExternalVideoBuffer
+{
+    public:
+        ExternalVideoFrame::ReleaseFunc m_release;
+
+        explicit ExternalVideoBuffer(const ExternalVideoFrame::ReleaseFunc &release):
+            m_release(release)
+        {
+        }
+
+        ~ExternalVideoBuffer()
+        {
+            if (this->m_release)
+                this->m_release();
+        }
+};
+
+class ExternalVideoFramePrivate
+{
+    public:
+        AkVideoCaps m_caps;
+        QVector<ExternalVideoPlane> m_planes;
+        std::shared_ptr<ExternalVideoBuffer> m_buffer;
+};
+
+ExternalVideoFrame::ExternalVideoFrame()
+{
+    this->d = new ExternalVideoFramePrivate;
+}
+
+ExternalVideoFrame::ExternalVideoFrame(const AkVideoCaps &caps,
+                                       const QVector<ExternalVideoPlane> &planes,
+                                       const ReleaseFunc &release)
+{
+    this->d = new ExternalVideoFramePrivate;
+    this->d->m_caps = caps;
+    this->d->m_planes = planes;
+    this->d->m_buffer = std::make_shared<ExternalVideoBuffer>(release);
+}
+
+ExternalVideoFrame::ExternalVideoFrame(const ExternalVideoFrame &other)
+{
+    this->d = new ExternalVideoFramePrivate;
+    *this->d = *other.d;
+}
+
+ExternalVideoFrame::~ExternalVideoFrame()
+{
+    delete this->d;
+}
+
+ExternalVideoFrame &ExternalVideoFrame::operator =(const ExternalVideoFrame &other)
+{
+    if (this != &other)
+        *this->d = *other.d;
+
+    return *this;
+}
+
+ExternalVideoFrame::operator bool() const
+{
+    return this->d->m_buffer && !this->d->m_planes.isEmpty();
+}
+
+AkVideoCaps ExternalVideoFrame::caps() const
+{
+    return this->d->m_caps;
+}
+
+int ExternalVideoFrame::planes() const
+{
+    return this->d->m_planes.size();
+}
+
+const quint8 *ExternalVideoFrame::constPlane(int plane) const
+{
+    return this->d->m_planes[plane].data;
+}
+
+size_t ExternalVideoFrame::lineSize(int plane) const
+{
+    return this->d->m_planes[plane].lineSize;
+}
+
+size_t ExternalVideoFrame::lines(int plane) const
+{
+    return this->d->m_planes[plane].lines;
+}
+
+const quint8 *ExternalVideoFrame::constLine(int plane, int line) const
+{
+    auto &framePlane = this->d->m_planes[plane];
+
+    return framePlane.data + size_t(line) * framePlane.lineSize;
+}
+
+AkVideoPacket ExternalVideoFrame::toPacket() const
+{
+    if (!*this)
+        return {};
+
+    AkVideoPacket packet(this->d->m_caps);
+    auto planes = qMin(packet.planes(), this->d->m_planes.size());
+
+    for (int plane = 0; plane < planes; plane++) {
+        auto &framePlane = this->d->m_planes[plane];
+        auto lineSize = qMin<size_t>(packet.lineSize(plane),
+                                     framePlane.lineSize);
+        auto heightDiv = packet.heightDiv(plane);
+        auto lines = qMin<size_t>(framePlane.lines,
+                                  (size_t(packet.caps().height())
+                                   + (size_t(1) << heightDiv) - 1)
+                                  >> heightDiv);
+
+        if (lines < 1)
+            continue;
+
+        // Copy the whole plane at once when both buffers have the same
+        // layout.
+        if (framePlane.lineSize == packet.lineSize(plane)) {
+            memcpy(packet.line(plane, 0),
+                   framePlane.data,
+                   lines * framePlane.lineSize);
+
+            continue;
+        }
+
+        for (size_t line = 0; line < lines; line++)
+            memcpy(packet.line(plane, int(line << heightDiv)),
+                   framePlane.data + line * framePlane.lineSize,
+                   lineSize);
+    }
+
+    return packet;
+}
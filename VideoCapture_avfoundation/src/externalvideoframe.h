@@ -0,0 +1,72 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef EXTERNALVIDEOFRAME_H
+#define EXTERNALVIDEOFRAME_H
+
+#include <functional>
+#include <QVector>
+#include <akvideocaps.h>
+
+class ExternalVideoFramePrivate;
+class AkVideoPacket;
+
+struct ExternalVideoPlane
+{
+    const quint8 *data;
+    size_t lineSize;   // In bytes, as reported by the buffer owner.
+    size_t lines;
+};
+
+/* Video frame that borrows the memory of an external buffer.
+ *
+ * The planes point straight into the memory of the owner of the buffer, like
+ * a CVPixelBuffer, nothing is copied. Copies of the frame share the buffer,
+ * and the release function is called once, when the last copy is destroyed.
+ */
+class ExternalVideoFrame
+{
+    public:
+        using ReleaseFunc = std::function<void ()>;
+
+        ExternalVideoFrame();
+        ExternalVideoFrame(const AkVideoCaps &caps,
+                           const QVector<ExternalVideoPlane> &planes,
+                           const ReleaseFunc &release);
+        ExternalVideoFrame(const ExternalVideoFrame &other);
+        ~ExternalVideoFrame();
+
+        ExternalVideoFrame &operator =(const ExternalVideoFrame &other);
+        operator bool() const;
+
+        AkVideoCaps caps() const;
+        int planes() const;
+        const quint8 *constPlane(int plane) const;
+        size_t lineSize(int plane) const;
+        size_t lines(int plane) const;
+        const quint8 *constLine(int plane, int line) const;
+
+        // Copies the frame into a packet owning its memory.
+        AkVideoPacket toPacket() const;
+
+    private:
+        ExternalVideoFramePrivate *d;
+};
+
+#endif // EXTERNALVIDEOFRAME_H
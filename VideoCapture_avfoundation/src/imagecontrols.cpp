@@ -0,0 +1,656 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <akvideocaps.h>
+#include <akvideoconverter.h>
+#include <akvideopacket.h>
+
+#include "imagecontrols.h"
+#include "externalvideoframe.h"
+
+#define MAX_PLANES 3
+
+enum ImageControlsLayout
+{
+    ImageControlsLayoutNone,
+    ImageControlsLayoutPlanar,     // Y, Cb and Cr planes, or just Y.
+    ImageControlsLayoutSemiPlanar, // Y plane and interleaved CbCr plane.
+    ImageControlsLayoutPacked422,  // Two pixels in four bytes.
+    ImageControlsLayoutRgb,        // 24 or 32 bits RGB.
+};
+
+struct ImageControlsFormat
+{
+    ImageControlsLayout layout;
+    int planes;
+    int widthDiv;   // Subsampling of the chroma.
+    int heightDiv;
+    int step;       // Bytes per pixel, or per pair of pixels in Packed422.
+
+    /* Byte of each component in a pixel: Y0, Cb, Y1 and Cr in Packed422, Cb
+     * and Cr in SemiPlanar, and R, G, B and A in Rgb.
+     */
+    int offsets[4];
+};
+
+struct ImageControlsSource
+{
+    const quint8 *planes[MAX_PLANES];
+    size_t lineSize[MAX_PLANES];
+    size_t lines[MAX_PLANES];
+};
+
+struct ImageControlsValues
+{
+    int luminance;
+    int contrast;
+    int saturation;
+    int hue;
+    int gamma;
+
+    bool operator ==(const ImageControlsValues &other) const
+    {
+        return this->luminance == other.luminance
+               && this->contrast == other.contrast
+               && this->saturation == other.saturation
+               && this->hue == other.hue
+               && this->gamma == other.gamma;
+    }
+};
+
+class ImageControlsPrivate
+{
+    public:
+        std::atomic<int> m_luminance {0};
+        std::atomic<int> m_contrast {0};
+        std::atomic<int> m_saturation {0};
+        std::atomic<int> m_hue {0};
+        std::atomic<int> m_gamma {0};
+
+        // State of the processing thread.
+        AkVideoConverter m_videoConverter {{AkVideoCaps::Format_argbpack, 0, 0, {}}};
+        ImageControlsValues m_values {0, 0, 0, 0, 0};
+        quint8 m_luma[256];
+
+        // Chroma rotation scaled by the saturation, in 16.16 fixed point.
+        int m_chromaCos {65536};
+        int m_chromaSin {0};
+
+        /* The same for RGB frames: change of the R, G and B channels caused
+         * by the chroma adjustment, in 16.16 fixed point.
+         */
+        int m_rgbChroma[3][3];
+        bool m_adjustLuma {false};
+        bool m_adjustChroma {false};
+
+        ImageControlsValues values() const;
+        void update(const ImageControlsValues &values);
+        bool snapshot();
+        static ImageControlsFormat formatInfo(AkVideoCaps::PixelFormat format);
+        static ImageControlsSource sourceFromPacket(const AkVideoPacket &packet);
+        AkVideoPacket process(const ImageControlsSource &src,
+                              const AkVideoCaps &caps,
+                              const ImageControlsFormat &format) const;
+        AkVideoPacket processConverted(const AkVideoPacket &packet);
+        inline static void adjustChroma(int chromaCos,
+                                        int chromaSin,
+                                        int *cb,
+                                        int *cr);
+        void lumaLine(const quint8 *src, quint8 *dst, size_t width) const;
+        void chromaLine(const quint8 *srcCb,
+                        const quint8 *srcCr,
+                        quint8 *dstCb,
+                        quint8 *dstCr,
+                        size_t width,
+                        size_t step) const;
+        void packedLine(const quint8 *src,
+                        quint8 *dst,
+                        size_t pairs,
+                        const int *offsets) const;
+        void rgbLine(const quint8 *src,
+                     quint8 *dst,
+                     size_t width,
+                     int step,
+                     const int *offsets) const;
+};
+
+ImageControls::ImageControls()
+{
+    this->d = new ImageControlsPrivate;
+    this->d->update(this->d->m_values);
+}
+
+ImageControls::~ImageControls()
+{
+    delete this->d;
+}
+
+int ImageControls::luminance() const
+{
+    return this->d->m_luminance;
+}
+
+int ImageControls::contrast() const
+{
+    return this->d->m_contrast;
+}
+
+int ImageControls::saturation() const
+{
+    return this->d->m_saturation;
+}
+
+int ImageControls::hue() const
+{
+    return this->d->m_hue;
+}
+
+int ImageControls::gamma() const
+{
+    return this->d->m_gamma;
+}
+
+void ImageControls::setLuminance(int luminance)
+{
+    this->d->m_luminance = qBound(-255, luminance, 255);
+}
+
+void ImageControls::setContrast(int contrast)
+{
+    this->d->m_contrast = qBound(-255, contrast, 255);
+}
+
+void ImageControls::setSaturation(int saturation)
+{
+    this->d->m_saturation = qBound(-255, saturation, 255);
+}
+
+void ImageControls::setHue(int hue)
+{
+    this->d->m_hue = qBound(-359, hue, 359);
+}
+
+void ImageControls::setGamma(int gamma)
+{
+    this->d->m_gamma = qBound(-255, gamma, 255);
+}
+
+void ImageControls::reset()
+{
+    this->setLuminance(0);
+    this->setContrast(0);
+    this->setSaturation(0);
+    this->setHue(0);
+    this->setGamma(0);
+}
+
+bool ImageControls::isDefault() const
+{
+    return this->d->values() == ImageControlsValues {0, 0, 0, 0, 0};
+}
+
+AkVideoPacket ImageControls::process(const AkVideoPacket &packet)
+{
+    if (!packet || !this->d->snapshot())
+        return packet;
+
+    auto caps = packet.caps();
+    auto format = this->d->formatInfo(caps.format());
+
+    if (format.layout == ImageControlsLayoutNone
+        || int(packet.planes()) < format.planes)
+        return this->d->processConverted(packet);
+
+    auto dst = this->d->process(this->d->sourceFromPacket(packet),
+                                caps,
+                                format);
+    dst.copyMetadata(packet);
+
+    return dst;
+}
+
+AkVideoPacket ImageControls::process(const ExternalVideoFrame &frame)
+{
+    if (!frame)
+        return {};
+
+    if (!this->d->snapshot())
+        return frame.toPacket();
+
+    auto caps = frame.caps();
+    auto format = this->d->formatInfo(caps.format());
+
+    if (format.layout == ImageControlsLayoutNone
+        || frame.planes() < format.planes)
+        return this->d->processConverted(frame.toPacket());
+
+    ImageControlsSource src;
+
+    for (int plane = 0; plane < format.planes; plane++) {
+        src.planes[plane] = frame.constPlane(plane);
+        src.lineSize[plane] = frame.lineSize(plane);
+        src.lines[plane] = frame.lines(plane);
+    }
+
+    return this->d->process(src, caps, format);
+}
+
+ImageControlsValues ImageControlsPrivate::values() const
+{
+    return {
+        this->m_luminance,
+        this->m_contrast,
+        this->m_saturation,
+        this->m_hue,
+        this->m_gamma
+    };
+}
+
+void ImageControlsPrivate::update(const ImageControlsValues &values)
+{
+    this->m_values = values;
+    this->m_adjustLuma = values.luminance != 0
+                         || values.contrast != 0
+                         || values.gamma != 0;
+    this->m_adjustChroma = values.saturation != 0 || values.hue != 0;
+
+    // Gamma, contrast and luminance are all curves of the luma, combine them
+    // in a single table.
+    auto gamma = qMax(values.gamma, -254);
+    auto exponent = 255.0 / (gamma + 255);
+    auto contrast = 259.0 * (255 + values.contrast)
+                    / (255.0 * (259 - values.contrast));
+
+    for (int i = 0; i < 256; i++) {
+        auto level = 255.0 * std::pow(i / 255.0, exponent);
+        level = qBound(0.0, level, 255.0);
+        level = contrast * (level - 128.0) + 128.0 + values.luminance;
+        this->m_luma[i] = quint8(qBound(0, qRound(level), 255));
+    }
+
+    // Hue rotates the chroma around the gray axis, saturation scales it.
+    auto saturation = (255 + values.saturation) / 255.0;
+    auto angle = M_PI * values.hue / 180.0;
+    this->m_chromaCos = qRound(65536.0 * saturation * std::cos(angle));
+    this->m_chromaSin = qRound(65536.0 * saturation * std::sin(angle));
+
+    /* In RGB frames the chroma is taken in full range BT.601 YCbCr, rotated
+     * and scaled, and converted back, all of it folded in a single matrix.
+     */
+    static const qreal toChroma[2][3] {
+        {-0.168736, -0.331264,  0.5     },
+        { 0.5     , -0.418688, -0.081312},
+    };
+    static const qreal fromChroma[3][2] {
+        { 0.0     ,  1.402   },
+        {-0.344136, -0.714136},
+        { 1.772   ,  0.0     },
+    };
+    qreal rotation[2][2] {
+        {saturation * std::cos(angle), -saturation * std::sin(angle)},
+        {saturation * std::sin(angle),  saturation * std::cos(angle)},
+    };
+
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+            qreal k = 0.0;
+
+            for (int a = 0; a < 2; a++)
+                for (int b = 0; b < 2; b++)
+                    k += fromChroma[i][a] * rotation[a][b] * toChroma[b][j];
+
+            this->m_rgbChroma[i][j] = qRound(65536.0 * k);
+        }
+}
+
+bool ImageControlsPrivate::snapshot()
+{
+    // Read the controls once for the whole frame.
+    auto values = this->values();
+
+    if (!(values == this->m_values))
+        this->update(values);
+
+    return this->m_adjustLuma || this->m_adjustChroma;
+}
+
+ImageControlsFormat ImageControlsPrivate::formatInfo(AkVideoCaps::PixelFormat format)
+{
+    switch (format) {
+    case AkVideoCaps::Format_yuv420p:
+        return {ImageControlsLayoutPlanar, 3, 1, 1, 1, {}};
+    case AkVideoCaps::Format_yuv422p:
+        return {ImageControlsLayoutPlanar, 3, 1, 0, 1, {}};
+    case AkVideoCaps::Format_yuv444p:
+        return {ImageControlsLayoutPlanar, 3, 0, 0, 1, {}};
+    case AkVideoCaps::Format_gray8:
+        return {ImageControlsLayoutPlanar, 1, 0, 0, 1, {}};
+    case AkVideoCaps::Format_nv12:
+        return {ImageControlsLayoutSemiPlanar, 2, 1, 1, 2, {0, 1}};
+    case AkVideoCaps::Format_nv21:
+        return {ImageControlsLayoutSemiPlanar, 2, 1, 1, 2, {1, 0}};
+    case AkVideoCaps::Format_uyvy422:
+        return {ImageControlsLayoutPacked422, 1, 1, 0, 4, {1, 0, 3, 2}};
+    case AkVideoCaps::Format_yuyv422:
+        return {ImageControlsLayoutPacked422, 1, 1, 0, 4, {0, 1, 2, 3}};
+
+    // argbpack is 0xAARRGGBB in the byte order of the host.
+    case AkVideoCaps::Format_argbpack:
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        return {ImageControlsLayoutRgb, 1, 0, 0, 4, {2, 1, 0, 3}};
+#else
+        return {ImageControlsLayoutRgb, 1, 0, 0, 4, {1, 2, 3, 0}};
+#endif
+    case AkVideoCaps::Format_argb:
+        return {ImageControlsLayoutRgb, 1, 0, 0, 4, {1, 2, 3, 0}};
+    case AkVideoCaps::Format_bgra:
+        return {ImageControlsLayoutRgb, 1, 0, 0, 4, {2, 1, 0, 3}};
+    case AkVideoCaps::Format_abgr:
+        return {ImageControlsLayoutRgb, 1, 0, 0, 4, {3, 2, 1, 0}};
+    case AkVideoCaps::Format_rgba:
+        return {ImageControlsLayoutRgb, 1, 0, 0, 4, {0, 1, 2, 3}};
+    case AkVideoCaps::Format_rgb24:
+        return {ImageControlsLayoutRgb, 1, 0, 0, 3, {0, 1, 2, -1}};
+    case AkVideoCaps::Format_bgr24:
+        return {ImageControlsLayoutRgb, 1, 0, 0, 3, {2, 1, 0, -1}};
+    default:
+        break;
+    }
+
+    return {ImageControlsLayoutNone, 0, 0, 0, 0, {}};
+}
+
+ImageControlsSource ImageControlsPrivate::sourceFromPacket(const AkVideoPacket &packet)
+{
+    ImageControlsSource src;
+    auto height = size_t(packet.caps().height());
+    auto planes = qMin(int(packet.planes()), MAX_PLANES);
+
+    for (int plane = 0; plane < planes; plane++) {
+        size_t heightDiv = packet.heightDiv(plane);
+        src.planes[plane] = packet.constLine(plane, 0);
+        src.lineSize[plane] = packet.lineSize(plane);
+        src.lines[plane] = (height + (size_t(1) << heightDiv) - 1) >> heightDiv;
+    }
+
+    return src;
+}
+
+AkVideoPacket ImageControlsPrivate::process(const ImageControlsSource &src,
+                                            const AkVideoCaps &caps,
+                                            const ImageControlsFormat &format) const
+{
+    AkVideoPacket dst(caps);
+    auto width = size_t(caps.width());
+    auto height = size_t(caps.height());
+    auto chromaWidth = (width + (size_t(1) << format.widthDiv) - 1)
+                       >> format.widthDiv;
+    auto chromaHeight = (height + (size_t(1) << format.heightDiv) - 1)
+                        >> format.heightDiv;
+    quint8 *dstPlanes[MAX_PLANES];
+    size_t dstLineSize[MAX_PLANES];
+    size_t lineSize = std::numeric_limits<size_t>::max();
+
+    // Never read or write past the end of the shortest line.
+    for (int plane = 0; plane < format.planes; plane++) {
+        dstPlanes[plane] = dst.line(plane, 0);
+        dstLineSize[plane] = dst.lineSize(plane);
+
+        if (plane > 0 || format.layout != ImageControlsLayoutSemiPlanar)
+            lineSize = qMin(lineSize,
+                            qMin(src.lineSize[plane], dstLineSize[plane]));
+    }
+
+    auto srcLine = [&src] (int plane, size_t y) {
+        return src.planes[plane] + y * src.lineSize[plane];
+    };
+    auto dstLine = [&dstPlanes, &dstLineSize] (int plane, size_t y) {
+        return dstPlanes[plane] + y * dstLineSize[plane];
+    };
+
+    switch (format.layout) {
+    case ImageControlsLayoutPlanar:
+    case ImageControlsLayoutSemiPlanar: {
+        auto lumaWidth = qMin(width, qMin(src.lineSize[0], dstLineSize[0]));
+        auto lumaLines = qMin(height, src.lines[0]);
+
+        for (size_t y = 0; y < lumaLines; y++)
+            this->lumaLine(srcLine(0, y), dstLine(0, y), lumaWidth);
+
+        if (format.planes < 2)
+            break;
+
+        auto chromaLines = qMin(chromaHeight, src.lines[1]);
+
+        if (format.layout == ImageControlsLayoutSemiPlanar) {
+            auto pairs = qMin(chromaWidth, lineSize / 2);
+
+            for (size_t y = 0; y < chromaLines; y++) {
+                auto srcChroma = srcLine(1, y);
+                auto dstChroma = dstLine(1, y);
+
+                if (this->m_adjustChroma)
+                    this->chromaLine(srcChroma + format.offsets[0],
+                                     srcChroma + format.offsets[1],
+                                     dstChroma + format.offsets[0],
+                                     dstChroma + format.offsets[1],
+                                     pairs,
+                                     2);
+                else
+                    memcpy(dstChroma, srcChroma, 2 * pairs);
+            }
+
+            break;
+        }
+
+        chromaLines = qMin(chromaLines, src.lines[2]);
+        auto samples = qMin(chromaWidth, lineSize);
+
+        for (size_t y = 0; y < chromaLines; y++) {
+            if (this->m_adjustChroma) {
+                this->chromaLine(srcLine(1, y),
+                                 srcLine(2, y),
+                                 dstLine(1, y),
+                                 dstLine(2, y),
+                                 samples,
+                                 1);
+            } else {
+                memcpy(dstLine(1, y), srcLine(1, y), samples);
+                memcpy(dstLine(2, y), srcLine(2, y), samples);
+            }
+        }
+
+        break;
+    }
+
+    case ImageControlsLayoutPacked422: {
+        auto pairs = qMin(chromaWidth, lineSize / 4);
+        auto lines = qMin(height, src.lines[0]);
+
+        for (size_t y = 0; y < lines; y++)
+            this->packedLine(srcLine(0, y), dstLine(0, y), pairs, format.offsets);
+
+        break;
+    }
+
+    case ImageControlsLayoutRgb: {
+        auto pixels = qMin(width, lineSize / size_t(format.step));
+        auto lines = qMin(height, src.lines[0]);
+
+        for (size_t y = 0; y < lines; y++)
+            this->rgbLine(srcLine(0, y),
+                          dstLine(0, y),
+                          pixels,
+                          format.step,
+                          format.offsets);
+
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return dst;
+}
+
+AkVideoPacket ImageControlsPrivate::processConverted(const AkVideoPacket &packet)
+{
+    // No native path for this format, go through ARGB.
+    this->m_videoConverter.begin();
+    auto argb = this->m_videoConverter.convert(packet);
+    this->m_videoConverter.end();
+
+    if (!argb)
+        return {};
+
+    auto caps = argb.caps();
+    auto dst = this->process(this->sourceFromPacket(argb),
+                             caps,
+                             this->formatInfo(caps.format()));
+    dst.copyMetadata(argb);
+
+    return dst;
+}
+
+void ImageControlsPrivate::adjustChroma(int chromaCos,
+                                        int chromaSin,
+                                        int *cb,
+                                        int *cr)
+{
+    auto u = *cb - 128;
+    auto v = *cr - 128;
+    *cb = qBound(0, 128 + ((chromaCos * u - chromaSin * v + 32768) >> 16), 255);
+    *cr = qBound(0, 128 + ((chromaSin * u + chromaCos * v + 32768) >> 16), 255);
+}
+
+void ImageControlsPrivate::lumaLine(const quint8 *src,
+                                    quint8 *dst,
+                                    size_t width) const
+{
+    if (!this->m_adjustLuma) {
+        memcpy(dst, src, width);
+
+        return;
+    }
+
+    for (size_t x = 0; x < width; x++)
+        dst[x] = this->m_luma[src[x]];
+}
+
+void ImageControlsPrivate::chromaLine(const quint8 *srcCb,
+                                      const quint8 *srcCr,
+                                      quint8 *dstCb,
+                                      quint8 *dstCr,
+                                      size_t width,
+                                      size_t step) const
+{
+    // Locals, the stores to the lines could alias the members.
+    auto chromaCos = this->m_chromaCos;
+    auto chromaSin = this->m_chromaSin;
+
+    for (size_t x = 0; x < width; x++) {
+        auto i = x * step;
+        int cb = srcCb[i];
+        int cr = srcCr[i];
+        adjustChroma(chromaCos, chromaSin, &cb, &cr);
+        dstCb[i] = quint8(cb);
+        dstCr[i] = quint8(cr);
+    }
+}
+
+void ImageControlsPrivate::packedLine(const quint8 *src,
+                                      quint8 *dst,
+                                      size_t pairs,
+                                      const int *offsets) const
+{
+    auto luma = this->m_luma;
+
+    if (!this->m_adjustChroma) {
+        for (size_t x = 0; x < pairs; x++, src += 4, dst += 4) {
+            dst[offsets[0]] = luma[src[offsets[0]]];
+            dst[offsets[1]] = src[offsets[1]];
+            dst[offsets[2]] = luma[src[offsets[2]]];
+            dst[offsets[3]] = src[offsets[3]];
+        }
+
+        return;
+    }
+
+    auto chromaCos = this->m_chromaCos;
+    auto chromaSin = this->m_chromaSin;
+
+    for (size_t x = 0; x < pairs; x++, src += 4, dst += 4) {
+        int cb = src[offsets[1]];
+        int cr = src[offsets[3]];
+        adjustChroma(chromaCos, chromaSin, &cb, &cr);
+        dst[offsets[0]] = luma[src[offsets[0]]];
+        dst[offsets[1]] = quint8(cb);
+        dst[offsets[2]] = luma[src[offsets[2]]];
+        dst[offsets[3]] = quint8(cr);
+    }
+}
+
+void ImageControlsPrivate::rgbLine(const quint8 *src,
+                                   quint8 *dst,
+                                   size_t width,
+                                   int step,
+                                   const int *offsets) const
+{
+    auto luma = this->m_luma;
+    auto ro = offsets[0];
+    auto go = offsets[1];
+    auto bo = offsets[2];
+    auto ao = offsets[3];
+
+    if (!this->m_adjustChroma) {
+        // Without hue and saturation the curve is applied to each channel.
+        for (size_t x = 0; x < width; x++, src += step, dst += step) {
+            dst[ro] = luma[src[ro]];
+            dst[go] = luma[src[go]];
+            dst[bo] = luma[src[bo]];
+
+            if (ao >= 0)
+                dst[ao] = src[ao];
+        }
+
+        return;
+    }
+
+    // The luma goes through the curve, the chroma through the matrix.
+    int m[3][3];
+    memcpy(m, this->m_rgbChroma, sizeof(m));
+
+    for (size_t x = 0; x < width; x++, src += step, dst += step) {
+        int r = src[ro];
+        int g = src[go];
+        int b = src[bo];
+        int y = luma[(19595 * r + 38470 * g + 7471 * b + 32768) >> 16];
+        dst[ro] = quint8(qBound(0, y + ((m[0][0] * r + m[0][1] * g + m[0][2] * b + 32768) >> 16), 255));
+        dst[go] = quint8(qBound(0, y + ((m[1][0] * r + m[1][1] * g + m[1][2] * b + 32768) >> 16), 255));
+        dst[bo] = quint8(qBound(0, y + ((m[2][0] * r + m[2][1] * g + m[2][2] * b + 32768) >> 16), 255));
+
+        if (ao >= 0)
+            dst[ao] = src[ao];
+    }
+}
@@ -0,0 +1,76 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef IMAGECONTROLS_H
+#define IMAGECONTROLS_H
+
+#include <QtGlobal>
+
+class ImageControlsPrivate;
+class AkVideoPacket;
+class ExternalVideoFrame;
+
+/* Software brightness, contrast, saturation, hue and gamma controls.
+ *
+ * The controls are applied in the native format of the frame, without
+ * converting it to RGB. In YUV frames, luminance, contrast and gamma go
+ * through a single lookup table of the luma, and hue and saturation rotate
+ * and scale the chroma. RGB frames take the same path through YCbCr, or just
+ * the lookup table on each channel if hue and saturation are untouched.
+ * Other formats fall back to a conversion to ARGB.
+ *
+ * The controls can be changed from any thread, process() must be called
+ * always from the same thread. The values are read once at the start of each
+ * frame, so a frame is never processed with a mix of old and new values.
+ */
+class ImageControls
+{
+    public:
+        ImageControls();
+        ImageControls(const ImageControls &other) = delete;
+        ~ImageControls();
+
+        ImageControls &operator =(const ImageControls &other) = delete;
+
+        // All controls are in the range [-255, 255], but hue in [-359, 359].
+        int luminance() const;
+        int contrast() const;
+        int saturation() const;
+        int hue() const;
+        int gamma() const;
+        void setLuminance(int luminance);
+        void setContrast(int contrast);
+        void setSaturation(int saturation);
+        void setHue(int hue);
+        void setGamma(int gamma);
+        void reset();
+        bool isDefault() const;
+
+        AkVideoPacket process(const AkVideoPacket &packet);
+
+        /* Copies the frame into a packet applying the controls in the same
+         * pass, the result is the same as process(frame.toPacket()).
+         */
+        AkVideoPacket process(const ExternalVideoFrame &frame);
+
+    private:
+        ImageControlsPrivate *d;
+};
+
+#endif // IMAGECONTROLS_H
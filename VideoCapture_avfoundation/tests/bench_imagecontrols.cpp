@@ -0,0 +1,162 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <QtTest>
+#include <akvideocaps.h>
+#include <akvideopacket.h>
+
+#include "externalvideoframe.h"
+#include "imagecontrols.h"
+
+/* Cost of the software controls per camera frame, compared against the plain
+ * copy that is made anyway when the controls are at their defaults.
+ */
+
+#define ROUNDS 30
+
+using Clock = std::chrono::steady_clock;
+
+class BenchImageControls: public QObject
+{
+    Q_OBJECT
+
+    private:
+        // A camera frame with the lines aligned to 64 bytes, like CoreVideo.
+        static ExternalVideoFrame cameraFrame(AkVideoCaps::PixelFormat format,
+                                              int width,
+                                              int height);
+        static qint64 measure(ImageControls &controls,
+                              const ExternalVideoFrame &frame);
+        static void run(const char *name, AkVideoCaps::PixelFormat format);
+
+    private slots:
+        void nv12();
+        void uyvy422();
+        void bgra();
+};
+
+ExternalVideoFrame BenchImageControls::cameraFrame(AkVideoCaps::PixelFormat format,
+                                                   int width,
+                                                   int height)
+{
+    AkVideoCaps caps(format, width, height, {30, 1});
+    QVector<size_t> lineSizes;
+    QVector<size_t> lines;
+
+    switch (format) {
+    case AkVideoCaps::Format_nv12:
+        lineSizes = {size_t(width), size_t(width)};
+        lines = {size_t(height), size_t(height / 2)};
+        break;
+    case AkVideoCaps::Format_uyvy422:
+        lineSizes = {2 * size_t(width)};
+        lines = {size_t(height)};
+        break;
+    default:
+        lineSizes = {4 * size_t(width)};
+        lines = {size_t(height)};
+        break;
+    }
+
+    auto buffer = std::make_shared<std::vector<std::vector<quint8>>>();
+    QVector<ExternalVideoPlane> planes;
+
+    for (int plane = 0; plane < lineSizes.size(); plane++) {
+        auto lineSize = (lineSizes[plane] + 63) & ~size_t(63);
+        buffer->emplace_back(lineSize * lines[plane]);
+        auto &data = buffer->back();
+
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = quint8(i * 13 + (i >> 12));
+
+        planes << ExternalVideoPlane {data.data(), lineSize, lines[plane]};
+    }
+
+    return ExternalVideoFrame(caps, planes, [buffer] () {});
+}
+
+qint64 BenchImageControls::measure(ImageControls &controls,
+                                   const ExternalVideoFrame &frame)
+{
+    // Warm up the caches and the allocator first.
+    controls.process(frame);
+    auto start = Clock::now();
+
+    for (int i = 0; i < ROUNDS; i++)
+        controls.process(frame);
+
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()
+                                                                    - start).count();
+
+    return us / ROUNDS;
+}
+
+void BenchImageControls::run(const char *name, AkVideoCaps::PixelFormat format)
+{
+    static const struct
+    {
+        const char *name;
+        int width;
+        int height;
+    } sizes[] {
+        {"1080p", 1920, 1080},
+        {"2160p", 3840, 2160},
+    };
+
+    for (auto &size: sizes) {
+        auto frame = cameraFrame(format, size.width, size.height);
+        ImageControls controls;
+        auto copy = measure(controls, frame);
+
+        controls.setContrast(30);
+        controls.setGamma(20);
+        auto luma = measure(controls, frame);
+
+        controls.setSaturation(40);
+        controls.setHue(15);
+        auto all = measure(controls, frame);
+
+        qInfo() << name << size.name
+                << "µs per frame, copy:" << copy
+                << "luma controls:" << luma
+                << "all controls:" << all;
+    }
+}
+
+void BenchImageControls::nv12()
+{
+    run("nv12", AkVideoCaps::Format_nv12);
+}
+
+void BenchImageControls::uyvy422()
+{
+    run("uyvy422", AkVideoCaps::Format_uyvy422);
+}
+
+void BenchImageControls::bgra()
+{
+    run("bgra", AkVideoCaps::Format_bgra);
+}
+
+QTEST_GUILESS_MAIN(BenchImageControls)
+
+#include "bench_imagecontrols.moc"
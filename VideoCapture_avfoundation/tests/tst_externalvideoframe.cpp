@@ -0,0 +1,206 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <memory>
+#include <vector>
+#include <QtTest>
+#include <akvideocaps.h>
+#include <akvideopacket.h>
+
+#include "externalvideoframe.h"
+
+#define WIDTH  64
+#define HEIGHT 48
+
+/* Stands for the owner of the camera buffers, like CoreVideo: the planes are
+ * allocated with its own line sizes, and the frames hold a reference to the
+ * buffer until they are released.
+ */
+class FakeBufferProvider
+{
+    public:
+        int m_allocated {0};
+        int m_released {0};
+
+        static quint8 pattern(int plane, size_t line, size_t byte)
+        {
+            return quint8(64 * plane + 3 * line + byte);
+        }
+
+        ExternalVideoFrame frame(const AkVideoCaps &caps,
+                                 const QVector<size_t> &lineSizes,
+                                 const QVector<size_t> &lines)
+        {
+            auto buffer = std::make_shared<std::vector<std::vector<quint8>>>();
+            QVector<ExternalVideoPlane> planes;
+
+            for (int plane = 0; plane < lineSizes.size(); plane++) {
+                buffer->emplace_back(lineSizes[plane] * lines[plane]);
+                auto &data = buffer->back();
+
+                for (size_t line = 0; line < lines[plane]; line++)
+                    for (size_t byte = 0; byte < lineSizes[plane]; byte++)
+                        data[line * lineSizes[plane] + byte] =
+                                pattern(plane, line, byte);
+
+                planes << ExternalVideoPlane {data.data(),
+                                              lineSizes[plane],
+                                              lines[plane]};
+            }
+
+            this->m_allocated++;
+
+            // The memory is freed by the release function only.
+            return ExternalVideoFrame(caps, planes, [this, buffer] () {
+                buffer->clear();
+                this->m_released++;
+            });
+        }
+};
+
+class TestExternalVideoFrame: public QObject
+{
+    Q_OBJECT
+
+    private:
+        static AkVideoCaps nv12Caps();
+
+    private slots:
+        void emptyFrame();
+        void planesPointIntoBuffer();
+        void releasedOnLastCopy();
+        void assignmentReleasesPrevious();
+        void toPacketPaddedLines();
+        void toPacketSameLayout();
+};
+
+AkVideoCaps TestExternalVideoFrame::nv12Caps()
+{
+    return AkVideoCaps(AkVideoCaps::Format_nv12, WIDTH, HEIGHT, {30, 1});
+}
+
+void TestExternalVideoFrame::emptyFrame()
+{
+    ExternalVideoFrame frame;
+    QVERIFY(!frame);
+    QCOMPARE(frame.planes(), 0);
+    QVERIFY(!frame.toPacket());
+}
+
+void TestExternalVideoFrame::planesPointIntoBuffer()
+{
+    FakeBufferProvider provider;
+    auto frame = provider.frame(nv12Caps(), {WIDTH + 16, WIDTH + 16}, {HEIGHT, HEIGHT / 2});
+    QVERIFY(frame);
+    QCOMPARE(frame.planes(), 2);
+    QCOMPARE(frame.lineSize(1), size_t(WIDTH + 16));
+    QCOMPARE(frame.lines(1), size_t(HEIGHT / 2));
+
+    // Nothing is copied, the lines are read from the memory of the provider.
+    QCOMPARE(frame.constLine(0, 5), frame.constPlane(0) + 5 * (WIDTH + 16));
+    QCOMPARE(*frame.constLine(1, 3), FakeBufferProvider::pattern(1, 3, 0));
+    QCOMPARE(provider.m_released, 0);
+}
+
+void TestExternalVideoFrame::releasedOnLastCopy()
+{
+    FakeBufferProvider provider;
+
+    {
+        auto frame = provider.frame(nv12Caps(), {WIDTH, WIDTH}, {HEIGHT, HEIGHT / 2});
+
+        {
+            auto copy = frame;
+            ExternalVideoFrame assigned;
+            assigned = copy;
+            QCOMPARE(assigned.constPlane(0), frame.constPlane(0));
+        }
+
+        // The copies are gone, the original still holds the buffer.
+        QCOMPARE(provider.m_released, 0);
+        QCOMPARE(*frame.constLine(0, 1), FakeBufferProvider::pattern(0, 1, 0));
+    }
+
+    QCOMPARE(provider.m_released, 1);
+}
+
+void TestExternalVideoFrame::assignmentReleasesPrevious()
+{
+    FakeBufferProvider provider;
+    auto frame = provider.frame(nv12Caps(), {WIDTH, WIDTH}, {HEIGHT, HEIGHT / 2});
+    frame = provider.frame(nv12Caps(), {WIDTH, WIDTH}, {HEIGHT, HEIGHT / 2});
+    QCOMPARE(provider.m_allocated, 2);
+    QCOMPARE(provider.m_released, 1);
+
+    frame = {};
+    QCOMPARE(provider.m_released, 2);
+}
+
+void TestExternalVideoFrame::toPacketPaddedLines()
+{
+    // Camera buffers often have wider lines than the packets.
+    FakeBufferProvider provider;
+    auto frame = provider.frame(nv12Caps(),
+                                {WIDTH + 64, WIDTH + 64},
+                                {HEIGHT, HEIGHT / 2});
+    auto packet = frame.toPacket();
+    QVERIFY(packet);
+
+    for (int plane = 0; plane < 2; plane++) {
+        auto lines = size_t(HEIGHT) >> packet.heightDiv(plane);
+
+        for (size_t line = 0; line < lines; line++) {
+            auto data = packet.constLine(plane, int(line << packet.heightDiv(plane)));
+
+            for (size_t byte = 0; byte < WIDTH; byte++)
+                QCOMPARE(data[byte], FakeBufferProvider::pattern(plane, line, byte));
+        }
+    }
+
+    // The packet owns its memory, it outlives the buffer.
+    frame = {};
+    QCOMPARE(provider.m_released, 1);
+    QCOMPARE(*packet.constLine(1, 2), FakeBufferProvider::pattern(1, 1, 0));
+}
+
+void TestExternalVideoFrame::toPacketSameLayout()
+{
+    // Buffers with the layout of the packet are copied in a single block.
+    AkVideoPacket reference(nv12Caps());
+    FakeBufferProvider provider;
+    auto frame = provider.frame(nv12Caps(),
+                                {reference.lineSize(0), reference.lineSize(1)},
+                                {HEIGHT, HEIGHT / 2});
+    auto packet = frame.toPacket();
+    QVERIFY(packet);
+
+    for (int plane = 0; plane < 2; plane++) {
+        auto lineSize = reference.lineSize(plane);
+        auto data = packet.constLine(plane, 0);
+        auto lines = size_t(HEIGHT) >> packet.heightDiv(plane);
+
+        for (size_t i = 0; i < lines * lineSize; i++)
+            QCOMPARE(data[i],
+                     FakeBufferProvider::pattern(plane, i / lineSize, i % lineSize));
+    }
+}
+
+QTEST_GUILESS_MAIN(TestExternalVideoFrame)
+
+#include "tst_externalvideoframe.moc"
@@ -0,0 +1,303 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <QtTest>
+#include <akvideocaps.h>
+#include <akvideopacket.h>
+
+#include "externalvideoframe.h"
+#include "imagecontrols.h"
+
+#define WIDTH  64
+#define HEIGHT 48
+
+class TestImageControls: public QObject
+{
+    Q_OBJECT
+
+    private:
+        // Fills every line of the plane repeating the pattern.
+        static void fillPlane(AkVideoPacket &packet,
+                              int plane,
+                              const QVector<quint8> &pattern);
+        static AkVideoPacket solid(AkVideoCaps::PixelFormat format,
+                                   const QVector<QVector<quint8>> &patterns,
+                                   int width=WIDTH,
+                                   int height=HEIGHT);
+        static bool planeIs(const AkVideoPacket &packet,
+                            int plane,
+                            size_t bytes,
+                            const QVector<quint8> &pattern,
+                            int tolerance=0);
+
+    private slots:
+        void defaultKeepsFrame();
+        void luminanceOnLuma();
+        void saturationScalesChroma();
+        void hueRotatesChroma();
+        void packedFormats();
+        void rgbCurves();
+        void rgbSaturation();
+        void externalFrameMatchesPacket();
+        void valuesReadOncePerFrame();
+};
+
+void TestImageControls::fillPlane(AkVideoPacket &packet,
+                                  int plane,
+                                  const QVector<quint8> &pattern)
+{
+    auto lines = (packet.caps().height() + (1 << packet.heightDiv(plane)) - 1)
+                 >> packet.heightDiv(plane);
+
+    for (int y = 0; y < lines; y++) {
+        auto line = packet.line(plane, y << packet.heightDiv(plane));
+
+        for (size_t x = 0; x < packet.lineSize(plane); x++)
+            line[x] = pattern[int(x % size_t(pattern.size()))];
+    }
+}
+
+AkVideoPacket TestImageControls::solid(AkVideoCaps::PixelFormat format,
+                                       const QVector<QVector<quint8>> &patterns,
+                                       int width,
+                                       int height)
+{
+    AkVideoPacket packet({format, width, height, {30, 1}});
+
+    for (int plane = 0; plane < patterns.size(); plane++)
+        fillPlane(packet, plane, patterns[plane]);
+
+    return packet;
+}
+
+bool TestImageControls::planeIs(const AkVideoPacket &packet,
+                                int plane,
+                                size_t bytes,
+                                const QVector<quint8> &pattern,
+                                int tolerance)
+{
+    auto lines = (packet.caps().height() + (1 << packet.heightDiv(plane)) - 1)
+                 >> packet.heightDiv(plane);
+
+    for (int y = 0; y < lines; y++) {
+        auto line = packet.constLine(plane, y << packet.heightDiv(plane));
+
+        for (size_t x = 0; x < bytes; x++) {
+            auto expected = pattern[int(x % size_t(pattern.size()))];
+
+            if (qAbs(int(line[x]) - int(expected)) > tolerance)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void TestImageControls::defaultKeepsFrame()
+{
+    ImageControls controls;
+    QVERIFY(controls.isDefault());
+    auto packet = solid(AkVideoCaps::Format_yuv420p, {{1, 2, 3}, {4, 5}, {6}});
+    auto processed = controls.process(packet);
+    QVERIFY(planeIs(processed, 0, WIDTH, {1, 2, 3}));
+    QVERIFY(planeIs(processed, 1, WIDTH / 2, {4, 5}));
+    QVERIFY(planeIs(processed, 2, WIDTH / 2, {6}));
+
+    // Back to the defaults after changing a control.
+    controls.setHue(30);
+    QVERIFY(!controls.isDefault());
+    controls.reset();
+    QVERIFY(controls.isDefault());
+}
+
+void TestImageControls::luminanceOnLuma()
+{
+    ImageControls controls;
+    controls.setLuminance(50);
+    auto packet = solid(AkVideoCaps::Format_nv12, {{100, 230}, {90, 160}});
+    auto processed = controls.process(packet);
+
+    // The luma is clamped, and the chroma is copied untouched.
+    QVERIFY(planeIs(processed, 0, WIDTH, {150, 255}));
+    QVERIFY(planeIs(processed, 1, WIDTH, {90, 160}));
+}
+
+void TestImageControls::saturationScalesChroma()
+{
+    ImageControls controls;
+    auto packet = solid(AkVideoCaps::Format_yuv420p, {{100}, {90}, {160}});
+
+    controls.setSaturation(-255);
+    auto gray = controls.process(packet);
+    QVERIFY(planeIs(gray, 0, WIDTH, {100}));
+    QVERIFY(planeIs(gray, 1, WIDTH / 2, {128}));
+    QVERIFY(planeIs(gray, 2, WIDTH / 2, {128}));
+
+    // Twice the distance to the gray axis.
+    controls.setSaturation(255);
+    auto saturated = controls.process(packet);
+    QVERIFY(planeIs(saturated, 0, WIDTH, {100}));
+    QVERIFY(planeIs(saturated, 1, WIDTH / 2, {52}));
+    QVERIFY(planeIs(saturated, 2, WIDTH / 2, {192}));
+}
+
+void TestImageControls::hueRotatesChroma()
+{
+    // NV21 stores Cr first.
+    ImageControls controls;
+    auto packet = solid(AkVideoCaps::Format_nv21, {{100}, {160, 90}});
+
+    controls.setHue(180);
+    auto opposite = controls.process(packet);
+    QVERIFY(planeIs(opposite, 0, WIDTH, {100}));
+    QVERIFY(planeIs(opposite, 1, WIDTH, {96, 166}, 1));
+
+    // Cb = -Cr and Cr = Cb, around 128.
+    controls.setHue(90);
+    auto quarter = controls.process(packet);
+    QVERIFY(planeIs(quarter, 1, WIDTH, {90, 96}, 1));
+}
+
+void TestImageControls::packedFormats()
+{
+    ImageControls controls;
+    controls.setLuminance(10);
+    controls.setSaturation(-255);
+
+    auto uyvy = controls.process(solid(AkVideoCaps::Format_uyvy422,
+                                       {{100, 50, 150, 200}}));
+    QVERIFY(planeIs(uyvy, 0, 2 * WIDTH, {128, 60, 128, 210}));
+
+    auto yuyv = controls.process(solid(AkVideoCaps::Format_yuyv422,
+                                       {{50, 100, 200, 150}}));
+    QVERIFY(planeIs(yuyv, 0, 2 * WIDTH, {60, 128, 210, 128}));
+}
+
+void TestImageControls::rgbCurves()
+{
+    // Without hue and saturation each channel goes through the luma curve,
+    // and the alpha is kept.
+    ImageControls controls;
+    controls.setLuminance(20);
+
+    auto rgb = controls.process(solid(AkVideoCaps::Format_rgb24,
+                                      {{10, 100, 250}}));
+    QVERIFY(planeIs(rgb, 0, 3 * WIDTH, {30, 120, 255}));
+
+    auto bgra = controls.process(solid(AkVideoCaps::Format_bgra,
+                                       {{10, 100, 250, 77}}));
+    QVERIFY(planeIs(bgra, 0, 4 * WIDTH, {30, 120, 255, 77}));
+}
+
+void TestImageControls::rgbSaturation()
+{
+    ImageControls controls;
+    controls.setSaturation(-255);
+
+    // BT.601 luma of (200, 100, 50) is 124.
+    auto argb = controls.process(solid(AkVideoCaps::Format_argb,
+                                       {{200, 200, 100, 50}}));
+    QVERIFY(planeIs(argb, 0, 4 * WIDTH, {200, 124, 124, 124}, 1));
+
+    // Gray stays gray whatever the hue and the saturation.
+    controls.setSaturation(120);
+    controls.setHue(77);
+    auto gray = controls.process(solid(AkVideoCaps::Format_rgba,
+                                       {{90, 90, 90, 33}}));
+    QVERIFY(planeIs(gray, 0, 4 * WIDTH, {90, 90, 90, 33}));
+}
+
+void TestImageControls::externalFrameMatchesPacket()
+{
+    // The planes of the camera have their own line sizes.
+    AkVideoCaps caps(AkVideoCaps::Format_nv12, WIDTH, HEIGHT, {30, 1});
+    QVector<size_t> lineSizes {WIDTH + 40, WIDTH + 40};
+    QVector<size_t> lines {HEIGHT, HEIGHT / 2};
+    auto buffer = std::make_shared<std::vector<std::vector<quint8>>>();
+    QVector<ExternalVideoPlane> planes;
+
+    for (int plane = 0; plane < lineSizes.size(); plane++) {
+        buffer->emplace_back(lineSizes[plane] * lines[plane]);
+        auto &data = buffer->back();
+
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = quint8(7 * i + 31 * plane);
+
+        planes << ExternalVideoPlane {data.data(),
+                                      lineSizes[plane],
+                                      lines[plane]};
+    }
+
+    ExternalVideoFrame frame(caps, planes, [buffer] () {});
+    ImageControls controls;
+    controls.setContrast(40);
+    controls.setGamma(-30);
+    controls.setSaturation(60);
+    controls.setHue(-45);
+    auto fused = controls.process(frame);
+    auto copied = controls.process(frame.toPacket());
+    QVERIFY(fused);
+
+    for (int plane = 0; plane < 2; plane++)
+        for (int y = 0; y < int(lines[plane]); y++) {
+            auto line = y << fused.heightDiv(plane);
+            QVERIFY(memcmp(fused.constLine(plane, line),
+                           copied.constLine(plane, line),
+                           WIDTH) == 0);
+        }
+}
+
+void TestImageControls::valuesReadOncePerFrame()
+{
+    // The controls change while the frames are processed, but every frame
+    // must be processed with a single set of values.
+    ImageControls controls;
+    controls.setLuminance(20);
+    std::atomic<bool> running {true};
+
+    std::thread changer([&] () {
+        for (int i = 0; running; i++)
+            controls.setLuminance(i % 2? 60: 20);
+    });
+
+    auto packet = solid(AkVideoCaps::Format_yuv444p,
+                        {{100}, {128}, {128}},
+                        320,
+                        240);
+    bool uniform = true;
+
+    for (int i = 0; i < 200 && uniform; i++) {
+        auto processed = controls.process(packet);
+        auto value = *processed.constLine(0, 0);
+        uniform = (value == 120 || value == 160)
+                  && planeIs(processed, 0, 320, {value});
+    }
+
+    running = false;
+    changer.join();
+    QVERIFY(uniform);
+}
+
+QTEST_GUILESS_MAIN(TestImageControls)
+
+#include "tst_imagecontrols.moc"
@@ -0,0 +1,481 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <QDataStream>
+#include <QMutex>
+#include <QThread>
+#include <akfrac.h>
+#include <akpacket.h>
+#include <akvideocaps.h>
+#include <akcompressedvideocaps.h>
+#include <akvideopacket.h>
+#include <akcompressedvideopacket.h>
+#include <wels/codec_api.h>
+
+#include "videodecoderopenh264element.h"
+
+class VideoDecoderOpenH264ElementPrivate
+{
+    public:
+        VideoDecoderOpenH264Element *self;
+        int m_threads {0};
+        bool m_lowLatency {true};
+        ISVCDecoder *m_decoder {nullptr};
+        int m_decoderThreads {0};
+        AkCompressedVideoPacket m_headers;
+        QMutex m_mutex;
+        AkFrac m_fps;
+        AkFrac m_timeBase;
+        qint64 m_id {-1};
+        int m_index {0};
+        bool m_initialized {false};
+        bool m_paused {false};
+
+        explicit VideoDecoderOpenH264ElementPrivate(VideoDecoderOpenH264Element *self);
+        static QString stateToString(int state);
+        bool init();
+        void uninit();
+        int decodingThreads() const;
+        bool openDecoder();
+        void closeDecoder();
+        void restartDecoder();
+        void decodeHeaders(const AkCompressedVideoPacket &packet);
+        void decodeData(const quint8 *data, int size, qint64 pts);
+        void flush();
+        void sendFrame(unsigned char **planes, const SBufferInfo &info);
+};
+
+VideoDecoderOpenH264Element::VideoDecoderOpenH264Element():
+    AkElement()
+{
+    this->d = new VideoDecoderOpenH264ElementPrivate(this);
+}
+
+VideoDecoderOpenH264Element::~VideoDecoderOpenH264Element()
+{
+    this->d->uninit();
+    delete this->d;
+}
+
+int VideoDecoderOpenH264Element::threads() const
+{
+    return this->d->m_threads;
+}
+
+bool VideoDecoderOpenH264Element::lowLatency() const
+{
+    return this->d->m_lowLatency;
+}
+
+AkPacket VideoDecoderOpenH264Element::iStream(const AkPacket &packet)
+{
+    if (packet.type() != AkPacket::PacketVideoCompressed)
+        return {};
+
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    if (this->d->m_paused || !this->d->m_initialized)
+        return {};
+
+    // The threads were changed while decoding.
+    if (this->d->m_decoderThreads != this->d->decodingThreads()) {
+        this->d->restartDecoder();
+
+        if (!this->d->m_initialized)
+            return {};
+    }
+
+    AkCompressedVideoPacket videoPacket(packet);
+
+    if (videoPacket.caps().codec() != AkCompressedVideoCaps::VideoCodecID_avc)
+        return {};
+
+    auto fps = videoPacket.caps().rawCaps().fps();
+
+    if (fps)
+        this->d->m_fps = fps;
+
+    this->d->m_timeBase = videoPacket.timeBase();
+    this->d->m_id = videoPacket.id();
+    this->d->m_index = videoPacket.index();
+
+    if (videoPacket.flags() & AkCompressedVideoPacket::VideoPacketTypeFlag_Header) {
+        this->d->m_headers = videoPacket;
+        this->d->decodeHeaders(videoPacket);
+    } else
+        this->d->decodeData(reinterpret_cast<const quint8 *>(videoPacket.constData()),
+                            int(videoPacket.size()),
+                            videoPacket.pts());
+
+    return {};
+}
+
+void VideoDecoderOpenH264Element::setThreads(int threads)
+{
+    threads = qMax(threads, 0);
+
+    // The decoder is restarted with the new threads on the next packet.
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    if (threads == this->d->m_threads)
+        return;
+
+    this->d->m_threads = threads;
+    mutexLocker.unlock();
+    emit this->threadsChanged(threads);
+}
+
+void VideoDecoderOpenH264Element::setLowLatency(bool lowLatency)
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    if (lowLatency == this->d->m_lowLatency)
+        return;
+
+    this->d->m_lowLatency = lowLatency;
+    mutexLocker.unlock();
+    emit this->lowLatencyChanged(lowLatency);
+}
+
+void VideoDecoderOpenH264Element::resetThreads()
+{
+    this->setThreads(0);
+}
+
+void VideoDecoderOpenH264Element::resetLowLatency()
+{
+    this->setLowLatency(true);
+}
+
+bool VideoDecoderOpenH264Element::setState(ElementState state)
+{
+    auto curState = this->state();
+
+    switch (curState) {
+    case AkElement::ElementStateNull: {
+        switch (state) {
+        case AkElement::ElementStatePaused:
+            this->d->m_paused = state == AkElement::ElementStatePaused;
+        case AkElement::ElementStatePlaying:
+            if (!this->d->init()) {
+                this->d->m_paused = false;
+
+                return false;
+            }
+
+            return AkElement::setState(state);
+        default:
+            break;
+        }
+
+        break;
+    }
+    case AkElement::ElementStatePaused: {
+        switch (state) {
+        case AkElement::ElementStateNull:
+            this->d->uninit();
+
+            return AkElement::setState(state);
+        case AkElement::ElementStatePlaying:
+            this->d->m_paused = false;
+
+            return AkElement::setState(state);
+        default:
+            break;
+        }
+
+        break;
+    }
+    case AkElement::ElementStatePlaying: {
+        switch (state) {
+        case AkElement::ElementStateNull:
+            this->d->uninit();
+
+            return AkElement::setState(state);
+        case AkElement::ElementStatePaused:
+            this->d->m_paused = true;
+
+            return AkElement::setState(state);
+        default:
+            break;
+        }
+
+        break;
+    }
+    }
+
+    return false;
+}
+
+VideoDecoderOpenH264ElementPrivate::VideoDecoderOpenH264ElementPrivate(VideoDecoderOpenH264Element *self):
+    self(self)
+{
+
+}
+
+QString VideoDecoderOpenH264ElementPrivate::stateToString(int state)
+{
+    static const struct DecodingStateStr
+    {
+        DECODING_STATE state;
+        const char *str;
+    } openh264DecStates[] = {
+        {dsFramePending      , "Frame pending"           },
+        {dsRefLost           , "Reference lost"          },
+        {dsBitstreamError    , "Bitstream error"         },
+        {dsDepLayerLost      , "Dependency layer lost"   },
+        {dsNoParamSets       , "No parameter sets"       },
+        {dsDataErrorConcealed, "Data error concealed"    },
+        {dsRefListNullPtrs   , "Reference list null ptrs"},
+        {dsInvalidArgument   , "Invalid argument"        },
+        {dsInitialOptExpected, "Initialization expected" },
+        {dsOutOfMemory       , "Out of memory"           },
+        {dsDstBufNeedExpan   , "Buffer expansion needed" },
+        {dsErrorFree         , "Success"                 },
+    };
+
+    if (state == dsErrorFree)
+        return {"Success"};
+
+    QStringList states;
+
+    for (auto ds = openh264DecStates; ds->state != dsErrorFree; ++ds)
+        if (state & ds->state)
+            states << ds->str;
+
+    if (states.isEmpty())
+        return QString::number(state);
+
+    return states.join(", ");
+}
+
+bool VideoDecoderOpenH264ElementPrivate::init()
+{
+    this->uninit();
+
+    if (!this->openDecoder())
+        return false;
+
+    this->m_fps = {};
+    this->m_timeBase = {};
+    this->m_headers = {};
+    this->m_initialized = true;
+
+    return true;
+}
+
+void VideoDecoderOpenH264ElementPrivate::uninit()
+{
+    QMutexLocker mutexLocker(&this->m_mutex);
+
+    if (!this->m_initialized)
+        return;
+
+    this->m_initialized = false;
+    this->closeDecoder();
+    this->m_headers = {};
+    this->m_paused = false;
+}
+
+int VideoDecoderOpenH264ElementPrivate::decodingThreads() const
+{
+    /* Each extra thread keeps one more frame in flight, so in low latency
+     * mode decode in a single thread unless requested otherwise.
+     */
+    return this->m_threads > 0?
+               this->m_threads:
+           this->m_lowLatency?
+               1:
+               QThread::idealThreadCount();
+}
+
+bool VideoDecoderOpenH264ElementPrivate::openDecoder()
+{
+    if (WelsCreateDecoder(&this->m_decoder) != 0 || !this->m_decoder) {
+        qCritical() << "Failed to create the decoder";
+        this->m_decoder = nullptr;
+
+        return false;
+    }
+
+    // Threads must be configured before initializing the decoder.
+    int32_t threads = this->decodingThreads();
+    this->m_decoderThreads = threads;
+
+    if (threads > 1)
+        this->m_decoder->SetOption(DECODER_OPTION_NUM_OF_THREADS, &threads);
+
+    SDecodingParam param;
+    memset(&param, 0, sizeof(SDecodingParam));
+    param.uiTargetDqLayer = UCHAR_MAX;
+    param.eEcActiveIdc = ERROR_CON_SLICE_COPY;
+    param.sVideoProperty.size = sizeof(SVideoProperty);
+    param.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_AVC;
+
+    auto result = this->m_decoder->Initialize(&param);
+
+    if (result != cmResultSuccess) {
+        qCritical() << "Failed to initialize the decoder:" << result;
+        WelsDestroyDecoder(this->m_decoder);
+        this->m_decoder = nullptr;
+
+        return false;
+    }
+
+    return true;
+}
+
+void VideoDecoderOpenH264ElementPrivate::closeDecoder()
+{
+    if (!this->m_decoder)
+        return;
+
+    this->flush();
+    this->m_decoder->Uninitialize();
+    WelsDestroyDecoder(this->m_decoder);
+    this->m_decoder = nullptr;
+}
+
+void VideoDecoderOpenH264ElementPrivate::restartDecoder()
+{
+    // Called from the decoding thread, with the mutex locked.
+    this->closeDecoder();
+
+    if (!this->openDecoder()) {
+        this->m_initialized = false;
+
+        return;
+    }
+
+    /* Without global headers the parameter sets come with the next key
+     * frame, otherwise resend the last ones.
+     */
+    if (this->m_headers)
+        this->decodeHeaders(this->m_headers);
+}
+
+void VideoDecoderOpenH264ElementPrivate::decodeHeaders(const AkCompressedVideoPacket &packet)
+{
+    // The headers are stored as a list of NAL units, see the encoder.
+    QByteArray privateData(packet.constData(), packet.size());
+    QDataStream ds(&privateData, QIODeviceBase::ReadOnly);
+    quint64 nalCount = 0;
+    ds >> nalCount;
+
+    for (quint64 i = 0; i < nalCount && !ds.atEnd(); i++) {
+        quint64 size = 0;
+        ds >> size;
+        QByteArray nal(qsizetype(size), Qt::Uninitialized);
+        ds.readRawData(nal.data(), int(size));
+        this->decodeData(reinterpret_cast<const quint8 *>(nal.constData()),
+                         int(nal.size()),
+                         packet.pts());
+    }
+}
+
+void VideoDecoderOpenH264ElementPrivate::decodeData(const quint8 *data,
+                                                    int size,
+                                                    qint64 pts)
+{
+    if (size < 1)
+        return;
+
+    unsigned char *planes[3] = {nullptr, nullptr, nullptr};
+    SBufferInfo info;
+    memset(&info, 0, sizeof(SBufferInfo));
+    info.uiInBsTimeStamp = quint64(pts);
+
+    /* DecodeFrameNoDelay() returns the frame as soon as it is decoded, while
+     * DecodeFrame2() waits for the start of the next access unit.
+     */
+    auto state = this->m_lowLatency?
+                     this->m_decoder->DecodeFrameNoDelay(data,
+                                                         size,
+                                                         planes,
+                                                         &info):
+                     this->m_decoder->DecodeFrame2(data,
+                                                   size,
+                                                   planes,
+                                                   &info);
+
+    if (state != dsErrorFree && state != dsFramePending)
+        qWarning() << "Error decoding frame:" << stateToString(state);
+
+    if (info.iBufferStatus == 1)
+        this->sendFrame(planes, info);
+}
+
+void VideoDecoderOpenH264ElementPrivate::flush()
+{
+    int32_t pending = 0;
+    this->m_decoder->GetOption(DECODER_OPTION_NUM_OF_FRAMES_REMAINING_IN_BUFFER,
+                               &pending);
+
+    for (int32_t i = 0; i < pending; i++) {
+        unsigned char *planes[3] = {nullptr, nullptr, nullptr};
+        SBufferInfo info;
+        memset(&info, 0, sizeof(SBufferInfo));
+        this->m_decoder->FlushFrame(planes, &info);
+
+        if (info.iBufferStatus == 1)
+            this->sendFrame(planes, info);
+    }
+}
+
+void VideoDecoderOpenH264ElementPrivate::sendFrame(unsigned char **planes,
+                                                   const SBufferInfo &info)
+{
+    auto &buffer = info.UsrData.sSystemBuffer;
+
+    if (buffer.iWidth < 1 || buffer.iHeight < 1)
+        return;
+
+    auto fps = this->m_fps? this->m_fps: AkFrac(30, 1);
+    AkVideoPacket videoPacket({AkVideoCaps::Format_yuv420p,
+                               buffer.iWidth,
+                               buffer.iHeight,
+                               fps});
+
+    // Copy the decoder buffers straight into the output planes.
+    for (int plane = 0; plane < videoPacket.planes(); ++plane) {
+        auto iData = planes[plane];
+
+        if (!iData)
+            return;
+
+        auto iLineSize = buffer.iStride[plane < 1? 0: 1];
+        auto lineSize = qMin<size_t>(videoPacket.lineSize(plane), iLineSize);
+        auto heightDiv = videoPacket.heightDiv(plane);
+
+        for (int y = 0; y < buffer.iHeight; y += 1 << heightDiv)
+            memcpy(videoPacket.line(plane, y),
+                   iData + (y >> heightDiv) * iLineSize,
+                   lineSize);
+    }
+
+    videoPacket.setPts(qint64(info.uiOutYuvTimeStamp));
+    videoPacket.setDuration(1);
+    videoPacket.setTimeBase(this->m_timeBase? this->m_timeBase: fps.invert());
+    videoPacket.setId(this->m_id);
+    videoPacket.setIndex(this->m_index);
+
+    emit self->oStream(videoPacket);
+}
+
+#include "moc_videodecoderopenh264element.cpp"
@@ -0,0 +1,66 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef VIDEODECODEROPENH264ELEMENT_H
+#define VIDEODECODEROPENH264ELEMENT_H
+
+#include <iak/akelement.h>
+
+class VideoDecoderOpenH264ElementPrivate;
+
+class VideoDecoderOpenH264Element: public AkElement
+{
+    Q_OBJECT
+    Q_PROPERTY(int threads
+               READ threads
+               WRITE setThreads
+               RESET resetThreads
+               NOTIFY threadsChanged)
+    Q_PROPERTY(bool lowLatency
+               READ lowLatency
+               WRITE setLowLatency
+               RESET resetLowLatency
+               NOTIFY lowLatencyChanged)
+
+    public:
+        VideoDecoderOpenH264Element();
+        ~VideoDecoderOpenH264Element();
+
+        Q_INVOKABLE int threads() const;
+        Q_INVOKABLE bool lowLatency() const;
+
+    private:
+        VideoDecoderOpenH264ElementPrivate *d;
+
+    protected:
+        AkPacket iStream(const AkPacket &packet) override;
+
+    signals:
+        void threadsChanged(int threads);
+        void lowLatencyChanged(bool lowLatency);
+
+    public slots:
+        void setThreads(int threads);
+        void setLowLatency(bool lowLatency);
+        void resetThreads();
+        void resetLowLatency();
+        bool setState(AkElement::ElementState state) override;
+};
+
+#endif // VIDEODECODEROPENH264ELEMENT_H
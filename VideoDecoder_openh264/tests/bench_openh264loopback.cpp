@@ -0,0 +1,309 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <QMutex>
+#include <QThread>
+#include <QtTest>
+#include <akcompressedvideopacket.h>
+#include <akelement.h>
+#include <akfrac.h>
+#include <akpluginmanager.h>
+#include <akvideocaps.h>
+#include <akvideoencoder.h>
+#include <akvideopacket.h>
+
+/* Feeds a synthetic clip in real time to the OpenH264 encoder element, sends
+ * every packet it outputs straight to the OpenH264 decoder element, and
+ * measures the end to end latency and the quality of the decoded frames for
+ * several encoder and decoder settings.
+ */
+
+#define WIDTH   640
+#define HEIGHT  360
+#define FPS     30
+#define FRAMES  90
+#define BITRATE 2000000
+
+using Clock = std::chrono::steady_clock;
+
+struct LoopbackResult
+{
+    qreal meanLatency {0.0};    // Milliseconds from the encoder input.
+    qreal maxLatency {0.0};
+    qreal meanDelay {0.0};      // Frames held by the decoder.
+    qreal psnr {0.0};           // Mean of the decoded frames, in dB.
+    int encoded {0};
+    int frames {0};
+};
+
+class BenchOpenH264Loopback: public QObject
+{
+    Q_OBJECT
+
+    private:
+        static AkVideoPacket frame(int index);
+        static qreal psnr(const AkVideoPacket &reference,
+                          const AkVideoPacket &decoded);
+        static bool loopback(const QString &usageType,
+                             int encoderThreads,
+                             bool frameSkip,
+                             bool lowLatency,
+                             int decoderThreads,
+                             LoopbackResult *result);
+
+    private slots:
+        void initTestCase();
+        void loopback_data();
+        void loopback();
+};
+
+AkVideoPacket BenchOpenH264Loopback::frame(int index)
+{
+    // A scrolling gradient with a moving box.
+    AkVideoPacket packet({AkVideoCaps::Format_yuv420p,
+                          WIDTH,
+                          HEIGHT,
+                          {FPS, 1}});
+    int boxX = (8 * index) % (WIDTH - 64);
+    int boxY = (4 * index) % (HEIGHT - 64);
+
+    for (int y = 0; y < HEIGHT; y++) {
+        auto line = packet.line(0, y);
+
+        for (int x = 0; x < WIDTH; x++) {
+            bool box = x >= boxX && x < boxX + 64
+                       && y >= boxY && y < boxY + 64;
+            line[x] = box? 235: quint8(16 + (x + y + 2 * index) % 200);
+        }
+    }
+
+    for (int y = 0; y < HEIGHT; y += 2) {
+        auto u = packet.line(1, y);
+        auto v = packet.line(2, y);
+
+        for (int x = 0; x < WIDTH / 2; x++) {
+            u[x] = quint8(64 + (x + index) % 128);
+            v[x] = quint8(64 + (y / 2 + index) % 128);
+        }
+    }
+
+    packet.setPts(index);
+    packet.setDuration(1);
+    packet.setTimeBase({1, FPS});
+
+    return packet;
+}
+
+qreal BenchOpenH264Loopback::psnr(const AkVideoPacket &reference,
+                                  const AkVideoPacket &decoded)
+{
+    if (decoded.caps().width() != WIDTH || decoded.caps().height() != HEIGHT)
+        return 0.0;
+
+    // Luma only.
+    qreal error = 0.0;
+
+    for (int y = 0; y < HEIGHT; y++) {
+        auto ref = reference.constLine(0, y);
+        auto line = decoded.constLine(0, y);
+
+        for (int x = 0; x < WIDTH; x++) {
+            qreal diff = qreal(ref[x]) - qreal(line[x]);
+            error += diff * diff;
+        }
+    }
+
+    error /= WIDTH * HEIGHT;
+
+    return error > 0.0? 10.0 * std::log10(255.0 * 255.0 / error): 100.0;
+}
+
+bool BenchOpenH264Loopback::loopback(const QString &usageType,
+                                     int encoderThreads,
+                                     bool frameSkip,
+                                     bool lowLatency,
+                                     int decoderThreads,
+                                     LoopbackResult *result)
+{
+    auto encoder =
+            akPluginManager->create<AkVideoEncoder>("VideoEncoder/Avc/OpenH264");
+    auto decoder =
+            akPluginManager->create<AkElement>("VideoDecoder/Avc/OpenH264");
+
+    if (!encoder || !decoder)
+        return false;
+
+    // Parameter sets go in band with the key frames.
+    encoder->setProperty("usageType", usageType);
+    encoder->setProperty("threads", encoderThreads);
+    encoder->setProperty("enableFrameSkip", frameSkip);
+    encoder->setProperty("globalHeader", false);
+    encoder->setInputCaps({AkVideoCaps::Format_yuv420p,
+                           WIDTH,
+                           HEIGHT,
+                           {FPS, 1}});
+    encoder->setBitrate(BITRATE);
+    encoder->setGop(1000);
+    decoder->setProperty("lowLatency", lowLatency);
+    decoder->setProperty("threads", decoderThreads);
+
+    QVector<Clock::time_point> inputTimes(FRAMES);
+    QMutex mutex;
+    qreal latency = 0.0;
+    qreal delay = 0.0;
+    qreal quality = 0.0;
+
+    // The packets may leave the elements from their own threads.
+    QObject::connect(encoder.data(),
+                     &AkElement::oStream,
+                     decoder.data(),
+                     [&] (const AkPacket &packet) {
+                         mutex.lock();
+                         result->encoded++;
+                         mutex.unlock();
+                         decoder->iStream(packet);
+                     },
+                     Qt::DirectConnection);
+    QObject::connect(decoder.data(),
+                     &AkElement::oStream,
+                     encoder.data(),
+                     [&] (const AkPacket &packet) {
+                         auto now = Clock::now();
+                         AkVideoPacket videoPacket(packet);
+                         auto index = int(videoPacket.pts());
+
+                         if (index < 0 || index >= FRAMES)
+                             return;
+
+                         auto quantity = psnr(frame(index), videoPacket);
+                         QMutexLocker mutexLocker(&mutex);
+                         auto elapsed = now - inputTimes[index];
+                         qreal ms =
+                             std::chrono::duration<qreal, std::milli>(elapsed).count();
+                         latency += ms;
+                         result->maxLatency = qMax(result->maxLatency, ms);
+                         delay += qreal(result->encoded - 1 - index);
+                         quality += quantity;
+                         result->frames++;
+                     },
+                     Qt::DirectConnection);
+
+    if (!decoder->setState(AkElement::ElementStatePlaying))
+        return false;
+
+    if (!encoder->setState(AkElement::ElementStatePlaying)) {
+        decoder->setState(AkElement::ElementStateNull);
+
+        return false;
+    }
+
+    auto start = Clock::now();
+
+    for (int i = 0; i < FRAMES; i++) {
+        auto packet = frame(i);
+        auto inputTime = start + std::chrono::microseconds(1000000 * i / FPS);
+        mutex.lock();
+        inputTimes[i] = inputTime;
+        mutex.unlock();
+        std::this_thread::sleep_until(inputTime);
+        encoder->iStream(packet);
+    }
+
+    // The frames still in the decoder are lost to the latency measure.
+    encoder->setState(AkElement::ElementStateNull);
+    decoder->setState(AkElement::ElementStateNull);
+
+    if (result->frames > 0) {
+        result->meanLatency = latency / result->frames;
+        result->meanDelay = delay / result->frames;
+        result->psnr = quality / result->frames;
+    }
+
+    return true;
+}
+
+void BenchOpenH264Loopback::initTestCase()
+{
+    // Load the plugins from the build tree.
+    akPluginManager->setSearchPaths({AKPLUGINSPATH});
+    akPluginManager->scanPlugins();
+}
+
+void BenchOpenH264Loopback::loopback_data()
+{
+    QTest::addColumn<QString>("usageType");
+    QTest::addColumn<int>("encoderThreads");
+    QTest::addColumn<bool>("frameSkip");
+    QTest::addColumn<bool>("lowLatency");
+    QTest::addColumn<int>("decoderThreads");
+
+    // The default configuration of the elements first.
+    QTest::newRow("camera, low latency")
+            << "UsageType_CameraVideoRealTime" << 1 << false << true << 1;
+    QTest::newRow("camera, encoder threads")
+            << "UsageType_CameraVideoRealTime" << 0 << false << true << 1;
+    QTest::newRow("camera, frame skip")
+            << "UsageType_CameraVideoRealTime" << 1 << true << true << 1;
+    QTest::newRow("screen, low latency")
+            << "UsageType_ScreenContentRealTime" << 1 << false << true << 1;
+    QTest::newRow("camera, decoder threads")
+            << "UsageType_CameraVideoRealTime" << 1 << false << true
+            << QThread::idealThreadCount();
+    QTest::newRow("camera, buffered")
+            << "UsageType_CameraVideoRealTime" << 1 << false << false << 1;
+}
+
+void BenchOpenH264Loopback::loopback()
+{
+    QFETCH(QString, usageType);
+    QFETCH(int, encoderThreads);
+    QFETCH(bool, frameSkip);
+    QFETCH(bool, lowLatency);
+    QFETCH(int, decoderThreads);
+
+    LoopbackResult result;
+    QVERIFY(loopback(usageType,
+                     encoderThreads,
+                     frameSkip,
+                     lowLatency,
+                     decoderThreads,
+                     &result));
+    qInfo() << QTest::currentDataTag()
+            << "encoded:" << result.encoded << "/" << FRAMES
+            << "decoded:" << result.frames
+            << "latency ms mean:" << result.meanLatency
+            << "max:" << result.maxLatency
+            << "delay frames:" << result.meanDelay
+            << "PSNR dB:" << result.psnr;
+    QVERIFY(result.frames > 0);
+    QVERIFY(result.psnr > 30.0);
+
+    // Every access unit leaves the decoder as soon as it enters.
+    if (lowLatency && decoderThreads <= 1) {
+        QCOMPARE(result.frames, result.encoded);
+        QCOMPARE(result.meanDelay, 0.0);
+    }
+}
+
+QTEST_GUILESS_MAIN(BenchOpenH264Loopback)
+
+#include "bench_openh264loopback.moc"
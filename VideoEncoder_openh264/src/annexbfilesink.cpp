@@ -0,0 +1,533 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <atomic>
+#include <QFile>
+#include <QFuture>
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtConcurrent>
+#include <QtDebug>
+#include <akcompressedvideopacket.h>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "annexbfilesink.h"
+
+// Send the pending buffers to the writer when any of these limits is reached.
+#define MAX_PENDING_BUFFERS 64
+#define MAX_PENDING_BYTES   (1 << 20)
+
+/* Bytes waiting for the writer before write() blocks. Only reached when the
+ * disk can't keep up with the stream.
+ */
+#define MAX_QUEUED_BYTES (16 << 20)
+
+// O_DIRECT requires the offsets and sizes to be aligned to the block size.
+#define DIRECT_IO_ALIGNMENT 4096
+#define DIRECT_IO_STAGING   (4 << 20)
+
+struct AnnexBFileSinkBuffer
+{
+    AkCompressedVideoPacket packet;
+    QByteArray data;
+
+    inline const char *constData() const
+    {
+        return this->data.isEmpty()?
+                    this->packet.constData():
+                    this->data.constData();
+    }
+
+    inline size_t size() const
+    {
+        return this->data.isEmpty()?
+                    size_t(this->packet.size()):
+                    size_t(this->data.size());
+    }
+};
+
+using AnnexBFileSinkBatch = QList<AnnexBFileSinkBuffer>;
+
+/* The batches are written from a pool shared by all the sinks, so many
+ * streams don't need a thread each. A sink has at most one writer running at
+ * a time, which keeps its batches in order.
+ */
+Q_GLOBAL_STATIC(QThreadPool, annexBFileSinkWriters)
+
+class AnnexBFileSinkPrivate
+{
+    public:
+        QString m_fileName;
+        AnnexBFileSinkBatch m_pending;
+        QList<AnnexBFileSinkBatch> m_batches;
+        QMutex m_mutex;
+        QWaitCondition m_batchWritten;
+        QFuture<void> m_writerStatus;
+        qint64 m_pendingBytes {0};
+        qint64 m_queuedBytes {0};
+        std::atomic<qint64> m_bytesWritten {0};
+        bool m_writing {false};
+        bool m_writeError {false};
+        bool m_directIO {false};
+        bool m_waitKeyFrame {true};
+#ifdef Q_OS_UNIX
+        int m_fd {-1};
+        char *m_staging {nullptr};
+        size_t m_stagingSize {0};
+#else
+        QFile m_file;
+#endif
+
+        bool isOpen() const;
+        bool append(const AnnexBFileSinkBuffer &buffer);
+        void queuePending();
+        bool flush();
+        void writeBatches();
+        bool writeBatch(const AnnexBFileSinkBatch &batch);
+#ifdef Q_OS_UNIX
+        bool writeAll(const char *data, size_t size);
+        bool writeVectored(const AnnexBFileSinkBatch &batch);
+        bool writeStaged(const AnnexBFileSinkBatch &batch, bool last);
+#endif
+};
+
+AnnexBFileSink::AnnexBFileSink()
+{
+    this->d = new AnnexBFileSinkPrivate;
+}
+
+AnnexBFileSink::~AnnexBFileSink()
+{
+    this->close();
+    delete this->d;
+}
+
+bool AnnexBFileSink::isOpen() const
+{
+    return this->d->isOpen();
+}
+
+QString AnnexBFileSink::fileName() const
+{
+    return this->d->m_fileName;
+}
+
+qint64 AnnexBFileSink::bytesWritten() const
+{
+    return this->d->m_bytesWritten;
+}
+
+bool AnnexBFileSink::open(const QString &fileName, bool directIO)
+{
+    this->close();
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+#ifdef Q_OS_UNIX
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+#ifdef O_DIRECT
+    if (directIO)
+        flags |= O_DIRECT;
+#endif
+
+    this->d->m_fd = ::open(QFile::encodeName(fileName).constData(),
+                           flags,
+                           0644);
+
+    if (this->d->m_fd < 0) {
+        qCritical() << "Can't open" << fileName << ":" << strerror(errno);
+
+        return false;
+    }
+
+#ifdef O_DIRECT
+    if (directIO) {
+        if (posix_memalign(reinterpret_cast<void **>(&this->d->m_staging),
+                           DIRECT_IO_ALIGNMENT,
+                           DIRECT_IO_STAGING) != 0) {
+            qCritical() << "Can't allocate the direct I/O staging buffer";
+            ::close(this->d->m_fd);
+            this->d->m_fd = -1;
+
+            return false;
+        }
+
+        this->d->m_stagingSize = 0;
+    }
+#elif defined(F_NOCACHE)
+    // There is no O_DIRECT on Mac, just bypass the page cache.
+    if (directIO)
+        fcntl(this->d->m_fd, F_NOCACHE, 1);
+
+    directIO = false;
+#else
+    directIO = false;
+#endif
+#else
+    this->d->m_file.setFileName(fileName);
+
+    if (!this->d->m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCritical() << "Can't open" << fileName << ":" << this->d->m_file.errorString();
+
+        return false;
+    }
+
+    directIO = false;
+#endif
+
+    this->d->m_fileName = fileName;
+    this->d->m_directIO = directIO;
+    this->d->m_waitKeyFrame = true;
+    this->d->m_pendingBytes = 0;
+    this->d->m_queuedBytes = 0;
+    this->d->m_bytesWritten = 0;
+    this->d->m_writeError = false;
+
+    return true;
+}
+
+bool AnnexBFileSink::write(const QByteArray &data)
+{
+    if (data.isEmpty())
+        return true;
+
+    return this->d->append({{}, data});
+}
+
+bool AnnexBFileSink::write(const AkCompressedVideoPacket &packet)
+{
+    if (packet.size() < 1)
+        return true;
+
+    {
+        QMutexLocker mutexLocker(&this->d->m_mutex);
+
+        if (this->d->m_waitKeyFrame) {
+            if (!(packet.flags() & AkCompressedVideoPacket::VideoPacketTypeFlag_KeyFrame))
+                return this->d->isOpen();
+
+            this->d->m_waitKeyFrame = false;
+        }
+    }
+
+    return this->d->append({packet, {}});
+}
+
+bool AnnexBFileSink::flush()
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    return this->d->flush();
+}
+
+void AnnexBFileSink::close()
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    if (!this->d->isOpen())
+        return;
+
+    // Let the writer return, the file can be used from here.
+    forever {
+        this->d->flush();
+        auto writerStatus = this->d->m_writerStatus;
+        mutexLocker.unlock();
+        writerStatus.waitForFinished();
+        mutexLocker.relock();
+
+        if (!this->d->m_writing && this->d->m_pending.isEmpty())
+            break;
+    }
+
+#ifdef Q_OS_UNIX
+    if (this->d->m_directIO) {
+        this->d->writeStaged({}, true);
+        free(this->d->m_staging);
+        this->d->m_staging = nullptr;
+        this->d->m_stagingSize = 0;
+    }
+
+    ::close(this->d->m_fd);
+    this->d->m_fd = -1;
+#else
+    this->d->m_file.close();
+#endif
+
+    this->d->m_pending.clear();
+    this->d->m_pendingBytes = 0;
+    this->d->m_directIO = false;
+}
+
+bool AnnexBFileSinkPrivate::isOpen() const
+{
+#ifdef Q_OS_UNIX
+    return this->m_fd >= 0;
+#else
+    return this->m_file.isOpen();
+#endif
+}
+
+bool AnnexBFileSinkPrivate::append(const AnnexBFileSinkBuffer &buffer)
+{
+    QMutexLocker mutexLocker(&this->m_mutex);
+
+    if (!this->isOpen())
+        return false;
+
+    this->m_pending << buffer;
+    this->m_pendingBytes += qint64(buffer.size());
+
+    if (this->m_pending.size() >= MAX_PENDING_BUFFERS
+        || this->m_pendingBytes >= MAX_PENDING_BYTES) {
+        // Block only if the writer is too far behind.
+        while (this->m_queuedBytes >= MAX_QUEUED_BYTES && this->m_writing)
+            this->m_batchWritten.wait(&this->m_mutex);
+
+        this->queuePending();
+    }
+
+    return !this->m_writeError;
+}
+
+void AnnexBFileSinkPrivate::queuePending()
+{
+    // Must be called with m_mutex locked.
+    if (this->m_pending.isEmpty())
+        return;
+
+    this->m_batches << this->m_pending;
+    this->m_queuedBytes += this->m_pendingBytes;
+    this->m_pending.clear();
+    this->m_pendingBytes = 0;
+
+    if (this->m_writing)
+        return;
+
+    this->m_writing = true;
+    this->m_writerStatus =
+            QtConcurrent::run(annexBFileSinkWriters(),
+                              &AnnexBFileSinkPrivate::writeBatches,
+                              this);
+}
+
+bool AnnexBFileSinkPrivate::flush()
+{
+    // Must be called with m_mutex locked, waits until everything is written.
+    if (!this->isOpen())
+        return false;
+
+    this->queuePending();
+
+    while (this->m_writing)
+        this->m_batchWritten.wait(&this->m_mutex);
+
+    return !this->m_writeError;
+}
+
+void AnnexBFileSinkPrivate::writeBatches()
+{
+    // Runs in the writer pool, the file is only used from here while writing.
+    this->m_mutex.lock();
+
+    while (!this->m_batches.isEmpty()) {
+        auto batch = this->m_batches.first();
+        qint64 batchBytes = 0;
+
+        for (auto &buffer: batch)
+            batchBytes += qint64(buffer.size());
+
+        this->m_mutex.unlock();
+        bool ok = this->writeBatch(batch);
+        batch.clear();
+        this->m_mutex.lock();
+
+        this->m_batches.removeFirst();
+        this->m_queuedBytes -= batchBytes;
+
+        if (!ok)
+            this->m_writeError = true;
+
+        this->m_batchWritten.wakeAll();
+    }
+
+    this->m_writing = false;
+    this->m_batchWritten.wakeAll();
+    this->m_mutex.unlock();
+}
+
+bool AnnexBFileSinkPrivate::writeBatch(const AnnexBFileSinkBatch &batch)
+{
+    // Keep consuming the batches after an error, so write() never blocks.
+    if (this->m_writeError)
+        return false;
+
+#ifdef Q_OS_UNIX
+    return this->m_directIO?
+                this->writeStaged(batch, false):
+                this->writeVectored(batch);
+#else
+    for (auto &buffer: batch) {
+        if (this->m_file.write(buffer.constData(), qint64(buffer.size())) < 0) {
+            qCritical() << "Error writing to" << this->m_fileName << ":" << this->m_file.errorString();
+
+            return false;
+        }
+
+        this->m_bytesWritten += qint64(buffer.size());
+    }
+
+    return true;
+#endif
+}
+
+#ifdef Q_OS_UNIX
+bool AnnexBFileSinkPrivate::writeAll(const char *data, size_t size)
+{
+    while (size > 0) {
+        auto written = ::write(this->m_fd, data, size);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            qCritical() << "Error writing to" << this->m_fileName << ":" << strerror(errno);
+
+            return false;
+        }
+
+        data += written;
+        size -= size_t(written);
+    }
+
+    return true;
+}
+
+bool AnnexBFileSinkPrivate::writeVectored(const AnnexBFileSinkBatch &batch)
+{
+    iovec iov[MAX_PENDING_BUFFERS];
+    int nIov = 0;
+
+    for (auto &buffer: batch) {
+        iov[nIov].iov_base = const_cast<char *>(buffer.constData());
+        iov[nIov].iov_len = buffer.size();
+        nIov++;
+    }
+
+    auto curIov = iov;
+
+    // Write all buffers at once, resume from the last one on short writes.
+    while (nIov > 0) {
+        auto written = ::writev(this->m_fd, curIov, nIov);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            qCritical() << "Error writing to" << this->m_fileName << ":" << strerror(errno);
+
+            return false;
+        }
+
+        this->m_bytesWritten += written;
+
+        while (nIov > 0 && size_t(written) >= curIov->iov_len) {
+            written -= curIov->iov_len;
+            curIov++;
+            nIov--;
+        }
+
+        if (nIov > 0) {
+            curIov->iov_base = static_cast<char *>(curIov->iov_base) + written;
+            curIov->iov_len -= size_t(written);
+        }
+    }
+
+    return true;
+}
+
+bool AnnexBFileSinkPrivate::writeStaged(const AnnexBFileSinkBatch &batch,
+                                         bool last)
+{
+    /* Copy the buffers of the batch into the aligned staging buffer, and
+     * write only whole blocks. The remaining bytes are kept for the next
+     * batch.
+     */
+    for (auto &buffer: batch) {
+        auto data = buffer.constData();
+        auto size = buffer.size();
+
+        while (size > 0) {
+            auto copyBytes = qMin<size_t>(size,
+                                          DIRECT_IO_STAGING - this->m_stagingSize);
+            memcpy(this->m_staging + this->m_stagingSize, data, copyBytes);
+            this->m_stagingSize += copyBytes;
+            data += copyBytes;
+            size -= copyBytes;
+
+            if (this->m_stagingSize < DIRECT_IO_STAGING)
+                continue;
+
+            if (!this->writeAll(this->m_staging, this->m_stagingSize))
+                return false;
+
+            this->m_bytesWritten += qint64(this->m_stagingSize);
+            this->m_stagingSize = 0;
+        }
+    }
+
+    auto alignedSize = this->m_stagingSize
+                       - this->m_stagingSize % DIRECT_IO_ALIGNMENT;
+
+    if (alignedSize > 0) {
+        if (!this->writeAll(this->m_staging, alignedSize))
+            return false;
+
+        this->m_bytesWritten += qint64(alignedSize);
+        this->m_stagingSize -= alignedSize;
+        memmove(this->m_staging,
+                this->m_staging + alignedSize,
+                this->m_stagingSize);
+    }
+
+    // The tail of the file is not block aligned, write it without O_DIRECT.
+    if (last && this->m_stagingSize > 0) {
+#ifdef O_DIRECT
+        fcntl(this->m_fd, F_SETFL, fcntl(this->m_fd, F_GETFL) & ~O_DIRECT);
+#endif
+
+        if (!this->writeAll(this->m_staging, this->m_stagingSize))
+            return false;
+
+        this->m_bytesWritten += qint64(this->m_stagingSize);
+        this->m_stagingSize = 0;
+    }
+
+    return true;
+}
+#endif
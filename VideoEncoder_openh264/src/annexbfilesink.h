@@ -0,0 +1,54 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef ANNEXBFILESINK_H
+#define ANNEXBFILESINK_H
+
+#include <QString>
+
+class AnnexBFileSinkPrivate;
+class AkCompressedVideoPacket;
+
+/* Writes a raw H264 (Annex-B) stream to a file. The packets are not copied,
+ * a reference is kept until the batch is written with a single vectored
+ * write. The full batches are written from a thread pool, so write() doesn't
+ * wait for the disk, flush() and close() wait until everything is written.
+ * The packets received before the first key frame of the file are dropped, so
+ * a file opened in the middle of a GOP is still decodable.
+ */
+class AnnexBFileSink
+{
+    public:
+        AnnexBFileSink();
+        ~AnnexBFileSink();
+
+        bool isOpen() const;
+        QString fileName() const;
+        qint64 bytesWritten() const;
+        bool open(const QString &fileName, bool directIO=false);
+        bool write(const QByteArray &data);
+        bool write(const AkCompressedVideoPacket &packet);
+        bool flush();
+        void close();
+
+    private:
+        AnnexBFileSinkPrivate *d;
+};
+
+#endif // ANNEXBFILESINK_H
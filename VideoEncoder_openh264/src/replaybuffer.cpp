@@ -0,0 +1,252 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <QList>
+#include <QMutex>
+#include <akfrac.h>
+#include <akcompressedvideopacket.h>
+
+#include "replaybuffer.h"
+
+struct ReplayBufferEntry
+{
+    qsizetype offset;
+    qsizetype size;
+    qint64 time; // In milliseconds
+    qint64 duration; // In milliseconds
+    bool keyFrame;
+};
+
+class ReplayBufferPrivate
+{
+    public:
+        QByteArray m_arena;
+        QList<ReplayBufferEntry> m_entries;
+        mutable QMutex m_mutex;
+        qint64 m_length {0};
+        qsizetype m_readPos {0};
+        qsizetype m_writePos {0};
+
+        bool allocate(qsizetype size, qsizetype *offset) const;
+        void dropGop();
+        inline qint64 bufferedTime(int from) const;
+};
+
+ReplayBuffer::ReplayBuffer()
+{
+    this->d = new ReplayBufferPrivate;
+}
+
+ReplayBuffer::~ReplayBuffer()
+{
+    delete this->d;
+}
+
+qint64 ReplayBuffer::length() const
+{
+    return this->d->m_length;
+}
+
+qsizetype ReplayBuffer::capacity() const
+{
+    return this->d->m_arena.size();
+}
+
+qint64 ReplayBuffer::duration() const
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    return this->d->bufferedTime(0);
+}
+
+void ReplayBuffer::configure(qint64 length, qsizetype capacity)
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    this->d->m_length = qMax<qint64>(length, 0);
+
+    if (this->d->m_length < 1)
+        capacity = 0;
+
+    // Only reallocate when the arena size changes.
+    if (this->d->m_arena.size() != capacity)
+        this->d->m_arena = QByteArray(capacity, Qt::Uninitialized);
+
+    this->d->m_entries.reserve(qMax<qint64>(this->d->m_length / 10, 16));
+    this->d->m_entries.clear();
+    this->d->m_readPos = 0;
+    this->d->m_writePos = 0;
+}
+
+bool ReplayBuffer::push(const AkCompressedVideoPacket &packet)
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    if (this->d->m_length < 1 || this->d->m_arena.isEmpty())
+        return false;
+
+    bool keyFrame =
+            packet.flags() & AkCompressedVideoPacket::VideoPacketTypeFlag_KeyFrame;
+
+    // The buffer must always start with a key frame.
+    if (this->d->m_entries.isEmpty() && !keyFrame)
+        return false;
+
+    auto size = qsizetype(packet.size());
+
+    if (size < 1 || size > this->d->m_arena.size())
+        return false;
+
+    qsizetype offset = 0;
+
+    while (!this->d->allocate(size, &offset)) {
+        if (this->d->m_entries.isEmpty())
+            return false;
+
+        this->d->dropGop();
+
+        // If the packet is not a key frame and all GOPs were discarded, the
+        // buffer can't start with it.
+        if (this->d->m_entries.isEmpty() && !keyFrame)
+            return false;
+    }
+
+    memcpy(this->d->m_arena.data() + offset, packet.constData(), size);
+    auto timeBase = packet.timeBase();
+    this->d->m_entries << ReplayBufferEntry {
+        offset,
+        size,
+        qRound64(1000.0 * packet.pts() * timeBase.value()),
+        qRound64(1000.0 * packet.duration() * timeBase.value()),
+        keyFrame
+    };
+    this->d->m_writePos = offset + size;
+
+    /* Discard the oldest GOP while the following ones still cover the
+     * requested length.
+     */
+    forever {
+        int nextGop = 1;
+
+        for (; nextGop < this->d->m_entries.size(); nextGop++)
+            if (this->d->m_entries[nextGop].keyFrame)
+                break;
+
+        if (nextGop >= this->d->m_entries.size()
+            || this->d->bufferedTime(nextGop) < this->d->m_length)
+            break;
+
+        this->d->dropGop();
+    }
+
+    return true;
+}
+
+QByteArray ReplayBuffer::read(const QByteArray &headers) const
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+    qsizetype size = headers.size();
+
+    for (auto &entry: this->d->m_entries)
+        size += entry.size;
+
+    QByteArray data(size, Qt::Uninitialized);
+    auto dataPtr = data.data();
+    memcpy(dataPtr, headers.constData(), headers.size());
+    dataPtr += headers.size();
+
+    for (auto &entry: this->d->m_entries) {
+        memcpy(dataPtr, this->d->m_arena.constData() + entry.offset, entry.size);
+        dataPtr += entry.size;
+    }
+
+    return data;
+}
+
+void ReplayBuffer::clear()
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+    this->d->m_entries.clear();
+    this->d->m_readPos = 0;
+    this->d->m_writePos = 0;
+}
+
+bool ReplayBufferPrivate::allocate(qsizetype size, qsizetype *offset) const
+{
+    if (this->m_entries.isEmpty()) {
+        *offset = 0;
+
+        return size <= this->m_arena.size();
+    }
+
+    if (this->m_writePos > this->m_readPos) {
+        // Free space at the end of the arena.
+        if (this->m_arena.size() - this->m_writePos >= size) {
+            *offset = this->m_writePos;
+
+            return true;
+        }
+
+        // Wrap around to the beginning of the arena.
+        if (this->m_readPos >= size) {
+            *offset = 0;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    // The data is wrapped, the free space is between both positions.
+    if (this->m_readPos - this->m_writePos >= size) {
+        *offset = this->m_writePos;
+
+        return true;
+    }
+
+    return false;
+}
+
+void ReplayBufferPrivate::dropGop()
+{
+    if (this->m_entries.isEmpty())
+        return;
+
+    this->m_entries.removeFirst();
+
+    while (!this->m_entries.isEmpty() && !this->m_entries.first().keyFrame)
+        this->m_entries.removeFirst();
+
+    if (this->m_entries.isEmpty()) {
+        this->m_readPos = 0;
+        this->m_writePos = 0;
+    } else {
+        this->m_readPos = this->m_entries.first().offset;
+    }
+}
+
+qint64 ReplayBufferPrivate::bufferedTime(int from) const
+{
+    if (from >= this->m_entries.size())
+        return 0;
+
+    auto &last = this->m_entries.last();
+
+    return last.time + last.duration - this->m_entries[from].time;
+}
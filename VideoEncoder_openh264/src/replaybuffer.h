@@ -0,0 +1,50 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#ifndef REPLAYBUFFER_H
+#define REPLAYBUFFER_H
+
+#include <QByteArray>
+
+class ReplayBufferPrivate;
+class AkCompressedVideoPacket;
+
+/* Keeps the last N milliseconds of encoded packets in a single preallocated
+ * arena. The buffer always starts at a key frame, old packets are discarded
+ * one GOP at a time.
+ */
+class ReplayBuffer
+{
+    public:
+        ReplayBuffer();
+        ~ReplayBuffer();
+
+        qint64 length() const;
+        qsizetype capacity() const;
+        qint64 duration() const;
+        void configure(qint64 length, qsizetype capacity);
+        bool push(const AkCompressedVideoPacket &packet);
+        QByteArray read(const QByteArray &headers={}) const;
+        void clear();
+
+    private:
+        ReplayBufferPrivate *d;
+};
+
+#endif // REPLAYBUFFER_H
@@ -32,7 +32,18 @@
 #include <iak/akelement.h>
 #include <wels/codec_api.h>
 
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "videoencoderopenh264element.h"
+#include "annexbfilesink.h"
+#include "replaybuffer.h"
 
 /* Have tried adjusting several parameters, apply patches and many more things,
  * yet this codec does not seems to provide valid data.
@@ -81,6 +92,89 @@ struct PixFormatTable
     }
 };
 
+// https://blog.mediacoderhq.com/h264-profiles-and-levels/
+// https://en.wikipedia.org/wiki/Advanced_Video_Coding#Levels
+
+struct LevelsTable
+{
+    ELevelIdc level;
+    quint64 mbps;
+    quint64 frameSize;
+    qint64 maxBitrate[4];
+
+    static inline const LevelsTable *table()
+    {
+        static const LevelsTable openH264Levels[] = {
+            {LEVEL_1_0    , 1485   , 99L   , {64L    , 80L    , 192L   , 256L   }},
+            {LEVEL_1_B    , 1485   , 99L   , {128L   , 160L   , 384L   , 512L   }},
+            {LEVEL_1_1    , 3000   , 396L  , {192L   , 240L   , 576L   , 768L   }},
+            {LEVEL_1_2    , 6000   , 396L  , {384L   , 480L   , 1152L  , 1536L  }},
+            {LEVEL_1_3    , 11880  , 396L  , {768L   , 960L   , 2304L  , 3072L  }},
+            {LEVEL_2_0    , 11880  , 396L  , {2000L  , 2500L  , 6000L  , 8000L  }},
+            {LEVEL_2_1    , 19800  , 792L  , {4000L  , 5000L  , 12000L , 16000L }},
+            {LEVEL_2_2    , 20250  , 1620L , {4000L  , 5000L  , 12000L , 16000L }},
+            {LEVEL_3_0    , 40500  , 1620L , {10000L , 12500L , 30000L , 40000L }},
+            {LEVEL_3_1    , 108000 , 3600L , {14000L , 17500L , 42000L , 56000L }},
+            {LEVEL_3_2    , 216000 , 5120L , {20000L , 25000L , 60000L , 80000L }},
+            {LEVEL_4_0    , 245760 , 8192L , {20000L , 25000L , 60000L , 80000L }},
+            {LEVEL_4_1    , 245760 , 8192L , {50000L , 50000L , 150000L, 200000L}},
+            {LEVEL_4_2    , 522240 , 8704L , {50000L , 50000L , 150000L, 200000L}},
+            {LEVEL_5_0    , 589824 , 22080L, {135000L, 168750L, 405000L, 540000L}},
+            {LEVEL_5_1    , 983040 , 36864L, {240000L, 300000L, 720000L, 960000L}},
+            {LEVEL_5_2    , 2073600, 36864L, {240000L, 300000L, 720000L, 960000L}},
+            {LEVEL_UNKNOWN, 0      , 0L    , {0L     , 0L     , 0L     , 0L     }},
+        };
+
+        return openH264Levels;
+    }
+
+    static inline const LevelsTable *byLevel(ELevelIdc level)
+    {
+        auto lvl = table();
+
+        for (; lvl->level != LEVEL_UNKNOWN; lvl++)
+            if (lvl->level == level)
+                return lvl;
+
+        return lvl;
+    }
+
+    static inline int bitrateIndex(EProfileIdc profile)
+    {
+        switch (profile) {
+        case PRO_HIGH:
+            return 1;
+        case PRO_HIGH10:
+            return 2;
+        case PRO_HIGH422:
+        case PRO_HIGH444:
+            return 3;
+        default:
+            break;
+        }
+
+        return 0;
+    }
+
+    // Max bitrate in bits/sec for the given profile.
+    inline qint64 bitrate(EProfileIdc profile) const
+    {
+        return 1000 * this->maxBitrate[bitrateIndex(profile)];
+    }
+};
+
+// Scheduling options of a thread, as they were before applying ours.
+struct ThreadPolicyState
+{
+    qint64 tid {0};
+#ifdef Q_OS_LINUX
+    cpu_set_t affinity;
+    int policy {SCHED_OTHER};
+    sched_param param;
+    int niceness {0};
+#endif
+};
+
 class VideoEncoderOpenH264ElementPrivate
 {
     public:
@@ -92,6 +186,20 @@ class VideoEncoderOpenH264ElementPrivate
         VideoEncoderOpenH264Element::LogLevel m_logLevel {VideoEncoderOpenH264Element::LogLevel_Warning};
         bool m_globalHeader {true};
         bool m_enableFrameSkip {true};
+        VideoEncoderOpenH264Element::Level m_level {VideoEncoderOpenH264Element::Level_Auto};
+        bool m_clampToLevel {true};
+        ELevelIdc m_encodingLevel {LEVEL_UNKNOWN};
+        QList<int> m_cpuAffinity;
+        VideoEncoderOpenH264Element::SchedulingPolicy m_schedulingPolicy {VideoEncoderOpenH264Element::SchedulingPolicy_Normal};
+        int m_niceness {0};
+        int m_threads {0};
+        Qt::HANDLE m_encodeThread {nullptr};
+        ThreadPolicyState m_encodeThreadState;
+        int m_replayBufferLength {0};
+        ReplayBuffer m_replayBuffer;
+        QString m_outputFile;
+        bool m_outputFileDirectIO {false};
+        AnnexBFileSink m_fileSink;
         AkCompressedVideoPackets m_headers;
         ISVCEncoder *m_encoder {nullptr};
         SSourcePicture m_frame;
@@ -100,6 +208,7 @@ class VideoEncoderOpenH264ElementPrivate
         int m_index {0};
         bool m_initialized {false};
         bool m_paused {false};
+        bool m_forceKeyFrame {false};
         qint64 m_dts {0};
         qint64 m_encodedTimePts {0};
         AkElementPtr m_fpsControl {akPluginManager->create<AkElement>("VideoFilter/FpsControl")};
@@ -114,7 +223,21 @@ class VideoEncoderOpenH264ElementPrivate
         void encodeFrame(const AkVideoPacket &src);
         void sendFrame(const QByteArray &packetData,
                        const SFrameBSInfo &info);
-        ELevelIdc level(const AkVideoCaps &caps, EProfileIdc profile) const;
+        static quint64 lumaPictureSize(const AkVideoCaps &caps);
+        static ELevelIdc level(const AkVideoCaps &caps,
+                               int bitrate,
+                               EProfileIdc profile);
+        ELevelIdc planLevel(AkVideoCaps &caps,
+                            int &bitrate,
+                            EProfileIdc profile) const;
+        bool threadPolicyIsDefault() const;
+        void applyThreadPolicy() const;
+        static bool saveThreadPolicy(ThreadPolicyState *state);
+        static void restoreThreadPolicy(ThreadPolicyState *state);
+        void updateThreadPolicy();
+        QByteArray annexBHeaders() const;
+        void updateReplayBuffer();
+        void openOutputFile();
 };
 
 VideoEncoderOpenH264Element::VideoEncoderOpenH264Element():
@@ -179,6 +302,63 @@ bool VideoEncoderOpenH264Element::enableFrameSkip() const
     return this->d->m_enableFrameSkip;
 }
 
+VideoEncoderOpenH264Element::Level VideoEncoderOpenH264Element::level() const
+{
+    return this->d->m_level;
+}
+
+bool VideoEncoderOpenH264Element::clampToLevel() const
+{
+    return this->d->m_clampToLevel;
+}
+
+VideoEncoderOpenH264Element::Level VideoEncoderOpenH264Element::encodingLevel() const
+{
+    return Level(this->d->m_encodingLevel);
+}
+
+QList<int> VideoEncoderOpenH264Element::cpuAffinity() const
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    return this->d->m_cpuAffinity;
+}
+
+VideoEncoderOpenH264Element::SchedulingPolicy VideoEncoderOpenH264Element::schedulingPolicy() const
+{
+    return this->d->m_schedulingPolicy;
+}
+
+int VideoEncoderOpenH264Element::niceness() const
+{
+    return this->d->m_niceness;
+}
+
+int VideoEncoderOpenH264Element::threads() const
+{
+    return this->d->m_threads;
+}
+
+int VideoEncoderOpenH264Element::replayBufferLength() const
+{
+    return this->d->m_replayBufferLength;
+}
+
+QByteArray VideoEncoderOpenH264Element::replayBuffer() const
+{
+    return this->d->m_replayBuffer.read(this->d->annexBHeaders());
+}
+
+QString VideoEncoderOpenH264Element::outputFile() const
+{
+    return this->d->m_outputFile;
+}
+
+bool VideoEncoderOpenH264Element::outputFileDirectIO() const
+{
+    return this->d->m_outputFileDirectIO;
+}
+
 QString VideoEncoderOpenH264Element::controlInterfaceProvide(const QString &controlId) const
 {
     Q_UNUSED(controlId)
@@ -269,6 +449,120 @@ void VideoEncoderOpenH264Element::setEnableFrameSkip(bool enableFrameSkip)
     emit this->enableFrameSkipChanged(enableFrameSkip);
 }
 
+void VideoEncoderOpenH264Element::setLevel(Level level)
+{
+    if (level == this->d->m_level)
+        return;
+
+    this->d->m_level = level;
+    emit this->levelChanged(level);
+}
+
+void VideoEncoderOpenH264Element::setClampToLevel(bool clampToLevel)
+{
+    if (clampToLevel == this->d->m_clampToLevel)
+        return;
+
+    this->d->m_clampToLevel = clampToLevel;
+    emit this->clampToLevelChanged(clampToLevel);
+}
+
+void VideoEncoderOpenH264Element::setCpuAffinity(const QList<int> &cpuAffinity)
+{
+    // The encoding thread reads the options while holding the mutex.
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    if (cpuAffinity == this->d->m_cpuAffinity)
+        return;
+
+    this->d->m_cpuAffinity = cpuAffinity;
+    this->d->updateThreadPolicy();
+    mutexLocker.unlock();
+    emit this->cpuAffinityChanged(cpuAffinity);
+}
+
+void VideoEncoderOpenH264Element::setSchedulingPolicy(SchedulingPolicy schedulingPolicy)
+{
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    if (schedulingPolicy == this->d->m_schedulingPolicy)
+        return;
+
+    this->d->m_schedulingPolicy = schedulingPolicy;
+    this->d->updateThreadPolicy();
+    mutexLocker.unlock();
+    emit this->schedulingPolicyChanged(schedulingPolicy);
+}
+
+void VideoEncoderOpenH264Element::setNiceness(int niceness)
+{
+    niceness = qBound(-20, niceness, 19);
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+
+    if (niceness == this->d->m_niceness)
+        return;
+
+    this->d->m_niceness = niceness;
+    this->d->updateThreadPolicy();
+    mutexLocker.unlock();
+    emit this->nicenessChanged(niceness);
+}
+
+void VideoEncoderOpenH264Element::setThreads(int threads)
+{
+    threads = qMax(threads, 0);
+
+    if (threads == this->d->m_threads)
+        return;
+
+    this->d->m_threads = threads;
+    emit this->threadsChanged(threads);
+}
+
+void VideoEncoderOpenH264Element::setReplayBufferLength(int replayBufferLength)
+{
+    replayBufferLength = qMax(replayBufferLength, 0);
+
+    if (replayBufferLength == this->d->m_replayBufferLength)
+        return;
+
+    this->d->m_replayBufferLength = replayBufferLength;
+
+    if (this->d->m_initialized)
+        this->d->updateReplayBuffer();
+
+    emit this->replayBufferLengthChanged(replayBufferLength);
+}
+
+void VideoEncoderOpenH264Element::setOutputFile(const QString &outputFile)
+{
+    if (outputFile == this->d->m_outputFile)
+        return;
+
+    QMutexLocker mutexLocker(&this->d->m_mutex);
+    this->d->m_outputFile = outputFile;
+
+    /* The new file can only start with a key frame, ask for one instead of
+     * waiting for the end of the GOP.
+     */
+    if (this->d->m_initialized) {
+        this->d->openOutputFile();
+        this->d->m_forceKeyFrame = true;
+    }
+
+    mutexLocker.unlock();
+    emit this->outputFileChanged(outputFile);
+}
+
+void VideoEncoderOpenH264Element::setOutputFileDirectIO(bool outputFileDirectIO)
+{
+    if (outputFileDirectIO == this->d->m_outputFileDirectIO)
+        return;
+
+    this->d->m_outputFileDirectIO = outputFileDirectIO;
+    emit this->outputFileDirectIOChanged(outputFileDirectIO);
+}
+
 void VideoEncoderOpenH264Element::resetUsageType()
 {
     this->setUsageType(UsageType_CameraVideoRealTime);
@@ -294,10 +588,69 @@ void VideoEncoderOpenH264Element::resetEnableFrameSkip()
     this->setEnableFrameSkip(false);
 }
 
+void VideoEncoderOpenH264Element::resetLevel()
+{
+    this->setLevel(Level_Auto);
+}
+
+void VideoEncoderOpenH264Element::resetClampToLevel()
+{
+    this->setClampToLevel(true);
+}
+
+void VideoEncoderOpenH264Element::resetCpuAffinity()
+{
+    this->setCpuAffinity({});
+}
+
+void VideoEncoderOpenH264Element::resetSchedulingPolicy()
+{
+    this->setSchedulingPolicy(SchedulingPolicy_Normal);
+}
+
+void VideoEncoderOpenH264Element::resetNiceness()
+{
+    this->setNiceness(0);
+}
+
+void VideoEncoderOpenH264Element::resetThreads()
+{
+    this->setThreads(0);
+}
+
+void VideoEncoderOpenH264Element::resetReplayBufferLength()
+{
+    this->setReplayBufferLength(0);
+}
+
+void VideoEncoderOpenH264Element::resetOutputFile()
+{
+    this->setOutputFile({});
+}
+
+void VideoEncoderOpenH264Element::resetOutputFileDirectIO()
+{
+    this->setOutputFileDirectIO(false);
+}
+
+void VideoEncoderOpenH264Element::clearReplayBuffer()
+{
+    this->d->m_replayBuffer.clear();
+}
+
 void VideoEncoderOpenH264Element::resetOptions()
 {
     AkVideoEncoder::resetOptions();
     this->resetUsageType();
+    this->resetLevel();
+    this->resetClampToLevel();
+    this->resetCpuAffinity();
+    this->resetSchedulingPolicy();
+    this->resetNiceness();
+    this->resetThreads();
+    this->resetReplayBufferLength();
+    this->resetOutputFile();
+    this->resetOutputFileDirectIO();
 }
 
 bool VideoEncoderOpenH264Element::setState(ElementState state)
@@ -462,22 +815,69 @@ bool VideoEncoderOpenH264ElementPrivate::init()
         return false;
     }
 
+    /* The converter keeps the frame rate derived from the input, the level
+     * clamps a copy of it, so changing the level or clampToLevel takes
+     * effect on the next init().
+     */
+    auto encodingCaps = this->m_videoConverter.outputCaps();
+    int bitrate = self->bitrate();
+    auto level = this->planLevel(encodingCaps, bitrate, eqFormat->profile);
+
+    // Publish the clamped frame rate and bitrate, the muxers need the real
+    // ones.
+    AkCompressedVideoCaps outputCaps(self->codec(), encodingCaps, bitrate);
+
+    if (this->m_outputCaps != outputCaps) {
+        this->m_outputCaps = outputCaps;
+        emit self->outputCapsChanged(this->m_outputCaps);
+    }
+
     param.iUsageType = EUsageType(this->m_usageType);
     param.iRCMode = RC_BITRATE_MODE;
-    param.fMaxFrameRate = inputCaps.fps().value();
+    param.fMaxFrameRate = encodingCaps.fps().value();
     param.iPicWidth = inputCaps.width();
     param.iPicHeight = inputCaps.height();
-    param.iTargetBitrate = self->bitrate();
+    param.iTargetBitrate = bitrate;
     param.uiIntraPeriod =
-        qMax(self->gop() * inputCaps.fps().num()
-             / (1000 * inputCaps.fps().den()), 1);
+        qMax(self->gop() * encodingCaps.fps().num()
+             / (1000 * encodingCaps.fps().den()), 1);
     param.iComplexityMode = ECOMPLEXITY_MODE(VideoEncoderOpenH264Element::ComplexityMode_Low);
     param.bEnableFrameSkip = this->m_enableFrameSkip;
     param.bEnableDenoise = 0;
-    param.iMultipleThreadIdc = QThread::idealThreadCount();
+    param.iMultipleThreadIdc = this->m_threads > 0?
+                                   this->m_threads:
+                                   QThread::idealThreadCount();
+
+    // Signal the planned profile and level in the SPS.
+    param.sSpatialLayers[0].iVideoWidth = param.iPicWidth;
+    param.sSpatialLayers[0].iVideoHeight = param.iPicHeight;
+    param.sSpatialLayers[0].fFrameRate = param.fMaxFrameRate;
+    param.sSpatialLayers[0].iSpatialBitrate = param.iTargetBitrate;
+    param.sSpatialLayers[0].uiProfileIdc = eqFormat->profile;
+
+    if (level != LEVEL_UNKNOWN) {
+        param.sSpatialLayers[0].uiLevelIdc = level;
+        param.sSpatialLayers[0].iMaxSpatialBitrate =
+                int(LevelsTable::byLevel(level)->bitrate(eqFormat->profile));
+        param.iMaxBitrate = param.sSpatialLayers[0].iMaxSpatialBitrate;
+    }
+
+    /* openh264 creates its worker threads while initializing, and they
+     * inherit the scheduling options of this thread. This thread is not ours,
+     * so it gets its own options back right after.
+     */
+    ThreadPolicyState initThreadState;
+    bool initThreadPolicyApplied = !this->threadPolicyIsDefault()
+                                   && this->saveThreadPolicy(&initThreadState);
+
+    if (initThreadPolicyApplied)
+        this->applyThreadPolicy();
 
     result = this->m_encoder->InitializeExt(&param);
 
+    if (initThreadPolicyApplied)
+        this->restoreThreadPolicy(&initThreadState);
+
     if (result != cmResultSuccess) {
         qCritical() << "Failed to initialize the encoder:" << errorToString(result);
         WelsDestroySVCEncoder(this->m_encoder);
@@ -486,6 +886,8 @@ bool VideoEncoderOpenH264ElementPrivate::init()
         return false;
     }
 
+    this->m_encodeThread = nullptr;
+
     int32_t videoFormat = eqFormat->openh264Format;
     result = this->m_encoder->SetOption(ENCODER_OPTION_DATAFORMAT, &videoFormat);
 
@@ -496,35 +898,24 @@ bool VideoEncoderOpenH264ElementPrivate::init()
 
         return false;
     }
-/*
-    SProfileInfo profile;
-    profile.iLayer = 0;
-    profile.uiProfileIdc = eqFormat->profile;
-    result = this->m_encoder->SetOption(ENCODER_OPTION_PROFILE, &profile);
-
-    if (result != cmResultSuccess) {
-        qCritical() << "Error setting the profile:" << errorToString(result);
-        WelsDestroySVCEncoder(this->m_encoder);
-        this->m_encoder = nullptr;
-
-        return false;
-    }
-*/
     memset(&this->m_frame, 0, sizeof(SSourcePicture));
     this->m_frame.iPicWidth = inputCaps.width();
     this->m_frame.iPicHeight = inputCaps.height();
     this->m_frame.iColorFormat = eqFormat->openh264Format;
 
     this->updateHeaders();
+    this->updateReplayBuffer();
+    this->openOutputFile();
 
     if (this->m_fpsControl) {
-        this->m_fpsControl->setProperty("fps", QVariant::fromValue(this->m_videoConverter.outputCaps().fps()));
+        this->m_fpsControl->setProperty("fps", QVariant::fromValue(encodingCaps.fps()));
         this->m_fpsControl->setProperty("fillGaps", self->fillGaps());
         QMetaObject::invokeMethod(this->m_fpsControl.data(),
                                   "restart",
                                   Qt::DirectConnection);
     }
 
+    this->m_encodingLevel = level;
     this->m_dts = 0;
     this->m_encodedTimePts = 0;
     this->m_initialized = true;
@@ -552,7 +943,12 @@ void VideoEncoderOpenH264ElementPrivate::uninit()
                                   "restart",
                                   Qt::DirectConnection);
 
+    this->m_fileSink.close();
+    this->m_encodingLevel = LEVEL_UNKNOWN;
+    this->restoreThreadPolicy(&this->m_encodeThreadState);
+    this->m_encodeThread = nullptr;
     this->m_paused = false;
+    this->m_forceKeyFrame = false;
 }
 
 void VideoEncoderOpenH264ElementPrivate::updateHeaders()
@@ -641,6 +1037,21 @@ void VideoEncoderOpenH264ElementPrivate::encodeFrame(const AkVideoPacket &src)
     this->m_id = src.id();
     this->m_index = src.index();
 
+    /* The encoding thread may change between frames. It's not ours, so the
+     * previous one gets its own scheduling options back before applying them
+     * to the new one.
+     */
+    auto currentThread = QThread::currentThreadId();
+
+    if (currentThread != this->m_encodeThread) {
+        this->m_encodeThread = currentThread;
+        this->restoreThreadPolicy(&this->m_encodeThreadState);
+
+        if (!this->threadPolicyIsDefault()
+            && this->saveThreadPolicy(&this->m_encodeThreadState))
+            this->applyThreadPolicy();
+    }
+
     // Write the current frame.
     for (int plane = 0; plane < src.planes(); ++plane) {
         auto planeData = this->m_frame.pData[plane];
@@ -659,6 +1070,11 @@ void VideoEncoderOpenH264ElementPrivate::encodeFrame(const AkVideoPacket &src)
     this->m_frame.uiTimeStamp =
             qRound64(src.pts() * src.timeBase().value() * 1000);
 
+    if (this->m_forceKeyFrame) {
+        this->m_encoder->ForceIntraFrame(true);
+        this->m_forceKeyFrame = false;
+    }
+
     SFrameBSInfo info;
     memset(&info, 0, sizeof (SFrameBSInfo));
     auto result = this->m_encoder->EncodeFrame(&this->m_frame, &info);
@@ -711,86 +1127,292 @@ void VideoEncoderOpenH264ElementPrivate::sendFrame(const QByteArray &packetData,
     packet.setTimeBase(this->m_outputCaps.rawCaps().fps().invert());
     packet.setId(this->m_id);
     packet.setIndex(this->m_index);
+    this->m_replayBuffer.push(packet);
+
+    if (this->m_fileSink.isOpen())
+        this->m_fileSink.write(packet);
 
     emit self->oStream(packet);
     this->m_dts++;
 }
 
+quint64 VideoEncoderOpenH264ElementPrivate::lumaPictureSize(const AkVideoCaps &caps)
+{
+    quint64 mbWidth = (caps.width() + 15) / 16;
+    quint64 mbHeight = (caps.height() + 15) / 16;
+
+    return mbWidth * mbHeight;
+}
+
 ELevelIdc VideoEncoderOpenH264ElementPrivate::level(const AkVideoCaps &caps,
-                                                    EProfileIdc profile) const
+                                                    int bitrate,
+                                                    EProfileIdc profile)
 {
-    // https://blog.mediacoderhq.com/h264-profiles-and-levels/
-    // https://en.wikipedia.org/wiki/Advanced_Video_Coding#Levels
+    auto pictureSize = lumaPictureSize(caps);
+    quint64 lumaSampleRate = qRound64(pictureSize * caps.fps().value());
 
-    static const struct OpenH264LevelsDef
-    {
-        ELevelIdc level;
-        quint64 mbps;
-        quint64 frameSize;
-        qint64 maxBitrate[4];
-    } openH264Levels[] = {
-        {LEVEL_1_0    , 1485   , 99L   , {64L    , 80L    , 192L   , 256L   }},
-        {LEVEL_1_B    , 1485   , 99L   , {128L   , 160L   , 384L   , 512L   }},
-        {LEVEL_1_1    , 3000   , 396L  , {192L   , 240L   , 576L   , 768L   }},
-        {LEVEL_1_2    , 6000   , 396L  , {384L   , 480L   , 1152L  , 1536L  }},
-        {LEVEL_1_3    , 11880  , 396L  , {768L   , 960L   , 2304L  , 3072L  }},
-        {LEVEL_2_0    , 11880  , 396L  , {2000L  , 2500L  , 6000L  , 8000L  }},
-        {LEVEL_2_1    , 19800  , 792L  , {4000L  , 5000L  , 12000L , 16000L }},
-        {LEVEL_2_2    , 20250  , 1620L , {4000L  , 5000L  , 12000L , 16000L }},
-        {LEVEL_3_0    , 40500  , 1620L , {10000L , 12500L , 30000L , 40000L }},
-        {LEVEL_3_1    , 108000 , 3600L , {14000L , 17500L , 42000L , 56000L }},
-        {LEVEL_3_2    , 216000 , 5120L , {20000L , 25000L , 60000L , 80000L }},
-        {LEVEL_4_0    , 245760 , 8192L , {20000L , 25000L , 60000L , 80000L }},
-        {LEVEL_4_1    , 245760 , 8192L , {50000L , 50000L , 150000L, 200000L}},
-        {LEVEL_4_2    , 522240 , 8704L , {50000L , 50000L , 150000L, 200000L}},
-        {LEVEL_5_0    , 589824 , 22080L, {135000L, 168750L, 405000L, 540000L}},
-        {LEVEL_5_1    , 983040 , 36864L, {240000L, 300000L, 720000L, 960000L}},
-        {LEVEL_5_2    , 2073600, 36864L, {240000L, 300000L, 720000L, 960000L}},
-        {LEVEL_UNKNOWN, 0      , 0L    , {0L     , 0L     , 0L     , 0L     }},
-    };
+    for (auto level = LevelsTable::table(); level->level != LEVEL_UNKNOWN; ++level)
+        if (level->frameSize >= pictureSize
+            && level->mbps >= lumaSampleRate
+            && level->bitrate(profile) >= bitrate) {
+            return level->level;
+        }
 
-    int mbWidth = (caps.width() + 15) / 16;
-    int mbHeight = (caps.height() + 15) / 16;
-    quint64 lumaPictureSize = mbWidth * mbHeight;
-    quint64 lumaSampleRate = qRound64(lumaPictureSize * caps.fps().value());
-    int bitrate = self->bitrate();
-    int bitrateIndex = 0;
+    return LEVEL_UNKNOWN;
+}
 
-    switch (profile) {
-    case PRO_BASELINE:
-    case PRO_MAIN:
-    case PRO_EXTENDED:
-        bitrateIndex = 0;
+ELevelIdc VideoEncoderOpenH264ElementPrivate::planLevel(AkVideoCaps &caps,
+                                                        int &bitrate,
+                                                        EProfileIdc profile) const
+{
+    auto minLevel = level(caps, bitrate, profile);
 
-        break;
+    if (this->m_level == VideoEncoderOpenH264Element::Level_Auto) {
+        if (minLevel == LEVEL_UNKNOWN)
+            qWarning() << "The encoding parameters exceed the limits of any H264 level";
 
-    case PRO_HIGH:
-        bitrateIndex = 1;
+        return minLevel;
+    }
 
-        break;
+    auto target = LevelsTable::byLevel(ELevelIdc(this->m_level));
 
-    case PRO_HIGH10:
-        bitrateIndex = 2;
+    if (target->level == LEVEL_UNKNOWN)
+        return minLevel;
 
-        break;
-    case PRO_HIGH422:
-    case PRO_HIGH444:
-        bitrateIndex = 3;
+    /* The target level works as an upper limit, if the configuration fits
+     * in it signal the lowest legal level. The levels table is sorted from
+     * the lowest to the highest level.
+     */
+    if (minLevel != LEVEL_UNKNOWN
+        && LevelsTable::byLevel(minLevel) <= target)
+        return minLevel;
+
+    auto pictureSize = lumaPictureSize(caps);
+
+    if (!this->m_clampToLevel || target->frameSize < pictureSize) {
+        qWarning() << "The encoding parameters exceed the limits of the level"
+                   << this->m_level
+                   << "- frame size:" << pictureSize << "/" << target->frameSize
+                   << "MBs, macroblock rate:"
+                   << qRound64(pictureSize * caps.fps().value())
+                   << "/" << target->mbps
+                   << "MBs/s, bitrate:" << bitrate
+                   << "/" << target->bitrate(profile) << "bps";
+
+        return minLevel;
+    }
+
+    // Clamp the frame rate and the bitrate to the limits of the target level.
+    auto maxFps = AkFrac(qint64(target->mbps), qint64(pictureSize));
+
+    if (caps.fps().value() > maxFps.value()) {
+        qWarning() << "Clamping the frame rate from"
+                   << caps.fps().value()
+                   << "to"
+                   << maxFps.value()
+                   << "fps to fit in the level"
+                   << this->m_level;
+        caps.setFps(maxFps);
+    }
+
+    auto maxBitrate = target->bitrate(profile);
+
+    if (bitrate > maxBitrate) {
+        qWarning() << "Clamping the bitrate from"
+                   << bitrate
+                   << "to"
+                   << maxBitrate
+                   << "bps to fit in the level"
+                   << this->m_level;
+        bitrate = int(maxBitrate);
+    }
+
+    return target->level;
+}
+
+bool VideoEncoderOpenH264ElementPrivate::threadPolicyIsDefault() const
+{
+    return this->m_cpuAffinity.isEmpty()
+           && this->m_schedulingPolicy == VideoEncoderOpenH264Element::SchedulingPolicy_Normal
+           && this->m_niceness == 0;
+}
+
+void VideoEncoderOpenH264ElementPrivate::applyThreadPolicy() const
+{
+#ifdef Q_OS_LINUX
+    auto tid = qint64(syscall(SYS_gettid));
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+
+    if (this->m_cpuAffinity.isEmpty()) {
+        // Restore the affinity of the process.
+        sched_getaffinity(getpid(), sizeof(cpu_set_t), &cpuSet);
+    } else {
+        for (auto &cpu: this->m_cpuAffinity)
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &cpuSet);
+    }
+
+    if (sched_setaffinity(pid_t(tid), sizeof(cpu_set_t), &cpuSet) < 0)
+        qWarning() << "Can't set the CPU affinity of the thread"
+                   << tid
+                   << ":"
+                   << strerror(errno);
+
+    int policy = SCHED_OTHER;
+    sched_param param;
+    memset(&param, 0, sizeof(sched_param));
+
+    switch (this->m_schedulingPolicy) {
+    case VideoEncoderOpenH264Element::SchedulingPolicy_Batch:
+        policy = SCHED_BATCH;
 
         break;
+    case VideoEncoderOpenH264Element::SchedulingPolicy_Fifo:
+        policy = SCHED_FIFO;
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO);
 
+        break;
     default:
         break;
     }
 
-    for (auto level = openH264Levels; level->level != LEVEL_UNKNOWN; ++level)
-        if (level->frameSize >= lumaPictureSize
-            && level->mbps >= lumaSampleRate
-            && 1000 * level->maxBitrate[bitrateIndex] >= bitrate) {
-            return level->level;
-        }
+    if (sched_setscheduler(pid_t(tid), policy, &param) < 0)
+        qWarning() << "Can't set the scheduling policy of the thread"
+                   << tid
+                   << ":"
+                   << strerror(errno);
+
+    // The niceness does not have effect on real-time threads.
+    if (policy != SCHED_FIFO
+        && setpriority(PRIO_PROCESS, id_t(tid), this->m_niceness) < 0)
+        qWarning() << "Can't set the niceness of the thread"
+                   << tid
+                   << ":"
+                   << strerror(errno);
+#endif
+}
 
-    return LEVEL_UNKNOWN;
+bool VideoEncoderOpenH264ElementPrivate::saveThreadPolicy(ThreadPolicyState *state)
+{
+#ifdef Q_OS_LINUX
+    auto tid = pid_t(syscall(SYS_gettid));
+    CPU_ZERO(&state->affinity);
+
+    if (sched_getaffinity(tid, sizeof(cpu_set_t), &state->affinity) < 0)
+        return false;
+
+    state->policy = sched_getscheduler(tid);
+
+    if (state->policy < 0 || sched_getparam(tid, &state->param) < 0)
+        return false;
+
+    // -1 is a valid niceness, errno tells the errors apart.
+    errno = 0;
+    state->niceness = getpriority(PRIO_PROCESS, id_t(tid));
+
+    if (errno != 0)
+        return false;
+
+    state->tid = tid;
+
+    return true;
+#else
+    Q_UNUSED(state)
+
+    return false;
+#endif
+}
+
+void VideoEncoderOpenH264ElementPrivate::restoreThreadPolicy(ThreadPolicyState *state)
+{
+    if (state->tid < 1)
+        return;
+
+#ifdef Q_OS_LINUX
+    // The thread may be gone already, then there is nothing to restore.
+    auto tid = pid_t(state->tid);
+
+    if (sched_setaffinity(tid, sizeof(cpu_set_t), &state->affinity) < 0
+        && errno != ESRCH)
+        qWarning() << "Can't restore the CPU affinity of the thread"
+                   << tid
+                   << ":"
+                   << strerror(errno);
+
+    if (sched_setscheduler(tid, state->policy, &state->param) < 0
+        && errno != ESRCH)
+        qWarning() << "Can't restore the scheduling policy of the thread"
+                   << tid
+                   << ":"
+                   << strerror(errno);
+
+    if (setpriority(PRIO_PROCESS, id_t(tid), state->niceness) < 0
+        && errno != ESRCH)
+        qWarning() << "Can't restore the niceness of the thread"
+                   << tid
+                   << ":"
+                   << strerror(errno);
+#endif
+
+    state->tid = 0;
+}
+
+void VideoEncoderOpenH264ElementPrivate::updateThreadPolicy()
+{
+    /* A thread can only be moved safely by itself, apply the options to the
+     * encoding thread on the next frame. The worker threads of openh264 take
+     * them on the next init().
+     */
+    this->m_encodeThread = nullptr;
+}
+
+QByteArray VideoEncoderOpenH264ElementPrivate::annexBHeaders() const
+{
+    // Without global header the parameter sets are sent with the key frames.
+    if (!this->m_globalHeader || this->m_headers.isEmpty())
+        return {};
+
+    auto &header = this->m_headers.first();
+    QByteArray privateData(header.constData(), header.size());
+    QDataStream ds(&privateData, QIODeviceBase::ReadOnly);
+    quint64 nalCount = 0;
+    ds >> nalCount;
+    QByteArray headers;
+
+    for (quint64 i = 0; i < nalCount && !ds.atEnd(); i++) {
+        quint64 size = 0;
+        ds >> size;
+        auto offset = headers.size();
+        headers.resize(offset + qsizetype(size));
+        ds.readRawData(headers.data() + offset, int(size));
+    }
+
+    return headers;
+}
+
+void VideoEncoderOpenH264ElementPrivate::updateReplayBuffer()
+{
+    /* Reserve enough room for twice the expected stream size, plus one extra
+     * GOP, since the buffer is trimmed in whole GOPs.
+     */
+    auto length = qint64(this->m_replayBufferLength);
+    auto capacity =
+            qMax<qint64>(2 * qint64(self->bitrate()) * (length + self->gop()) / 8000,
+                         1 << 20);
+    this->m_replayBuffer.configure(length, qsizetype(capacity));
+}
+
+void VideoEncoderOpenH264ElementPrivate::openOutputFile()
+{
+    this->m_fileSink.close();
+
+    if (this->m_outputFile.isEmpty())
+        return;
+
+    if (this->m_fileSink.open(this->m_outputFile, this->m_outputFileDirectIO))
+        this->m_fileSink.write(this->annexBHeaders());
 }
 
 #include "moc_videoencoderopenh264element.cpp"
@@ -52,6 +52,51 @@ class VideoEncoderOpenH264Element: public AkVideoEncoder
                WRITE setEnableFrameSkip
                RESET resetEnableFrameSkip
                NOTIFY enableFrameSkipChanged)
+    Q_PROPERTY(Level level
+               READ level
+               WRITE setLevel
+               RESET resetLevel
+               NOTIFY levelChanged)
+    Q_PROPERTY(bool clampToLevel
+               READ clampToLevel
+               WRITE setClampToLevel
+               RESET resetClampToLevel
+               NOTIFY clampToLevelChanged)
+    Q_PROPERTY(QList<int> cpuAffinity
+               READ cpuAffinity
+               WRITE setCpuAffinity
+               RESET resetCpuAffinity
+               NOTIFY cpuAffinityChanged)
+    Q_PROPERTY(SchedulingPolicy schedulingPolicy
+               READ schedulingPolicy
+               WRITE setSchedulingPolicy
+               RESET resetSchedulingPolicy
+               NOTIFY schedulingPolicyChanged)
+    Q_PROPERTY(int niceness
+               READ niceness
+               WRITE setNiceness
+               RESET resetNiceness
+               NOTIFY nicenessChanged)
+    Q_PROPERTY(int threads
+               READ threads
+               WRITE setThreads
+               RESET resetThreads
+               NOTIFY threadsChanged)
+    Q_PROPERTY(int replayBufferLength
+               READ replayBufferLength
+               WRITE setReplayBufferLength
+               RESET resetReplayBufferLength
+               NOTIFY replayBufferLengthChanged)
+    Q_PROPERTY(QString outputFile
+               READ outputFile
+               WRITE setOutputFile
+               RESET resetOutputFile
+               NOTIFY outputFileChanged)
+    Q_PROPERTY(bool outputFileDirectIO
+               READ outputFileDirectIO
+               WRITE setOutputFileDirectIO
+               RESET resetOutputFileDirectIO
+               NOTIFY outputFileDirectIOChanged)
 
     public:
         enum UsageType
@@ -85,6 +130,37 @@ class VideoEncoderOpenH264Element: public AkVideoEncoder
         };
         Q_ENUM(LogLevel)
 
+        enum Level
+        {
+            Level_Auto = 0,
+            Level_1_B  = 9,
+            Level_1_0  = 10,
+            Level_1_1  = 11,
+            Level_1_2  = 12,
+            Level_1_3  = 13,
+            Level_2_0  = 20,
+            Level_2_1  = 21,
+            Level_2_2  = 22,
+            Level_3_0  = 30,
+            Level_3_1  = 31,
+            Level_3_2  = 32,
+            Level_4_0  = 40,
+            Level_4_1  = 41,
+            Level_4_2  = 42,
+            Level_5_0  = 50,
+            Level_5_1  = 51,
+            Level_5_2  = 52,
+        };
+        Q_ENUM(Level)
+
+        enum SchedulingPolicy
+        {
+            SchedulingPolicy_Normal,
+            SchedulingPolicy_Batch,
+            SchedulingPolicy_Fifo,
+        };
+        Q_ENUM(SchedulingPolicy)
+
         VideoEncoderOpenH264Element();
         ~VideoEncoderOpenH264Element();
 
@@ -97,6 +173,17 @@ class VideoEncoderOpenH264Element: public AkVideoEncoder
         Q_INVOKABLE LogLevel logLevel() const;
         Q_INVOKABLE bool globalHeader() const;
         Q_INVOKABLE bool enableFrameSkip() const;
+        Q_INVOKABLE Level level() const;
+        Q_INVOKABLE bool clampToLevel() const;
+        Q_INVOKABLE Level encodingLevel() const;
+        Q_INVOKABLE QList<int> cpuAffinity() const;
+        Q_INVOKABLE SchedulingPolicy schedulingPolicy() const;
+        Q_INVOKABLE int niceness() const;
+        Q_INVOKABLE int threads() const;
+        Q_INVOKABLE int replayBufferLength() const;
+        Q_INVOKABLE QByteArray replayBuffer() const;
+        Q_INVOKABLE QString outputFile() const;
+        Q_INVOKABLE bool outputFileDirectIO() const;
 
     private:
         VideoEncoderOpenH264ElementPrivate *d;
@@ -113,6 +200,15 @@ class VideoEncoderOpenH264Element: public AkVideoEncoder
         void logLevelChanged(LogLevel logLevel);
         void globalHeaderChanged(bool globalHeader);
         void enableFrameSkipChanged(bool enableFrameSkip);
+        void levelChanged(Level level);
+        void clampToLevelChanged(bool clampToLevel);
+        void cpuAffinityChanged(const QList<int> &cpuAffinity);
+        void schedulingPolicyChanged(SchedulingPolicy schedulingPolicy);
+        void nicenessChanged(int niceness);
+        void threadsChanged(int threads);
+        void replayBufferLengthChanged(int replayBufferLength);
+        void outputFileChanged(const QString &outputFile);
+        void outputFileDirectIOChanged(bool outputFileDirectIO);
 
     public slots:
         void setUsageType(UsageType usageType);
@@ -120,11 +216,30 @@ class VideoEncoderOpenH264Element: public AkVideoEncoder
         void setLogLevel(LogLevel logLevel);
         void setGlobalHeader(bool globalHeader);
         void setEnableFrameSkip(bool enableFrameSkip);
+        void setLevel(Level level);
+        void setClampToLevel(bool clampToLevel);
+        void setCpuAffinity(const QList<int> &cpuAffinity);
+        void setSchedulingPolicy(SchedulingPolicy schedulingPolicy);
+        void setNiceness(int niceness);
+        void setThreads(int threads);
+        void setReplayBufferLength(int replayBufferLength);
+        void setOutputFile(const QString &outputFile);
+        void setOutputFileDirectIO(bool outputFileDirectIO);
         void resetUsageType();
         void resetComplexityMode();
         void resetLogLevel();
         void resetGlobalHeader();
         void resetEnableFrameSkip();
+        void resetLevel();
+        void resetClampToLevel();
+        void resetCpuAffinity();
+        void resetSchedulingPolicy();
+        void resetNiceness();
+        void resetThreads();
+        void resetReplayBufferLength();
+        void resetOutputFile();
+        void resetOutputFileDirectIO();
+        void clearReplayBuffer();
         void resetOptions() override;
         bool setState(AkElement::ElementState state) override;
 };
@@ -132,5 +247,7 @@ class VideoEncoderOpenH264Element: public AkVideoEncoder
 Q_DECLARE_METATYPE(VideoEncoderOpenH264Element::UsageType)
 Q_DECLARE_METATYPE(VideoEncoderOpenH264Element::ComplexityMode)
 Q_DECLARE_METATYPE(VideoEncoderOpenH264Element::LogLevel)
+Q_DECLARE_METATYPE(VideoEncoderOpenH264Element::Level)
+Q_DECLARE_METATYPE(VideoEncoderOpenH264Element::SchedulingPolicy)
 
 #endif // VIDEOENCODEROPENH264ELEMENT_H
@@ -0,0 +1,179 @@
+/* Webcamoid, webcam capture application.
+ * Copyright (C) 2024  Gonzalo Exequiel Pedone
+ *
+ * Webcamoid is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Webcamoid is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Webcamoid. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Web-Site: http://webcamoid.github.io/
+ */
+
+#include <chrono>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+#include <akcompressedvideocaps.h>
+#include <akcompressedvideopacket.h>
+#include <akvideocaps.h>
+
+#include "annexbfilesink.h"
+
+/* Writes the packets of several 1080p streams at 4 Mbps, round robin from a
+ * single thread, like a recording node does. Measures the time the caller
+ * spends in each write, which is what the encoding thread pays, and the
+ * throughput until the files are closed. Per packet write() calls on an
+ * unbuffered file are the reference.
+ */
+
+#define FPS          30
+#define GOP          60
+#define PACKETS      300
+#define FRAME_BYTES  (4000000 / 8 / FPS)
+#define KEY_BYTES    (6 * FRAME_BYTES)
+
+using Clock = std::chrono::steady_clock;
+
+class BenchAnnexBFileSink: public QObject
+{
+    Q_OBJECT
+
+    private:
+        QList<AkCompressedVideoPacket> m_packets;
+
+    private slots:
+        void initTestCase();
+        void write_data();
+        void write();
+};
+
+void BenchAnnexBFileSink::initTestCase()
+{
+    AkCompressedVideoCaps caps(AkCompressedVideoCaps::VideoCodecID_avc,
+                               {AkVideoCaps::Format_yuv420p,
+                                1920,
+                                1080,
+                                {FPS, 1}},
+                               4000000);
+
+    for (int i = 0; i < PACKETS; i++) {
+        bool keyFrame = i % GOP == 0;
+        AkCompressedVideoPacket packet(caps,
+                                       keyFrame?
+                                           KEY_BYTES:
+                                           FRAME_BYTES / 2 + (i * 7919) % FRAME_BYTES);
+        memset(packet.data(), i & 0xff, packet.size());
+        packet.setFlags(keyFrame?
+                            AkCompressedVideoPacket::VideoPacketTypeFlag_KeyFrame:
+                            AkCompressedVideoPacket::VideoPacketTypeFlag_None);
+        packet.setPts(i);
+        packet.setTimeBase({1, FPS});
+        this->m_packets << packet;
+    }
+}
+
+void BenchAnnexBFileSink::write_data()
+{
+    QTest::addColumn<int>("streams");
+    QTest::addColumn<bool>("useSink");
+    QTest::addColumn<bool>("directIO");
+
+    for (auto streams: {1, 16}) {
+        auto tag = QString("%1 streams, ").arg(streams);
+        QTest::newRow(qPrintable(tag + "write() per packet"))
+                << streams << false << false;
+        QTest::newRow(qPrintable(tag + "sink"))
+                << streams << true << false;
+        QTest::newRow(qPrintable(tag + "sink, direct I/O"))
+                << streams << true << true;
+    }
+}
+
+void BenchAnnexBFileSink::write()
+{
+    QFETCH(int, streams);
+    QFETCH(bool, useSink);
+    QFETCH(bool, directIO);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVector<AnnexBFileSink *> sinks;
+    QVector<QFile *> files;
+
+    for (int i = 0; i < streams; i++) {
+        auto fileName = dir.filePath(QString("stream%1.h264").arg(i));
+
+        if (useSink) {
+            sinks << new AnnexBFileSink;
+            QVERIFY(sinks.last()->open(fileName, directIO));
+        } else {
+            files << new QFile(fileName);
+            QVERIFY(files.last()->open(QIODevice::WriteOnly
+                                       | QIODevice::Truncate
+                                       | QIODevice::Unbuffered));
+        }
+    }
+
+    qint64 bytes = 0;
+    qreal maxWrite = 0.0;
+    bool ok = true;
+    auto start = Clock::now();
+
+    for (auto &packet: this->m_packets)
+        for (int i = 0; i < streams; i++) {
+            auto writeStart = Clock::now();
+
+            if (useSink)
+                ok &= sinks[i]->write(packet);
+            else
+                ok &= files[i]->write(packet.constData(),
+                                      qint64(packet.size())) == qint64(packet.size());
+
+            auto us =
+                    std::chrono::duration<qreal, std::micro>(Clock::now()
+                                                             - writeStart).count();
+            maxWrite = qMax(maxWrite, us);
+            bytes += qint64(packet.size());
+        }
+
+    auto written = Clock::now();
+    qint64 bytesWritten = 0;
+
+    for (auto sink: sinks) {
+        sink->close();
+        bytesWritten += sink->bytesWritten();
+    }
+
+    for (auto file: files) {
+        file->close();
+        bytesWritten += file->size();
+    }
+
+    auto closed = Clock::now();
+    qDeleteAll(sinks);
+    qDeleteAll(files);
+
+    auto writeUs =
+            std::chrono::duration<qreal, std::micro>(written - start).count();
+    auto totalSeconds =
+            std::chrono::duration<qreal>(closed - start).count();
+    qInfo() << QTest::currentDataTag()
+            << "µs per write mean:" << writeUs / (streams * PACKETS)
+            << "max:" << maxWrite
+            << "MB/s until closed:" << qreal(bytes) / totalSeconds / 1e6;
+
+    QVERIFY(ok);
+    QCOMPARE(bytesWritten, bytes);
+}
+
+QTEST_GUILESS_MAIN(BenchAnnexBFileSink)
+
+#include "bench_annexbfilesink.moc"